@@ -20,9 +20,11 @@
 
 #include "active_device.hpp"
 #include "types.hpp"
+#include "usbd_types.hpp"
 #include <boost/json/object.hpp>
 #include <stdexcept>
 #include <string>
+#include <tuple>
 
 namespace alterator::usbmount {
 
@@ -41,6 +43,11 @@ ActiveDevice::ActiveDevice(const json::object &obj) {
   status = obj.at("status").as_string().c_str();
 }
 
+ActiveDevice::ActiveDevice(const dbus_bindings::usbd::DeviceStruct &dev)
+    : block(std::get<0>(dev)), fs(std::get<4>(dev)), vid(std::get<1>(dev)),
+      pid(std::get<2>(dev)), serial(std::get<3>(dev)),
+      mount_point(std::get<5>(dev)), status(std::get<6>(dev)) {}
+
 vecPairs ActiveDevice::SerializeForLisp() const noexcept {
   vecPairs res;
   res.emplace_back("name", std::to_string(index));
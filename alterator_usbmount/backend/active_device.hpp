@@ -22,6 +22,7 @@
 
 #include "serializable_for_lisp.hpp"
 #include "types.hpp"
+#include "usbd_types.hpp"
 #include <boost/json.hpp>
 #include <boost/json/object.hpp>
 #include <cstddef>
@@ -49,6 +50,9 @@ struct ActiveDevice : SerializableForLisp<ActiveDevice> {
    * @throws std::invalid_argument
    */
   explicit ActiveDevice(const json::object &obj);
+
+  /// @brief Construct from the ListDevicesV2 DBus struct
+  explicit ActiveDevice(const dbus_bindings::usbd::DeviceStruct &dev);
 };
 
 } // namespace alterator::usbmount
\ No newline at end of file
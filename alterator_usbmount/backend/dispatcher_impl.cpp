@@ -30,8 +30,10 @@
 #include <boost/json/object.hpp>
 #include <boost/json/parse.hpp>
 #include <boost/json/serialize.hpp>
+#include <cstdint>
 #include <exception>
 #include <iostream>
+#include <string>
 #include <utility>
 
 namespace alterator::usbmount {
@@ -48,15 +50,28 @@ bool DispatcherImpl::Dispatch(const LispMessage &msg) const noexcept {
   if (msg.action == "read" && msg.objects == "list-devices") {
     return ListRules();
   }
+  if (msg.action == "read" && msg.objects == "rules_page") {
+    return ListRulesPage(msg);
+  }
 
   if (msg.action == "read" && msg.objects == "get_users_groups") {
     return GetUsersGroups();
   }
+  if (msg.action == "read" && msg.objects == "search_principals") {
+    return SearchPrincipals(msg);
+  }
 
   if (msg.action == "read" && msg.objects == "save_rules") {
     return SaveRules(msg);
   }
 
+  if (msg.action == "read" && msg.objects == "snapshot") {
+    return Snapshot();
+  }
+  if (msg.action == "list" && msg.objects == "snapshot_block") {
+    return ListSnapshotDevices();
+  }
+
   if (msg.action == "read" && msg.objects == "health") {
     return Health();
   }
@@ -92,6 +107,31 @@ bool DispatcherImpl::ListRules() const noexcept {
   return true;
 }
 
+bool DispatcherImpl::ListRulesPage(const LispMessage &msg) const noexcept {
+  namespace cu = common_utils;
+  RulesPageQuery query;
+  if (msg.params.count("cursor") > 0) {
+    query.cursor = cu::StrToUint(msg.params.at("cursor")).value_or(0);
+  }
+  if (msg.params.count("limit") > 0) {
+    query.limit = cu::StrToUint(msg.params.at("limit")).value_or(0);
+  }
+  if (msg.params.count("device") > 0) {
+    query.device = msg.params.at("device");
+  }
+  if (msg.params.count("user") > 0) {
+    query.user = msg.params.at("user");
+  }
+  if (msg.params.count("group") > 0) {
+    query.group = msg.params.at("group");
+  }
+  std::cout << kMessBeg;
+  std::cout << cu::WrapWithQuotes(
+      cu::EscapeQuotes(usbmount_.GetRulesPageJson(query)));
+  std::cout << kMessEnd;
+  return true;
+}
+
 bool DispatcherImpl::GetUsersGroups() const noexcept {
   namespace cu = common_utils;
   std::cout << kMessBeg;
@@ -100,6 +140,23 @@ bool DispatcherImpl::GetUsersGroups() const noexcept {
   return true;
 }
 
+bool DispatcherImpl::SearchPrincipals(const LispMessage &msg) const noexcept {
+  namespace cu = common_utils;
+  const std::string prefix =
+      msg.params.count("prefix") > 0 ? msg.params.at("prefix") : "";
+  const std::string kind =
+      msg.params.count("kind") > 0 ? msg.params.at("kind") : "user";
+  uint32_t limit = 0;
+  if (msg.params.count("limit") > 0) {
+    limit = cu::StrToUint(msg.params.at("limit")).value_or(0);
+  }
+  std::cout << kMessBeg;
+  std::cout << cu::WrapWithQuotes(
+      cu::EscapeQuotes(usbmount_.SearchPrincipalsJson(prefix, kind, limit)));
+  std::cout << kMessEnd;
+  return true;
+}
+
 bool DispatcherImpl::SaveRules(const LispMessage &msg) const noexcept {
   namespace cu = common_utils;
   std::cout << kMessBeg;
@@ -125,6 +182,28 @@ bool DispatcherImpl::Health() const noexcept {
   return true;
 }
 
+bool DispatcherImpl::Snapshot() const noexcept {
+  namespace cu = common_utils;
+  auto snapshot = usbmount_.GetSnapshot();
+  snapshot_devices_ = std::move(snapshot.devices);
+  std::cout << kMessBeg;
+  std::cout << cu::WrapWithQuotes(snapshot.health ? "OK" : "DEAD") << " ";
+  std::cout << cu::WrapWithQuotes(cu::EscapeQuotes(snapshot.users_groups))
+            << " ";
+  std::cout << cu::WrapWithQuotes(cu::EscapeQuotes(snapshot.rules));
+  std::cout << kMessEnd;
+  return true;
+}
+
+bool DispatcherImpl::ListSnapshotDevices() const noexcept {
+  std::cout << kMessBeg;
+  for (const auto &device : snapshot_devices_) {
+    std::cout << common_utils::ToLisp(device);
+  }
+  std::cout << kMessEnd;
+  return true;
+}
+
 bool DispatcherImpl::RunDaemon() const noexcept {
   std::cout << kMessBeg;
   std::cout << common_utils::WrapWithQuotes(usbmount_.Run() ? "OK" : "FAIL");
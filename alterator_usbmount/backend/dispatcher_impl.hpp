@@ -20,7 +20,9 @@
 
 #include "lisp_message.hpp"
 #include "message_dispatcher.hpp"
+#include "active_device.hpp"
 #include "usb_mount.hpp"
+#include <vector>
 
 namespace alterator::usbmount {
 
@@ -33,9 +35,17 @@ public:
 private:
   bool ListBlockDevices() const noexcept;
   bool ListRules() const noexcept;
+  /// @brief params: cursor, limit, device, user, group - all optional
+  bool ListRulesPage(const LispMessage &) const noexcept;
   bool GetUsersGroups() const noexcept;
+  /// @brief params: prefix, kind ("user"|"group"), limit - all optional
+  bool SearchPrincipals(const LispMessage &) const noexcept;
   bool SaveRules(const LispMessage &) const noexcept;
   bool Health() const noexcept;
+  /// @brief health, users and groups, rules; keeps the devices
+  bool Snapshot() const noexcept;
+  /// @brief devices of the last Snapshot call, no DBus call
+  bool ListSnapshotDevices() const noexcept;
   bool RunDaemon() const noexcept;
   bool StopDaemon() const noexcept;
   static bool ReadLog(const LispMessage &) noexcept;
@@ -44,6 +54,8 @@ private:
   static constexpr const char *kMessEnd = ")";
 
   UsbMount &usbmount_;
+  /// devices of the last snapshot - the same view as the rules
+  mutable std::vector<ActiveDevice> snapshot_devices_;
 };
 
 } // namespace alterator::usbmount
@@ -22,20 +22,25 @@
 #include "active_device.hpp"
 #include "log.hpp"
 #include "systemd_dbus.hpp"
+#include "usbd_types.hpp"
 #include <boost/json.hpp>
 #include <boost/json/array.hpp>
 #include <boost/json/object.hpp>
 #include <cstddef>
+#include <cstdint>
 #include <exception>
+#include <map>
 #include <sdbus-c++/IConnection.h>
 #include <sdbus-c++/Types.h>
 #include <sdbus-c++/sdbus-c++.h>
 #include <stdexcept>
 #include <string>
+#include <tuple>
 #include <vector>
 
 namespace alterator::usbmount {
 using common_utils::Log;
+namespace usbd = dbus_bindings::usbd;
 
 UsbMount::UsbMount() noexcept
     : dbus_proxy_(nullptr), interface_usbd_{kInterfaceName} {
@@ -48,16 +53,38 @@ UsbMount::UsbMount() noexcept
 }
 
 std::vector<ActiveDevice> UsbMount::ListDevices() const noexcept {
+  std::vector<ActiveDevice> res;
+  if (!dbus_proxy_) {
+    return res;
+  }
+  try {
+    const sdbus::MethodName list_method(usbd::kListDevicesV2);
+    auto method = dbus_proxy_->createMethodCall(interface_usbd_, list_method);
+    auto reply = dbus_proxy_->callMethod(method);
+    std::vector<usbd::DeviceStruct> devices;
+    reply >> devices;
+    res.reserve(devices.size());
+    size_t counter = 1;
+    for (const auto &device : devices) {
+      res.emplace_back(device);
+      res.back().index = counter;
+      ++counter;
+    }
+    return res;
+  } catch (const std::exception &ex) {
+    // the daemon of an older version has no ListDevicesV2
+    Log::Debug() << "[ListDevices] " << ex.what();
+  }
+  return ListDevicesJson();
+}
+
+std::vector<ActiveDevice> UsbMount::ListDevicesJson() const noexcept {
   namespace json = boost::json;
   std::vector<ActiveDevice> res;
   if (!dbus_proxy_) {
     return res;
   }
-  const sdbus::MemberName list_method("ListDevices");
-  auto method = dbus_proxy_->createMethodCall(interface_usbd_, list_method);
-  auto reply = dbus_proxy_->callMethod(method);
-  std::string json_string;
-  reply >> json_string;
+  const std::string json_string = GetStringNoParams("ListDevices");
   try {
     auto value = json::parse(json_string);
     const json::array &arr = value.as_array();
@@ -122,6 +149,92 @@ std::string UsbMount::getRulesJson() const noexcept {
   return GetStringNoParams("ListRules");
 }
 
+std::string
+UsbMount::GetRulesPageJson(const RulesPageQuery &query) const noexcept {
+  namespace json = boost::json;
+  if (!dbus_proxy_) {
+    return {};
+  }
+  try {
+    const sdbus::MethodName page_method(usbd::kListRulesPage);
+    auto method = dbus_proxy_->createMethodCall(interface_usbd_, page_method);
+    std::map<std::string, std::string> filter;
+    if (!query.device.empty()) {
+      filter.emplace("device", query.device);
+    }
+    if (!query.user.empty()) {
+      filter.emplace("user", query.user);
+    }
+    if (!query.group.empty()) {
+      filter.emplace("group", query.group);
+    }
+    method << query.cursor << query.limit << filter;
+    auto reply = dbus_proxy_->callMethod(method);
+    std::vector<usbd::RuleStruct> rules;
+    bool has_next = false;
+    uint64_t next = 0;
+    reply >> rules >> has_next >> next;
+    json::array arr;
+    for (const auto &rule : rules) {
+      json::array users;
+      for (const auto &user : std::get<4>(rule)) {
+        users.emplace_back(json::object{{"uid", std::get<0>(user)},
+                                        {"name", std::get<1>(user)}});
+      }
+      json::array groups;
+      for (const auto &group : std::get<5>(rule)) {
+        groups.emplace_back(json::object{{"gid", std::get<0>(group)},
+                                         {"name", std::get<1>(group)}});
+      }
+      json::object perm;
+      perm["device"] = json::object{{"vid", std::get<1>(rule)},
+                                    {"pid", std::get<2>(rule)},
+                                    {"serial", std::get<3>(rule)}};
+      perm["users"] = std::move(users);
+      perm["groups"] = std::move(groups);
+      arr.emplace_back(json::object{{"id", std::to_string(std::get<0>(rule))},
+                                    {"perm", std::move(perm)}});
+    }
+    json::object res;
+    res["rules"] = std::move(arr);
+    if (has_next) {
+      res["next"] = std::to_string(next);
+    } else {
+      res["next"] = nullptr;
+    }
+    return json::serialize(res);
+  } catch (const std::exception &ex) {
+    Log::Error() << "[GetRulesPageJson] " << ex.what();
+  }
+  return {};
+}
+
+std::string UsbMount::SearchPrincipalsJson(const std::string &prefix,
+                                           const std::string &kind,
+                                           uint32_t limit) const noexcept {
+  namespace json = boost::json;
+  if (!dbus_proxy_) {
+    return {};
+  }
+  try {
+    const sdbus::MethodName search_method(usbd::kSearchPrincipals);
+    auto method = dbus_proxy_->createMethodCall(interface_usbd_, search_method);
+    method << prefix << kind << limit;
+    auto reply = dbus_proxy_->callMethod(method);
+    std::vector<usbd::PrincipalStruct> principals;
+    reply >> principals;
+    json::array arr;
+    for (const auto &principal : principals) {
+      arr.emplace_back(json::object{{"id", std::get<0>(principal)},
+                                    {"name", std::get<1>(principal)}});
+    }
+    return json::serialize(arr);
+  } catch (const std::exception &ex) {
+    Log::Error() << "[SearchPrincipalsJson] " << ex.what();
+  }
+  return {};
+}
+
 std::string UsbMount::GetUsersGroups() const noexcept {
   return GetStringNoParams("GetUsersAndGroups");
 }
@@ -138,6 +251,42 @@ bool UsbMount::Health() const noexcept {
   return response == "OK";
 }
 
+UsbMountSnapshot UsbMount::GetSnapshot() const noexcept {
+  UsbMountSnapshot res;
+  if (!dbus_proxy_) {
+    return res;
+  }
+  try {
+    const sdbus::MethodName snapshot_method(usbd::kGetSnapshot);
+    auto method =
+        dbus_proxy_->createMethodCall(interface_usbd_, snapshot_method);
+    auto reply = dbus_proxy_->callMethod(method);
+    uint64_t generation = 0;
+    std::string health;
+    std::vector<usbd::DeviceStruct> devices;
+    reply >> generation >> health >> res.users_groups >> res.rules >> devices;
+    res.health = health == "OK";
+    res.devices.reserve(devices.size());
+    size_t counter = 1;
+    for (const auto &device : devices) {
+      res.devices.emplace_back(device);
+      res.devices.back().index = counter;
+      ++counter;
+    }
+    return res;
+  } catch (const std::exception &ex) {
+    // the daemon of an older version has no GetSnapshot
+    Log::Debug() << "[GetSnapshot] " << ex.what();
+  }
+  res.health = Health();
+  if (res.health) {
+    res.users_groups = GetUsersGroups();
+    res.rules = getRulesJson();
+    res.devices = ListDevices();
+  }
+  return res;
+}
+
 bool UsbMount::Run() noexcept {
   dbus_bindings::Systemd systemd;
   auto enabled = systemd.IsUnitEnabled(kServiceUnitName);
@@ -20,25 +20,64 @@
 
 #pragma once
 #include "active_device.hpp"
+#include <cstdint>
 #include <memory>
 #include <sdbus-c++/sdbus-c++.h>
+#include <string>
+#include <vector>
 
 namespace alterator::usbmount {
 
+/// @brief ListRulesPage parameters, empty filters match everything
+struct RulesPageQuery {
+  uint64_t cursor = 0;
+  uint32_t limit = 0;
+  std::string device; /// substring of vid, pid or serial
+  std::string user;
+  std::string group;
+};
+
 struct DbusOneParam {
   std::string method;
   std::string param;
 };
 
+/// @brief Everything the UI shows, from one daemon reply
+struct UsbMountSnapshot {
+  bool health = false;
+  std::string users_groups; /// GetUsersAndGroups JSON
+  std::string rules;        /// ListRules JSON
+  std::vector<ActiveDevice> devices;
+};
+
 class UsbMount {
 public:
   UsbMount() noexcept;
 
   std::vector<ActiveDevice> ListDevices() const noexcept;
   std::string getRulesJson() const noexcept;
+  /**
+   * @brief A page of rules
+   * @return {"rules":[ListRules format],"next":"cursor"}, "next" is null on
+   * the last page; empty string on error
+   */
+  std::string GetRulesPageJson(const RulesPageQuery &query) const noexcept;
   std::string GetUsersGroups() const noexcept;
+  /**
+   * @brief Users or groups whose name starts with the prefix
+   * @param kind "user" or "group"
+   * @return [{"id":N,"name":"..."}], empty string on error
+   */
+  std::string SearchPrincipalsJson(const std::string &prefix,
+                                   const std::string &kind,
+                                   uint32_t limit) const noexcept;
   std::string SaveRules(const std::string &) const noexcept;
   bool Health() const noexcept;
+  /**
+   * @brief Health, users and groups, rules and devices in one DBus call
+   * @details Falls back to separate calls for a daemon without GetSnapshot
+   */
+  UsbMountSnapshot GetSnapshot() const noexcept;
   bool Run() noexcept;
   bool Stop() noexcept;
 
@@ -48,6 +87,8 @@ private:
   const std::string kInterfaceName = "ru.alterator.Usbd";
   const std::string kServiceUnitName = "altusbd.service";
 
+  /// @brief ListDevices via the JSON method (compatibility)
+  std::vector<ActiveDevice> ListDevicesJson() const noexcept;
   std::string GetStringNoParams(const std::string &method_name) const noexcept;
   std::string GetStringResponse(const DbusOneParam &) const noexcept;
   std::unique_ptr<sdbus::IProxy> dbus_proxy_;
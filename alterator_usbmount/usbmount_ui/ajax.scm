@@ -31,11 +31,14 @@
      ); //if
 )
 
+; health, users and groups, rules and devices from one daemon snapshot
 (define (update_ui)
-        (js "SetHealthStatus" "OK")
-        (js "SetUsersAndGroups" (car(removeFirstElement(woo-read "/usbmount/get_users_groups"))))
-        (ls-rules)
-        (ls-devices)
+  (let ((snapshot (car(removeFirstElement(woo-read "/usbmount/snapshot")))))
+        (js "SetHealthStatus" (car snapshot))
+        (js "SetUsersAndGroups" (list (cadr snapshot)))
+        (js "UpdateRulesList" (list (caddr snapshot)))
+        (form-update-enum "list_prsnt_devices" (woo-list "/usbmount/snapshot_block"))
+  )
 )
 
 (define (run_service)
@@ -0,0 +1,231 @@
+/* File: polkit_snapshot.cpp
+
+  Copyright (C)   2024
+  Author: Oleg Proskurin, <proskurinov@basealt.ru>
+
+  This program is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with this program; if not, see <https://www.gnu.org/licenses/>.
+
+*/
+
+#include "polkit_snapshot.hpp"
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <exception>
+#include <fcntl.h>
+#include <fstream>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/sysmacros.h>
+#include <sys/types.h>
+#include <unistd.h>
+#include <vector>
+
+namespace common_utils::polkit {
+
+namespace {
+
+// NOLINTNEXTLINE(modernize-avoid-c-arrays)
+constexpr char kMagic[8] = {'A', 'U', 'S', 'B', 'P', 'K', 'S', 'N'};
+
+std::string_view BlockName(const Entry &entry) noexcept {
+  return {entry.block, strnlen(entry.block, kBlockNameSize)};
+}
+
+} // namespace
+
+uint32_t Hash(std::string_view str) noexcept {
+  uint32_t res = 2166136261U;
+  for (const char chr : str) {
+    res ^= static_cast<unsigned char>(chr);
+    res *= 16777619U;
+  }
+  return res;
+}
+
+std::string Build(const std::vector<Entry> &entries, uint64_t generation) {
+  std::vector<const Entry *> published;
+  published.reserve(entries.size());
+  for (const auto &entry : entries) {
+    const std::string_view name = BlockName(entry);
+    if (!name.empty() && name.size() < kBlockNameSize) {
+      published.push_back(&entry);
+    }
+  }
+  // at most half full - short probe sequences
+  uint32_t slot_count = 2;
+  while (slot_count < published.size() * 2) {
+    slot_count <<= 1U;
+  }
+  const uint32_t mask = slot_count - 1;
+  std::vector<uint32_t> slots(slot_count, 0);
+  for (uint32_t i = 0; i < published.size(); ++i) {
+    uint32_t pos = Hash(BlockName(*published[i])) & mask;
+    while (slots[pos] != 0) {
+      pos = (pos + 1) & mask;
+    }
+    slots[pos] = i + 1;
+  }
+  Header header{};
+  std::memcpy(header.magic, kMagic, sizeof(kMagic));
+  header.version = kVersion;
+  header.slot_count = slot_count;
+  header.entry_count = static_cast<uint32_t>(published.size());
+  header.generation = generation;
+  std::string res;
+  res.reserve(sizeof(Header) + slots.size() * sizeof(uint32_t) +
+              published.size() * sizeof(Entry));
+  // NOLINTBEGIN(cppcoreguidelines-pro-type-reinterpret-cast)
+  res.append(reinterpret_cast<const char *>(&header), sizeof(Header));
+  res.append(reinterpret_cast<const char *>(slots.data()),
+             slots.size() * sizeof(uint32_t));
+  for (const Entry *entry : published) {
+    res.append(reinterpret_cast<const char *>(entry), sizeof(Entry));
+  }
+  // NOLINTEND(cppcoreguidelines-pro-type-reinterpret-cast)
+  return res;
+}
+
+std::optional<Entry> MakeEntry(const std::string &block, uint32_t flags) {
+  struct stat info {};
+  if (block.size() >= kBlockNameSize || stat(block.c_str(), &info) != 0 ||
+      !S_ISBLK(info.st_mode)) {
+    return std::nullopt;
+  }
+  Entry res{};
+  std::memcpy(res.block, block.data(), block.size());
+  res.rdev = info.st_rdev;
+  res.diskseq = ReadDiskSeq(info.st_rdev);
+  res.flags = flags;
+  return res;
+}
+
+uint64_t ReadDiskSeq(dev_t rdev) noexcept {
+  try {
+    std::ifstream file("/sys/dev/block/" + std::to_string(major(rdev)) + ':' +
+                       std::to_string(minor(rdev)) + "/diskseq");
+    uint64_t res = 0;
+    if (file.is_open() && file >> res) {
+      return res;
+    }
+  } catch (const std::exception &) {
+  }
+  return 0;
+}
+
+// NOLINTBEGIN(cppcoreguidelines-pro-type-reinterpret-cast,cppcoreguidelines-pro-bounds-pointer-arithmetic)
+View::View(const void *data, size_t size) noexcept {
+  const auto *bytes = static_cast<const char *>(data);
+  if (bytes == nullptr || size < sizeof(Header) ||
+      reinterpret_cast<uintptr_t>(bytes) % alignof(Header) != 0) {
+    return;
+  }
+  const auto *header = reinterpret_cast<const Header *>(bytes);
+  if (std::memcmp(header->magic, kMagic, sizeof(kMagic)) != 0 ||
+      header->version != kVersion || header->slot_count == 0 ||
+      (header->slot_count & (header->slot_count - 1)) != 0 ||
+      header->entry_count >= header->slot_count) {
+    return;
+  }
+  const uint64_t slots_size =
+      static_cast<uint64_t>(header->slot_count) * sizeof(uint32_t);
+  if (sizeof(Header) + slots_size +
+          static_cast<uint64_t>(header->entry_count) * sizeof(Entry) !=
+      size) {
+    return;
+  }
+  header_ = header;
+  slots_ = reinterpret_cast<const uint32_t *>(bytes + sizeof(Header));
+  entries_ = reinterpret_cast<const Entry *>(bytes + sizeof(Header) +
+                                             slots_size);
+}
+
+uint64_t View::generation() const noexcept {
+  return header_ != nullptr ? header_->generation : 0;
+}
+
+const Entry *View::Find(std::string_view block) const noexcept {
+  if (header_ == nullptr) {
+    return nullptr;
+  }
+  const uint32_t mask = header_->slot_count - 1;
+  uint32_t pos = Hash(block) & mask;
+  for (uint32_t probe = 0; probe < header_->slot_count; ++probe) {
+    const uint32_t index = slots_[pos];
+    if (index == 0 || index > header_->entry_count) {
+      return nullptr;
+    }
+    if (BlockName(entries_[index - 1]) == block) {
+      return &entries_[index - 1];
+    }
+    pos = (pos + 1) & mask;
+  }
+  return nullptr;
+}
+// NOLINTEND(cppcoreguidelines-pro-type-reinterpret-cast,cppcoreguidelines-pro-bounds-pointer-arithmetic)
+
+std::optional<std::string> Answer(const std::string &snapshot_path,
+                                  const std::string &block,
+                                  const std::string &action) noexcept {
+  // NOLINTNEXTLINE(cppcoreguidelines-pro-type-vararg,hicpp-vararg)
+  const int fd = open(snapshot_path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
+    return std::nullopt;
+  }
+  struct stat info {};
+  if (fstat(fd, &info) != 0 || info.st_uid != 0 ||
+      (info.st_mode & (S_IWGRP | S_IWOTH)) != 0 ||
+      static_cast<size_t>(info.st_size) < sizeof(Header)) {
+    close(fd);
+    return std::nullopt;
+  }
+  const auto size = static_cast<size_t>(info.st_size);
+  void *data = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (data == MAP_FAILED) {
+    return std::nullopt;
+  }
+  std::optional<Entry> entry;
+  {
+    const View view(data, size);
+    const Entry *found = view.Find(block);
+    if (found != nullptr) {
+      entry = *found;
+    }
+  }
+  munmap(data, size);
+  if (!entry) {
+    return std::nullopt;
+  }
+  // the name may belong to another device since the snapshot was written
+  struct stat dev_info {};
+  if (stat(block.c_str(), &dev_info) != 0 || !S_ISBLK(dev_info.st_mode) ||
+      dev_info.st_rdev != entry->rdev ||
+      (entry->diskseq != 0 &&
+       ReadDiskSeq(dev_info.st_rdev) != entry->diskseq)) {
+    return std::nullopt;
+  }
+  if (action == "mount" && (entry->flags & kKnownDevice) != 0) {
+    return (entry->flags & kHasRule) != 0 ? "NO" : "YES";
+  }
+  if (action == "unmount" && (entry->flags & kMountedByDaemon) != 0) {
+    return "YES";
+  }
+  return std::nullopt;
+}
+
+} // namespace common_utils::polkit
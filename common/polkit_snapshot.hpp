@@ -0,0 +1,120 @@
+/* File: polkit_snapshot.hpp
+
+  Copyright (C)   2024
+  Author: Oleg Proskurin, <proskurinov@basealt.ru>
+
+  This program is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with this program; if not, see <https://www.gnu.org/licenses/>.
+
+*/
+
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <sys/types.h>
+#include <vector>
+
+/**
+ * @brief The answers for polkit published by the daemon
+ * @details altusbmount_askdbus is spawned for every udisks mount and unmount
+ * authorization. Instead of a DBus call it maps this file and looks the block
+ * device up. The file is replaced with rename, a mapping is never changed.
+ * Layout (host byte order): Header, uint32_t slots[slot_count] (entry index
+ * + 1, 0 - empty, open addressing with linear probing), Entry
+ * entries[entry_count].
+ */
+namespace common_utils::polkit {
+
+constexpr const char *kSnapshotPath = "/run/alt-usb-mount/polkit.snapshot";
+constexpr uint32_t kVersion = 1;
+/// longer block names are not published, the helper asks the daemon
+constexpr size_t kBlockNameSize = 32;
+
+enum EntryFlags : uint32_t {
+  kKnownDevice = 1,    /// vid, pid and serial are known, kHasRule is valid
+  kHasRule = 2,        /// CanUserMount - NO
+  kMountedByDaemon = 4 /// CanAnotherUserUnmount - YES
+};
+
+struct Header {
+  char magic[8]; // NOLINT(modernize-avoid-c-arrays)
+  uint32_t version;
+  uint32_t slot_count; /// a power of two
+  uint32_t entry_count;
+  uint32_t reserved;
+  uint64_t generation; /// incremented on every change
+};
+
+struct Entry {
+  char block[kBlockNameSize]; // NOLINT(modernize-avoid-c-arrays)
+  uint64_t rdev;    /// device number of the block device
+  uint64_t diskseq; /// /sys/dev/block/M:m/diskseq, 0 if unknown
+  uint32_t flags;
+  uint32_t reserved;
+};
+
+static_assert(sizeof(Header) == 32 && sizeof(Entry) == 56,
+              "the snapshot layout is a file format");
+
+/// @brief FNV-1a
+uint32_t Hash(std::string_view str) noexcept;
+
+/**
+ * @brief Serialize the snapshot
+ * @details Entries with a block name that doesn't fit are skipped.
+ */
+std::string Build(const std::vector<Entry> &entries, uint64_t generation);
+
+/// @brief Entry for the block device, rdev and diskseq from the system
+std::optional<Entry> MakeEntry(const std::string &block, uint32_t flags);
+
+/// @brief /sys/dev/block/M:m/diskseq, 0 if the kernel doesn't have it
+uint64_t ReadDiskSeq(dev_t rdev) noexcept;
+
+/**
+ * @class View
+ * @brief Lookup in serialized bytes, doesn't copy them
+ */
+class View {
+public:
+  /// @brief An invalid layout makes an empty view
+  View(const void *data, size_t size) noexcept;
+
+  bool valid() const noexcept { return header_ != nullptr; }
+  uint64_t generation() const noexcept;
+
+  /// @return nullptr if not found
+  const Entry *Find(std::string_view block) const noexcept;
+
+private:
+  const Header *header_ = nullptr;
+  const uint32_t *slots_ = nullptr;
+  const Entry *entries_ = nullptr;
+};
+
+/**
+ * @brief The helper answer from the snapshot file
+ * @details The file must belong to root and must not be writable by others.
+ * The entry is used only if it is still the same block device (rdev and
+ * diskseq).
+ * @param action "mount" or "unmount"
+ * @return "YES"/"NO" or empty if the daemon must be asked
+ */
+std::optional<std::string> Answer(const std::string &snapshot_path,
+                                  const std::string &block,
+                                  const std::string &action) noexcept;
+
+} // namespace common_utils::polkit
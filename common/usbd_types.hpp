@@ -0,0 +1,96 @@
+/* File: usbd_types.hpp
+
+  Copyright (C)   2024
+  Author: Oleg Proskurin, <proskurinov@basealt.ru>
+
+  This program is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with this program; if not, see <https://www.gnu.org/licenses/>.
+
+*/
+
+#pragma once
+
+#include <cstdint>
+#include <sdbus-c++/Types.h>
+#include <string>
+#include <vector>
+
+/**
+ * @file usbd_types.hpp
+ * @brief Native DBus types of the ru.alterator.Usbd interface (versioned
+ * methods). The JSON methods are kept for compatibility.
+ */
+
+namespace dbus_bindings::usbd {
+
+/// @brief block, vid, pid, serial, fs, mount point, status ("owned"|"free")
+using DeviceStruct = sdbus::Struct<std::string, std::string, std::string,
+                                   std::string, std::string, std::string,
+                                   std::string>;
+
+/// @brief uid or gid, name
+using PrincipalStruct = sdbus::Struct<uint32_t, std::string>;
+
+/// @brief disk, attribute, value written, value before
+using QueueTuningStruct =
+    sdbus::Struct<std::string, std::string, std::string, std::string>;
+
+/// @brief id, vid, pid, serial, users, groups
+using RuleStruct =
+    sdbus::Struct<uint64_t, std::string, std::string, std::string,
+                  std::vector<PrincipalStruct>, std::vector<PrincipalStruct>>;
+
+constexpr const char *kListDevicesV2 = "ListDevicesV2";
+constexpr const char *kListDevicesV2Signature = "a(sssssss)";
+constexpr const char *kListRulesV2 = "ListRulesV2";
+constexpr const char *kListRulesV2Signature = "a(tsssa(us)a(us))";
+constexpr const char *kListRulesPage = "ListRulesPage";
+/// cursor, limit, filter {"device","user","group"}
+constexpr const char *kListRulesPageInSignature = "tua{ss}";
+/// rules, has next page, next cursor
+constexpr const char *kListRulesPageSignature = "a(tsssa(us)a(us))bt";
+constexpr const char *kGetSnapshot = "GetSnapshot";
+/// generation, health, users and groups, rules (ListRules JSON), devices
+constexpr const char *kGetSnapshotSignature = "tsssa(sssssss)";
+constexpr const char *kSearchPrincipals = "SearchPrincipals";
+/// prefix, kind ("user"|"group"), limit
+constexpr const char *kSearchPrincipalsInSignature = "ssu";
+/// uid or gid, name
+constexpr const char *kSearchPrincipalsSignature = "a(us)";
+/// Prometheus text exposition format
+constexpr const char *kGetMetrics = "GetMetrics";
+constexpr const char *kGetMetricsSignature = "s";
+/// sysfs settings written to the connected disks, see QueueTuning
+constexpr const char *kGetQueueTuning = "GetQueueTuning";
+constexpr const char *kGetQueueTuningSignature = "a(ssss)";
+/// JSON lines through a UNIX fd
+constexpr const char *kImportRules = "ImportRules";
+/// fd, mode ("merge"|"replace")
+constexpr const char *kImportRulesInSignature = "hs";
+/// created, skipped
+constexpr const char *kImportRulesSignature = "tt";
+constexpr const char *kExportRules = "ExportRules";
+constexpr const char *kExportRulesInSignature = "h";
+/// rules written
+constexpr const char *kExportRulesSignature = "t";
+
+// signals
+constexpr const char *kDeviceAdded = "DeviceAdded";     // sssss
+constexpr const char *kDeviceRemoved = "DeviceRemoved"; // s
+constexpr const char *kMounted = "Mounted";             // ss
+constexpr const char *kUnmounted = "Unmounted";         // ss
+constexpr const char *kMountFailed = "MountFailed";     // ss
+constexpr const char *kUnmountFailed = "UnmountFailed"; // ss
+constexpr const char *kRulesChanged = "RulesChanged";   // t
+
+} // namespace dbus_bindings::usbd
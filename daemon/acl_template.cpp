@@ -0,0 +1,211 @@
+/* File: acl_template.cpp
+
+  Copyright (C)   2024
+  Author: Oleg Proskurin, <proskurinov@basealt.ru>
+
+  This program is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with this program; if not, see <https://www.gnu.org/licenses/>.
+
+*/
+
+#include "acl_template.hpp"
+#include "dal/dto.hpp"
+#include "utils.hpp"
+#include <acl/libacl.h>
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <exception>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <sys/acl.h>
+#include <sys/types.h>
+#include <utility>
+#include <vector>
+
+namespace usbmount {
+
+namespace {
+
+/// @brief An entry without a qualifier: owner, owning group, mask, others
+void AddEntry(acl_t &acl, acl_tag_t tag, acl_perm_t perms) {
+  acl_entry_t entry{};
+  acl_permset_t permset{};
+  if (acl_create_entry(&acl, &entry) != 0 ||
+      acl_get_permset(entry, &permset) != 0 || acl_clear_perms(permset) != 0 ||
+      (perms != 0 && acl_add_perm(permset, perms) != 0) ||
+      acl_set_tag_type(entry, tag) != 0 ||
+      acl_set_permset(entry, permset) != 0) {
+    throw std::runtime_error("Can't create ACL entry " +
+                             utils::SafeErrorNoToStr());
+  }
+}
+
+template <typename T> std::vector<T> SortedUnique(std::vector<T> ids) {
+  std::sort(ids.begin(), ids.end());
+  ids.erase(std::unique(ids.begin(), ids.end()), ids.end());
+  return ids;
+}
+
+} // namespace
+
+std::shared_ptr<const AclTemplate>
+AclTemplate::Compile(uint64_t index, const std::vector<uid_t> &users,
+                     const std::vector<gid_t> &groups) {
+  if (users.empty() || groups.empty()) {
+    throw std::invalid_argument("A rule without a user or a group");
+  }
+  auto res = std::make_shared<AclTemplate>();
+  res->uid = users.front();
+  res->gid = groups.front();
+  if (users.size() > 1 || groups.size() > 1) {
+    res->dir_suffix = '+' + std::to_string(index);
+  }
+  res->key = res->dir_suffix;
+  for (size_t i = 0; i < users.size(); ++i) {
+    res->key += i == 0 ? ':' : ',';
+    res->key += std::to_string(users[i]);
+  }
+  for (size_t i = 0; i < groups.size(); ++i) {
+    res->key += i == 0 ? ':' : ',';
+    res->key += std::to_string(groups[i]);
+  }
+  // a principal listed twice makes the ACL invalid
+  const auto uids = SortedUnique(users);
+  const auto gids = SortedUnique(groups);
+  acl_t acl = acl_init(static_cast<int>(uids.size() + gids.size() + 4));
+  if (acl == nullptr) {
+    throw std::runtime_error("acl_init failed " + utils::SafeErrorNoToStr());
+  }
+  try {
+    AddEntry(acl, ACL_USER_OBJ, ACL_READ | ACL_WRITE | ACL_EXECUTE);
+    AddEntry(acl, ACL_GROUP_OBJ, ACL_READ | ACL_EXECUTE);
+    AddEntry(acl, ACL_OTHER, 0);
+    for (const uid_t uid : uids) {
+      utils::acl::CreateUserAclEntry(acl, uid);
+    }
+    for (const gid_t gid : gids) {
+      utils::acl::CreateGroupAclEntry(acl, gid);
+    }
+    AddEntry(acl, ACL_MASK, ACL_READ | ACL_EXECUTE);
+    if (acl_valid(acl) != 0) {
+      throw std::runtime_error("The compiled ACL is invalid");
+    }
+    const ssize_t size = acl_size(acl);
+    if (size <= 0) {
+      throw std::runtime_error("acl_size failed");
+    }
+    res->blob.resize(static_cast<size_t>(size));
+    if (acl_copy_ext(res->blob.data(), acl, size) < 0) {
+      throw std::runtime_error("acl_copy_ext failed");
+    }
+  } catch (const std::exception &) {
+    acl_free(acl);
+    throw;
+  }
+  acl_free(acl);
+  return res;
+}
+
+std::shared_ptr<const AclTemplate>
+AclTemplate::Compile(uint64_t index, const dal::PermissionEntry &rule) {
+  std::vector<uid_t> users;
+  users.reserve(rule.getUsers().size());
+  for (const auto &user : rule.getUsers()) {
+    users.push_back(user.uid());
+  }
+  std::vector<gid_t> groups;
+  groups.reserve(rule.getGroups().size());
+  for (const auto &group : rule.getGroups()) {
+    groups.push_back(group.gid());
+  }
+  return Compile(index, users, groups);
+}
+
+void AclTemplate::Apply(const std::string &path) const {
+  acl_t acl = acl_copy_int(blob.data());
+  if (acl == nullptr) {
+    throw std::runtime_error("acl_copy_int failed " +
+                             utils::SafeErrorNoToStr());
+  }
+  const int res = acl_set_file(path.c_str(), ACL_TYPE_ACCESS, acl);
+  const std::string err = res != 0 ? utils::SafeErrorNoToStr() : "";
+  acl_free(acl);
+  if (res != 0) {
+    throw std::runtime_error("acl_set_file failed " + err);
+  }
+}
+
+AclTemplates &AclTemplates::Instance() {
+  static AclTemplates instance;
+  return instance;
+}
+
+void AclTemplates::Compile(
+    const std::map<uint64_t, std::shared_ptr<const dal::PermissionEntry>>
+        &rules,
+    uint64_t generation, const utils::logger_t &logger) noexcept {
+  try {
+    std::unordered_map<uint64_t, std::shared_ptr<const AclTemplate>> compiled;
+    compiled.reserve(rules.size());
+    for (const auto &rule : rules) {
+      try {
+        compiled.emplace(rule.first, AclTemplate::Compile(rule.first,
+                                                          *rule.second));
+      } catch (const std::exception &ex) {
+        logger->warn("[AclTemplates] Rule {} {}", rule.first, ex.what());
+      }
+    }
+    const std::lock_guard<std::mutex> lock(mutex_);
+    if (generation >= generation_) {
+      generation_ = generation;
+      templates_ = std::move(compiled);
+    }
+  } catch (const std::exception &ex) {
+    logger->error("[AclTemplates] {}", ex.what());
+  }
+}
+
+std::shared_ptr<const AclTemplate>
+AclTemplates::Find(uint64_t index, const dal::PermissionEntry &rule,
+                   uint64_t generation) {
+  {
+    const std::lock_guard<std::mutex> lock(mutex_);
+    if (generation == generation_) {
+      auto it_found = templates_.find(index);
+      if (it_found != templates_.cend()) {
+        return it_found->second;
+      }
+    }
+  }
+  auto res = AclTemplate::Compile(index, rule);
+  const std::lock_guard<std::mutex> lock(mutex_);
+  if (generation > generation_) {
+    generation_ = generation;
+    templates_.clear();
+  }
+  if (generation == generation_) {
+    templates_[index] = res;
+  }
+  return res;
+}
+
+size_t AclTemplates::size() const noexcept {
+  const std::lock_guard<std::mutex> lock(mutex_);
+  return templates_.size();
+}
+
+} // namespace usbmount
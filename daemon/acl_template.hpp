@@ -0,0 +1,100 @@
+/* File: acl_template.hpp
+
+  Copyright (C)   2024
+  Author: Oleg Proskurin, <proskurinov@basealt.ru>
+
+  This program is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with this program; if not, see <https://www.gnu.org/licenses/>.
+
+*/
+
+#pragma once
+#include "dal/dto.hpp"
+#include "utils.hpp"
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <sys/types.h>
+#include <unordered_map>
+#include <vector>
+
+namespace usbmount {
+
+/**
+ * @brief The ACL of a base mount directory, compiled from a rule
+ * @details Entries: owner rwx, owning group r-x, others none, r-x for every
+ * user and group of the rule and the r-x mask - the same ACL the former
+ * SetAcl built for one user and one group.
+ */
+struct AclTemplate {
+  /// the first user and group own the mounted filesystem
+  uid_t uid = 0;
+  gid_t gid = 0;
+  /// principals in the rule order, e.g. "+3:1000,1001:100"
+  std::string key;
+  /// "+<rule index>" if more than one user or group, a directory per rule
+  std::string dir_suffix;
+  /// acl_copy_ext form
+  std::string blob;
+
+  /**
+   * @throws std::invalid_argument for a rule without a user or a group,
+   * std::runtime_error on libacl errors
+   */
+  static std::shared_ptr<const AclTemplate>
+  Compile(uint64_t index, const std::vector<uid_t> &users,
+          const std::vector<gid_t> &groups);
+
+  static std::shared_ptr<const AclTemplate>
+  Compile(uint64_t index, const dal::PermissionEntry &rule);
+
+  /**
+   * @brief acl_copy_int + acl_set_file, also sets the mode bits
+   * @throws std::runtime_error
+   */
+  void Apply(const std::string &path) const;
+};
+
+/**
+ * @class AclTemplates
+ * @brief Templates of all rules, compiled when the rules are saved
+ * @details A rule changed after the last Compile is compiled on the first
+ * mount.
+ */
+class AclTemplates {
+public:
+  static AclTemplates &Instance();
+
+  /// @param generation DevicePermissions::generation() read before the rules
+  void
+  Compile(const std::map<uint64_t, std::shared_ptr<const dal::PermissionEntry>>
+              &rules,
+          uint64_t generation, const utils::logger_t &logger) noexcept;
+
+  /// @throws as AclTemplate::Compile
+  std::shared_ptr<const AclTemplate> Find(uint64_t index,
+                                          const dal::PermissionEntry &rule,
+                                          uint64_t generation);
+
+  size_t size() const noexcept;
+
+private:
+  mutable std::mutex mutex_;
+  uint64_t generation_ = 0;
+  std::unordered_map<uint64_t, std::shared_ptr<const AclTemplate>> templates_;
+};
+
+} // namespace usbmount
@@ -0,0 +1,173 @@
+/* File: base_dir_cache.cpp
+
+  Copyright (C)   2024
+  Author: Oleg Proskurin, <proskurinov@basealt.ru>
+
+  This program is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with this program; if not, see <https://www.gnu.org/licenses/>.
+
+*/
+
+#include "base_dir_cache.hpp"
+#include <array>
+#include <cerrno>
+#include <cstddef>
+#include <exception>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/xattr.h>
+#include <utility>
+
+namespace usbmount {
+
+namespace {
+
+// a few entries: owner, user, group, mask, other
+constexpr size_t kAclBufferSize = 256;
+constexpr const char *kAclAccess = "system.posix_acl_access";
+// the ACL may be replaced between the size query and the read
+constexpr size_t kAclAttempts = 3;
+
+bool SameInode(const struct stat &info, dev_t dev, ino_t ino) noexcept {
+  return info.st_dev == dev && info.st_ino == ino;
+}
+
+bool SameTime(const timespec &lhs, const timespec &rhs) noexcept {
+  return lhs.tv_sec == rhs.tv_sec && lhs.tv_nsec == rhs.tv_nsec;
+}
+
+/**
+ * @brief The raw ACL of the path, empty if there is none
+ * @details A template with many principals doesn't fit the buffer, the size
+ * is asked for then.
+ * @return false on an error
+ */
+bool ReadAcl(const std::string &path, std::string &acl) {
+  std::array<char, kAclBufferSize> buf{};
+  ssize_t len = getxattr(path.c_str(), kAclAccess, buf.data(), buf.size());
+  if (len >= 0) {
+    acl.assign(buf.data(), static_cast<size_t>(len));
+    return true;
+  }
+  for (size_t attempt = 0; attempt < kAclAttempts && errno == ERANGE;
+       ++attempt) {
+    len = getxattr(path.c_str(), kAclAccess, nullptr, 0);
+    if (len < 0) {
+      break;
+    }
+    acl.resize(static_cast<size_t>(len));
+    len = getxattr(path.c_str(), kAclAccess, acl.data(), acl.size());
+    if (len >= 0) {
+      acl.resize(static_cast<size_t>(len));
+      return true;
+    }
+  }
+  acl.clear();
+  return errno == ENODATA;
+}
+
+} // namespace
+
+BaseDirCache &BaseDirCache::Instance() {
+  static BaseDirCache instance;
+  return instance;
+}
+
+std::optional<std::string> BaseDirCache::Find(const std::string &key,
+                                              const Generations &generations) {
+  const std::lock_guard<std::mutex> lock(mutex_);
+  auto it_found = dirs_.find(key);
+  if (it_found == dirs_.end()) {
+    return std::nullopt;
+  }
+  Entry &entry = it_found->second;
+  if (entry.generations.rules != generations.rules ||
+      entry.generations.accounts != generations.accounts) {
+    dirs_.clear();
+    return std::nullopt;
+  }
+  struct stat info {};
+  if (stat(entry.path.c_str(), &info) != 0 ||
+      !SameInode(info, entry.dev, entry.ino)) {
+    dirs_.erase(it_found);
+    return std::nullopt;
+  }
+  if (SameTime(info.st_ctim, entry.ctime)) {
+    return entry.path;
+  }
+  // a mount point was created or removed inside, or the directory was changed
+  Entry current;
+  current.path = entry.path;
+  if (!ReadState(current) || !SameInode(info, current.dev, current.ino) ||
+      current.mode != entry.mode || current.owner != entry.owner ||
+      current.group != entry.group || current.acl != entry.acl) {
+    dirs_.erase(it_found);
+    return std::nullopt;
+  }
+  entry.ctime = current.ctime;
+  return entry.path;
+}
+
+void BaseDirCache::Put(const std::string &key, const Generations &generations,
+                       const std::string &path) noexcept {
+  try {
+    Entry entry;
+    entry.path = path;
+    entry.generations = generations;
+    const std::lock_guard<std::mutex> lock(mutex_);
+    if (!ReadState(entry)) {
+      dirs_.erase(key);
+      return;
+    }
+    dirs_[key] = std::move(entry);
+  } catch (const std::exception &) {
+    // not cached, prepared again next time
+  }
+}
+
+void BaseDirCache::Clear() noexcept {
+  const std::lock_guard<std::mutex> lock(mutex_);
+  dirs_.clear();
+}
+
+size_t BaseDirCache::size() const noexcept {
+  const std::lock_guard<std::mutex> lock(mutex_);
+  return dirs_.size();
+}
+
+bool BaseDirCache::ReadState(Entry &entry) noexcept {
+  // stat first, a change after it shows up as another ctime
+  struct stat info {};
+  if (stat(entry.path.c_str(), &info) != 0 || !S_ISDIR(info.st_mode)) {
+    return false;
+  }
+  try {
+    if (!ReadAcl(entry.path, entry.acl)) {
+      return false;
+    }
+  } catch (const std::exception &) {
+    return false;
+  }
+  entry.dev = info.st_dev;
+  entry.ino = info.st_ino;
+  entry.ctime = info.st_ctim;
+  entry.mode = info.st_mode;
+  entry.owner = info.st_uid;
+  entry.group = info.st_gid;
+  return true;
+}
+
+} // namespace usbmount
@@ -0,0 +1,89 @@
+/* File: base_dir_cache.hpp
+
+  Copyright (C)   2024
+  Author: Oleg Proskurin, <proskurinov@basealt.ru>
+
+  This program is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with this program; if not, see <https://www.gnu.org/licenses/>.
+
+*/
+
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <ctime>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <sys/types.h>
+#include <unordered_map>
+
+namespace usbmount {
+
+/**
+ * @class BaseDirCache
+ * @brief Base mount directories already prepared for a set of principals
+ * @details CustomMount creates the directory and applies the ACL once, the
+ * following mounts for the same AclTemplate key only check that the directory
+ * is still the same inode with the same ctime. Creating or removing a mount
+ * point inside changes the ctime, then the mode, the owner and the raw ACL
+ * (system.posix_acl_access) are compared with the recorded ones. Entries are
+ * dropped when the rules or the accounts change and on ReviewMountPoints.
+ */
+class BaseDirCache {
+public:
+  /// @brief State the directory was prepared for
+  struct Generations {
+    uint64_t rules = 0;    /// DevicePermissions::generation()
+    uint64_t accounts = 0; /// AccountsSnapshot::generation
+  };
+
+  static BaseDirCache &Instance();
+
+  /// @return the directory if it is unchanged since Put
+  /// @param key AclTemplate::key
+  std::optional<std::string> Find(const std::string &key,
+                                  const Generations &generations);
+
+  /**
+   * @brief Remember the prepared directory
+   * @details The inode, ctime, mode and ACL are read from the directory.
+   */
+  void Put(const std::string &key, const Generations &generations,
+           const std::string &path) noexcept;
+
+  void Clear() noexcept;
+
+  size_t size() const noexcept;
+
+private:
+  struct Entry {
+    std::string path;
+    Generations generations;
+    dev_t dev = 0;
+    ino_t ino = 0;
+    timespec ctime{};
+    mode_t mode = 0;
+    uid_t owner = 0;
+    gid_t group = 0;
+    std::string acl;
+  };
+
+  /// @brief Fill the inode, ctime, mode, owner and ACL
+  static bool ReadState(Entry &entry) noexcept;
+
+  mutable std::mutex mutex_;
+  std::unordered_map<std::string, Entry> dirs_;
+};
+
+} // namespace usbmount
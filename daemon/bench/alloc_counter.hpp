@@ -0,0 +1,30 @@
+/* File: alloc_counter.hpp
+
+  Copyright (C)   2024
+  Author: Oleg Proskurin, <proskurinov@basealt.ru>
+
+  This program is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with this program; if not, see <https://www.gnu.org/licenses/>.
+
+*/
+
+#pragma once
+#include <atomic>
+#include <cstddef>
+
+/*
+ * operator new is replaced for the whole bench_daemon, allocations of the
+ * current thread are counted while g_count_allocations is set.
+ */
+extern thread_local bool g_count_allocations;
+extern std::atomic<size_t> g_allocations;
@@ -0,0 +1,98 @@
+/* File: bench_acl_template.cpp
+
+  Copyright (C)   2024
+  Author: Oleg Proskurin, <proskurinov@basealt.ru>
+
+  This program is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with this program; if not, see <https://www.gnu.org/licenses/>.
+
+*/
+
+/*
+ * ACL of a base mount directory with 20 principals (10 users, 10 groups):
+ * the former SetAcl (read the ACL twice, drop user, group and mask entries,
+ * add them entry by entry, acl_cmp, acl_set_file) vs the compiled template
+ * (acl_copy_int + acl_set_file). The directory is in /tmp, run on a
+ * filesystem with POSIX ACL support.
+ */
+
+#include "acl_template.hpp"
+#include "utils.hpp"
+#include <acl/libacl.h>
+#include <catch2/catch.hpp>
+#include <filesystem>
+#include <stdexcept>
+#include <string>
+#include <sys/acl.h>
+#include <sys/types.h>
+#include <vector>
+
+namespace {
+
+constexpr size_t kPrincipals = 10; // of each kind
+
+/// @brief The former CustomMount::SetAcl for several users and groups
+void SetAclFromScratch(const std::string &path, const std::vector<uid_t> &uids,
+                       const std::vector<gid_t> &gids) {
+  acl_t acl = acl_get_file(path.c_str(), ACL_TYPE_ACCESS);
+  acl_t acl_old = acl_get_file(path.c_str(), ACL_TYPE_ACCESS);
+  if (acl == nullptr || acl_old == nullptr) {
+    throw std::runtime_error("Cant read ACL");
+  }
+  usbmount::utils::acl::DeleteACLUserGroupMask(acl);
+  for (const uid_t uid : uids) {
+    usbmount::utils::acl::CreateUserAclEntry(acl, uid);
+  }
+  for (const gid_t gid : gids) {
+    usbmount::utils::acl::CreateGroupAclEntry(acl, gid);
+  }
+  acl_entry_t entry{};
+  acl_permset_t permset{};
+  if (acl_create_entry(&acl, &entry) != 0 ||
+      acl_get_permset(entry, &permset) != 0 ||
+      acl_add_perm(permset, ACL_READ | ACL_EXECUTE) != 0 ||
+      acl_set_tag_type(entry, ACL_MASK) != 0 ||
+      acl_set_permset(entry, permset) != 0 || acl_valid(acl) != 0) {
+    throw std::runtime_error("Can't create the mask");
+  }
+  if (acl_cmp(acl, acl_old) == 1 &&
+      acl_set_file(path.c_str(), ACL_TYPE_ACCESS, acl) != 0) {
+    throw std::runtime_error("acl_set_file failed");
+  }
+  acl_free(acl);
+  acl_free(acl_old);
+}
+
+} // namespace
+
+TEST_CASE("Base directory ACL: from scratch vs template", "[!benchmark]") {
+  const std::string path = "/tmp/alt-usb-mount-bench/acl";
+  std::filesystem::create_directories(path);
+  std::vector<uid_t> uids;
+  std::vector<gid_t> gids;
+  for (size_t i = 0; i < kPrincipals; ++i) {
+    uids.push_back(static_cast<uid_t>(1000 + i));
+    gids.push_back(static_cast<gid_t>(2000 + i));
+  }
+  const auto compiled = usbmount::AclTemplate::Compile(1, uids, gids);
+  compiled->Apply(path);
+
+  BENCHMARK("from scratch, 20 principals") {
+    SetAclFromScratch(path, uids, gids);
+  };
+  BENCHMARK("template apply, 20 principals") { compiled->Apply(path); };
+  BENCHMARK("template compile, once per save") {
+    return usbmount::AclTemplate::Compile(1, uids, gids);
+  };
+  std::filesystem::remove_all("/tmp/alt-usb-mount-bench");
+}
@@ -0,0 +1,119 @@
+/* File: bench_can_user_mount.cpp
+
+  Copyright (C)   2024
+  Author: Oleg Proskurin, <proskurinov@basealt.ru>
+
+  This program is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with this program; if not, see <https://www.gnu.org/licenses/>.
+
+*/
+
+/*
+ * CanUserMount lookup: the former linear scan of the rules vs the device
+ * cache + indexed rule lookup. Allocations are counted with alloc_counter.
+ */
+
+#include "alloc_counter.hpp"
+#include "dal/device_permissions.hpp"
+#include "dal/dto.hpp"
+#include "device_cache.hpp"
+#include <algorithm>
+#include <atomic>
+#include <catch2/catch.hpp>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <filesystem>
+#include <map>
+#include <memory>
+#include <optional>
+#include <string>
+#include <utility>
+
+namespace {
+
+using namespace usbmount;
+
+constexpr size_t kRulesNumber = 10000;
+constexpr size_t kDevicesNumber = 32;
+const char *const kTablePath = "/tmp/alt-usb-mount-bench/permissions.json";
+
+std::string Serial(size_t index) {
+  return "4C53000" + std::to_string(index) + "10123456";
+}
+
+void FillRules(dal::DevicePermissions &permissions) {
+  permissions.StartTransaction();
+  permissions.Clear();
+  for (size_t i = 0; i < kRulesNumber; ++i) {
+    permissions.Create(dal::PermissionEntry(
+        dal::Device({"0781", "5567", Serial(i)}), {{1000, "user"}},
+        {{1001, "usb_flash"}}));
+  }
+  permissions.ProcessTransaction();
+}
+
+// DevicePermissions::Find before the index
+std::optional<uint64_t> LinearFind(
+    const std::map<uint64_t, std::shared_ptr<const dal::PermissionEntry>>
+        &rules,
+    const dal::Device &dev) {
+  auto it_found = std::find_if(
+      rules.cbegin(), rules.cend(),
+      [&dev](const std::pair<const uint64_t,
+                             std::shared_ptr<const dal::PermissionEntry>>
+                 &entry) { return entry.second->getDevice() == dev; });
+  return it_found != rules.cend() ? std::make_optional(it_found->first)
+                                  : std::nullopt;
+}
+
+} // namespace
+
+TEST_CASE("CanUserMount lookup", "[!benchmark]") {
+  std::filesystem::remove(kTablePath);
+  dal::DevicePermissions permissions(kTablePath);
+  FillRules(permissions);
+  const auto rules = permissions.getAll();
+  DeviceCache cache;
+  for (size_t i = 0; i < kDevicesNumber; ++i) {
+    // the last devices have rules - the worst case for the linear scan
+    cache.Put("/dev/sd" + std::to_string(i),
+              {"0781", "5567", Serial(kRulesNumber - 1 - i)});
+  }
+  const std::string block = "/dev/sd7";
+
+  BENCHMARK("linear scan") {
+    // CanUserMount constructed a Device from the udev device
+    const dal::Device dev({"0781", "5567", Serial(kRulesNumber - 8)});
+    return LinearFind(rules, dev);
+  };
+  BENCHMARK("device cache + index") {
+    auto dev = cache.Find(block);
+    return permissions.Find(dev->vid(), dev->pid(), dev->serial());
+  };
+
+  // warm up the index, then count
+  REQUIRE(permissions.Find("0781", "5567", Serial(0)) == 0);
+  g_allocations = 0;
+  g_count_allocations = true;
+  std::optional<uint64_t> found;
+  for (int i = 0; i < 1000; ++i) {
+    auto dev = cache.Find(block);
+    found = permissions.Find(dev->vid(), dev->pid(), dev->serial());
+  }
+  g_count_allocations = false;
+  std::printf("allocations per lookup: %zu\n", g_allocations.load() / 1000);
+  REQUIRE(found == kRulesNumber - 8);
+  REQUIRE(g_allocations == 0);
+  std::filesystem::remove(kTablePath);
+}
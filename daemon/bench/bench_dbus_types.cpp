@@ -0,0 +1,245 @@
+/* File: bench_dbus_types.cpp
+
+  Copyright (C)   2024
+  Author: Oleg Proskurin, <proskurinov@basealt.ru>
+
+  This program is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with this program; if not, see <https://www.gnu.org/licenses/>.
+
+*/
+
+/*
+ * JSON string methods vs native signatures (ListDevicesV2, ListRulesV2).
+ * Server side - building a message, client side - reading it back.
+ * Wire bytes are the marshalled body size (DBus alignment rules).
+ */
+
+#include "usbd_types.hpp"
+#include <boost/json.hpp>
+#include <catch2/catch.hpp>
+#include <cstddef>
+#include <cstdint>
+#include <iostream>
+#include <sdbus-c++/Message.h>
+#include <sdbus-c++/sdbus-c++.h>
+#include <string>
+#include <tuple>
+#include <vector>
+
+namespace {
+
+namespace json = boost::json;
+namespace usbd = dbus_bindings::usbd;
+
+constexpr size_t kDevicesNumber = 100;
+constexpr size_t kRulesNumber = 10000;
+
+// --- marshalled size of the DBus body
+
+size_t Align(size_t offset, size_t alignment) {
+  return (offset + alignment - 1) / alignment * alignment;
+}
+
+size_t AddString(size_t offset, const std::string &str) {
+  return Align(offset, 4) + 4 + str.size() + 1;
+}
+
+size_t AddPrincipals(size_t offset,
+                     const std::vector<usbd::PrincipalStruct> &arr) {
+  offset = Align(offset, 4) + 4;
+  offset = Align(offset, 8);
+  for (const auto &principal : arr) {
+    offset = Align(offset, 8) + 4;
+    offset = AddString(offset, std::get<1>(principal));
+  }
+  return offset;
+}
+
+size_t WireSize(const std::vector<usbd::DeviceStruct> &arr) {
+  size_t offset = Align(0, 4) + 4;
+  offset = Align(offset, 8);
+  for (const auto &dev : arr) {
+    offset = Align(offset, 8);
+    std::apply(
+        [&offset](const auto &...field) {
+          ((offset = AddString(offset, field)), ...);
+        },
+        static_cast<const std::tuple<std::string, std::string, std::string,
+                                     std::string, std::string, std::string,
+                                     std::string> &>(dev));
+  }
+  return offset;
+}
+
+size_t WireSize(const std::vector<usbd::RuleStruct> &arr) {
+  size_t offset = Align(0, 4) + 4;
+  offset = Align(offset, 8);
+  for (const auto &rule : arr) {
+    offset = Align(offset, 8) + 8;
+    offset = AddString(offset, std::get<1>(rule));
+    offset = AddString(offset, std::get<2>(rule));
+    offset = AddString(offset, std::get<3>(rule));
+    offset = AddPrincipals(offset, std::get<4>(rule));
+    offset = AddPrincipals(offset, std::get<5>(rule));
+  }
+  return offset;
+}
+
+size_t WireSize(const std::string &str) { return AddString(0, str); }
+
+// --- test data
+
+std::vector<usbd::DeviceStruct> MakeDevices() {
+  std::vector<usbd::DeviceStruct> res;
+  for (size_t i = 0; i < kDevicesNumber; ++i) {
+    res.emplace_back("/dev/sd" + std::to_string(i), "0781", "5567",
+                     "4C530001" + std::to_string(i), "vfat",
+                     "/media/alt-usb-mount/user_group/LABEL" +
+                         std::to_string(i),
+                     i % 2 == 0 ? "owned" : "free");
+  }
+  return res;
+}
+
+std::vector<usbd::RuleStruct> MakeRules() {
+  std::vector<usbd::RuleStruct> res;
+  for (size_t i = 0; i < kRulesNumber; ++i) {
+    res.emplace_back(i, "0781", "5567", "4C530001" + std::to_string(i),
+                     std::vector<usbd::PrincipalStruct>{{1000, "user"}},
+                     std::vector<usbd::PrincipalStruct>{{1001, "usb_flash"}});
+  }
+  return res;
+}
+
+std::string DevicesToJson(const std::vector<usbd::DeviceStruct> &devices) {
+  json::array arr;
+  for (const auto &dev : devices) {
+    json::object obj;
+    obj["device"] = std::get<0>(dev);
+    obj["vid"] = std::get<1>(dev);
+    obj["pid"] = std::get<2>(dev);
+    obj["serial"] = std::get<3>(dev);
+    obj["fs"] = std::get<4>(dev);
+    obj["mount"] = std::get<5>(dev);
+    obj["status"] = std::get<6>(dev);
+    arr.emplace_back(std::move(obj));
+  }
+  return json::serialize(arr);
+}
+
+std::string RulesToJson(const std::vector<usbd::RuleStruct> &rules) {
+  json::array arr;
+  for (const auto &rule : rules) {
+    json::object perm;
+    perm["device"] = json::object{{"vid", std::get<1>(rule)},
+                                  {"pid", std::get<2>(rule)},
+                                  {"serial", std::get<3>(rule)}};
+    json::array users;
+    for (const auto &user : std::get<4>(rule)) {
+      users.emplace_back(json::object{{"uid", std::get<0>(user)},
+                                      {"name", std::get<1>(user)}});
+    }
+    perm["users"] = std::move(users);
+    json::array groups;
+    for (const auto &group : std::get<5>(rule)) {
+      groups.emplace_back(json::object{{"gid", std::get<0>(group)},
+                                       {"name", std::get<1>(group)}});
+    }
+    perm["groups"] = std::move(groups);
+    json::object obj;
+    obj["id"] = std::to_string(std::get<0>(rule));
+    obj["perm"] = std::move(perm);
+    arr.emplace_back(std::move(obj));
+  }
+  return json::serialize(arr);
+}
+
+// client side of the JSON method - what UsbMount::ListDevicesJson does
+std::vector<usbd::DeviceStruct> DevicesFromJson(const std::string &str) {
+  std::vector<usbd::DeviceStruct> res;
+  const json::value val = json::parse(str);
+  for (const auto &element : val.as_array()) {
+    const json::object &obj = element.as_object();
+    res.emplace_back(obj.at("device").as_string().c_str(),
+                     obj.at("vid").as_string().c_str(),
+                     obj.at("pid").as_string().c_str(),
+                     obj.at("serial").as_string().c_str(),
+                     obj.at("fs").as_string().c_str(),
+                     obj.at("mount").as_string().c_str(),
+                     obj.at("status").as_string().c_str());
+  }
+  return res;
+}
+
+template <typename T> sdbus::PlainMessage MakeMessage(const T &body) {
+  auto msg = sdbus::createPlainMessage();
+  msg << body;
+  msg.seal();
+  return msg;
+}
+
+template <typename T> T ReadMessage(sdbus::PlainMessage &msg) {
+  T res;
+  msg.rewind(true);
+  msg >> res;
+  return res;
+}
+
+} // namespace
+
+TEST_CASE("DBus payload size", "[!benchmark]") {
+  const auto devices = MakeDevices();
+  const auto rules = MakeRules();
+  const std::string devices_json = DevicesToJson(devices);
+  const std::string rules_json = RulesToJson(rules);
+  std::cout << kDevicesNumber << " devices: json s = "
+            << WireSize(devices_json)
+            << " bytes, a(sssssss) = " << WireSize(devices) << " bytes\n";
+  std::cout << kRulesNumber << " rules: json s = " << WireSize(rules_json)
+            << " bytes, a(tsssa(us)a(us)) = " << WireSize(rules)
+            << " bytes\n";
+  REQUIRE(WireSize(devices) < WireSize(devices_json));
+  REQUIRE(WireSize(rules) < WireSize(rules_json));
+}
+
+TEST_CASE("ListDevices JSON vs a(sssssss)", "[!benchmark]") {
+  const auto devices = MakeDevices();
+  BENCHMARK("server: json") { return MakeMessage(DevicesToJson(devices)); };
+  BENCHMARK("server: struct array") { return MakeMessage(devices); };
+
+  auto json_msg = MakeMessage(DevicesToJson(devices));
+  auto struct_msg = MakeMessage(devices);
+  BENCHMARK("client: json") {
+    return DevicesFromJson(ReadMessage<std::string>(json_msg));
+  };
+  BENCHMARK("client: struct array") {
+    return ReadMessage<std::vector<usbd::DeviceStruct>>(struct_msg);
+  };
+  REQUIRE(DevicesFromJson(ReadMessage<std::string>(json_msg)) ==
+          ReadMessage<std::vector<usbd::DeviceStruct>>(struct_msg));
+}
+
+TEST_CASE("ListRules JSON vs a(tsssa(us)a(us))", "[!benchmark]") {
+  const auto rules = MakeRules();
+  BENCHMARK("server: json") { return MakeMessage(RulesToJson(rules)); };
+  BENCHMARK("server: struct array") { return MakeMessage(rules); };
+
+  auto json_msg = MakeMessage(RulesToJson(rules));
+  auto struct_msg = MakeMessage(rules);
+  BENCHMARK("client: json") {
+    return json::parse(ReadMessage<std::string>(json_msg));
+  };
+  BENCHMARK("client: struct array") {
+    return ReadMessage<std::vector<usbd::RuleStruct>>(struct_msg);
+  };
+}
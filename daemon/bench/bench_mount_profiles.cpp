@@ -0,0 +1,180 @@
+/* File: bench_mount_profiles.cpp
+
+  Copyright (C)   2024
+  Author: Oleg Proskurin, <proskurinov@basealt.ru>
+
+  This program is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with this program; if not, see <https://www.gnu.org/licenses/>.
+
+*/
+
+/*
+ * Copy throughput of the vfat and exfat profile variants, fio style: a
+ * sequential write of one big file in 1 MiB blocks and a burst of small
+ * files, each followed by umount so the data is on the device. The image is
+ * attached as a loop device and formatted for every variant; it needs root,
+ * losetup, mkfs.vfat and mkfs.exfat, a variant without its mkfs is skipped.
+ * The default vfat profile has "flush", the tuned ones replace it with
+ * noatime,lazytime.
+ */
+
+#include "mount_profiles.hpp"
+#include <catch2/catch.hpp>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <fcntl.h>
+#include <filesystem>
+#include <stdexcept>
+#include <string>
+#include <sys/mount.h>
+#include <unistd.h>
+#include <vector>
+
+namespace {
+
+constexpr const char *kRoot = "/tmp/alt-usb-mount-bench/profiles";
+constexpr size_t kImageMib = 256;
+constexpr size_t kBigFileMib = 128;
+constexpr size_t kSmallFiles = 512;
+constexpr size_t kSmallFileSize = 16 * 1024;
+constexpr size_t kBlockSize = 1024 * 1024;
+
+struct Variant {
+  const char *name;
+  const char *fs;
+  const char *rule_options; /// applied to the built-in profile
+};
+
+/// @brief Attach the image, detached on destruction
+class LoopDevice {
+public:
+  LoopDevice(const LoopDevice &) = delete;
+  LoopDevice(LoopDevice &&) = delete;
+  LoopDevice &operator=(const LoopDevice &) = delete;
+  LoopDevice &operator=(LoopDevice &&) = delete;
+
+  explicit LoopDevice(const std::string &image) {
+    FILE *pipe = popen(("losetup --find --show " + image).c_str(), "r");
+    if (pipe == nullptr) {
+      throw std::runtime_error("Can't run losetup");
+    }
+    std::vector<char> buf(64, 0);
+    if (fgets(buf.data(), static_cast<int>(buf.size()), pipe) != nullptr) {
+      device_ = buf.data();
+    }
+    pclose(pipe);
+    while (!device_.empty() && device_.back() == '\n') {
+      device_.pop_back();
+    }
+    if (device_.empty()) {
+      throw std::runtime_error("Can't attach " + image);
+    }
+  }
+
+  ~LoopDevice() {
+    static_cast<void>(std::system(("losetup -d " + device_).c_str()));
+  }
+
+  const std::string &device() const noexcept { return device_; }
+
+private:
+  std::string device_;
+};
+
+void WriteFile(const std::string &path, size_t size,
+               const std::vector<char> &block) {
+  const int fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC,
+                      0600);
+  if (fd < 0) {
+    throw std::runtime_error("Can't create " + path);
+  }
+  for (size_t done = 0; done < size;) {
+    const size_t len = std::min(block.size(), size - done);
+    const ssize_t res = write(fd, block.data(), len);
+    if (res <= 0) {
+      close(fd);
+      throw std::runtime_error("Can't write " + path);
+    }
+    done += static_cast<size_t>(res);
+  }
+  close(fd);
+}
+
+/// @return MiB/s of the big file and files/s of the small ones
+std::pair<double, double> Copy(const std::string &device,
+                               const Variant &variant) {
+  const usbmount::MountProfiles profiles(usbmount::MountProfiles::Defaults());
+  usbmount::MountProfile profile = *profiles.Find(variant.fs);
+  usbmount::MountProfiles::ApplyOptions(variant.rule_options, profile);
+  const std::string data = "uid=0,gid=0," + profile.data;
+  const std::string target = std::string(kRoot) + "/mnt";
+  std::filesystem::create_directories(target);
+  const std::vector<char> block(kBlockSize, 'x');
+  using Clock = std::chrono::steady_clock;
+  auto mount_fs = [&] {
+    if (mount(device.c_str(), target.c_str(), variant.fs,
+              MS_NOSUID | MS_NODEV | profile.flags, data.c_str()) != 0) {
+      throw std::runtime_error(std::string("Can't mount ") + variant.name);
+    }
+  };
+
+  mount_fs();
+  auto started = Clock::now();
+  WriteFile(target + "/big", kBigFileMib * kBlockSize, block);
+  umount2(target.c_str(), 0);
+  const std::chrono::duration<double> big = Clock::now() - started;
+
+  mount_fs();
+  started = Clock::now();
+  for (size_t i = 0; i < kSmallFiles; ++i) {
+    WriteFile(target + "/small" + std::to_string(i), kSmallFileSize, block);
+  }
+  umount2(target.c_str(), 0);
+  const std::chrono::duration<double> small = Clock::now() - started;
+  return {static_cast<double>(kBigFileMib) / big.count(),
+          static_cast<double>(kSmallFiles) / small.count()};
+}
+
+} // namespace
+
+TEST_CASE("Copy throughput of the vfat and exfat profiles", "[!benchmark]") {
+  if (geteuid() != 0) {
+    WARN("Needs root for the loop device, nothing to measure");
+    return;
+  }
+  std::filesystem::create_directories(kRoot);
+  const std::string image = std::string(kRoot) + "/disk.img";
+  const std::vector<Variant> variants{
+      {"vfat, built-in (flush)", "vfat", ""},
+      {"vfat, -flush", "vfat", "-flush"},
+      {"vfat, noatime,lazytime,-flush", "vfat", "noatime,lazytime,-flush"},
+      {"exfat, built-in", "exfat", ""},
+      {"exfat, noatime,lazytime,iocharset=utf8", "exfat",
+       "noatime,lazytime,iocharset=utf8"}};
+  for (const auto &variant : variants) {
+    const std::string mkfs = std::string("mkfs.") + variant.fs;
+    if (std::system(("truncate -s " + std::to_string(kImageMib) + "M " +
+                     image + " && " + mkfs + " " + image + " >/dev/null 2>&1")
+                        .c_str()) != 0) {
+      WARN(mkfs << " failed, " << variant.name << " is skipped");
+      continue;
+    }
+    const LoopDevice loop(image);
+    const auto res = Copy(loop.device(), variant);
+    WARN(variant.name << ": " << res.first << " MiB/s sequential, "
+                      << res.second << " small files/s");
+    std::filesystem::remove(image);
+  }
+  std::filesystem::remove_all("/tmp/alt-usb-mount-bench");
+}
@@ -0,0 +1,83 @@
+/* File: bench_mount_table.cpp
+
+  Copyright (C)   2024
+  Author: Oleg Proskurin, <proskurinov@basealt.ru>
+
+  This program is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with this program; if not, see <https://www.gnu.org/licenses/>.
+
+*/
+
+/*
+ * Mount lookup by the source device: the former getmntent_r scan of
+ * /etc/mtab vs the MountTable snapshot. The scan cost grows with the number
+ * of mounts (containers, snaps); the snapshot is parsed only after a change,
+ * so between changes a lookup is a poll(2) and a hash lookup.
+ */
+
+#include "mount_table.hpp"
+#include <catch2/catch.hpp>
+#include <cstdio>
+#include <fstream>
+#include <iterator>
+#include <memory>
+#include <mntent.h>
+#include <string>
+#include <vector>
+
+namespace {
+
+/// @brief The former UnMount lookup
+std::string ScanMtab(const std::string &source) {
+  FILE *p_file = setmntent("/etc/mtab", "r");
+  if (p_file == nullptr) {
+    return {};
+  }
+  std::string res;
+  mntent entry{};
+  std::vector<char> buff(BUFSIZ);
+  while (getmntent_r(p_file, &entry, buff.data(),
+                     static_cast<int>(buff.size())) != nullptr) {
+    if (source == entry.mnt_fsname) {
+      res = entry.mnt_dir;
+      break;
+    }
+  }
+  endmntent(p_file);
+  return res;
+}
+
+} // namespace
+
+TEST_CASE("Mount lookup: mtab scan vs MountTable", "[!benchmark]") {
+  usbmount::MountTable table;
+  const auto snapshot = table.Get();
+  REQUIRE_FALSE(snapshot->mounts().empty());
+  // the last mount is the worst case for the scan
+  const std::string source(snapshot->mounts().back().source);
+  REQUIRE(ScanMtab(source) == snapshot->FindBySource(source)->mount_point);
+
+  BENCHMARK("getmntent_r, " + std::to_string(snapshot->mounts().size()) +
+            " mounts") {
+    return ScanMtab(source);
+  };
+  BENCHMARK("MountTable::Get + FindBySource") {
+    return table.Get()->FindBySource(source) != nullptr;
+  };
+  std::ifstream file("/proc/self/mountinfo");
+  const std::string content((std::istreambuf_iterator<char>(file)),
+                            std::istreambuf_iterator<char>());
+  BENCHMARK("MountTableSnapshot parse, once per change") {
+    return std::make_shared<const usbmount::MountTableSnapshot>(content);
+  };
+}
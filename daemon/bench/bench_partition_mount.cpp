@@ -0,0 +1,189 @@
+/* File: bench_partition_mount.cpp
+
+  Copyright (C)   2024
+  Author: Oleg Proskurin, <proskurinov@basealt.ru>
+
+  This program is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with this program; if not, see <https://www.gnu.org/licenses/>.
+
+*/
+
+/*
+ * Time until the last partition of a disk is mounted: the partitions one
+ * after another, as the udev thread did, vs PartitionMounter. Each mount
+ * prepares the base directory with the compiled ACL and creates the endpoint
+ * as CustomMount does; with the pool the base directory is prepared once per
+ * disk. The fixture is a loop device with kPartitions vfat partitions, it
+ * needs root, losetup, sfdisk and mkfs.vfat.
+ */
+
+#include "acl_template.hpp"
+#include "partition_mounter.hpp"
+#include <catch2/catch.hpp>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <memory>
+#include <mutex>
+#include <spdlog/logger.h>
+#include <stdexcept>
+#include <string>
+#include <sys/mount.h>
+#include <unistd.h>
+#include <vector>
+
+namespace {
+
+constexpr size_t kPartitions = 4;
+constexpr size_t kRounds = 20;
+constexpr const char *kRoot = "/tmp/alt-usb-mount-bench/partitions";
+
+/// @brief A loop device with vfat partitions, detached on destruction
+class LoopDisk {
+public:
+  LoopDisk(const LoopDisk &) = delete;
+  LoopDisk(LoopDisk &&) = delete;
+  LoopDisk &operator=(const LoopDisk &) = delete;
+  LoopDisk &operator=(LoopDisk &&) = delete;
+
+  LoopDisk() {
+    const std::string image = std::string(kRoot) + "/disk.img";
+    std::string layout = "label: dos\\n";
+    for (size_t i = 0; i < kPartitions; ++i) {
+      layout += ",32M\\n";
+    }
+    if (std::system(("truncate -s " + std::to_string(kPartitions * 32 + 1) +
+                     "M " + image + " && printf '" + layout +
+                     "' | sfdisk -q " + image)
+                        .c_str()) != 0) {
+      throw std::runtime_error("Can't create the disk image");
+    }
+    FILE *pipe = popen(("losetup --find --show --partscan " + image).c_str(),
+                       "r");
+    if (pipe == nullptr) {
+      throw std::runtime_error("Can't run losetup");
+    }
+    std::vector<char> buf(64, 0);
+    if (fgets(buf.data(), static_cast<int>(buf.size()), pipe) != nullptr) {
+      device_ = buf.data();
+    }
+    pclose(pipe);
+    while (!device_.empty() && device_.back() == '\n') {
+      device_.pop_back();
+    }
+    if (device_.empty()) {
+      throw std::runtime_error("Can't attach the loop device");
+    }
+    for (size_t i = 1; i <= kPartitions; ++i) {
+      partitions_.push_back(device_ + 'p' + std::to_string(i));
+      if (std::system(("udevadm settle; mkfs.vfat " + partitions_.back() +
+                       " >/dev/null")
+                          .c_str()) != 0) {
+        throw std::runtime_error("Can't format " + partitions_.back());
+      }
+    }
+  }
+
+  ~LoopDisk() {
+    static_cast<void>(std::system(("losetup -d " + device_).c_str()));
+  }
+
+  const std::vector<std::string> &partitions() const noexcept {
+    return partitions_;
+  }
+
+private:
+  std::string device_;
+  std::vector<std::string> partitions_;
+};
+
+/// @brief The base directory and the mount of one partition
+void MountPartition(usbmount::DiskContext &context,
+                    const usbmount::AclTemplate &acl, const std::string &block,
+                    size_t index) {
+  std::call_once(context.base_dir_once, [&context, &acl] {
+    const std::string base = std::string(kRoot) + "/user_group";
+    std::filesystem::create_directories(base);
+    acl.Apply(base);
+    context.base_dir = base;
+  });
+  const std::string endpoint =
+      context.base_dir.value() + "/PART" + std::to_string(index);
+  std::filesystem::create_directory(endpoint);
+  if (mount(block.c_str(), endpoint.c_str(), "vfat",
+            MS_NOSUID | MS_NODEV | MS_RELATIME, "uid=1000,gid=100") != 0) {
+    throw std::runtime_error("Can't mount " + block);
+  }
+}
+
+void UnmountAll() {
+  const std::string base = std::string(kRoot) + "/user_group";
+  for (size_t i = 0; i < kPartitions; ++i) {
+    umount2((base + "/PART" + std::to_string(i)).c_str(), 0);
+  }
+  std::filesystem::remove_all(base);
+}
+
+} // namespace
+
+TEST_CASE("Partitions of a disk: one by one vs PartitionMounter",
+          "[!benchmark]") {
+  if (geteuid() != 0) {
+    WARN("Needs root for the loop device, nothing to measure");
+    return;
+  }
+  std::filesystem::create_directories(kRoot);
+  const LoopDisk disk;
+  const auto acl = usbmount::AclTemplate::Compile(1, {1000}, {100});
+  using Clock = std::chrono::steady_clock;
+
+  Clock::duration serial{};
+  for (size_t round = 0; round < kRounds; ++round) {
+    const auto started = Clock::now();
+    // a context per partition - each event looked everything up again
+    for (size_t i = 0; i < kPartitions; ++i) {
+      usbmount::DiskContext context;
+      MountPartition(context, *acl, disk.partitions()[i], i);
+    }
+    serial += Clock::now() - started;
+    UnmountAll();
+  }
+
+  auto logger = std::make_shared<spdlog::logger>("bench");
+  usbmount::PartitionMounter mounter(kPartitions, logger);
+  Clock::duration parallel{};
+  for (size_t round = 0; round < kRounds; ++round) {
+    const auto started = Clock::now();
+    for (size_t i = 0; i < kPartitions; ++i) {
+      const std::string &block = disk.partitions()[i];
+      REQUIRE(mounter.Submit(
+          "loop", block,
+          [&acl, &block, i](const std::shared_ptr<usbmount::DiskContext> &ctx) {
+            MountPartition(*ctx, *acl, block, i);
+          }));
+    }
+    mounter.Wait();
+    parallel += Clock::now() - started;
+    UnmountAll();
+  }
+  using std::chrono::microseconds;
+  const auto serial_us =
+      std::chrono::duration_cast<microseconds>(serial).count() / kRounds;
+  const auto parallel_us =
+      std::chrono::duration_cast<microseconds>(parallel).count() / kRounds;
+  WARN("Last of " << kPartitions << " partitions mounted, one by one: "
+                  << serial_us << " us, PartitionMounter: " << parallel_us
+                  << " us");
+  std::filesystem::remove_all("/tmp/alt-usb-mount-bench");
+}
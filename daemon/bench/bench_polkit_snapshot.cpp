@@ -0,0 +1,151 @@
+/* File: bench_polkit_snapshot.cpp
+
+  Copyright (C)   2024
+  Author: Oleg Proskurin, <proskurinov@basealt.ru>
+
+  This program is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with this program; if not, see <https://www.gnu.org/licenses/>.
+
+*/
+
+/*
+ * The polkit helper answer: DBus (system bus connection, proxy, blocking
+ * CanUserMount call) vs the mapped snapshot (open, mmap, hashed lookup, stat).
+ * The spawn benchmarks run the built altusbmount_askdbus. Spawn-to-answer of
+ * the snapshot path is the spawn without params plus the snapshot answer. The
+ * DBus benchmarks are skipped if ru.alterator.usbd is not running.
+ */
+
+#include "polkit_snapshot.hpp"
+#include "polkit_snapshot_writer.hpp"
+#include <catch2/catch.hpp>
+#include <cstddef>
+#include <exception>
+#include <fcntl.h>
+#include <memory>
+#include <optional>
+#include <sdbus-c++/IConnection.h>
+#include <sdbus-c++/IProxy.h>
+#include <sdbus-c++/Types.h>
+#include <sdbus-c++/sdbus-c++.h>
+#include <spawn.h>
+#include <spdlog/logger.h>
+#include <string>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <vector>
+
+// NOLINTNEXTLINE
+extern char **environ;
+
+namespace {
+
+namespace polkit = common_utils::polkit;
+
+constexpr size_t kEntries = 64;
+const char *const kSnapshot = "/tmp/alt-usb-mount-bench/polkit.snapshot";
+
+std::optional<std::string> AskDbus(const std::string &dev) {
+  try {
+    auto proxy = sdbus::createProxy(sdbus::ServiceName{"ru.alterator.usbd"},
+                                    sdbus::ObjectPath{"/ru/alterator/altusbd"});
+    auto method = proxy->createMethodCall(
+        sdbus::InterfaceName{"ru.alterator.Usbd"},
+        sdbus::MethodName{"CanUserMount"});
+    method << dev;
+    auto reply = proxy->callMethod(method);
+    std::string res;
+    reply >> res;
+    return res;
+  } catch (const std::exception &) {
+    return std::nullopt;
+  }
+}
+
+#ifdef ASKDBUS_PATH
+int Spawn(std::vector<std::string> args) {
+  std::vector<char *> argv;
+  argv.reserve(args.size() + 1);
+  for (auto &arg : args) {
+    argv.push_back(arg.data());
+  }
+  argv.push_back(nullptr);
+  posix_spawn_file_actions_t actions;
+  posix_spawn_file_actions_init(&actions);
+  posix_spawn_file_actions_addopen(&actions, STDOUT_FILENO, "/dev/null",
+                                   O_WRONLY, 0);
+  pid_t pid = 0;
+  int status = -1;
+  if (posix_spawn(&pid, ASKDBUS_PATH, &actions, nullptr, argv.data(),
+                  environ) == 0) {
+    waitpid(pid, &status, 0);
+  }
+  posix_spawn_file_actions_destroy(&actions);
+  return status;
+}
+#endif
+
+} // namespace
+
+TEST_CASE("Polkit helper: DBus vs snapshot", "[!benchmark]") {
+  const auto logger = std::make_shared<spdlog::logger>("bench_polkit");
+  // a block device, so the whole check is done
+  std::string block = "/dev/sda";
+  struct stat info {};
+  for (const char *name : {"/dev/sda", "/dev/vda", "/dev/nvme0n1",
+                           "/dev/zram0", "/dev/loop0"}) {
+    if (stat(name, &info) == 0 && S_ISBLK(info.st_mode)) {
+      block = name;
+      break;
+    }
+  }
+  std::vector<polkit::Entry> entries;
+  for (size_t i = 0; i < kEntries; ++i) {
+    polkit::Entry entry{};
+    const std::string name = "/dev/sd" + std::to_string(i);
+    name.copy(entry.block, sizeof(entry.block));
+    entry.flags = polkit::kKnownDevice;
+    entries.push_back(entry);
+  }
+  auto own = polkit::MakeEntry(block, polkit::kKnownDevice);
+  if (own) {
+    entries.push_back(own.value());
+  }
+  usbmount::PolkitSnapshotWriter writer(kSnapshot);
+  REQUIRE(writer.Publish(entries, logger));
+  // the snapshot must be owned by root, otherwise the lookup is measured
+  if (geteuid() == 0) {
+    REQUIRE(polkit::Answer(kSnapshot, block, "mount") == "YES");
+  }
+
+  BENCHMARK("snapshot: open, mmap, lookup, stat") {
+    return polkit::Answer(kSnapshot, block, "mount");
+  };
+
+  if (AskDbus(block)) {
+    BENCHMARK("dbus: connect, call CanUserMount") { return AskDbus(block); };
+  } else {
+    WARN("ru.alterator.usbd is not running, DBus is not measured");
+  }
+
+#ifdef ASKDBUS_PATH
+  BENCHMARK("spawn: helper without params") {
+    return Spawn({ASKDBUS_PATH});
+  };
+  // not in the snapshot - the daemon is asked
+  BENCHMARK("spawn: helper, DBus path") {
+    return Spawn({ASKDBUS_PATH, "/dev/not-published", "mount"});
+  };
+#endif
+}
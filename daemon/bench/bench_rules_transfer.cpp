@@ -0,0 +1,116 @@
+/* File: bench_rules_transfer.cpp
+
+  Copyright (C)   2024
+  Author: Oleg Proskurin, <proskurinov@basealt.ru>
+
+  This program is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with this program; if not, see <https://www.gnu.org/licenses/>.
+
+*/
+
+/*
+ * ImportRules and ExportRules with 100k rules through a file descriptor.
+ * Every rule is validated against 1000 local users and 100 groups.
+ */
+
+#include "dal/device_permissions.hpp"
+#include "rules_transfer.hpp"
+#include "system_accounts.hpp"
+#include <catch2/catch.hpp>
+#include <cstddef>
+#include <cstdint>
+#include <fcntl.h>
+#include <filesystem>
+#include <fstream>
+#include <memory>
+#include <spdlog/logger.h>
+#include <string>
+#include <unistd.h>
+
+namespace {
+
+using namespace usbmount;
+
+constexpr size_t kRulesNumber = 100000;
+constexpr size_t kUsers = 1000;
+constexpr size_t kGroups = 100;
+const char *const kDir = "/tmp/alt-usb-mount-bench/transfer";
+
+SystemAccounts::Paths WriteAccounts() {
+  SystemAccounts::Paths paths{
+      std::string(kDir) + "/login.defs", std::string(kDir) + "/shells",
+      std::string(kDir) + "/passwd", std::string(kDir) + "/group"};
+  std::ofstream(paths.login_defs)
+      << "UID_MIN 1000\nUID_MAX 60000\nGID_MIN 1000\nGID_MAX 60000\n";
+  std::ofstream(paths.shells) << "/bin/bash\n";
+  std::ofstream passwd(paths.passwd);
+  for (size_t i = 0; i < kUsers; ++i) {
+    passwd << "user" << i << ":x:" << 1000 + i << ":1000::/home/user" << i
+           << ":/bin/bash\n";
+  }
+  std::ofstream group(paths.group);
+  for (size_t i = 0; i < kGroups; ++i) {
+    group << "group" << i << ":x:" << 1000 + i << ":\n";
+  }
+  return paths;
+}
+
+std::string WriteRules() {
+  const std::string path = std::string(kDir) + "/rules.jsonl";
+  std::ofstream rules(path);
+  for (size_t i = 0; i < kRulesNumber; ++i) {
+    rules << R"({"vid":"0781","pid":"5567","serial":"4C53)" << i
+          << R"(","users":["user)" << i % kUsers << R"("],"groups":["group)"
+          << i % kGroups << "\"]}\n";
+  }
+  return path;
+}
+
+} // namespace
+
+TEST_CASE("Rules transfer: 100k rules", "[!benchmark]") {
+  std::filesystem::create_directories(kDir);
+  const auto logger = std::make_shared<spdlog::logger>("bench_transfer");
+  SystemAccounts accounts(WriteAccounts());
+  const std::string rules_path = WriteRules();
+  const std::string table = std::string(kDir) + "/permissions.json";
+  std::filesystem::remove(table);
+  dal::DevicePermissions permissions(table);
+
+  BENCHMARK("import, replace") {
+    RulesTransfer transfer(permissions, accounts, logger);
+    const int fd = open(rules_path.c_str(), O_RDONLY | O_CLOEXEC);
+    const auto res = transfer.Import(fd, RulesTransfer::Mode::kReplace);
+    close(fd);
+    return res.created;
+  };
+  REQUIRE(permissions.getAll().size() == kRulesNumber);
+
+  BENCHMARK("import, merge of known devices") {
+    RulesTransfer transfer(permissions, accounts, logger);
+    const int fd = open(rules_path.c_str(), O_RDONLY | O_CLOEXEC);
+    const auto res = transfer.Import(fd, RulesTransfer::Mode::kMerge);
+    close(fd);
+    return res.skipped;
+  };
+
+  const std::string export_path = std::string(kDir) + "/export.jsonl";
+  BENCHMARK("export") {
+    const RulesTransfer transfer(permissions, accounts, logger);
+    const int fd = open(export_path.c_str(),
+                        O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+    const uint64_t res = transfer.Export(fd);
+    close(fd);
+    return res;
+  };
+}
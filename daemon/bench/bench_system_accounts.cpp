@@ -0,0 +1,111 @@
+/* File: bench_system_accounts.cpp
+
+  Copyright (C)   2024
+  Author: Oleg Proskurin, <proskurinov@basealt.ru>
+
+  This program is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with this program; if not, see <https://www.gnu.org/licenses/>.
+
+*/
+
+/*
+ * Users and groups for a DBus call: parsing login.defs, shells, passwd and
+ * group on every call (as GetUsersAndGroups, CreateRules and UpdateRules did)
+ * vs the cached SystemAccounts snapshot. passwd has 50k lines.
+ */
+
+#include "dal/dto.hpp"
+#include "system_accounts.hpp"
+#include "utils.hpp"
+#include <algorithm>
+#include <catch2/catch.hpp>
+#include <cstddef>
+#include <filesystem>
+#include <fstream>
+#include <memory>
+#include <spdlog/logger.h>
+#include <string>
+
+namespace {
+
+using namespace usbmount;
+
+constexpr size_t kPasswdLines = 50000;
+constexpr size_t kGroupLines = 5000;
+const char *const kDir = "/tmp/alt-usb-mount-bench/accounts";
+
+SystemAccounts::Paths WriteAccounts() {
+  namespace fs = std::filesystem;
+  fs::create_directories(kDir);
+  SystemAccounts::Paths paths{
+      std::string(kDir) + "/login.defs", std::string(kDir) + "/shells",
+      std::string(kDir) + "/passwd", std::string(kDir) + "/group"};
+  std::ofstream(paths.login_defs) << "# login.defs\n"
+                                  << "UID_MIN\t\t\t 1000\n"
+                                  << "UID_MAX\t\t\t 60000\n"
+                                  << "GID_MIN\t\t\t 1000\n"
+                                  << "GID_MAX\t\t\t 60000\n";
+  std::ofstream(paths.shells) << "/bin/sh\n/bin/bash\n";
+  std::ofstream passwd(paths.passwd);
+  for (size_t i = 0; i < kPasswdLines; ++i) {
+    // every 5th account is a system one
+    const bool system = i % 5 == 0;
+    passwd << "user" << i << ":x:" << (system ? i % 1000 : 1000 + i % 59000)
+           << ':' << 1000 + i % kGroupLines << ":User " << i << ":/home/user"
+           << i << ':' << (system ? "/dev/null" : "/bin/bash") << '\n';
+  }
+  std::ofstream group(paths.group);
+  for (size_t i = 0; i < kGroupLines; ++i) {
+    group << "group" << i << ":x:" << 1000 + i << ":user" << i << '\n';
+  }
+  return paths;
+}
+
+} // namespace
+
+TEST_CASE("Users and groups: parse vs cached snapshot", "[!benchmark]") {
+  const auto paths = WriteAccounts();
+  const auto logger = std::make_shared<spdlog::logger>("bench_accounts");
+  SystemAccounts accounts(paths);
+  const auto snapshot = accounts.Snapshot(logger);
+  REQUIRE(snapshot->users.size() == kPasswdLines / 5 * 4);
+  REQUIRE(snapshot->groups.size() == kGroupLines);
+
+  BENCHMARK("parse files") {
+    const auto id_limits =
+        utils::GetSystemUidMinMax(logger, paths.login_defs);
+    auto users =
+        utils::GetHumanUsers(id_limits.value(), logger,
+                             utils::GetPossibleShells(logger, paths.shells),
+                             paths.passwd);
+    auto groups =
+        utils::GetHumanGroups(id_limits.value(), logger, paths.group);
+    return users.size() + groups.size();
+  };
+  BENCHMARK("cached snapshot") {
+    const auto res = accounts.Snapshot(logger);
+    return res->users.size() + res->groups.size();
+  };
+
+  const std::string name = "user" + std::to_string(kPasswdLines - 1);
+  BENCHMARK("find user: linear") {
+    return std::find_if(snapshot->users.cbegin(), snapshot->users.cend(),
+                        [&name](const dal::User &usr) {
+                          return usr.name() == name;
+                        }) != snapshot->users.cend();
+  };
+  BENCHMARK("find user: index") {
+    return snapshot->FindUser(name) != nullptr;
+  };
+  REQUIRE(accounts.Snapshot(logger)->generation == snapshot->generation);
+}
@@ -0,0 +1,194 @@
+/* File: bench_udev_device.cpp
+
+  Copyright (C)   2024
+  Author: Oleg Proskurin, <proskurinov@basealt.ru>
+
+  This program is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with this program; if not, see <https://www.gnu.org/licenses/>.
+
+*/
+
+/*
+ * The device record on the decision path: the former eleven std::string
+ * layout vs the packed UsbUdevDevice. Both are filled from the same recorded
+ * properties and go the ApplyMountRulesIfNotMounted way: a vector of devices,
+ * a shared_ptr per device (a copy before, a move now) and a debug string.
+ * Allocations are counted with alloc_counter, RSS is read from
+ * /proc/self/statm for kResident devices kept alive.
+ */
+
+#include "alloc_counter.hpp"
+#include "usb_udev_device.hpp"
+#include <catch2/catch.hpp>
+#include <cstddef>
+#include <cstdio>
+#include <fstream>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <type_traits>
+#include <unistd.h>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+namespace {
+
+using usbmount::Action;
+using usbmount::UsbUdevDevice;
+using Properties = std::unordered_map<std::string, std::string>;
+
+constexpr size_t kDevices = 32;
+constexpr size_t kResident = 100000;
+
+/// @brief UsbUdevDevice before the packed layout
+struct LegacyDevice {
+  explicit LegacyDevice(const Properties &properties) {
+    auto get = [&properties](const char *key) {
+      auto it_value = properties.find(key);
+      return it_value != properties.end() ? it_value->second : std::string();
+    };
+    subsystem = get("SUBSYSTEM");
+    id_bus = get("ID_BUS");
+    block_name = get("DEVNAME");
+    fs_label = get("ID_FS_LABEL");
+    uid = get("ID_FS_UUID");
+    filesystem = get("ID_FS_TYPE");
+    dev_type = get("DEVTYPE");
+    partitions_number = std::stoi(get("ID_PART_ENTRY_NUMBER"));
+    vid = get("ID_VENDOR_ID");
+    pid = get("ID_MODEL_ID");
+    serial = get("ID_SERIAL_SHORT");
+  }
+
+  std::string toString() const {
+    std::stringstream res;
+    res << "Action: add block_name: " << block_name << " fs_label: "
+        << fs_label << " fs_uid: " << uid << " file_system: " << filesystem
+        << " device_type:" << dev_type << " partition number "
+        << std::to_string(partitions_number) << " vid " << vid << " pid "
+        << pid << " subsystem " << subsystem << " serial " << serial;
+    return res.str();
+  }
+
+  Action action = Action::kAdd;
+  std::string subsystem;
+  std::string block_name;
+  std::string id_bus;
+  std::string fs_label;
+  std::string uid;
+  std::string filesystem;
+  std::string dev_type;
+  int partitions_number = 0;
+  std::string vid;
+  std::string pid;
+  std::string serial;
+};
+
+Properties Flash(size_t index) {
+  return {{"SUBSYSTEM", "block"},
+          {"ID_BUS", "usb"},
+          {"DEVNAME", "/dev/sd" + std::to_string(index) + "1"},
+          {"DEVTYPE", "partition"},
+          {"ID_FS_TYPE", "exfat"},
+          {"ID_FS_LABEL", "TRANSCEND"},
+          {"ID_FS_UUID", "6F3A-91C2"},
+          {"ID_PART_ENTRY_NUMBER", "1"},
+          {"ID_VENDOR_ID", "0781"},
+          {"ID_MODEL_ID", "5567"},
+          {"ID_SERIAL_SHORT", "4C5300012309181" + std::to_string(index)}};
+}
+
+size_t ResidentBytes() {
+  std::ifstream statm("/proc/self/statm");
+  size_t size = 0;
+  size_t resident = 0;
+  statm >> size >> resident;
+  return resident * static_cast<size_t>(sysconf(_SC_PAGESIZE));
+}
+
+template <typename Device>
+size_t DecisionPath(const std::vector<Properties> &all) {
+  std::vector<Device> devices;
+  for (const auto &properties : all) {
+    if constexpr (std::is_same_v<Device, LegacyDevice>) {
+      devices.emplace_back(properties);
+    } else {
+      devices.emplace_back(Action::kAdd, properties);
+    }
+  }
+  size_t res = 0;
+  for (auto &dev : devices) {
+    std::shared_ptr<Device> device;
+    if constexpr (std::is_same_v<Device, LegacyDevice>) {
+      device = std::make_shared<Device>(dev);
+    } else {
+      device = std::make_shared<Device>(std::move(dev));
+    }
+    res += device->toString().size();
+  }
+  return res;
+}
+
+template <typename Device>
+size_t CountAllocations(const std::vector<Properties> &all) {
+  g_allocations = 0;
+  g_count_allocations = true;
+  DecisionPath<Device>(all);
+  g_count_allocations = false;
+  return g_allocations.load();
+}
+
+template <typename Device> size_t ResidentPerDevice() {
+  const Properties properties = Flash(7);
+  const size_t before = ResidentBytes();
+  std::vector<Device> devices;
+  devices.reserve(kResident);
+  for (size_t i = 0; i < kResident; ++i) {
+    if constexpr (std::is_same_v<Device, LegacyDevice>) {
+      devices.emplace_back(properties);
+    } else {
+      devices.emplace_back(Action::kAdd, properties);
+    }
+  }
+  return (ResidentBytes() - before) / kResident;
+}
+
+} // namespace
+
+TEST_CASE("Udev device record", "[!benchmark]") {
+  std::vector<Properties> all;
+  for (size_t i = 0; i < kDevices; ++i) {
+    all.push_back(Flash(i));
+  }
+  REQUIRE(DecisionPath<LegacyDevice>(all) > 0);
+  REQUIRE(DecisionPath<UsbUdevDevice>(all) > 0);
+
+  BENCHMARK("former: 11 strings, copy, stringstream") {
+    return DecisionPath<LegacyDevice>(all);
+  };
+  BENCHMARK("packed: one buffer, move, fmt") {
+    return DecisionPath<UsbUdevDevice>(all);
+  };
+
+  const size_t legacy_allocations = CountAllocations<LegacyDevice>(all);
+  const size_t packed_allocations = CountAllocations<UsbUdevDevice>(all);
+  std::printf("sizeof: former %zu, packed %zu\n", sizeof(LegacyDevice),
+              sizeof(UsbUdevDevice));
+  std::printf("allocations per device: former %zu, packed %zu\n",
+              legacy_allocations / kDevices, packed_allocations / kDevices);
+  std::printf("RSS per resident device: former %zu, packed %zu bytes\n",
+              ResidentPerDevice<LegacyDevice>(),
+              ResidentPerDevice<UsbUdevDevice>());
+  REQUIRE(packed_allocations < legacy_allocations);
+}
@@ -0,0 +1,131 @@
+/* File: bench_udev_lookup.cpp
+
+  Copyright (C)   2024
+  Author: Oleg Proskurin, <proskurinov@basealt.ru>
+
+  This program is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with this program; if not, see <https://www.gnu.org/licenses/>.
+
+*/
+
+/*
+ * udev device of a block device: the former enumeration of all block devices
+ * vs the devnum lookup. The enumeration cost grows with the number of block
+ * devices, run as root with 30+ of them attached, e.g.
+ *   for i in $(seq 40); do truncate -s 1M /tmp/l$i; losetup -f /tmp/l$i; done
+ * Neither the loop devices nor the usual disks are on USB, so the USB filter
+ * is not applied here. Both variants look up the same devnode.
+ */
+
+#include "usb_udev_device.hpp"
+#include "utils.hpp"
+#include <catch2/catch.hpp>
+#include <cstddef>
+#include <cstring>
+#include <filesystem>
+#include <libudev.h>
+#include <memory>
+#include <string>
+#include <sys/stat.h>
+#include <vector>
+
+namespace {
+
+using usbmount::UdevDeviceFree;
+using usbmount::UniquePtrUdevDeviceStruct;
+
+constexpr size_t kRecommendedDevices = 30;
+
+/// @brief The former FindUdevDeviceByBlockName without the USB filter
+UniquePtrUdevDeviceStruct EnumerateFind(const std::string &block_name) {
+  using usbmount::utils::udev::UdevEnumerateFree;
+  const std::unique_ptr<udev, decltype(&udev_unref)> udev{udev_new(),
+                                                          udev_unref};
+  const std::unique_ptr<udev_enumerate, decltype(&UdevEnumerateFree)> enumerate{
+      udev_enumerate_new(udev.get()), UdevEnumerateFree};
+  udev_enumerate_add_match_subsystem(enumerate.get(), "block");
+  udev_enumerate_scan_devices(enumerate.get());
+  for (udev_list_entry *entry = udev_enumerate_get_list_entry(enumerate.get());
+       entry != nullptr; entry = udev_list_entry_get_next(entry)) {
+    UniquePtrUdevDeviceStruct device(
+        udev_device_new_from_syspath(udev.get(),
+                                     udev_list_entry_get_name(entry)),
+        UdevDeviceFree);
+    if (!device) {
+      continue;
+    }
+    const char *devnode = udev_device_get_devnode(device.get());
+    if (devnode != nullptr && block_name == devnode) {
+      return device;
+    }
+  }
+  return {nullptr, UdevDeviceFree};
+}
+
+/// @brief The devnum lookup without the USB filter
+UniquePtrUdevDeviceStruct DevnumFind(udev *ctx, const std::string &block_name) {
+  struct stat info {};
+  if (stat(block_name.c_str(), &info) != 0 || !S_ISBLK(info.st_mode)) {
+    return {nullptr, UdevDeviceFree};
+  }
+  return {udev_device_new_from_devnum(ctx, 'b', info.st_rdev), UdevDeviceFree};
+}
+
+std::vector<std::string> BlockDevices() {
+  std::vector<std::string> res;
+  std::error_code err;
+  for (const auto &entry :
+       std::filesystem::directory_iterator("/sys/class/block", err)) {
+    const std::string devnode = "/dev/" + entry.path().filename().string();
+    struct stat info {};
+    if (stat(devnode.c_str(), &info) == 0 && S_ISBLK(info.st_mode)) {
+      res.push_back(devnode);
+    }
+  }
+  return res;
+}
+
+} // namespace
+
+TEST_CASE("Udev lookup: enumeration vs devnum", "[!benchmark]") {
+  const auto devices = BlockDevices();
+  if (devices.empty()) {
+    WARN("No block devices, nothing to measure");
+    return;
+  }
+  if (devices.size() < kRecommendedDevices) {
+    WARN("Only " << devices.size() << " block devices, attach "
+                 << kRecommendedDevices << "+ loop devices");
+  }
+  // the last one enumerated is the worst case for the scan
+  const std::string &block = devices.back();
+  const std::unique_ptr<udev, decltype(&udev_unref)> ctx{udev_new(),
+                                                         udev_unref};
+  REQUIRE(ctx);
+  REQUIRE(EnumerateFind(block));
+  REQUIRE(DevnumFind(ctx.get(), block));
+  REQUIRE(std::strcmp(udev_device_get_devnode(
+                          DevnumFind(ctx.get(), block).get()),
+                      block.c_str()) == 0);
+
+  BENCHMARK("enumeration, " + std::to_string(devices.size()) + " devices") {
+    return EnumerateFind(block);
+  };
+  BENCHMARK("devnum, shared udev context") {
+    return DevnumFind(ctx.get(), block);
+  };
+  // with the USB filter, nullptr for a non-USB device
+  BENCHMARK("UsbUdevDevice::FindUdevDeviceByBlockName") {
+    return usbmount::UsbUdevDevice::FindUdevDeviceByBlockName(block);
+  };
+}
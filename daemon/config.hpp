@@ -21,4 +21,20 @@
 #pragma once
 
 // #define BASE_MOUNT_POINT
-constexpr const char *BASE_MOUNT_POINT = "/media/alt-usb-mount/";
\ No newline at end of file
+constexpr const char *BASE_MOUNT_POINT = "/media/alt-usb-mount/";
+// Prometheus textfile for node_exporter, rewritten every METRICS_INTERVAL_SEC
+constexpr const char *METRICS_TEXTFILE = "/run/alt-usb-mount/altusbd.prom";
+constexpr long METRICS_INTERVAL_SEC = 15;
+// Mount flags that worked last time, see MountModeCache
+constexpr const char *MOUNT_MODES_FILE =
+    "/var/lib/alt-usb-mount/mount_modes.json";
+// Mount options by filesystem type, see MountProfiles
+constexpr const char *MOUNT_PROFILES_FILE =
+    "/etc/alt-usb-mount/mount_profiles.json";
+// Block queue and BDI settings of permitted disks, see QueueTuning
+constexpr const char *QUEUE_TUNING_FILE =
+    "/etc/alt-usb-mount/queue_tuning.json";
+// Threads mounting the partitions of a disk in parallel, see PartitionMounter
+constexpr unsigned MOUNT_WORKERS = 4;
+// Seconds before a busy mount is detached (MNT_DETACH), see UnmountQueue
+constexpr long UNMOUNT_GRACE_SEC = 10;
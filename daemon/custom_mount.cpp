@@ -19,26 +19,35 @@
 */
 
 #include "custom_mount.hpp"
+#include "acl_template.hpp"
+#include "base_dir_cache.hpp"
 #include "dal/dto.hpp"
 #include "dal/local_storage.hpp"
+#include "metrics.hpp"
+#include "mount_mode_cache.hpp"
+#include "mount_profiles.hpp"
+#include "mount_table.hpp"
+#include "partition_mounter.hpp"
+#include "queue_tuning.hpp"
+#include "system_accounts.hpp"
+#include "unmount_queue.hpp"
+#include "usb_topology.hpp"
 #include "usb_udev_device.hpp"
 #include "utils.hpp"
-#include <acl/libacl.h>
+#include "watchdog.hpp"
 #include <cerrno>
 #include <cstdint>
-#include <cstdio>
-#include <cstring>
 #include <exception>
 #include <filesystem>
 #include <grp.h>
 #include <memory>
-#include <mntent.h>
+#include <mutex>
 #include <optional>
 #include <pwd.h>
 #include <spdlog/logger.h>
 #include <stdexcept>
 #include <string>
-#include <sys/acl.h>
+#include <string_view>
 #include <sys/mount.h>
 #include <sys/stat.h>
 #include <sys/types.h>
@@ -49,19 +58,25 @@
 namespace usbmount {
 
 CustomMount::CustomMount(std::shared_ptr<UsbUdevDevice> &ptr_device,
-                         const std::shared_ptr<spdlog::logger> &logger) noexcept
+                         const std::shared_ptr<spdlog::logger> &logger,
+                         EventHandler on_event,
+                         std::shared_ptr<DiskContext> context) noexcept
     : logger_(logger), ptr_device_{ptr_device},
-      dbase_(dal::LocalStorage::GetStorage()) {}
+      dbase_(dal::LocalStorage::GetStorage()), on_event_(std::move(on_event)),
+      context_(std::move(context)) {}
 
 bool CustomMount::Mount() noexcept {
-  // get permissions for this device
-  const dal::Device dto_device(
-      {ptr_device_->vid(), ptr_device_->pid(), ptr_device_->serial()});
-  auto db_index = dbase_->permissions.Find(dto_device);
-  if (!db_index.has_value()) {
+  if (!context_) {
+    context_ = std::make_shared<DiskContext>();
+  }
+  // get permissions for this device, the partitions have the same ones
+  std::call_once(context_->rule_once, [this] { FindRule(*context_); });
+  if (!context_->rule_index || !context_->rule) {
     return false;
   }
-  auto perms = dbase_->permissions.Read(db_index.value());
+  rules_generation_ = context_->rules_generation;
+  const uint64_t db_index = context_->rule_index.value();
+  const auto &perms = context_->rule.value();
   // for now, only one user and group is allowed, though db stores users and
   // groups as array
   const auto &users = perms.getUsers();
@@ -73,154 +88,140 @@ bool CustomMount::Mount() noexcept {
   }
   uid_ = users[0].uid();
   gid_ = groups[0].gid();
+  rule_mount_options_ = perms.getMountOptions();
+  // once per disk, before its filesystems are read
+  const auto path = UsbTopology::Parse(ptr_device_->devpath());
+  if (path) {
+    QueueTuning::Instance().Apply(path->disk, perms.getQueueTuning(), logger_);
+  }
   logger_->debug(ptr_device_->toString());
   if (ptr_device_->dev_type() == "disk" &&
       ptr_device_->filesystem() != "ntfs") {
     logger_->debug("Skipped with device type disk");
     return true;
   }
-  if (!CreateAclMountPoint()) {
+  try {
+    acl_template_ =
+        AclTemplates::Instance().Find(db_index, perms, rules_generation_);
+  } catch (const std::exception &ex) {
+    logger_->error("Can't compile the ACL for device {} {}",
+                   ptr_device_->block_name(), ex.what());
+    Notify(EventType::kMountFailed, "Can't create the ACL directory");
+    return false;
+  }
+  // prepared by the first partition of the disk
+  std::call_once(context_->base_dir_once, [this] {
+    if (CreateAclMountPoint()) {
+      context_->base_dir = base_mount_point_;
+    }
+  });
+  base_mount_point_ = context_->base_dir;
+  if (!base_mount_point_) {
+    Notify(EventType::kMountFailed, "Can't create the ACL directory");
     return false;
   }
   // create endpoint
   if (!CreateMountEndpoint()) {
+    Notify(EventType::kMountFailed, "Can't create the mount point");
     return false;
   }
   // mount and save to local storage
-  if (PerfomMount()) {
-    try {
-      const dal::MountEntry entry(dal::MountEntryParams(
-          {ptr_device_->block_name(), end_mount_point_.value_or(""),
-           ptr_device_->filesystem()}));
-      dbase_->mount_points.Create(entry);
-      logger_->info("Created mountpoint for {} in the db",
-                    ptr_device_->block_name());
-    } catch (const std::exception &ex) {
-      logger_->error("Can't  add {} device mountpoint to database",
-                     ptr_device_->block_name());
-    }
+  if (!PerfomMount()) {
+    Notify(EventType::kMountFailed, "mount failed");
+    return false;
   }
+  try {
+    const dal::MountEntry entry(dal::MountEntryParams(
+        {std::string(ptr_device_->block_name()), end_mount_point_.value_or(""),
+         std::string(ptr_device_->filesystem())}));
+    dbase_->mount_points.Create(entry);
+    logger_->info("Created mountpoint for {} in the db",
+                  ptr_device_->block_name());
+  } catch (const std::exception &ex) {
+    logger_->error("Can't  add {} device mountpoint to database",
+                   ptr_device_->block_name());
+  }
+  Notify(EventType::kMounted, end_mount_point_.value_or(""));
   return true;
 }
 
+void CustomMount::FindRule(DiskContext &context) const {
+  const dal::Device dto_device(
+      {ptr_device_->vid(), ptr_device_->pid(),
+       std::string(ptr_device_->serial())});
+  // read before the rule, as for AclTemplates::Compile
+  context.rules_generation = dbase_->permissions.generation();
+  context.rule_index = dbase_->permissions.Find(dto_device);
+  if (context.rule_index) {
+    context.rule = dbase_->permissions.Read(context.rule_index.value());
+  }
+}
+
 bool CustomMount::CreateAclMountPoint() noexcept {
+  // names from the cached accounts, NSS only for users not in the files
+  const auto accounts = SystemAccounts::Instance().Snapshot(logger_);
+  // prepared by a previous mount for this pair
+  auto &base_dirs = BaseDirCache::Instance();
+  const BaseDirCache::Generations generations{rules_generation_,
+                                              accounts->generation};
+  auto cached = base_dirs.Find(acl_template_->key, generations);
+  if (cached) {
+    logger_->debug("Base directory {} is unchanged", cached.value());
+    base_mount_point_ = std::move(cached);
+    return true;
+  }
   std::string mount_point = mount_root;
   // get user name
   std::optional<std::string> user_name;
-  passwd pwd{};
-  passwd *result_usr = nullptr;
-  std::vector<char> buf_usr;
-  buf_usr.reserve(1200);
-  std::memset(buf_usr.data(), 0, 1200);
-  if (getpwuid_r(uid_.value_or(0), &pwd, buf_usr.data(), 1200, &result_usr) ==
-          0 &&
-      result_usr != nullptr) {
-    user_name = pwd.pw_name;
-  }
-  // const passwd *pwd = getpwuid(uid_.value_or(0));
-  // if (pwd->pw_name != nullptr){
-  //   user_name = pwd->pw_name;
-  // }
+  const dal::User *cached_user = accounts->FindUser(uid_.value_or(0));
+  if (cached_user != nullptr) {
+    user_name = cached_user->name();
+  } else {
+    passwd pwd{};
+    passwd *result_usr = nullptr;
+    std::vector<char> buf_usr(kNssBufferSize, 0);
+    if (getpwuid_r(uid_.value_or(0), &pwd, buf_usr.data(), buf_usr.size(),
+                   &result_usr) == 0 &&
+        result_usr != nullptr) {
+      user_name = pwd.pw_name;
+    }
+  }
   mount_point += user_name.value_or(std::to_string(uid_.value_or(0)));
   mount_point += '_';
   // get group name
   std::optional<std::string> group_name;
-
-  group grp{};
-  group *result_grp = nullptr;
-  std::vector<char> buf_grp;
-  buf_grp.reserve(1200);
-  std::memset(buf_grp.data(), 0, 1200);
-  if (getgrgid_r(gid_.value_or(0), &grp, buf_grp.data(), 1200, &result_grp) ==
-          0 &&
-      result_grp != nullptr) {
-    group_name = grp.gr_name;
-  }
-  // const group *grp = getgrgid(gid_.value_or(0));
-  // if (grp->gr_name != nullptr){
-  //   group_name = grp->gr_name;
-  // }
+  const dal::Group *cached_group = accounts->FindGroup(gid_.value_or(0));
+  if (cached_group != nullptr) {
+    group_name = cached_group->name();
+  } else {
+    group grp{};
+    group *result_grp = nullptr;
+    std::vector<char> buf_grp(kNssBufferSize, 0);
+    if (getgrgid_r(gid_.value_or(0), &grp, buf_grp.data(), buf_grp.size(),
+                   &result_grp) == 0 &&
+        result_grp != nullptr) {
+      group_name = grp.gr_name;
+    }
+  }
   mount_point += group_name.value_or(std::to_string(gid_.value_or(0)));
+  // a directory per rule if the rule has more principals
+  mount_point += acl_template_->dir_suffix;
   // create acl dir if no exists
   try {
     std::filesystem::create_directories(mount_point);
-    if (chmod(mount_point.c_str(), 0750) != 0) {
-      throw std::runtime_error("Chmod 0750 failed");
-    }
-    // process ACL
-    SetAcl(mount_point);
-
+    // the compiled ACL sets the mode too (0750)
+    acl_template_->Apply(mount_point);
+    logger_->debug("ACL for {} successfully set", mount_point);
   } catch (const std::exception &ex) {
     logger_->error("Cant create mount point {}", mount_point);
     logger_->error(ex.what());
     return false;
   }
+  base_dirs.Put(acl_template_->key, generations, mount_point);
   base_mount_point_ = std::move(mount_point);
   return true;
 }
 
-void CustomMount::SetAcl(const std::string &mount_point) {
-  // read acl
-  acl_t acl = acl_get_file(mount_point.c_str(), ACL_TYPE_ACCESS);
-  acl_t acl_old = acl_get_file(mount_point.c_str(), ACL_TYPE_ACCESS);
-  if (acl == nullptr) {
-    throw std::runtime_error("Cant read ACL for mountpoint");
-  }
-  // delete all ACL_USER and ACL_GROUP
-  utils::acl::DeleteACLUserGroupMask(acl);
-  acl_entry_t entry{};
-  acl_permset_t permset{};
-  try {
-    // add ACL_USER
-    utils::acl::CreateUserAclEntry(acl, uid_.value_or(0));
-    // Add ACL_GROUP
-    utils::acl::CreateGroupAclEntry(acl, gid_.value_or(0));
-    // Add ACL_MASK
-    if (acl_create_entry(&acl, &entry) != 0) {
-      throw std::runtime_error("Can't create ACL entry for mask");
-    }
-    if (acl_get_permset(entry, &permset) != 0) {
-      throw std::runtime_error("acl_get_permset failed");
-    }
-    if (acl_add_perm(permset, ACL_READ | ACL_EXECUTE) != 0) {
-      throw std::runtime_error("acl_add_perm failed");
-    }
-    if (acl_set_tag_type(entry, ACL_MASK) != 0) {
-      throw std::runtime_error("acl_set_tag_type failed");
-    }
-    if (acl_set_permset(entry, permset) != 0) {
-      throw std::runtime_error("acl_set_permset failed");
-    }
-    logger_->debug(utils::acl::ToString(acl));
-    if (acl_valid(acl) != 0) {
-      logger_->warn("Acl is invalid");
-      int last = 0;
-      logger_->warn(acl_error(acl_check(acl, &last)));
-      logger_->warn("last entry = {}", last);
-    }
-    const bool skip_acl = acl_cmp(acl, acl_old) != 1;
-    if (skip_acl) {
-      logger_->debug("Skipped setting same ACL");
-    }
-    if (!skip_acl &&
-        acl_set_file(mount_point.c_str(), ACL_TYPE_ACCESS, acl) != 0) {
-      // logger_->error(strerror(errno));
-      logger_->error(utils::SafeErrorNoToStr());
-      throw std::runtime_error("acl_set_file failed");
-    }
-  } catch (const std::exception &ex) {
-    // free acl and rethrow
-    acl_free(acl);
-    acl_free(acl_old);
-    throw;
-  }
-  // free ACL
-  if (acl_free(acl) != 0 || acl_free(acl_old) != 0) {
-    logger_->warn("acl_free failed");
-  }
-  logger_->debug("ACL for {} successfully set", mount_point);
-}
-
 bool CustomMount::CreateMountEndpoint() noexcept {
   namespace fs = std::filesystem;
   std::string endpoint;
@@ -231,30 +232,19 @@ bool CustomMount::CreateMountEndpoint() noexcept {
   endpoint += base_mount_point_.value();
   endpoint += "/";
   try {
-    if (!ptr_device_->fs_label().empty() &&
-        !fs::exists(endpoint + ptr_device_->fs_label())) {
-      endpoint += utils::SanitizeMount(ptr_device_->fs_label());
+    const std::string label(ptr_device_->fs_label());
+    if (!label.empty() && !fs::exists(endpoint + label)) {
+      endpoint += utils::SanitizeMount(label);
     } else if (!ptr_device_->fs_uid().empty()) {
-      endpoint += utils::SanitizeMount(ptr_device_->fs_uid());
+      endpoint += utils::SanitizeMount(std::string(ptr_device_->fs_uid()));
     } else { // just in case
       endpoint += "usb";
     }
-    // check if it exists add some index in this case
-    uint index = 0;
-    // if exists and non empty -> change name
-    while (fs::exists(endpoint) && !fs::is_empty(endpoint)) {
-      if (index == 0) {
-        endpoint += "_0";
-        ++index;
-        continue;
-      }
-      ++index;
-      endpoint.erase(endpoint.size() - 1);
-      endpoint += std::to_string(index);
-    }
-    if (!fs::exists(endpoint) && !fs::create_directory(endpoint)) {
-      logger_->error("Can't create directory {}", endpoint);
-      return false;
+    // the directory is claimed by creating it, if it exists (a partition
+    // mounted in parallel may have just created it) - add some index
+    const std::string name(endpoint);
+    for (uint index = 0; !fs::create_directory(endpoint); ++index) {
+      endpoint = name + "_" + std::to_string(index);
     }
     if (chown(endpoint.c_str(), uid_.value_or(0), gid_.value_or(0)) != 0) {
       logger_->error("Chown for failed {} ", endpoint);
@@ -280,31 +270,57 @@ bool CustomMount::PerfomMount() noexcept {
     return false;
   }
   // setup mount options
-  MountOptions mount_opts{0, ptr_device_->filesystem(), ""};
+  MountOptions mount_opts{0, std::string(ptr_device_->filesystem()), ""};
   SetMountOptions(mount_opts);
-  // perfom mount
-  int res = mount(ptr_device_->block_name().c_str(),
-                  end_mount_point_.value().c_str(), mount_opts.fs.c_str(),
-                  mount_opts.mount_flags, mount_opts.mount_data.c_str());
-  if (res == 0) {
-    logger_->info("Mounted {} to {}", ptr_device_->block_name(),
-                  end_mount_point_.value());
-  } else {
-    // logger_->error("[PerfomMount]{}", strerror(errno));
+  // null-terminated
+  const std::string_view block_name = ptr_device_->block_name();
+  // dirty or write-protected media, skip the read-write attempt
+  auto &mount_modes = MountModeCache::Instance();
+  const std::string mode_key = MountModeCache::Key(ptr_device_->fs_uid(),
+                                                   ptr_device_->filesystem());
+  const auto cached_flags = mount_modes.Find(mode_key);
+  // perfom mount, a hung mount(2) is reported by the watchdog
+  auto operation =
+      Watchdog::Instance().Track("mount " + std::string(block_name));
+  // NOLINTNEXTLINE(google-runtime-int)
+  auto try_mount = [&](unsigned long flags) {
+    return mount(block_name.data(), end_mount_point_.value().c_str(),
+                 mount_opts.fs.c_str(), mount_opts.mount_flags | flags,
+                 mount_opts.mount_data.c_str());
+  };
+  // NOLINTNEXTLINE(google-runtime-int)
+  unsigned long flags = cached_flags.value_or(0);
+  int res = try_mount(flags);
+  if (res != 0 && cached_flags) {
+    logger_->warn("[PerfomMount] Cached flags {} failed for {} {}", flags,
+                  block_name, utils::SafeErrorNoToStr());
+    mount_modes.Failure(mode_key, logger_);
+    flags = 0;
+    res = try_mount(flags);
+  }
+  if (res != 0 && (flags & MS_RDONLY) == 0) {
     logger_->error("[PerfomMount]{}", utils::SafeErrorNoToStr());
     logger_->info("Try to mount as READ only");
     // if mount failed try to mount as readonly
-    res = mount(ptr_device_->block_name().c_str(),
-                end_mount_point_.value().c_str(), mount_opts.fs.c_str(),
-                mount_opts.mount_flags | MS_RDONLY,
-                mount_opts.mount_data.c_str());
-    if (res == -1) {
-      logger_->error("[PerfomMount] Error mounting as read-only");
-      RemoveMountPoint(end_mount_point_.value());
-      return false;
+    flags |= MS_RDONLY;
+    res = try_mount(flags);
+    if (res == 0) {
+      metrics::Get().mounts_read_only.Inc();
     }
+  }
+  if (res != 0) {
+    logger_->error("[PerfomMount] Error mounting {}", block_name);
+    RemoveMountPoint(end_mount_point_.value(), logger_);
+    return false;
+  }
+  logger_->info("Mounted {} to {}", block_name, end_mount_point_.value());
+  if ((flags & MS_RDONLY) != 0) {
     logger_->warn("[PerfomMount] Mounted as READ ONLY");
+    if (cached_flags == flags) {
+      metrics::Get().mounts_read_only_cached.Inc();
+    }
   }
+  mount_modes.Success(mode_key, flags, logger_);
   // chown+chmod after mount if not read-only fs
   // if (!mount_opts.read_only) {
   //   if (chown(end_mount_point_.value().c_str(), uid_.value_or(0),
@@ -321,89 +337,218 @@ bool CustomMount::PerfomMount() noexcept {
   return true;
 }
 
-bool CustomMount::UnMount() noexcept {
+CustomMount::UnMountStatus CustomMount::UnMount() noexcept {
   // find mount point
-  FILE *p_file = setmntent("/etc/mtab", "r");
-  if (p_file == nullptr) {
-    logger_->error("[UnMount] Error opening /etc/mtab");
-    return false;
-  }
   std::string mount_point;
   std::string fs_type;
-  {
-    mntent entry{};
-    std::vector<char> buff;
-    buff.reserve(BUFSIZ);
-    std::memset(buff.data(), 0, BUFSIZ);
-    while (getmntent_r(p_file, &entry, buff.data(), BUFSIZ) != nullptr) {
-      if (std::string(entry.mnt_fsname) == ptr_device_->block_name()) {
-        mount_point = entry.mnt_dir;
-        fs_type = entry.mnt_type;
-        break;
-      }
+  try {
+    const auto table = MountTable::Instance().Get();
+    const MountInfo *mount = table->FindBySource(ptr_device_->block_name());
+    if (mount != nullptr) {
+      mount_point = mount->mount_point;
+      fs_type = mount->fs_type;
     }
-    // mntent *entry;
-    // while ((entry = getmntent(p_file)) != NULL) {
-    //   if (std::string(entry->mnt_fsname) == ptr_device_->block_name()) {
-    //     mount_point = entry->mnt_dir;
-    //     fs_type = entry->mnt_type;
-    //     break;
-    //   }
-    //}
+  } catch (const std::exception &ex) {
+    logger_->error("[UnMount] {}", ex.what());
+    return UnMountStatus::kFailed;
   }
   // just "ntfs" for ntfs3
   if (fs_type == "ntfs3") {
     fs_type.pop_back();
   }
-  endmntent(p_file);
-  // perfom unmount
-  if (!mount_point.empty()) {
-    const int res = umount2(mount_point.c_str(), 0);
-    if (res != 0) {
-      logger_->error("[UnMount] Error unmounting {}",
-                     ptr_device_->block_name());
-      logger_->error(utils::SafeErrorNoToStr());
-      // logger_->error(std::strerror(errno));
-      return false;
+  std::string block(ptr_device_->block_name());
+  if (mount_point.empty()) {
+    logger_->info("[UnMount] {} is not mounted", block);
+    FinishUnMount(dbase_, logger_, on_event_, block, mount_point, fs_type);
+    return UnMountStatus::kNotMounted;
+  }
+  // a busy mount is retried by the queue, other devices don't wait for it
+  try {
+    const bool queued = UnmountQueue::Instance().Push(
+        mount_point,
+        [dbase = dbase_, logger = logger_, on_event = on_event_, block,
+         mount_point, fs_type](UnmountQueue::Result result,
+                               const std::string &reason) {
+          if (result == UnmountQueue::Result::kFailed) {
+            logger->error("[UnMount] Error unmounting {} {}", block, reason);
+            Notify(on_event, logger, EventType::kUnmountFailed, block,
+                   reason);
+            return;
+          }
+          if (result == UnmountQueue::Result::kDetached) {
+            logger->warn("[UnMount] {} was busy, detached", mount_point);
+            metrics::Get().unmounts_detached.Inc();
+          }
+          FinishUnMount(dbase, logger, on_event, block, mount_point, fs_type);
+        });
+    if (!queued) {
+      logger_->debug("[UnMount] {} is already being unmounted", mount_point);
     }
-  } else {
-    logger_->info("[UnMount] {} is not mounted", ptr_device_->block_name());
+  } catch (const std::exception &ex) {
+    logger_->error("[UnMount] Can't schedule unmounting {} {}", block,
+                   ex.what());
+    return UnMountStatus::kFailed;
   }
+  return UnMountStatus::kQueued;
+}
 
+void CustomMount::FinishUnMount(
+    const std::shared_ptr<dal::LocalStorage> &dbase,
+    const std::shared_ptr<spdlog::logger> &logger,
+    const EventHandler &on_event, const std::string &block,
+    const std::string &mount_point, const std::string &fs_type) noexcept {
   // remove from the database
+  auto &mount_points = dbase->mount_points;
+  bool deleted = false;
+  mount_points.StartTransaction();
   try {
     std::optional<uint64_t> index;
     if (!mount_point.empty()) {
-      const dal::MountEntry entry(dal::MountEntryParams(
-          {ptr_device_->block_name(), mount_point, fs_type}));
-      index = dbase_->mount_points.Find(entry);
+      const dal::MountEntry entry(
+          dal::MountEntryParams({block, mount_point, fs_type}));
+      index = mount_points.Find(entry);
     } else {
-      index = dbase_->mount_points.Find(ptr_device_->block_name());
+      index = mount_points.Find(block);
     }
     if (index) {
-      // remove mount directory
-      RemoveMountPoint(mount_point);
-      // remove from db
-      dbase_->mount_points.Delete(index.value());
-      logger_->debug("[UnMount] Deleted {} from mountpoints table",
-                     ptr_device_->block_name());
+      mount_points.Delete(index.value());
+      deleted = true;
     }
   } catch (const std::exception &ex) {
-    logger_->error("[UnMount] Can't  remove {} device mountpoint from database",
-                   ptr_device_->block_name());
-    logger_->error(ex.what());
+    logger->error("[UnMount] Can't  remove {} device mountpoint from database",
+                  block);
+    logger->error(ex.what());
+    deleted = false;
   }
-  return true;
+  if (!deleted) {
+    mount_points.AbortTransaction();
+  } else if (mount_points.ProcessTransaction()) {
+    logger->debug("[UnMount] Deleted {} from mountpoints table", block);
+    // remove mount directory
+    RemoveMountPoint(mount_point, logger);
+  } else {
+    logger->error("[UnMount] Can't save the mount points");
+  }
+  if (!mount_point.empty()) {
+    Notify(on_event, logger, EventType::kUnmounted, block, mount_point);
+  }
+}
+
+size_t
+CustomMount::UnMountBatch(const std::vector<std::string> &blocks,
+                          const std::shared_ptr<spdlog::logger> &logger,
+                          const EventHandler &on_event) noexcept {
+  try {
+    const auto dbase = dal::LocalStorage::GetStorage();
+    auto &mount_points = dbase->mount_points;
+    // mounted by the daemon, the rows are found again in the transaction
+    std::vector<std::string> mounted;
+    for (const auto &block : blocks) {
+      if (mount_points.Find(block)) {
+        mounted.push_back(block);
+      }
+    }
+    if (mounted.empty()) {
+      return 0;
+    }
+    // one snapshot of the mount table for all devices
+    const auto table = MountTable::Instance().Get();
+    std::vector<std::pair<std::string, std::string>> unmounted;
+    std::vector<std::string> expired; // db rows to delete
+    for (const auto &block : mounted) {
+      const MountInfo *mount = table->FindBySource(block);
+      if (mount != nullptr) {
+        std::string mount_point(mount->mount_point);
+        auto operation = Watchdog::Instance().Track("umount " + mount_point);
+        // the device is gone, nothing can be flushed
+        if (umount2(mount_point.c_str(), MNT_DETACH) != 0) {
+          logger->error("[UnMountBatch] Error unmounting {} {}", block,
+                        utils::SafeErrorNoToStr());
+          metrics::Get().unmounts_failed.Inc();
+          continue;
+        }
+        unmounted.emplace_back(block, std::move(mount_point));
+      }
+      expired.push_back(block);
+    }
+    // FinishUnMount or a mount worker may have changed the table meanwhile
+    mount_points.StartTransaction();
+    try {
+      for (const auto &block : expired) {
+        auto index = mount_points.Find(block);
+        if (index) {
+          mount_points.Delete(index.value());
+        }
+      }
+      if (!mount_points.ProcessTransaction()) {
+        logger->error("[UnMountBatch] Can't save the mount points");
+      }
+    } catch (const std::exception &ex) {
+      mount_points.AbortTransaction();
+      logger->error("[UnMountBatch] Can't update the mount points {}",
+                    ex.what());
+    }
+    for (const auto &device : unmounted) {
+      RemoveMountPoint(device.second, logger);
+      Notify(on_event, logger, EventType::kUnmounted, device.first,
+             device.second);
+    }
+    logger->info("[UnMountBatch] Unmounted {} of {} devices", unmounted.size(),
+                 blocks.size());
+    return unmounted.size();
+  } catch (const std::exception &ex) {
+    logger->error("[UnMountBatch] {}", ex.what());
+  }
+  return 0;
 }
 
-void CustomMount::RemoveMountPoint(const std::string &path) noexcept {
+void CustomMount::RemoveMountPoint(
+    const std::string &path,
+    const std::shared_ptr<spdlog::logger> &logger) noexcept {
   try {
     if (std::filesystem::is_empty(path)) {
       std::filesystem::remove(path);
-      logger_->info("[UnMount] Remove {} ", path);
+      logger->info("[UnMount] Remove {} ", path);
+    }
+  } catch (const std::exception &ex) {
+    logger->error("[UnMount] Can't remove {}", path);
+  }
+}
+
+void CustomMount::Notify(EventType type,
+                         const std::string &details) const noexcept {
+  Notify(on_event_, logger_, type, ptr_device_->block_name(), details);
+}
+
+void CustomMount::Notify(const EventHandler &on_event,
+                         const std::shared_ptr<spdlog::logger> &logger,
+                         EventType type, std::string_view block,
+                         const std::string &details) noexcept {
+  if (type == EventType::kMounted) {
+    metrics::Get().mounts_ok.Inc();
+  } else if (type == EventType::kMountFailed) {
+    metrics::Get().mounts_failed.Inc();
+  } else if (type == EventType::kUnmounted) {
+    metrics::Get().unmounts_ok.Inc();
+  } else if (type == EventType::kUnmountFailed) {
+    metrics::Get().unmounts_failed.Inc();
+  }
+  if (!on_event) {
+    return;
+  }
+  try {
+    Event event;
+    event.type = type;
+    event.block = block;
+    if (type == EventType::kMountFailed ||
+        type == EventType::kUnmountFailed) {
+      event.reason = details;
+    } else {
+      event.mount_point = details;
     }
+    on_event(event);
   } catch (const std::exception &ex) {
-    logger_->error("[UnMount] Can't remove {}", path);
+    logger->error("[Notify] {}", ex.what());
   }
 }
 
@@ -411,37 +556,42 @@ void CustomMount::SetMountOptions(MountOptions &opts) const noexcept {
   if (opts.fs.empty()) {
     return;
   }
-  opts.mount_flags = MS_NOSUID | MS_NODEV | MS_RELATIME;
-  std::string uid_gid = "uid=";
-  uid_gid += std::to_string(uid_.value_or(0));
-  uid_gid += ",gid=";
-  uid_gid += std::to_string(gid_.value_or(0));
-  if (ptr_device_->filesystem() == "iso9660") {
-    opts.mount_flags = opts.mount_flags | MS_RDONLY;
-    opts.mount_data += uid_gid;
-    opts.mount_data += ",iocharset=utf8";
-    opts.read_only = true;
-  } else if (ptr_device_->filesystem() == "vfat") {
-    opts.mount_data += uid_gid;
-    opts.mount_data += ",fmask=0007,dmask=0007,allow_utime=0020,"
-                       "codepage=866,shortname=mixed"
-                       ",utf8,flush,errors=remount-ro";
-  } else if (ptr_device_->filesystem() == "exfat") {
-    opts.mount_data += uid_gid;
-    opts.mount_data += ",fmask=0007,dmask=0007";
-  } else if (ptr_device_->filesystem() == "ntfs") {
-    opts.fs += "3";
-    opts.mount_data += uid_gid;
-    //  opts.mount_data += ",fmask=0007,dmask=0007,iocharset=utf8";
-    opts.mount_data += ",iocharset=utf8";
-  } else if (ptr_device_->filesystem() == "udf") {
-    opts.mount_flags = opts.mount_flags | MS_RDONLY;
-    opts.mount_data += uid_gid;
-    opts.mount_data += ",mode=440,dmode=550,iocharset=utf8";
-    opts.read_only = true;
-  } else {
-    logger_->info("Filesystem {}, mounting with default parameters",
-                  ptr_device_->filesystem());
+  try {
+    const MountProfile *found = MountProfiles::Instance().Find(opts.fs);
+    if (found == nullptr) {
+      logger_->info("Filesystem {}, mounting with default parameters",
+                    opts.fs);
+    }
+    MountProfile profile = found != nullptr ? *found : MountProfile{};
+    if (!rule_mount_options_.empty()) {
+      MountProfile tuned = profile;
+      try {
+        MountProfiles::ApplyOptions(rule_mount_options_, tuned);
+        profile = std::move(tuned);
+      } catch (const std::invalid_argument &ex) {
+        logger_->error("Mount options of the rule {} are ignored {}",
+                       rule_mount_options_, ex.what());
+      }
+    }
+    opts.mount_flags = MS_NOSUID | MS_NODEV | profile.flags;
+    opts.read_only = (profile.flags & MS_RDONLY) != 0;
+    if (!profile.driver.empty()) {
+      opts.fs = profile.driver;
+    }
+    opts.mount_data.clear();
+    if (profile.owner) {
+      opts.mount_data += "uid=";
+      opts.mount_data += std::to_string(uid_.value_or(0));
+      opts.mount_data += ",gid=";
+      opts.mount_data += std::to_string(gid_.value_or(0));
+      if (!profile.data.empty()) {
+        opts.mount_data += ',';
+      }
+    }
+    opts.mount_data += profile.data;
+  } catch (const std::exception &ex) {
+    logger_->error("Can't set the mount options {}", ex.what());
+    opts.mount_flags = MS_NOSUID | MS_NODEV | MS_RELATIME;
   }
   logger_->info("Mount data = {}", opts.mount_data);
 }
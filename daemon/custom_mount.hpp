@@ -19,13 +19,20 @@
 */
 
 #pragma once
+#include "acl_template.hpp"
 #include "config.hpp"
 #include "dal/local_storage.hpp"
+#include "events.hpp"
+#include "partition_mounter.hpp"
 #include "usb_udev_device.hpp"
+#include <cstddef>
+#include <cstdint>
 #include <memory>
 #include <optional>
 #include <spdlog/logger.h>
 #include <string>
+#include <string_view>
+#include <vector>
 // NOLINTNEXTLINE
 #include <sys/types.h>
 
@@ -51,8 +58,18 @@ public:
   CustomMount &&operator=(CustomMount &&) = delete;
   ~CustomMount() = default;
 
+  /**
+   * @brief Construct a new Custom Mount object
+   * @param ptr_device The device
+   * @param logger
+   * @param on_event Receives Mounted,Unmounted,MountFailed and UnmountFailed
+   * events
+   * @param context Shared by the partitions of the disk, a new one if empty
+   */
   explicit CustomMount(std::shared_ptr<UsbUdevDevice> &ptr_device,
-                       const std::shared_ptr<spdlog::logger> &logger) noexcept;
+                       const std::shared_ptr<spdlog::logger> &logger,
+                       EventHandler on_event,
+                       std::shared_ptr<DiskContext> context = {}) noexcept;
 
   /**
    * @brief Mount a device
@@ -60,50 +77,100 @@ public:
    */
   bool Mount() noexcept;
 
+  enum class UnMountStatus : uint8_t {
+    kNotMounted, /// only the database row is dropped
+    kQueued,     /// the result comes with the Unmounted/UnmountFailed event
+    kFailed      /// can't be scheduled
+  };
+
   /**
    * @brief Unmount a device
+   * @details A mounted device is passed to UnmountQueue, the database row,
+   * the directory and the Unmounted (or UnmountFailed) event are handled when
+   * the queue is done with it.
    */
-  bool UnMount() noexcept;
+  UnMountStatus UnMount() noexcept;
+
+  /**
+   * @brief Unmount the block devices of a removed USB device at once
+   * @details The mount table is read once, the mounts are detached (the
+   * device is gone), the mount points table is written in one transaction
+   * and the mount directories are removed in one pass. Devices not mounted
+   * by the daemon are skipped.
+   * @param blocks e.g. /dev/sdb2, /dev/sdb1, /dev/sdb
+   * @return number of unmounted devices
+   */
+  static size_t UnMountBatch(const std::vector<std::string> &blocks,
+                             const std::shared_ptr<spdlog::logger> &logger,
+                             const EventHandler &on_event) noexcept;
 
   static constexpr const char *mount_root = BASE_MOUNT_POINT;
 
 private:
+  /// buffer for getpwuid_r and getgrgid_r
+  static constexpr size_t kNssBufferSize = 1200;
+
+  /// @brief Fill the rule of the context, called once per disk
+  void FindRule(DiskContext &context) const;
+
   /**
    * @brief Create a Acl-controlled directory for mount points
    */
   bool CreateAclMountPoint() noexcept;
 
-  /**
-   * @brief Set the Acl for directory
-   * @param mount_point
-   */
-  void SetAcl(const std::string &mount_point);
-
   /**
    * @brief Create a subfolder in ACL-controlled dir for mounting
    */
   bool CreateMountEndpoint() noexcept;
 
   bool PerfomMount() noexcept;
-  void RemoveMountPoint(const std::string &path) noexcept;
+  /**
+   * @brief Drop the database row and the directory, notify kUnmounted
+   * @details Called on the UnmountQueue worker, the row is found and deleted
+   * in one mount_points transaction, so UnMountBatch on the udev thread can't
+   * change the table in between.
+   */
+  static void FinishUnMount(const std::shared_ptr<dal::LocalStorage> &dbase,
+                            const std::shared_ptr<spdlog::logger> &logger,
+                            const EventHandler &on_event,
+                            const std::string &block,
+                            const std::string &mount_point,
+                            const std::string &fs_type) noexcept;
+  static void
+  RemoveMountPoint(const std::string &path,
+                   const std::shared_ptr<spdlog::logger> &logger) noexcept;
 
   /**
    * @brief Set the Mount Options object - paramterers for mount call
+   * @details The profile of the filesystem (MountProfiles) changed by the
+   * mount options of the rule.
    * @param[in][out] opts
    */
   void SetMountOptions(MountOptions &opts) const noexcept;
 
+  /// @brief Pass the event to the handler (if any)
+  void Notify(EventType type, const std::string &details) const noexcept;
+  static void Notify(const EventHandler &on_event,
+                     const std::shared_ptr<spdlog::logger> &logger,
+                     EventType type, std::string_view block,
+                     const std::string &details) noexcept;
+
   // unused
   // bool FixNtfs(const std::string &block) const noexcept;
 
   const std::shared_ptr<spdlog::logger> logger_;
   std::shared_ptr<UsbUdevDevice> ptr_device_;
   std::shared_ptr<dal::LocalStorage> dbase_;
+  EventHandler on_event_;
+  std::shared_ptr<DiskContext> context_;
 
   // NOLINTBEGIN
   std::optional<uid_t> uid_;
   std::optional<gid_t> gid_;
   // NOLINTEND
+  uint64_t rules_generation_ = 0;
+  std::string rule_mount_options_; /// overrides the mount profile
+  std::shared_ptr<const AclTemplate> acl_template_; // ACL of the base dir
   std::optional<std::string> base_mount_point_; // base mount point with acl
   std::optional<std::string> end_mount_point_;  // child dir for mounting
 };
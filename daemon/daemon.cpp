@@ -19,13 +19,24 @@
 */
 
 #include "daemon.hpp"
+#include "config.hpp"
 #include "dbus_methods.hpp"
+#include "metrics.hpp"
+#include "mount_profiles.hpp"
+#include "queue_tuning.hpp"
 #include "udev_monitor.hpp"
 // #include "udisks_dbus.hpp"
 #include "utils.hpp"
+#include "watchdog.hpp"
+#include <algorithm>
+#include <chrono>
 #include <csignal>
+#include <ctime>
 #include <memory>
+#include <optional>
 #include <sdbus-c++/sdbus-c++.h>
+#include <string>
+#include <systemd/sd-daemon.h>
 #include <thread>
 
 // NOLINTBEGIN(misc-include-cleaner)
@@ -36,7 +47,15 @@ Daemon::Daemon()
     : is_running_(true), reload_(false),
       logger_(utils::InitLogFile("/var/log/alt-usb-automount/log.txt")),
       udev_(std::make_shared<UdevMonitor>(logger_)),
-      dbus_methods_(udev_, logger_) {}
+      dbus_methods_(udev_, logger_) {
+  // ExportRules writes to a pipe the client may close, EPIPE is enough
+  std::signal(SIGPIPE, SIG_IGN);
+  // compiled before the monitor mounts anything
+  MountProfiles::Instance().Load(MOUNT_PROFILES_FILE, logger_);
+  QueueTuning::Instance().Load(QUEUE_TUNING_FILE, logger_);
+  udev_->SetEventHandler(
+      [this](const Event &event) { dbus_methods_.EmitEvent(event); });
+}
 
 bool Daemon::IsRunning() noexcept {
   if (reload_) {
@@ -73,9 +92,55 @@ void Daemon::Run() {
   sigaddset(&signal_set, SIGHUP);
   // NOLINTNEXTLINE(concurrency-mt-unsafe)
   sigprocmask(SIG_BLOCK, &signal_set, nullptr);
+  // WatchdogSec= of the unit, notified twice per interval
+  uint64_t watchdog_usec = 0;
+  const bool watchdog_enabled = sd_watchdog_enabled(0, &watchdog_usec) > 0;
+  const std::chrono::milliseconds metrics_interval(METRICS_INTERVAL_SEC *
+                                                   1000);
+  std::chrono::milliseconds tick = metrics_interval;
+  if (watchdog_enabled) {
+    tick = std::clamp(std::chrono::milliseconds(watchdog_usec / 2000),
+                      std::chrono::milliseconds(100), metrics_interval);
+  }
+  const timespec tick_ts{static_cast<time_t>(tick.count() / 1000),
+                         static_cast<long>(tick.count() % 1000) * 1000000};
+  auto metrics_due = std::chrono::steady_clock::now();
+  bool metrics_written = true;
+  std::optional<std::string> unhealthy;
   while (IsRunning()) {
-    sigwait(&signal_set, &signal_number);
-    SignalHandler(signal_number);
+    signal_number = sigtimedwait(&signal_set, nullptr, &tick_ts);
+    if (signal_number > 0) {
+      SignalHandler(signal_number);
+      continue;
+    }
+    // timeout (EAGAIN) or EINTR
+    dbus_methods_.ProbeLoops(tick);
+    auto problem = Watchdog::Instance().Check();
+    if (!problem) {
+      if (watchdog_enabled) {
+        sd_notify(0, "WATCHDOG=1");
+      }
+      if (unhealthy) {
+        logger_->info("Watchdog: healthy again");
+      }
+    } else if (!unhealthy) {
+      // systemd restarts the daemon after WatchdogSec without notifications
+      logger_->error("Watchdog: {}", problem.value());
+    }
+    unhealthy = std::move(problem);
+    const auto now = std::chrono::steady_clock::now();
+    if (now < metrics_due) {
+      continue;
+    }
+    metrics_due = now + metrics_interval;
+    const bool written =
+        metrics::Registry::Instance().WriteTextfile(METRICS_TEXTFILE);
+    if (!written && metrics_written) {
+      logger_->warn("Can't write metrics to {}", METRICS_TEXTFILE);
+    }
+    metrics_written = written;
+    // devices found on start and "change" events don't emit events
+    dbus_methods_.PublishPolkitSnapshot();
   }
   udev_->Stop();
   thread_monitor.join();
@@ -27,22 +27,39 @@
 #include <boost/json/array.hpp>
 #include <boost/json/object.hpp>
 #include <boost/json/parse.hpp>
+#include <boost/json/serialize.hpp>
 #include <boost/json/value.hpp>
+#include <cstddef>
 #include <cstdint>
+#include <exception>
 #include <map>
 #include <memory>
 #include <mutex>
 #include <optional>
+#include <set>
 #include <shared_mutex>
 #include <stdexcept>
 #include <string>
+#include <string_view>
+#include <tuple>
 #include <utility>
 
 namespace usbmount::dal {
 
+namespace {
+// The row format of the ListRules response.
+std::string RuleListRow(uint64_t index, const Dto &dto) {
+  json::object obj;
+  obj["id"] = std::to_string(index);
+  obj["perm"] = dto.ToJson();
+  return json::serialize(obj);
+}
+} // namespace
+
 // DevicePermissions
 
-DevicePermissions::DevicePermissions(const std::string &path) : Table(path) {
+DevicePermissions::DevicePermissions(const std::string &path)
+    : Table(path), rules_list_cache_(RuleListRow) {
   DevicePermissions::DataFromRawJson();
 }
 
@@ -57,9 +74,10 @@ void DevicePermissions::DataFromRawJson() {
   const json::array arr = val.as_array();
   // array of tuples iteration
   std::unique_lock<std::shared_mutex> lock;
-  if (!transaction_started_) {
+  if (!InTransaction()) {
     lock = std::unique_lock(data_mutex_);
   }
+  InvalidateCache();
   for (const json::value &element : arr) {
     if (!element.is_object()) {
       throw std::runtime_error("Invalid JSON object");
@@ -79,12 +97,13 @@ void DevicePermissions::DataFromRawJson() {
 void DevicePermissions::Create(const Dto &dto) {
   const auto &entry = dynamic_cast<const PermissionEntry &>(dto);
   std::unique_lock<std::shared_mutex> lock;
-  if (!transaction_started_) {
+  if (!InTransaction()) {
     lock = std::unique_lock(data_mutex_);
   }
   uint64_t index = data_.empty() ? 0 : (data_.rbegin()->first) + 1;
   data_.emplace(index, std::make_shared<PermissionEntry>(entry));
-  if (!transaction_started_) {
+  InvalidateCache(index);
+  if (!InTransaction()) {
     lock.unlock();
     WriteRaw();
   }
@@ -93,7 +112,7 @@ void DevicePermissions::Create(const Dto &dto) {
 const PermissionEntry &DevicePermissions::Read(uint64_t index) const {
   CheckIndex(index);
   std::shared_lock<std::shared_mutex> lock;
-  if (!transaction_started_) {
+  if (!InTransaction()) {
     lock = std::shared_lock(data_mutex_);
   }
   auto entry = std::dynamic_pointer_cast<PermissionEntry>(data_.at(index));
@@ -105,39 +124,163 @@ const PermissionEntry &DevicePermissions::Read(uint64_t index) const {
 
 std::optional<uint64_t>
 DevicePermissions::Find(const Device &dev) const noexcept {
+  return Find(dev.vid(), dev.pid(), dev.serial());
+}
+
+std::optional<uint64_t>
+DevicePermissions::Find(std::string_view vid, std::string_view pid,
+                        std::string_view serial) const noexcept {
   std::shared_lock<std::shared_mutex> lock;
-  if (!transaction_started_) {
+  if (!InTransaction()) {
     lock = std::shared_lock(data_mutex_);
   }
-  auto it_found = std::find_if(
-      data_.cbegin(), data_.cend(),
-      [&dev](const std::pair<const uint64_t, std::shared_ptr<Dto>> &entry) {
-        return std::dynamic_pointer_cast<PermissionEntry>(entry.second)
-                   ->getDevice() == dev;
-      });
-  return it_found != data_.cend() ? std::make_optional(it_found->first)
-                                  : std::nullopt;
+  try {
+    const std::lock_guard<std::mutex> index_lock(indexes_mutex_);
+    if (!indexes_valid_) {
+      BuildIndexes();
+    }
+    auto it_found = device_index_.find(std::make_tuple(vid, pid, serial));
+    return it_found != device_index_.cend()
+               ? std::make_optional(it_found->second)
+               : std::nullopt;
+  } catch (const std::exception &ex) {
+    // no memory for the index - fall back to a full scan
+    auto it_found = std::find_if(
+        data_.cbegin(), data_.cend(),
+        [vid, pid,
+         serial](const std::pair<const uint64_t, std::shared_ptr<Dto>> &entry) {
+          const Device &dev =
+              std::dynamic_pointer_cast<PermissionEntry>(entry.second)
+                  ->getDevice();
+          return dev.vid() == vid && dev.pid() == pid &&
+                 dev.serial() == serial;
+        });
+    return it_found != data_.cend() ? std::make_optional(it_found->first)
+                                    : std::nullopt;
+  }
+}
+
+void DevicePermissions::BuildIndexes() const {
+  indexes_valid_ = false;
+  device_index_.clear();
+  user_index_.clear();
+  group_index_.clear();
+  // ascending indexes - the first rule for a device wins
+  for (const auto &entry : data_) {
+    auto perm = std::dynamic_pointer_cast<PermissionEntry>(entry.second);
+    if (!perm) {
+      continue;
+    }
+    const Device &dev = perm->getDevice();
+    device_index_.emplace(DeviceKey{dev.vid(), dev.pid(), dev.serial()},
+                          entry.first);
+    for (const auto &user : perm->getUsers()) {
+      user_index_[user.name()].emplace(entry.first);
+    }
+    for (const auto &group : perm->getGroups()) {
+      group_index_[group.name()].emplace(entry.first);
+    }
+  }
+  indexes_valid_ = true;
 }
 
 void DevicePermissions::Update(uint64_t index, const Dto &dto) {
   const auto &entry = dynamic_cast<const PermissionEntry &>(dto);
   CheckIndex(index);
   std::unique_lock<std::shared_mutex> lock;
-  if (!transaction_started_) {
+  if (!InTransaction()) {
     lock = std::unique_lock(data_mutex_);
   }
   data_.at(index) = std::make_shared<PermissionEntry>(entry);
-  if (!transaction_started_) {
+  InvalidateCache(index);
+  if (!InTransaction()) {
     lock.unlock();
     WriteRaw();
   }
 }
 
+DevicePermissions::Page
+DevicePermissions::GetPage(uint64_t cursor, size_t limit,
+                           const Filter &filter) const {
+  Page res;
+  std::shared_lock<std::shared_mutex> lock;
+  if (!InTransaction()) {
+    lock = std::shared_lock(data_mutex_);
+  }
+  const std::lock_guard<std::mutex> index_lock(indexes_mutex_);
+  if (!indexes_valid_) {
+    BuildIndexes();
+  }
+  // candidates from the name indexes, nullptr - all rules
+  static const std::set<uint64_t> kNothing;
+  const std::set<uint64_t> *users = nullptr;
+  const std::set<uint64_t> *groups = nullptr;
+  if (!filter.user.empty()) {
+    auto it_user = user_index_.find(filter.user);
+    users = it_user != user_index_.end() ? &it_user->second : &kNothing;
+  }
+  if (!filter.group.empty()) {
+    auto it_group = group_index_.find(filter.group);
+    groups = it_group != group_index_.end() ? &it_group->second : &kNothing;
+  }
+  auto matches = [&filter, users, groups](uint64_t index,
+                                          const PermissionEntry &perm) {
+    if (users != nullptr && users->count(index) == 0) {
+      return false;
+    }
+    if (groups != nullptr && groups->count(index) == 0) {
+      return false;
+    }
+    if (filter.device.empty()) {
+      return true;
+    }
+    const Device &dev = perm.getDevice();
+    return dev.vid().find(filter.device) != std::string::npos ||
+           dev.pid().find(filter.device) != std::string::npos ||
+           dev.serial().find(filter.device) != std::string::npos;
+  };
+  auto take = [&res, limit, &matches](uint64_t index,
+                                      const std::shared_ptr<Dto> &dto) {
+    auto perm = std::dynamic_pointer_cast<const PermissionEntry>(dto);
+    if (!perm || !matches(index, *perm)) {
+      return true;
+    }
+    if (res.rules.size() == limit) {
+      res.next = index;
+      return false;
+    }
+    res.rules.emplace_back(index, std::move(perm));
+    return true;
+  };
+  // walk the smallest candidate set
+  const std::set<uint64_t> *candidates = users;
+  if (groups != nullptr &&
+      (candidates == nullptr || groups->size() < candidates->size())) {
+    candidates = groups;
+  }
+  if (candidates != nullptr) {
+    for (auto it = candidates->lower_bound(cursor); it != candidates->end();
+         ++it) {
+      auto it_data = data_.find(*it);
+      if (it_data != data_.end() && !take(it_data->first, it_data->second)) {
+        break;
+      }
+    }
+  } else {
+    for (auto it = data_.lower_bound(cursor); it != data_.end(); ++it) {
+      if (!take(it->first, it->second)) {
+        break;
+      }
+    }
+  }
+  return res;
+}
+
 std::map<uint64_t, std::shared_ptr<const PermissionEntry>>
 DevicePermissions::getAll() const noexcept {
   std::map<uint64_t, std::shared_ptr<const PermissionEntry>> res;
   std::shared_lock<std::shared_mutex> lock;
-  if (!transaction_started_) {
+  if (!InTransaction()) {
     lock = std::shared_lock(data_mutex_);
   }
   for (const auto &entry : data_) {
@@ -149,4 +292,56 @@ DevicePermissions::getAll() const noexcept {
   return res;
 }
 
-} // namespace usbmount::dal
\ No newline at end of file
+std::string DevicePermissions::SerializeRulesList() const noexcept {
+  std::shared_lock<std::shared_mutex> lock;
+  if (!InTransaction()) {
+    lock = std::shared_lock(data_mutex_);
+  }
+  try {
+    return rules_list_cache_.Get(data_);
+  } catch (const std::exception &ex) {
+    return {};
+  }
+}
+
+DevicePermissions::Snapshot DevicePermissions::GetSnapshot() const noexcept {
+  Snapshot res;
+  std::shared_lock<std::shared_mutex> lock;
+  if (!InTransaction()) {
+    lock = std::shared_lock(data_mutex_);
+  }
+  try {
+    res.generation = generation();
+    res.rules_list = rules_list_cache_.Get(data_);
+    for (const auto &entry : data_) {
+      auto perm =
+          std::dynamic_pointer_cast<const PermissionEntry>(entry.second);
+      if (perm) {
+        res.rules.emplace(entry.first, perm);
+      }
+    }
+  } catch (const std::exception &ex) {
+    return {};
+  }
+  return res;
+}
+
+void DevicePermissions::InvalidateCache(uint64_t index) noexcept {
+  rules_list_cache_.Invalidate(index);
+  {
+    const std::lock_guard<std::mutex> lock(indexes_mutex_);
+    indexes_valid_ = false;
+  }
+  Table::InvalidateCache(index);
+}
+
+void DevicePermissions::InvalidateCache() noexcept {
+  rules_list_cache_.Invalidate();
+  {
+    const std::lock_guard<std::mutex> lock(indexes_mutex_);
+    indexes_valid_ = false;
+  }
+  Table::InvalidateCache();
+}
+
+} // namespace usbmount::dal
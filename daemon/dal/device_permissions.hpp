@@ -21,16 +21,46 @@
 #pragma once
 #include "dto.hpp"
 #include "table.hpp"
+#include <cstddef>
 #include <cstdint>
+#include <functional>
 #include <map>
 #include <memory>
+#include <mutex>
 #include <optional>
+#include <set>
 #include <string>
+#include <string_view>
+#include <tuple>
+#include <utility>
+#include <vector>
 
 namespace usbmount::dal {
 
 class DevicePermissions : public Table {
 public:
+  /// @brief ListRulesPage filter, empty fields match everything
+  struct Filter {
+    std::string device; /// substring of vid, pid or serial
+    std::string user;   /// user name
+    std::string group;  /// group name
+  };
+
+  /// @brief Rules ordered by index
+  struct Page {
+    std::vector<std::pair<uint64_t, std::shared_ptr<const PermissionEntry>>>
+        rules;
+    /// the cursor of the next page, empty if this page is the last one
+    std::optional<uint64_t> next;
+  };
+
+  /// @brief A consistent view of the table
+  struct Snapshot {
+    uint64_t generation = 0;
+    std::string rules_list; /// SerializeRulesList format
+    std::map<uint64_t, std::shared_ptr<const PermissionEntry>> rules;
+  };
+
   /**
    * @brief Construct a new DevicePermissions object
    * @param path Path to a file to store data
@@ -66,9 +96,36 @@ public:
    */
   std::optional<uint64_t> Find(const Device &dev) const noexcept;
 
+  /**
+   * @brief Find by vid, pid and serial without constructing a Device
+   * @details An indexed lookup, the index is rebuilt after the table changes.
+   * @return std::optional<uint64_t> the lowest index or empty
+   */
+  std::optional<uint64_t> Find(std::string_view vid, std::string_view pid,
+                               std::string_view serial) const noexcept;
+
   std::map<uint64_t, std::shared_ptr<const PermissionEntry>>
   getAll() const noexcept;
 
+  /**
+   * @brief Serialize the list of rules in the ListRules format
+   * @details [{"id":"index","perm":{...}}], cached until the table changes.
+   */
+  std::string SerializeRulesList() const noexcept;
+
+  /**
+   * @brief Rules, their ListRules JSON and the generation taken under one
+   * lock
+   */
+  Snapshot GetSnapshot() const noexcept;
+
+  /**
+   * @brief Up to limit rules with index >= cursor matching the filter
+   * @details Indexes are stable, so a cursor stays valid while the table
+   * changes. User and group filters use the name indexes.
+   */
+  Page GetPage(uint64_t cursor, size_t limit, const Filter &filter) const;
+
 private:
   /**
    * @brief Read raw_json_ and fill the fields with data
@@ -76,6 +133,23 @@ private:
    */
   void DataFromRawJson() override;
 
+  void InvalidateCache(uint64_t index) noexcept override;
+  void InvalidateCache() noexcept override;
+
+  /// @brief Fill the indexes from data_, under indexes_mutex_
+  void BuildIndexes() const;
+
+  mutable SerializationCache rules_list_cache_;
+
+  /// vid, pid, serial
+  using DeviceKey = std::tuple<std::string, std::string, std::string>;
+  mutable std::mutex indexes_mutex_;
+  mutable bool indexes_valid_ = false;
+  mutable std::map<DeviceKey, uint64_t, std::less<>> device_index_;
+  /// name -> rule indexes
+  mutable std::map<std::string, std::set<uint64_t>, std::less<>> user_index_;
+  mutable std::map<std::string, std::set<uint64_t>, std::less<>> group_index_;
+
   // no cloning
   std::shared_ptr<Dto> Clone() const noexcept override { return nullptr; };
 };
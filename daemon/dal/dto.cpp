@@ -181,14 +181,32 @@ PermissionEntry::PermissionEntry(const json::object &obj) {
     groups_.emplace_back(group.as_object());
   }
   device_ = Device(obj.at("device").as_object());
+  // rules saved before the field was added don't have it
+  const json::value *options = obj.if_contains("mount_options");
+  if (options != nullptr) {
+    if (!options->is_string()) {
+      throw std::runtime_error(ex_string);
+    }
+    mount_options_ = options->get_string().c_str();
+  }
+  const json::value *tuning = obj.if_contains("queue_tuning");
+  if (tuning != nullptr) {
+    if (!tuning->is_string()) {
+      throw std::runtime_error(ex_string);
+    }
+    queue_tuning_ = tuning->get_string().c_str();
+  }
 }
 
 PermissionEntry::PermissionEntry(Device &&dev, std::vector<User> &&users,
-                                 std::vector<Group> &&groups)
+                                 std::vector<Group> &&groups,
+                                 std::string mount_options,
+                                 std::string queue_tuning)
     :
 
       device_(std::move(dev)), users_(std::move(users)),
-      groups_(std::move(groups)) {
+      groups_(std::move(groups)), mount_options_(std::move(mount_options)),
+      queue_tuning_(std::move(queue_tuning)) {
   if (users_.empty() && groups_.empty()) {
     throw std::invalid_argument("Users and groups are empty");
   }
@@ -207,6 +225,12 @@ json::value PermissionEntry::ToJson() const noexcept {
     arr_groups.emplace_back(group.ToJson());
   }
   obj["groups"] = std::move(arr_groups);
+  if (!mount_options_.empty()) {
+    obj["mount_options"] = mount_options_;
+  }
+  if (!queue_tuning_.empty()) {
+    obj["queue_tuning"] = queue_tuning_;
+  }
   return obj;
 }
 
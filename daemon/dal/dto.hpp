@@ -41,7 +41,7 @@ public:
   Dto &operator=(const Dto &) = default;
   Dto &operator=(Dto &&) = default;
   virtual ~Dto() = default;
-  std::string Serialize() const noexcept;
+  virtual std::string Serialize() const noexcept;
   virtual boost::json::value ToJson() const noexcept = 0;
   virtual std::shared_ptr<Dto> Clone() const noexcept = 0;
 };
@@ -174,8 +174,11 @@ public:
   PermissionEntry(PermissionEntry &&) = default;
   PermissionEntry &operator=(const PermissionEntry &) = default;
   PermissionEntry &operator=(PermissionEntry &&) = default;
+  /// @param mount_options overrides the mount profile, see MountProfiles
+  /// @param queue_tuning overrides the disk settings, see QueueTuning
   PermissionEntry(Device &&dev, std::vector<User> &&users,
-                  std::vector<Group> &&groups);
+                  std::vector<Group> &&groups, std::string mount_options = {},
+                  std::string queue_tuning = {});
   ~PermissionEntry() override = default;
 
   json::value ToJson() const noexcept override;
@@ -185,6 +188,12 @@ public:
   inline const std::vector<Group> &getGroups() const noexcept {
     return groups_;
   }
+  inline const std::string &getMountOptions() const noexcept {
+    return mount_options_;
+  }
+  inline const std::string &getQueueTuning() const noexcept {
+    return queue_tuning_;
+  }
   inline std::shared_ptr<Dto> Clone() const noexcept override {
     return std::make_shared<PermissionEntry>(*this);
   };
@@ -193,6 +202,8 @@ private:
   Device device_;
   std::vector<User> users_;
   std::vector<Group> groups_;
+  std::string mount_options_; /// optional, empty - the profile as is
+  std::string queue_tuning_;  /// optional, empty - the profile as is
 };
 
 } // namespace usbmount::dal
\ No newline at end of file
@@ -54,9 +54,10 @@ void Mountpoints::DataFromRawJson() {
   }
   const json::array arr = val.as_array();
   std::unique_lock<std::shared_mutex> lock;
-  if (!transaction_started_) {
+  if (!InTransaction()) {
     lock = std::unique_lock(data_mutex_);
   }
+  InvalidateCache();
   for (const json::value &element : arr) {
     if (!element.is_object()) {
       throw std::runtime_error("not an object");
@@ -71,7 +72,7 @@ void Mountpoints::DataFromRawJson() {
     data_.emplace(obj.at("id").to_number<uint64_t>(),
                   std::make_shared<MountEntry>(obj));
   }
-  if (!transaction_started_) {
+  if (!InTransaction()) {
     lock.unlock();
   }
 }
@@ -82,14 +83,15 @@ void Mountpoints::Create(const Dto &dto) {
   auto index = Find(entry);
   if (!index) {
     std::unique_lock<std::shared_mutex> lock;
-    if (!transaction_started_) {
+    if (!InTransaction()) {
       lock = std::unique_lock(data_mutex_);
     }
     index = data_.empty() ? 0 : (data_.rbegin()->first) + 1;
     if (index) {
       data_.emplace(*index, std::make_shared<MountEntry>(entry));
+      InvalidateCache(*index);
     }
-    if (!transaction_started_) {
+    if (!InTransaction()) {
       lock.unlock();
       WriteRaw();
     }
@@ -99,7 +101,7 @@ void Mountpoints::Create(const Dto &dto) {
 const MountEntry &Mountpoints::Read(uint64_t index) const {
   CheckIndex(index);
   std::shared_lock<std::shared_mutex> lock;
-  if (!transaction_started_) {
+  if (!InTransaction()) {
     lock = std::shared_lock(data_mutex_);
   }
   auto entry = std::dynamic_pointer_cast<MountEntry>(data_.at(index));
@@ -113,11 +115,12 @@ void Mountpoints::Update(uint64_t index, const Dto &dto) {
   const auto &entry = dynamic_cast<const MountEntry &>(dto);
   CheckIndex(index);
   std::unique_lock<std::shared_mutex> lock;
-  if (!transaction_started_) {
+  if (!InTransaction()) {
     lock = std::unique_lock(data_mutex_);
   }
   data_.at(index) = std::make_shared<MountEntry>(entry);
-  if (!transaction_started_) {
+  InvalidateCache(index);
+  if (!InTransaction()) {
     lock.unlock();
     WriteRaw();
   }
@@ -126,7 +129,7 @@ void Mountpoints::Update(uint64_t index, const Dto &dto) {
 std::optional<uint64_t>
 Mountpoints::Find(const MountEntry &entry) const noexcept {
   std::shared_lock<std::shared_mutex> lock;
-  if (!transaction_started_) {
+  if (!InTransaction()) {
     lock = std::shared_lock(data_mutex_);
   }
   auto it_found = std::find_if(
@@ -145,7 +148,7 @@ Mountpoints::Find(const MountEntry &entry) const noexcept {
 std::optional<uint64_t>
 Mountpoints::Find(const std::string &block_dev) const noexcept {
   std::shared_lock<std::shared_mutex> lock;
-  if (!transaction_started_) {
+  if (!InTransaction()) {
     lock = std::shared_lock(data_mutex_);
   }
   auto it_found = std::find_if(
@@ -165,18 +168,19 @@ Mountpoints::Find(const std::string &block_dev) const noexcept {
 void Mountpoints::RemoveExpired(
     const std::unordered_set<std::string> &valid_set) noexcept {
   std::unique_lock<std::shared_mutex> lock;
-  if (!transaction_started_) {
+  if (!InTransaction()) {
     lock = std::unique_lock(data_mutex_);
   }
   for (auto it = data_.cbegin(); it != data_.cend();) {
     auto mnt_entry = std::dynamic_pointer_cast<MountEntry>(it->second);
     if (mnt_entry && valid_set.count(mnt_entry->mount_point()) == 0) {
+      InvalidateCache(it->first);
       it = data_.erase(it);
     } else {
       ++it;
     }
   }
-  if (!transaction_started_) {
+  if (!InTransaction()) {
     lock.unlock();
     WriteRaw();
   }
@@ -184,7 +188,7 @@ void Mountpoints::RemoveExpired(
 
 std::vector<MountEntry> Mountpoints::GetAll() const noexcept {
   std::shared_lock<std::shared_mutex> lock;
-  if (!transaction_started_) {
+  if (!InTransaction()) {
     lock = std::shared_lock(data_mutex_);
   }
   std::vector<MountEntry> res;
@@ -19,6 +19,7 @@
 */
 
 #include "table.hpp"
+#include <cstddef>
 #include <cstdint>
 #include <exception>
 #include <filesystem>
@@ -30,18 +31,76 @@
 #include <boost/json.hpp>
 #include <boost/json/array.hpp>
 #include <boost/json/object.hpp>
+#include <boost/json/serialize.hpp>
 #include <mutex>
 #include <shared_mutex>
 #include <stdexcept>
 #include <string>
+#include <thread>
 #include <utility>
 
 namespace usbmount::dal {
 
 namespace fs = std::filesystem;
 
+namespace {
+// The row format of a data file - an entry object with an "id" field.
+std::string RowWithId(uint64_t index, const Dto &dto) {
+  json::object obj = dto.ToJson().as_object();
+  obj["id"] = index;
+  return json::serialize(obj);
+}
+} // namespace
+
+// SerializationCache
+SerializationCache::SerializationCache(Formatter formatter)
+    : formatter_(std::move(formatter)) {}
+
+std::string SerializationCache::Get(
+    const std::map<uint64_t, std::shared_ptr<Dto>> &data) {
+  const std::lock_guard<std::mutex> lock(mutex_);
+  if (array_valid_) {
+    return array_;
+  }
+  size_t total_size = 2;
+  for (const auto &entry : data) {
+    auto it_row = rows_.find(entry.first);
+    if (it_row == rows_.end()) {
+      it_row =
+          rows_.emplace(entry.first, formatter_(entry.first, *entry.second))
+              .first;
+    }
+    total_size += it_row->second.size() + 1;
+  }
+  array_.clear();
+  array_.reserve(total_size);
+  array_ += '[';
+  for (const auto &entry : data) {
+    if (array_.size() > 1) {
+      array_ += ',';
+    }
+    array_ += rows_.at(entry.first);
+  }
+  array_ += ']';
+  array_valid_ = true;
+  return array_;
+}
+
+void SerializationCache::Invalidate(uint64_t index) noexcept {
+  const std::lock_guard<std::mutex> lock(mutex_);
+  rows_.erase(index);
+  array_valid_ = false;
+}
+
+void SerializationCache::Invalidate() noexcept {
+  const std::lock_guard<std::mutex> lock(mutex_);
+  rows_.clear();
+  array_valid_ = false;
+}
+
 // CRUD Table
-Table::Table(const std::string &data_file_path) : file_path_(data_file_path) {
+Table::Table(const std::string &data_file_path)
+    : file_path_(data_file_path), cache_(RowWithId) {
   if (!fs::exists(file_path_)) {
     std::unique_lock<std::shared_mutex> lock(file_mutex_);
     fs::create_directories(fs::path(file_path_).parent_path());
@@ -61,7 +120,7 @@ void Table::ReadRaw() {
     return;
   }
   std::shared_lock<std::shared_mutex> lock;
-  if (!transaction_started_) {
+  if (!InTransaction()) {
     lock = std::shared_lock(file_mutex_);
   }
   std::ifstream file(file_path_);
@@ -75,16 +134,24 @@ void Table::ReadRaw() {
 
 void Table::WriteRaw() {
   std::unique_lock<std::shared_mutex> lock;
-  if (!transaction_started_) {
+  if (!InTransaction()) {
     lock = std::unique_lock(file_mutex_);
   }
+  // a failed serialization must not truncate the file
+  std::string content = SerializeData();
+  // nothing has changed since the last write
+  if (content == written_) {
+    return;
+  }
   std::ofstream file(file_path_, std::ios_base::out);
   if (!file.is_open()) {
     throw std::runtime_error("Can't open " + file_path_);
   }
-  file << Serialize();
+  file << content;
   file.close();
-  if (!transaction_started_) {
+  written_ = std::move(content);
+  ++generation_;
+  if (!InTransaction()) {
     lock.unlock();
   }
 }
@@ -92,7 +159,7 @@ void Table::WriteRaw() {
 json::value Table::ToJson() const noexcept {
   json::array res;
   std::shared_lock<std::shared_mutex> lock;
-  if (!transaction_started_) {
+  if (!InTransaction()) {
     lock = std::shared_lock(data_mutex_);
   }
   for (const auto &entry : data_) {
@@ -103,9 +170,31 @@ json::value Table::ToJson() const noexcept {
   return res;
 }
 
+std::string Table::Serialize() const noexcept {
+  try {
+    return SerializeData();
+  } catch (const std::exception &) {
+    return {};
+  }
+}
+
+std::string Table::SerializeData() const {
+  std::shared_lock<std::shared_mutex> lock;
+  if (!InTransaction()) {
+    lock = std::shared_lock(data_mutex_);
+  }
+  return cache_.Get(data_);
+}
+
+void Table::InvalidateCache(uint64_t index) noexcept {
+  cache_.Invalidate(index);
+}
+
+void Table::InvalidateCache() noexcept { cache_.Invalidate(); }
+
 void Table::CheckIndex(uint64_t index) const {
   std::shared_lock<std::shared_mutex> lock;
-  if (!transaction_started_) {
+  if (!InTransaction()) {
     lock = std::shared_lock(data_mutex_);
   }
   if (data_.count(index) == 0) {
@@ -115,11 +204,12 @@ void Table::CheckIndex(uint64_t index) const {
 
 void Table::Delete(uint64_t index) {
   std::unique_lock<std::shared_mutex> lock;
-  if (!transaction_started_) {
+  if (!InTransaction()) {
     lock = std::unique_lock(data_mutex_);
   }
   data_.erase(index);
-  if (!transaction_started_) {
+  InvalidateCache(index);
+  if (!InTransaction()) {
     lock.unlock();
     WriteRaw();
   }
@@ -129,11 +219,12 @@ uint64_t Table::size() const noexcept { return data_.size(); }
 
 void Table::Clear() {
   std::unique_lock<std::shared_mutex> lock;
-  if (!transaction_started_) {
+  if (!InTransaction()) {
     lock = std::unique_lock(data_mutex_);
   }
   data_.clear();
-  if (!transaction_started_) {
+  InvalidateCache();
+  if (!InTransaction()) {
     lock.unlock();
     WriteRaw();
   }
@@ -141,30 +232,42 @@ void Table::Clear() {
 
 void Table::StartTransaction() noexcept {
   transaction_mutex_.lock();
-  transaction_started_ = true;
   transaction_data_lock_ = std::unique_lock(data_mutex_);
   transaction_file_lock_ = std::unique_lock(file_mutex_);
+  // the locks are skipped only by this thread
+  transaction_owner_ = std::this_thread::get_id();
+  DeepDataClone();
 }
 
 bool Table::ProcessTransaction() noexcept {
   try {
-    DeepDataClone();
     WriteRaw();
   } catch (const std::exception &ex) {
-    std::swap(data_, data_clone_);
-    data_clone_.clear();
-    transaction_file_lock_.unlock();
-    transaction_data_lock_.unlock();
-    transaction_mutex_.unlock();
-    transaction_started_ = false;
+    RollbackLocked();
+    ReleaseTransaction();
     return false;
   }
+  data_clone_.clear();
+  ReleaseTransaction();
+  return true;
+}
+
+void Table::AbortTransaction() noexcept {
+  RollbackLocked();
+  ReleaseTransaction();
+}
+
+void Table::RollbackLocked() noexcept {
+  std::swap(data_, data_clone_);
+  data_clone_.clear();
+  InvalidateCache();
+}
+
+void Table::ReleaseTransaction() noexcept {
+  transaction_owner_ = std::thread::id();
   transaction_file_lock_.unlock();
   transaction_data_lock_.unlock();
-  transaction_started_ = false;
   transaction_mutex_.unlock();
-
-  return true;
 }
 
 void Table::DeepDataClone() {
@@ -20,16 +20,51 @@
 
 #pragma once
 #include "dto.hpp"
+#include <atomic>
 #include <boost/json/value.hpp>
 #include <cstdint>
+#include <functional>
 #include <map>
 #include <memory>
 #include <mutex>
 #include <shared_mutex>
 #include <string>
+#include <thread>
 
 namespace usbmount::dal {
 
+/**
+ * @brief Cache of serialized rows.
+ * @details Each row is serialized once and kept as a JSON fragment, the
+ * fragments are spliced into an array on demand. The whole array is kept
+ * until the next invalidation.
+ */
+class SerializationCache {
+public:
+  using Formatter = std::function<std::string(uint64_t, const Dto &)>;
+
+  explicit SerializationCache(Formatter formatter);
+
+  /**
+   * @brief Get serialized array for data
+   * @details Only rows without a cached fragment are serialized.
+   */
+  std::string Get(const std::map<uint64_t, std::shared_ptr<Dto>> &data);
+
+  /// @brief Drop a fragment for one row and the spliced array
+  void Invalidate(uint64_t index) noexcept;
+
+  /// @brief Drop all cached data
+  void Invalidate() noexcept;
+
+private:
+  Formatter formatter_;
+  std::mutex mutex_;
+  std::map<uint64_t, std::string> rows_;
+  std::string array_;
+  bool array_valid_ = false;
+};
+
 // CRUD table
 class Table : public Dto {
 public:
@@ -41,9 +76,23 @@ public:
   ~Table() override = default;
   json::value ToJson() const noexcept override;
 
+  /**
+   * @brief Serialize the table
+   * @details The result is cached and invalidated by modifying methods.
+   * @return empty string on a serialization error
+   */
+  std::string Serialize() const noexcept override;
+
   void Clear();
   uint64_t size() const noexcept;
 
+  /**
+   * @brief Generation of the data
+   * @details Incremented each time a changed table is written to the file.
+   * Starts from zero on each start of the daemon.
+   */
+  uint64_t generation() const noexcept { return generation_.load(); }
+
   virtual void Create(const Dto &) = 0;
   virtual const Dto &Read(uint64_t) const = 0;
   virtual void Update(uint64_t, const Dto &) = 0;
@@ -51,16 +100,35 @@ public:
 
   /**
    * @brief Transactions can be used for modifing method - CREATE,UPDATE,DELETE
+   * @details The transaction belongs to the thread that started it, other
+   * threads wait for the table locks until it is processed or aborted.
    */
   void StartTransaction() noexcept;
+  /// @brief Write the changes, they are rolled back if the write fails
   bool ProcessTransaction() noexcept;
+  /// @brief Drop the changes made since StartTransaction
+  void AbortTransaction() noexcept;
 
 protected:
   void CheckIndex(uint64_t index) const;
+  /// @throws std::exception the file is kept as is
   void WriteRaw();
+  /// @throws std::exception if a row can't be serialized
+  std::string SerializeData() const;
+
+  /// @brief The calling thread holds the locks of a transaction
+  bool InTransaction() const noexcept {
+    return transaction_owner_.load() == std::this_thread::get_id();
+  }
+
+  /// @brief Must be called on every change of a row (data_ is locked)
+  virtual void InvalidateCache(uint64_t index) noexcept;
+  /// @brief Must be called when the whole data_ is replaced (data_ is locked)
+  virtual void InvalidateCache() noexcept;
+
   // NOLINTBEGIN
   std::mutex transaction_mutex_;
-  bool transaction_started_ = false;
+  std::atomic<std::thread::id> transaction_owner_{};
   std::string raw_json_;
   static constexpr const char *kWrongArg = "no data with such index";
   std::map<uint64_t, std::shared_ptr<Dto>> data_;
@@ -72,9 +140,15 @@ private:
   void ReadRaw();
   virtual void DataFromRawJson() = 0;
   void DeepDataClone();
+  void RollbackLocked() noexcept;
+  void ReleaseTransaction() noexcept;
 
   const std::string file_path_; // path to data file
+  std::string written_;         // last content written to the file
+  std::atomic<uint64_t> generation_{0};
+  mutable SerializationCache cache_;
 
+  /// the data before the transaction
   std::map<uint64_t, std::shared_ptr<Dto>> data_clone_;
   std::unique_lock<std::shared_mutex> transaction_data_lock_;
   std::unique_lock<std::shared_mutex> transaction_file_lock_;
@@ -24,6 +24,7 @@
 #include <boost/json/parse.hpp>
 #include <boost/json/serialize.hpp>
 #include <boost/json/value.hpp>
+#include <chrono>
 #include <climits>
 #include <cstddef>
 #include <fstream>
@@ -145,6 +146,19 @@ TEST_CASE("Test DTO objects"){
                             {{0,"root"}},{{500,""}}));
      REQUIRE_THROWS(PermissionEntry(Device({"00","0000","234958098"}),
                             {},{}));                                                      
+     // optional, written only if set
+     const PermissionEntry tuned(Device({"00","0000","234958098"}),
+                            {{0,"root"}},{{500,"groupName"}},"noatime,-flush");
+     REQUIRE(tuned.Serialize()==js_string.substr(0,js_string.size()-1)+
+                            ",\"mount_options\":\"noatime,-flush\"}");
+     REQUIRE(PermissionEntry(tuned.ToJson().as_object()).getMountOptions()=="noatime,-flush");
+     REQUIRE(PermissionEntry(json::parse(js_string).as_object()).getMountOptions().empty());
+     const PermissionEntry queue(Device({"00","0000","234958098"}),
+                            {{0,"root"}},{{500,"groupName"}},"","read_ahead_kb=4096");
+     REQUIRE(queue.Serialize()==js_string.substr(0,js_string.size()-1)+
+                            ",\"queue_tuning\":\"read_ahead_kb=4096\"}");
+     REQUIRE(PermissionEntry(queue.ToJson().as_object()).getQueueTuning()=="read_ahead_kb=4096");
+     REQUIRE(PermissionEntry(json::parse(js_string).as_object()).getQueueTuning().empty());
   }
 }
 
@@ -410,7 +424,174 @@ TEST_CASE("Write from threads"){
     REQUIRE(permsdb.size()==0);
   }
 
+  SECTION("Transaction belongs to its thread"){
+    auto& permsdb=LocalStorage::GetStorage()->permissions;
+    permsdb.Clear();
+    permsdb.StartTransaction();
+    permsdb.Create(PermissionEntry(Device({"00","0000","234958098"}),
+                              {{0,"root"}},{{500,"groupName"}}));
+    // another thread waits for the transaction instead of reading unlocked
+    auto reader=std::async(std::launch::async,[&permsdb](){
+      return permsdb.Find(Device({"00","0000","234958098"})).has_value();
+    });
+    REQUIRE(reader.wait_for(std::chrono::milliseconds(100))==std::future_status::timeout);
+    REQUIRE(permsdb.ProcessTransaction());
+    REQUIRE(reader.get());
+    permsdb.Clear();
+  }
+
+  SECTION("Aborted transaction"){
+    auto& permsdb=LocalStorage::GetStorage()->permissions;
+    permsdb.Clear();
+    permsdb.Create(PermissionEntry(Device({"00","0000","234958098"}),
+                              {{0,"root"}},{{500,"groupName"}}));
+    const auto generation=permsdb.generation();
+    const std::string serialized=permsdb.Serialize();
+    permsdb.StartTransaction();
+    permsdb.Clear();
+    permsdb.Create(PermissionEntry(Device({"00d","00da","0000"}),
+                              {{1,"test"}},{{501,"groupName2"}}));
+    permsdb.AbortTransaction();
+    REQUIRE(permsdb.size()==1);
+    REQUIRE(permsdb.Find(Device({"00","0000","234958098"})));
+    REQUIRE(!permsdb.Find(Device({"00d","00da","0000"})));
+    REQUIRE(permsdb.Serialize()==serialized);
+    REQUIRE(permsdb.generation()==generation);
+    // the table is usable after the abort
+    permsdb.StartTransaction();
+    permsdb.Clear();
+    REQUIRE(permsdb.ProcessTransaction());
+    REQUIRE(permsdb.size()==0);
+  }
+
+
+}
+
+TEST_CASE("Serialization cache"){
+  auto& permsdb=LocalStorage::GetStorage()->permissions;
+  permsdb.Clear();
+  REQUIRE(permsdb.SerializeRulesList()=="[]");
+  permsdb.Create(
+    PermissionEntry(Device({"00","0000","234958098"}),
+                          {{0,"root"}},{{500,"groupName"}})
+  );
+  permsdb.Create(
+    PermissionEntry(Device({"00d","00da","0000"}),
+                          {{1,"test"}},{{501,"groupName2"}})
+  );
+  REQUIRE(permsdb.Serialize()==json::serialize(permsdb.ToJson()));
+  // the cached value is returned until the table changes
+  REQUIRE(permsdb.Serialize()==permsdb.Serialize());
+  {
+    auto snapshot=permsdb.GetSnapshot();
+    REQUIRE(snapshot.rules.size()==2);
+    REQUIRE(snapshot.rules_list==permsdb.SerializeRulesList());
+    REQUIRE(snapshot.generation==permsdb.generation());
+  }
+  REQUIRE(permsdb.SerializeRulesList()=="[{\"id\":\"0\",\"perm\":{\"device\":{\"vid\":\"00\",\"pid\":\"0000\",\"serial\":\"234958098\"},\"users\":[{\"uid\":0,\"name\":\"root\"}],\"groups\":[{\"gid\":500,\"name\":\"groupName\"}]}},"
+                                        "{\"id\":\"1\",\"perm\":{\"device\":{\"vid\":\"00d\",\"pid\":\"00da\",\"serial\":\"0000\"},\"users\":[{\"uid\":1,\"name\":\"test\"}],\"groups\":[{\"gid\":501,\"name\":\"groupName2\"}]}}]");
+  // update invalidates only the changed row
+  permsdb.Update(1,PermissionEntry(Device({"00d","00da","1111"}),
+                          {{1,"test"}},{{501,"groupName2"}}));
+  REQUIRE(permsdb.Serialize()==json::serialize(permsdb.ToJson()));
+  REQUIRE(boost::contains(permsdb.SerializeRulesList(),"1111"));
+  REQUIRE(!boost::contains(permsdb.SerializeRulesList(),"\"serial\":\"0000\""));
+  // delete
+  permsdb.Delete(0);
+  REQUIRE(permsdb.Serialize()==json::serialize(permsdb.ToJson()));
+  REQUIRE(!boost::contains(permsdb.SerializeRulesList(),"234958098"));
+  // deletion inside a transaction
+  permsdb.StartTransaction();
+  permsdb.Delete(1);
+  permsdb.ProcessTransaction();
+  REQUIRE(permsdb.Serialize()=="[]");
+  REQUIRE(permsdb.SerializeRulesList()=="[]");
+  {
+    std::ifstream file("/var/lib/alt-usb-mount/permissions.json");
+    std::stringstream string_stream;
+    string_stream<< file.rdbuf();
+    REQUIRE(string_stream.str()=="[]");
+  }
+}
 
+TEST_CASE("Indexed device lookup"){
+  auto& permsdb=LocalStorage::GetStorage()->permissions;
+  permsdb.Clear();
+  REQUIRE(!permsdb.Find("00","0000","234958098").has_value());
+  permsdb.Create(
+    PermissionEntry(Device({"00","0000","234958098"}),
+                          {{0,"root"}},{{500,"groupName"}})
+  );
+  permsdb.Create(
+    PermissionEntry(Device({"00d","00da","0000"}),
+                          {{1,"test"}},{{501,"groupName2"}})
+  );
+  // the same device - the first rule wins
+  permsdb.Create(
+    PermissionEntry(Device({"00","0000","234958098"}),
+                          {{1,"test"}},{{501,"groupName2"}})
+  );
+  REQUIRE(permsdb.Find("00","0000","234958098")==0);
+  REQUIRE(permsdb.Find(Device({"00d","00da","0000"}))==1);
+  REQUIRE(!permsdb.Find("00d","00da","").has_value());
+  permsdb.Delete(0);
+  REQUIRE(permsdb.Find("00","0000","234958098")==2);
+  permsdb.Update(1,PermissionEntry(Device({"00d","00da","1111"}),
+                          {{1,"test"}},{{501,"groupName2"}}));
+  REQUIRE(!permsdb.Find("00d","00da","0000").has_value());
+  REQUIRE(permsdb.Find("00d","00da","1111")==1);
+  permsdb.StartTransaction();
+  permsdb.Delete(1);
+  permsdb.ProcessTransaction();
+  REQUIRE(!permsdb.Find("00d","00da","1111").has_value());
+  permsdb.Clear();
+  REQUIRE(!permsdb.Find("00","0000","234958098").has_value());
+}
+
+TEST_CASE("Rules pages"){
+  auto& permsdb=LocalStorage::GetStorage()->permissions;
+  permsdb.Clear();
+  permsdb.StartTransaction();
+  for (int i=0;i<25;++i){
+    permsdb.Create(
+      PermissionEntry(Device({"0781","5567",std::to_string(1000+i)}),
+                      {{0,i%2==0 ? "root":"test"}},{{500,"groupName"}}));
+  }
+  permsdb.ProcessTransaction();
+  DevicePermissions::Filter filter;
+  // walk all pages
+  uint64_t cursor=0;
+  size_t total=0;
+  while (true){
+    auto page=permsdb.GetPage(cursor,10,filter);
+    total+=page.rules.size();
+    if (!page.next) break;
+    REQUIRE(page.rules.size()==10);
+    REQUIRE(*page.next>page.rules.back().first);
+    cursor=*page.next;
+  }
+  REQUIRE(total==25);
+  // user index + device substring
+  filter.user="test";
+  auto page=permsdb.GetPage(0,100,filter);
+  REQUIRE(page.rules.size()==12);
+  REQUIRE(!page.next);
+  filter.device="101";
+  page=permsdb.GetPage(0,100,filter);
+  REQUIRE(page.rules.size()==5);
+  for (const auto& rule:page.rules){
+    REQUIRE(rule.first%2==1);
+  }
+  filter.group="nobody";
+  REQUIRE(permsdb.GetPage(0,100,filter).rules.empty());
+  // the cursor is stable when a rule before it is deleted
+  filter={};
+  page=permsdb.GetPage(0,5,filter);
+  REQUIRE(page.next==5);
+  permsdb.Delete(0);
+  page=permsdb.GetPage(*page.next,5,filter);
+  REQUIRE(page.rules.front().first==5);
+  permsdb.Clear();
 }
 
 TEST_CASE("CreateInitialDb"){
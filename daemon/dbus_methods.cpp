@@ -21,36 +21,60 @@
 // NOLINTBEGIN(misc-include-cleaner)
 
 #include "dbus_methods.hpp"
+#include "acl_template.hpp"
 #include "dal/dto.hpp"
 #include "dal/local_storage.hpp"
+#include "events.hpp"
+#include "method_dispatcher.hpp"
+#include "metrics.hpp"
+#include "mount_profiles.hpp"
+#include "polkit_snapshot.hpp"
+#include "principal_directory.hpp"
+#include "queue_tuning.hpp"
+#include "rules_transfer.hpp"
+#include "system_accounts.hpp"
 #include "udev_monitor.hpp"
 #include "usb_udev_device.hpp"
+#include "usbd_types.hpp"
 #include "utils.hpp"
-#include <algorithm>
+#include "watchdog.hpp"
 #include <boost/json.hpp>
 #include <boost/json/array.hpp>
 #include <boost/json/object.hpp>
 #include <boost/json/parse.hpp>
 #include <boost/json/serialize.hpp>
 #include <boost/json/value.hpp>
+#include <chrono>
 #include <cstdint>
 #include <exception>
+#include <functional>
 #include <iterator>
+#include <map>
 #include <memory>
+#include <mutex>
+#include <optional>
 #include <sdbus-c++/IConnection.h>
+#include <sdbus-c++/Error.h>
+#include <sdbus-c++/IProxy.h>
 #include <sdbus-c++/Message.h>
+#include <sdbus-c++/Types.h>
 #include <sdbus-c++/VTableItems.h>
 #include <sdbus-c++/sdbus-c++.h>
+#include <set>
 #include <spdlog/spdlog.h>
 #include <stdexcept>
 #include <string>
 #include <sys/socket.h>
+#include <systemd/sd-bus.h>
+#include <tuple>
+#include <unordered_map>
 #include <utility>
 #include <vector>
 
 namespace usbmount {
 
 namespace json = boost::json;
+namespace usbd = dbus_bindings::usbd;
 
 DbusMethods::DbusMethods(std::shared_ptr<UdevMonitor> udev_monitor,
                          std::shared_ptr<spdlog::logger> logger)
@@ -58,9 +82,24 @@ DbusMethods::DbusMethods(std::shared_ptr<UdevMonitor> udev_monitor,
       interface_name_obj_{interface_name},
       connection_(sdbus::createSystemBusConnection(service_name_obj_)),
       dbus_object_ptr(sdbus::createObject(*connection_, object_path_obj_)),
+      health_proxy_(sdbus::createProxy(*connection_, service_name_obj_,
+                                       object_path_obj_)),
       logger_(std::move(logger)), dbase_(dal::LocalStorage::GetStorage()),
-      udev_monitor_(std::move(udev_monitor)) {
+      udev_monitor_(std::move(udev_monitor)),
+      polkit_snapshot_(common_utils::polkit::kSnapshotPath),
+      dispatcher_(kFastLaneWorkers, kWorkers, logger_) {
   // NOLINTEND(misc-include-cleaner)
+  // libudev context of UdevMonitor is not thread safe
+  dispatcher_.SetLimit(kUdevEnumeration, 1);
+  // rules are saved in one transaction
+  dispatcher_.SetLimit("SaveRules", 1);
+  // reads the whole passwd and group
+  dispatcher_.SetLimit("GetUsersAndGroups", 2);
+  // one NSS enumeration at a time anyway, keep a worker for other methods
+  dispatcher_.SetLimit(usbd::kSearchPrincipals, 2);
+  // builds a line per rule, one client at a time
+  dispatcher_.SetLimit(usbd::kExportRules, 1);
+  RegisterMetrics();
   dbus_object_ptr
       ->addVTable(
           sdbus::MethodVTableItem{sdbus::MethodName{"health"},
@@ -75,9 +114,10 @@ DbusMethods::DbusMethods(std::shared_ptr<UdevMonitor> udev_monitor,
                                   {},
                                   sdbus::Signature{"s"},
                                   {},
-                                  [this](const sdbus::MethodCall &call) {
-                                    ListActiveDevices(call);
-                                  },
+                                  Deferred(Lane::kNormal, "ListDevices",
+                                           [this](sdbus::MethodCall call) {
+                                             ListActiveDevices(call);
+                                           }),
                                   {}},
           sdbus::MethodVTableItem{
               sdbus::MethodName{"ListRules"},
@@ -85,25 +125,102 @@ DbusMethods::DbusMethods(std::shared_ptr<UdevMonitor> udev_monitor,
               {},
               sdbus::Signature{"s"},
               {},
-              [this](const sdbus::MethodCall &call) { ListActiveRules(call); },
+              Deferred(Lane::kNormal, "ListRules",
+                       [this](sdbus::MethodCall call) {
+                         ListActiveRules(call);
+                       }),
+              {}},
+          sdbus::MethodVTableItem{
+              sdbus::MethodName{usbd::kListDevicesV2},
+              sdbus::Signature{""},
+              {},
+              sdbus::Signature{usbd::kListDevicesV2Signature},
+              {},
+              Deferred(Lane::kNormal, usbd::kListDevicesV2,
+                       [this](sdbus::MethodCall call) {
+                         ListActiveDevicesV2(call);
+                       }),
+              {}},
+          sdbus::MethodVTableItem{
+              sdbus::MethodName{usbd::kListRulesV2},
+              sdbus::Signature{""},
+              {},
+              sdbus::Signature{usbd::kListRulesV2Signature},
+              {},
+              Deferred(Lane::kNormal, usbd::kListRulesV2,
+                       [this](sdbus::MethodCall call) {
+                         ListActiveRulesV2(call);
+                       }),
               {}},
           sdbus::MethodVTableItem{sdbus::MethodName{"GetUsersAndGroups"},
                                   sdbus::Signature{""},
                                   {},
                                   sdbus::Signature{"s"},
                                   {},
-                                  [this](const sdbus::MethodCall &call) {
-                                    GetSystemUsersAndGroups(call);
-                                  },
+                                  Deferred(Lane::kNormal, "GetUsersAndGroups",
+                                           [this](sdbus::MethodCall call) {
+                                             GetSystemUsersAndGroups(call);
+                                           }),
                                   {}},
+          sdbus::MethodVTableItem{
+              sdbus::MethodName{usbd::kListRulesPage},
+              sdbus::Signature{usbd::kListRulesPageInSignature},
+              {"cursor", "limit", "filter"},
+              sdbus::Signature{usbd::kListRulesPageSignature},
+              {"rules", "has_next", "next_cursor"},
+              Deferred(Lane::kNormal, usbd::kListRulesPage,
+                       [this](sdbus::MethodCall call) {
+                         ListRulesPage(std::move(call));
+                       }),
+              {}},
+          sdbus::MethodVTableItem{
+              sdbus::MethodName{usbd::kSearchPrincipals},
+              sdbus::Signature{usbd::kSearchPrincipalsInSignature},
+              {"prefix", "kind", "limit"},
+              sdbus::Signature{usbd::kSearchPrincipalsSignature},
+              {"principals"},
+              Deferred(Lane::kNormal, usbd::kSearchPrincipals,
+                       [this](sdbus::MethodCall call) {
+                         SearchPrincipals(std::move(call));
+                       }),
+              {}},
+          sdbus::MethodVTableItem{
+              sdbus::MethodName{usbd::kGetMetrics},
+              sdbus::Signature{""},
+              {},
+              sdbus::Signature{usbd::kGetMetricsSignature},
+              {"metrics"},
+              Deferred(Lane::kNormal, usbd::kGetMetrics,
+                       [this](sdbus::MethodCall call) { GetMetrics(call); }),
+              {}},
+          sdbus::MethodVTableItem{
+              sdbus::MethodName{usbd::kGetQueueTuning},
+              sdbus::Signature{""},
+              {},
+              sdbus::Signature{usbd::kGetQueueTuningSignature},
+              {"settings"},
+              Deferred(Lane::kNormal, usbd::kGetQueueTuning,
+                       [](sdbus::MethodCall call) { GetQueueTuning(call); }),
+              {}},
+          sdbus::MethodVTableItem{
+              sdbus::MethodName{usbd::kGetSnapshot},
+              sdbus::Signature{""},
+              {},
+              sdbus::Signature{usbd::kGetSnapshotSignature},
+              {"generation", "health", "users_groups", "rules", "devices"},
+              Deferred(Lane::kNormal, usbd::kGetSnapshot,
+                       [this](sdbus::MethodCall call) { GetSnapshot(call); }),
+              {}},
           sdbus::MethodVTableItem{sdbus::MethodName{"CanAnotherUserUnmount"},
                                   sdbus::Signature{"s"},
                                   {},
                                   sdbus::Signature{"s"},
                                   {},
-                                  [this](sdbus::MethodCall call) {
-                                    CanAnotherUserUnmount(std::move(call));
-                                  },
+                                  Deferred(Lane::kFast, "CanAnotherUserUnmount",
+                                           [this](sdbus::MethodCall call) {
+                                             CanAnotherUserUnmount(
+                                                 std::move(call));
+                                           }),
                                   {}},
           sdbus::MethodVTableItem{
               sdbus::MethodName{"CanUserMount"},
@@ -111,7 +228,10 @@ DbusMethods::DbusMethods(std::shared_ptr<UdevMonitor> udev_monitor,
               {},
               sdbus::Signature{"s"},
               {},
-              [this](sdbus::MethodCall call) { CanUserMount(std::move(call)); },
+              Deferred(Lane::kFast, "CanUserMount",
+                       [this](sdbus::MethodCall call) {
+                         CanUserMount(std::move(call));
+                       }),
               {}},
           sdbus::MethodVTableItem{
               sdbus::MethodName{"SaveRules"},
@@ -119,8 +239,61 @@ DbusMethods::DbusMethods(std::shared_ptr<UdevMonitor> udev_monitor,
               {},
               sdbus::Signature{"s"},
               {},
-              [this](sdbus::MethodCall call) { SaveRules(std::move(call)); },
-              {}})
+              Deferred(Lane::kNormal, "SaveRules",
+                       [this](sdbus::MethodCall call) {
+                         SaveRules(std::move(call));
+                       }),
+              {}},
+          sdbus::MethodVTableItem{
+              sdbus::MethodName{usbd::kImportRules},
+              sdbus::Signature{usbd::kImportRulesInSignature},
+              {"fd", "mode"},
+              sdbus::Signature{usbd::kImportRulesSignature},
+              {"created", "skipped"},
+              Deferred(Lane::kNormal, usbd::kImportRules,
+                       [this](sdbus::MethodCall call) {
+                         ImportRules(std::move(call));
+                       }),
+              {}},
+          sdbus::MethodVTableItem{
+              sdbus::MethodName{usbd::kExportRules},
+              sdbus::Signature{usbd::kExportRulesInSignature},
+              {"fd"},
+              sdbus::Signature{usbd::kExportRulesSignature},
+              {"exported"},
+              Deferred(Lane::kNormal, usbd::kExportRules,
+                       [this](sdbus::MethodCall call) {
+                         ExportRules(std::move(call));
+                       }),
+              {}},
+          sdbus::SignalVTableItem{sdbus::SignalName{usbd::kDeviceAdded},
+                                  sdbus::Signature{"sssss"},
+                                  {"block", "vid", "pid", "serial", "fs"},
+                                  {}},
+          sdbus::SignalVTableItem{sdbus::SignalName{usbd::kDeviceRemoved},
+                                  sdbus::Signature{"s"},
+                                  {"block"},
+                                  {}},
+          sdbus::SignalVTableItem{sdbus::SignalName{usbd::kMounted},
+                                  sdbus::Signature{"ss"},
+                                  {"block", "mount_point"},
+                                  {}},
+          sdbus::SignalVTableItem{sdbus::SignalName{usbd::kUnmounted},
+                                  sdbus::Signature{"ss"},
+                                  {"block", "mount_point"},
+                                  {}},
+          sdbus::SignalVTableItem{sdbus::SignalName{usbd::kMountFailed},
+                                  sdbus::Signature{"ss"},
+                                  {"block", "reason"},
+                                  {}},
+          sdbus::SignalVTableItem{sdbus::SignalName{usbd::kUnmountFailed},
+                                  sdbus::Signature{"ss"},
+                                  {"block", "reason"},
+                                  {}},
+          sdbus::SignalVTableItem{sdbus::SignalName{usbd::kRulesChanged},
+                                  sdbus::Signature{"t"},
+                                  {"generation"},
+                                  {}})
       .forInterface(interface_name_obj_);
 
   // dbus_object_ptr->registerMethod(interface_name_obj_, "health", "", "s",
@@ -155,7 +328,175 @@ DbusMethods::DbusMethods(std::shared_ptr<UdevMonitor> udev_monitor,
   // dbus_object_ptr->finishRegistration();
 }
 
-void DbusMethods::Run() { connection_->enterEventLoopAsync(); }
+DbusMethods::~DbusMethods() noexcept {
+  try {
+    // joins the event loop thread, no new calls are dispatched
+    connection_->leaveEventLoop();
+  } catch (const std::exception &ex) {
+    logger_->error("[DBUS] Can't leave the event loop {}", ex.what());
+  }
+  health_proxy_.reset();
+  dbus_object_ptr.reset();
+  // the queued calls are answered while the handlers' members are alive
+  dispatcher_.Stop();
+}
+
+void DbusMethods::Run() {
+  PublishPolkitSnapshot();
+  connection_->enterEventLoopAsync();
+}
+
+std::string DbusMethods::LimitKey(const std::string &method) {
+  if (method == "ListDevices" || method == usbd::kListDevicesV2 ||
+      method == usbd::kGetSnapshot) {
+    return kUdevEnumeration;
+  }
+  // writers of the rules table wait for each other
+  if (method == usbd::kImportRules) {
+    return "SaveRules";
+  }
+  return method;
+}
+
+sdbus::method_callback
+DbusMethods::Deferred(Lane lane, std::string method,
+                      std::function<void(sdbus::MethodCall)> handler) {
+  auto &registry = metrics::Registry::Instance();
+  const std::string labels = "method=\"" + method + "\"";
+  const MethodMetrics method_metrics{
+      &registry.AddCounter("altusbd_dbus_calls_total", "DBus method calls",
+                           labels),
+      &registry.AddCounter("altusbd_dbus_errors_total",
+                           "DBus method calls answered with an error", labels),
+      &registry.AddHistogram("altusbd_dbus_call_duration_seconds",
+                             "DBus method latency including the queue wait",
+                             labels)};
+  std::string key = LimitKey(method);
+  return [this, lane, key = std::move(key), method = std::move(method),
+          method_metrics,
+          handler = std::move(handler)](sdbus::MethodCall call) {
+    method_metrics.calls->Inc();
+    const auto start = std::chrono::steady_clock::now();
+    // the message is owned by the task, not shared with this thread
+    MethodDispatcher::Task task = [this, method, method_metrics, start,
+                                   handler, call = std::move(call)]() {
+      try {
+        handler(call);
+      } catch (const std::exception &ex) {
+        method_metrics.errors->Inc();
+        logger_->error("[DBUS][{}] {}", method, ex.what());
+        try {
+          call.createErrorReply(
+                  sdbus::Error(sdbus::Error::Name{SD_BUS_ERROR_FAILED},
+                               ex.what()))
+              .send();
+        } catch (const std::exception &ex_reply) {
+          logger_->error("[DBUS][{}] Can't send error reply {}", method,
+                         ex_reply.what());
+        }
+      }
+      method_metrics.latency->Observe(std::chrono::steady_clock::now() -
+                                      start);
+    };
+    // the dispatcher is stopped - serve in the event loop thread
+    if (!dispatcher_.Submit(lane, key, std::move(task))) {
+      task();
+    }
+  };
+}
+
+void DbusMethods::RegisterMetrics() {
+  auto &registry = metrics::Registry::Instance();
+  registry.AddCallback(
+      "altusbd_dbus_queue_depth", "DBus calls waiting for a worker",
+      metrics::Type::kGauge, "lane=\"fast\"", [this]() {
+        return static_cast<double>(dispatcher_.QueueSize(Lane::kFast));
+      });
+  registry.AddCallback(
+      "altusbd_dbus_queue_depth", "DBus calls waiting for a worker",
+      metrics::Type::kGauge, "lane=\"normal\"", [this]() {
+        return static_cast<double>(dispatcher_.QueueSize(Lane::kNormal));
+      });
+  // the generation is bumped on every write of the table file
+  registry.AddCallback(
+      "altusbd_db_writes_total", "Writes of the local database files",
+      metrics::Type::kCounter, "table=\"permissions\"", [this]() {
+        return static_cast<double>(dbase_->permissions.generation());
+      });
+  registry.AddCallback(
+      "altusbd_db_writes_total", "Writes of the local database files",
+      metrics::Type::kCounter, "table=\"mount_points\"", [this]() {
+        return static_cast<double>(dbase_->mount_points.generation());
+      });
+  // registers the daemon metrics, so they are exported before the first event
+  metrics::Get();
+}
+
+void DbusMethods::GetMetrics(const sdbus::MethodCall &call) {
+  sdbus::MethodReply reply = call.createReply();
+  reply << metrics::Registry::Instance().Serialize();
+  reply.send();
+}
+
+void DbusMethods::GetQueueTuning(const sdbus::MethodCall &call) {
+  std::vector<usbd::QueueTuningStruct> res;
+  for (const auto &disk : QueueTuning::Instance().Applied()) {
+    for (const auto &setting : disk.second) {
+      res.emplace_back(disk.first, setting.attribute, setting.value,
+                       setting.previous);
+    }
+  }
+  sdbus::MethodReply reply = call.createReply();
+  reply << res;
+  reply.send();
+}
+
+void DbusMethods::EmitEvent(const Event &event) noexcept {
+  // before the signal, a polkit check may follow it immediately
+  PublishPolkitSnapshot();
+  try {
+    switch (event.type) {
+    case EventType::kDeviceAdded:
+      dbus_object_ptr->emitSignal(sdbus::SignalName{usbd::kDeviceAdded})
+          .onInterface(interface_name_obj_)
+          .withArguments(event.block, event.vid, event.pid, event.serial,
+                         event.fs);
+      break;
+    case EventType::kDeviceRemoved:
+      dbus_object_ptr->emitSignal(sdbus::SignalName{usbd::kDeviceRemoved})
+          .onInterface(interface_name_obj_)
+          .withArguments(event.block);
+      break;
+    case EventType::kMounted:
+      dbus_object_ptr->emitSignal(sdbus::SignalName{usbd::kMounted})
+          .onInterface(interface_name_obj_)
+          .withArguments(event.block, event.mount_point);
+      break;
+    case EventType::kUnmounted:
+      dbus_object_ptr->emitSignal(sdbus::SignalName{usbd::kUnmounted})
+          .onInterface(interface_name_obj_)
+          .withArguments(event.block, event.mount_point);
+      break;
+    case EventType::kMountFailed:
+      dbus_object_ptr->emitSignal(sdbus::SignalName{usbd::kMountFailed})
+          .onInterface(interface_name_obj_)
+          .withArguments(event.block, event.reason);
+      break;
+    case EventType::kUnmountFailed:
+      dbus_object_ptr->emitSignal(sdbus::SignalName{usbd::kUnmountFailed})
+          .onInterface(interface_name_obj_)
+          .withArguments(event.block, event.reason);
+      break;
+    case EventType::kRulesChanged:
+      dbus_object_ptr->emitSignal(sdbus::SignalName{usbd::kRulesChanged})
+          .onInterface(interface_name_obj_)
+          .withArguments(event.generation);
+      break;
+    }
+  } catch (const std::exception &ex) {
+    logger_->error("[DBUS][EmitEvent] {}", ex.what());
+  }
+}
 
 void DbusMethods::Health(const sdbus::MethodCall &call) {
   auto reply = call.createReply();
@@ -193,19 +534,27 @@ void DbusMethods::CanUserMount(sdbus::MethodCall call) {
   Read local db define is this user is allowed to mount this drive
   (if drive is in db - reply NO - automount will mount it )
   */
-  logger_->info("Polkit request for device (CanUserMount)" + dev);
+  logger_->info("Polkit request for device (CanUserMount) {}", dev);
   sdbus::MethodReply reply = call.createReply();
   try {
-    const UsbUdevDevice device({dev, "add"});
-    const dal::Device dto_device({device.vid(), device.pid(), device.serial()});
-    if (dbase_->permissions.Find(dto_device)) {
+    std::optional<uint64_t> rule;
+    // a device known from udev events - no udev enumeration
+    auto cached = udev_monitor_->device_cache().Find(dev);
+    if (cached) {
+      rule = dbase_->permissions.Find(cached->vid(), cached->pid(),
+                                      cached->serial());
+    } else {
+      const UsbUdevDevice device({dev, "add"});
+      rule = dbase_->permissions.Find(device.vid(), device.pid(),
+                                      device.serial());
+    }
+    if (rule) {
       logger_->info("daemon reply to polkit = NO");
       reply << "NO";
     } else {
       logger_->info("daemon reply to polkit = YES");
       reply << "YES";
     }
-    logger_->flush();
     reply.send();
     return;
   } catch (const std::exception &ex) {
@@ -217,28 +566,41 @@ void DbusMethods::CanUserMount(sdbus::MethodCall call) {
   reply.send();
 }
 
-void DbusMethods::ListActiveDevices(const sdbus::MethodCall &call) {
-  logger_->debug("[DBUS][ListActiveDevices]");
+std::vector<usbd::DeviceStruct> DbusMethods::CollectActiveDevices() const {
+  std::vector<usbd::DeviceStruct> res;
   auto devices = udev_monitor_->GetConnectedDevices();
-  json::array response_array;
+  res.reserve(devices.size());
   for (const auto &dev : devices) {
-    json::object obj;
-    obj["device"] = dev.block_name();
-    obj["vid"] = dev.vid();
-    obj["pid"] = dev.pid();
-    obj["serial"] = dev.serial();
-    obj["fs"] = dev.filesystem();
     // mount_point
-    auto index_mount = dbase_->mount_points.Find(dev.block_name());
+    std::string mount_point;
+    auto index_mount =
+        dbase_->mount_points.Find(std::string(dev.block_name()));
     if (index_mount) {
-      obj["mount"] = dbase_->mount_points.Read(*index_mount).mount_point();
-    } else {
-      obj["mount"] = "";
+      mount_point = dbase_->mount_points.Read(*index_mount).mount_point();
     }
     // permissions
-    auto perm_index = dbase_->permissions.Find(
-        dal::Device({dev.vid(), dev.pid(), dev.serial()}));
-    perm_index.has_value() ? obj["status"] = "owned" : obj["status"] = "free";
+    auto perm_index =
+        dbase_->permissions.Find(dev.vid(), dev.pid(), dev.serial());
+    res.emplace_back(std::string(dev.block_name()), dev.vid(), dev.pid(),
+                     std::string(dev.serial()), std::string(dev.filesystem()),
+                     std::move(mount_point),
+                     perm_index.has_value() ? "owned" : "free");
+  }
+  return res;
+}
+
+void DbusMethods::ListActiveDevices(const sdbus::MethodCall &call) {
+  logger_->debug("[DBUS][ListActiveDevices]");
+  json::array response_array;
+  for (const auto &dev : CollectActiveDevices()) {
+    json::object obj;
+    obj["device"] = std::get<0>(dev);
+    obj["vid"] = std::get<1>(dev);
+    obj["pid"] = std::get<2>(dev);
+    obj["serial"] = std::get<3>(dev);
+    obj["fs"] = std::get<4>(dev);
+    obj["mount"] = std::get<5>(dev);
+    obj["status"] = std::get<6>(dev);
     response_array.emplace_back(std::move(obj));
   }
   sdbus::MethodReply reply = call.createReply();
@@ -247,44 +609,169 @@ void DbusMethods::ListActiveDevices(const sdbus::MethodCall &call) {
   reply.send();
 }
 
+void DbusMethods::ListActiveDevicesV2(const sdbus::MethodCall &call) {
+  logger_->debug("[DBUS][ListActiveDevicesV2]");
+  sdbus::MethodReply reply = call.createReply();
+  reply << CollectActiveDevices();
+  reply.send();
+}
+
 void DbusMethods::ListActiveRules(const sdbus::MethodCall &call) {
   logger_->debug("[DBUS][ListActiveRules]");
-  json::array response_array;
+  sdbus::MethodReply reply = call.createReply();
+  reply << dbase_->permissions.SerializeRulesList();
+  reply.send();
+}
+
+usbd::RuleStruct DbusMethods::ToRuleStruct(uint64_t index,
+                                           const dal::PermissionEntry &rule) {
+  const dal::Device &device = rule.getDevice();
+  std::vector<usbd::PrincipalStruct> users;
+  users.reserve(rule.getUsers().size());
+  for (const auto &user : rule.getUsers()) {
+    users.emplace_back(static_cast<uint32_t>(user.uid()), user.name());
+  }
+  std::vector<usbd::PrincipalStruct> groups;
+  groups.reserve(rule.getGroups().size());
+  for (const auto &group : rule.getGroups()) {
+    groups.emplace_back(static_cast<uint32_t>(group.gid()), group.name());
+  }
+  return usbd::RuleStruct(index, device.vid(), device.pid(), device.serial(),
+                          std::move(users), std::move(groups));
+}
+
+void DbusMethods::ListActiveRulesV2(const sdbus::MethodCall &call) {
+  logger_->debug("[DBUS][ListActiveRulesV2]");
+  std::vector<usbd::RuleStruct> response;
   auto rules = dbase_->permissions.getAll();
-  for (auto &rule : rules) {
-    json::object obj;
-    obj["id"] = std::to_string(rule.first);
-    obj["perm"] = rule.second->ToJson();
-    response_array.emplace_back(std::move(obj));
+  response.reserve(rules.size());
+  for (const auto &rule : rules) {
+    response.emplace_back(ToRuleStruct(rule.first, *rule.second));
   }
   sdbus::MethodReply reply = call.createReply();
-  reply << json::serialize(response_array);
+  reply << response;
+  reply.send();
+}
+
+void DbusMethods::ListRulesPage(sdbus::MethodCall call) {
+  uint64_t cursor = 0;
+  uint32_t limit = 0;
+  std::map<std::string, std::string> filter_params;
+  call >> cursor >> limit >> filter_params;
+  logger_->debug("[DBUS][ListRulesPage] cursor {} limit {}", cursor, limit);
+  if (limit == 0 || limit > kMaxPageSize) {
+    limit = kMaxPageSize;
+  }
+  dal::DevicePermissions::Filter filter;
+  for (auto &param : filter_params) {
+    if (param.first == "device") {
+      filter.device = std::move(param.second);
+    } else if (param.first == "user") {
+      filter.user = std::move(param.second);
+    } else if (param.first == "group") {
+      filter.group = std::move(param.second);
+    } else {
+      throw std::invalid_argument("Unknown filter " + param.first);
+    }
+  }
+  auto page = dbase_->permissions.GetPage(cursor, limit, filter);
+  std::vector<usbd::RuleStruct> rules;
+  rules.reserve(page.rules.size());
+  for (const auto &rule : page.rules) {
+    rules.emplace_back(ToRuleStruct(rule.first, *rule.second));
+  }
+  sdbus::MethodReply reply = call.createReply();
+  reply << rules << page.next.has_value() << page.next.value_or(0);
   reply.send();
 }
 
 void DbusMethods::GetSystemUsersAndGroups(const sdbus::MethodCall &call) {
   logger_->debug("[DBUS][GetUsersAndGroups]");
+  sdbus::MethodReply reply = call.createReply();
+  reply << UsersAndGroupsJson();
+  reply.send();
+}
+
+std::string DbusMethods::UsersAndGroupsJson() const {
   json::object res;
-  const auto id_limits = utils::GetSystemUidMinMax(logger_);
-  if (id_limits.has_value()) {
-    auto users = utils::GetHumanUsers(id_limits.value(), logger_);
-    if (!std::empty(users)) {
-      users.emplace_back(0, "--");
-      res["users"] = json::array();
-      for (const auto &usr : users) {
-        res["users"].as_array().emplace_back(usr.ToJson());
+  const auto accounts = SystemAccounts::Instance().Snapshot(logger_);
+  if (accounts->id_limits.has_value()) {
+    if (!accounts->users.empty()) {
+      json::array users;
+      users.reserve(accounts->users.size() + 1);
+      for (const auto &usr : accounts->users) {
+        users.emplace_back(usr.ToJson());
       }
+      users.emplace_back(dal::User(0, "--").ToJson());
+      res["users"] = std::move(users);
     }
-    auto groups = utils::GetHumanGroups(id_limits.value(), logger_);
-    if (!groups.empty()) {
-      res["groups"] = json::array();
-      for (const auto &grp : groups) {
-        res["groups"].as_array().emplace_back(grp.ToJson());
+    if (!accounts->groups.empty()) {
+      json::array groups;
+      groups.reserve(accounts->groups.size());
+      for (const auto &grp : accounts->groups) {
+        groups.emplace_back(grp.ToJson());
       }
+      res["groups"] = std::move(groups);
     }
   }
+  return json::serialize(res);
+}
+
+void DbusMethods::SearchPrincipals(sdbus::MethodCall call) {
+  std::string prefix;
+  std::string kind_str;
+  uint32_t limit = 0;
+  call >> prefix >> kind_str >> limit;
+  logger_->debug("[DBUS][SearchPrincipals] {} {} limit {}", kind_str, prefix,
+                 limit);
+  PrincipalKind kind = PrincipalKind::kUser;
+  if (kind_str == "group") {
+    kind = PrincipalKind::kGroup;
+  } else if (kind_str != "user") {
+    throw std::invalid_argument("Unknown principal kind " + kind_str);
+  }
+  if (limit == 0 || limit > kMaxPageSize) {
+    limit = kMaxPageSize;
+  }
+  const auto found =
+      PrincipalDirectory::Instance().Search(prefix, kind, limit, logger_);
+  std::vector<usbd::PrincipalStruct> res;
+  res.reserve(found.size());
+  for (const auto &principal : found) {
+    res.emplace_back(principal.id, principal.name);
+  }
   sdbus::MethodReply reply = call.createReply();
-  reply << json::serialize(res);
+  reply << res;
+  reply.send();
+}
+
+void DbusMethods::GetSnapshot(const sdbus::MethodCall &call) {
+  logger_->debug("[DBUS][GetSnapshot]");
+  const auto snapshot = dbase_->permissions.GetSnapshot();
+  std::set<std::tuple<std::string, std::string, std::string>> owned;
+  for (const auto &rule : snapshot.rules) {
+    const dal::Device &device = rule.second->getDevice();
+    owned.emplace(device.vid(), device.pid(), device.serial());
+  }
+  std::unordered_map<std::string, std::string> mount_points;
+  for (const auto &entry : dbase_->mount_points.GetAll()) {
+    mount_points.emplace(entry.dev_name(), entry.mount_point());
+  }
+  std::vector<usbd::DeviceStruct> devices;
+  for (const auto &dev : udev_monitor_->GetConnectedDevices()) {
+    std::string block_name(dev.block_name());
+    std::string serial(dev.serial());
+    auto it_mount = mount_points.find(block_name);
+    const bool is_owned = owned.count({dev.vid(), dev.pid(), serial}) > 0;
+    devices.emplace_back(
+        std::move(block_name), dev.vid(), dev.pid(), std::move(serial),
+        std::string(dev.filesystem()),
+        it_mount != mount_points.end() ? it_mount->second : std::string(),
+        is_owned ? "owned" : "free");
+  }
+  sdbus::MethodReply reply = call.createReply();
+  reply << snapshot.generation << "OK" << UsersAndGroupsJson()
+        << snapshot.rules_list << devices;
   reply.send();
 }
 
@@ -293,11 +780,14 @@ void DbusMethods::SaveRules(sdbus::MethodCall call) {
   json::object res;
   std::string form_data;
   call >> form_data;
+  const uint64_t generation = dbase_->permissions.generation();
+  bool transaction_started = false;
   try {
     // parse data to json object
     const json::value val = json::parse(form_data);
     const json::object &json_data = val.as_object();
     dbase_->permissions.StartTransaction();
+    transaction_started = true;
     // delete rules
     if (json_data.contains("deleted") && json_data.at("deleted").is_array()) {
       const json::array arr_deleted = json_data.at("deleted").as_array();
@@ -320,13 +810,19 @@ void DbusMethods::SaveRules(sdbus::MethodCall call) {
       logger_->debug("[DBUS][SaveRules] Created");
       CreateRules(arr_created);
     }
+    transaction_started = false;
     dbase_->permissions.ProcessTransaction();
     logger_->debug("[DBUS][SaveRules] Finished transacion");
   } catch (const std::exception &ex) {
+    // other threads wait for the table until the transaction is closed
+    if (transaction_started) {
+      dbase_->permissions.AbortTransaction();
+    }
     logger_->error(ex.what());
   }
   logger_->debug("[DBUS][SaveRules]{}", form_data);
   logger_->flush();
+  NotifyRulesChanged(generation);
 
   res["STATUS"] = "OK";
   sdbus::MethodReply reply = call.createReply();
@@ -334,16 +830,117 @@ void DbusMethods::SaveRules(sdbus::MethodCall call) {
   reply.send();
 }
 
-void DbusMethods::CreateRules(const boost::json::array &arr_created) {
-  auto id_limits = utils::GetSystemUidMinMax(logger_);
-  std::vector<dal::User> system_users;
-  std::vector<dal::Group> system_groups;
-  if (id_limits) {
-    system_users = utils::GetHumanUsers(id_limits.value(), logger_);
-    system_users.emplace_back(0, "root");
-    system_groups = utils::GetHumanGroups(id_limits.value(), logger_);
+void DbusMethods::ImportRules(sdbus::MethodCall call) {
+  sdbus::UnixFd fd;
+  std::string mode;
+  call >> fd >> mode;
+  logger_->debug("[DBUS][ImportRules] {}", mode);
+  const uint64_t generation = dbase_->permissions.generation();
+  RulesTransfer transfer(dbase_->permissions, SystemAccounts::Instance(),
+                         logger_);
+  const auto res = transfer.Import(fd.get(), RulesTransfer::ParseMode(mode));
+  NotifyRulesChanged(generation);
+  sdbus::MethodReply reply = call.createReply();
+  reply << res.created << res.skipped;
+  reply.send();
+}
+
+void DbusMethods::ExportRules(sdbus::MethodCall call) {
+  sdbus::UnixFd fd;
+  call >> fd;
+  logger_->debug("[DBUS][ExportRules]");
+  const RulesTransfer transfer(dbase_->permissions, SystemAccounts::Instance(),
+                               logger_);
+  const uint64_t exported = transfer.Export(fd.get());
+  sdbus::MethodReply reply = call.createReply();
+  reply << exported;
+  reply.send();
+}
+
+void DbusMethods::PublishPolkitSnapshot() noexcept {
+  namespace polkit = common_utils::polkit;
+  try {
+    // called from the event handlers and the daemon tick
+    const std::lock_guard<std::mutex> lock(polkit_mutex_);
+    // sorted - the same state is serialized to the same bytes
+    std::map<std::string, uint32_t> flags;
+    for (const auto &device : udev_monitor_->device_cache().GetAll()) {
+      uint32_t &block_flags = flags[device.first];
+      block_flags |= polkit::kKnownDevice;
+      if (dbase_->permissions.Find(device.second->vid(), device.second->pid(),
+                                   device.second->serial())) {
+        block_flags |= polkit::kHasRule;
+      }
+    }
+    for (const auto &entry : dbase_->mount_points.GetAll()) {
+      flags[entry.dev_name()] |= polkit::kMountedByDaemon;
+    }
+    std::vector<polkit::Entry> entries;
+    entries.reserve(flags.size());
+    for (const auto &block : flags) {
+      auto entry = polkit::MakeEntry(block.first, block.second);
+      if (entry) {
+        entries.push_back(entry.value());
+      }
+    }
+    polkit_snapshot_.Publish(entries, logger_);
+  } catch (const std::exception &ex) {
+    logger_->error("[DBUS][PublishPolkitSnapshot] {}", ex.what());
   }
+}
 
+void DbusMethods::ProbeLoops(std::chrono::milliseconds period) noexcept {
+  auto &watchdog = Watchdog::Instance();
+  const auto posted = Watchdog::Clock::now();
+  try {
+    for (const auto lane : {Lane::kFast, Lane::kNormal}) {
+      Watchdog::Loop &loop = watchdog.AddLoop(
+          lane == Lane::kFast ? "dbus_fast_lane" : "dbus_normal_lane", period);
+      dispatcher_.Submit(lane, kWatchdogProbe,
+                         [&loop, posted]() { loop.Beat(posted); });
+    }
+  } catch (const std::exception &ex) {
+    logger_->error("[DBUS][ProbeLoops] {}", ex.what());
+  }
+  // the previous probe is still waiting, the loop age grows
+  if (health_probe_pending_.exchange(true)) {
+    return;
+  }
+  try {
+    Watchdog::Loop &loop = watchdog.AddLoop("dbus", period);
+    auto call = health_proxy_->createMethodCall(interface_name_obj_,
+                                                sdbus::MethodName{"health"});
+    health_proxy_->callMethodAsync(
+        call,
+        [this, &loop, posted](const sdbus::MethodReply & /*reply*/,
+                              const std::optional<sdbus::Error> &error) {
+          health_probe_pending_ = false;
+          if (!error) {
+            loop.Beat(posted);
+          }
+        },
+        period);
+  } catch (const std::exception &ex) {
+    health_probe_pending_ = false;
+    logger_->error("[DBUS][ProbeLoops] {}", ex.what());
+  }
+}
+
+void DbusMethods::NotifyRulesChanged(uint64_t generation) noexcept {
+  if (dbase_->permissions.generation() != generation) {
+    // the next mount applies a ready ACL
+    const uint64_t saved = dbase_->permissions.generation();
+    AclTemplates::Instance().Compile(dbase_->permissions.getAll(), saved,
+                                     logger_);
+    Event event;
+    event.type = EventType::kRulesChanged;
+    event.generation = dbase_->permissions.generation();
+    EmitEvent(event);
+  }
+}
+
+void DbusMethods::CreateRules(const boost::json::array &arr_created) {
+  const auto accounts = SystemAccounts::Instance().Snapshot(logger_);
   for (const auto &element : arr_created) {
     const json::object &obj = element.as_object();
     std::string vid = obj.at("vid").as_string().c_str();
@@ -354,23 +951,29 @@ void DbusMethods::CreateRules(const boost::json::array &arr_created) {
       user = "root";
     }
     std::string group = obj.at("group").as_string().c_str();
-    auto it_system_user = std::find_if(
-        system_users.cbegin(), system_users.cend(),
-        [&user](const dal::User &usr) { return usr.name() == user; });
-    const bool valid_user = it_system_user != system_users.cend();
-    auto it_system_group = std::find_if(
-        system_groups.cbegin(), system_groups.cend(),
-        [&group](const dal::Group &grp) { return grp.name() == group; });
-    const bool valid_group = it_system_group != system_groups.cend();
+    const auto system_user = FindRuleUser(*accounts, user, logger_);
+    const auto system_group = FindRuleGroup(*accounts, group, logger_);
     if (!utils::ValidVid(vid) || !utils::ValidVid(pid) || serial.empty() ||
-        user.empty() || group.empty() || !valid_group || !valid_user) {
+        user.empty() || group.empty() || !system_group || !system_user) {
       throw std::invalid_argument("invalid arguments for device permissions");
     }
-    std::vector<dal::User> new_users{*it_system_user};
-    std::vector<dal::Group> new_groups{*it_system_group};
-    const dal::PermissionEntry new_entry(dal::Device({vid, pid, serial}),
-                                         std::move(new_users),
-                                         std::move(new_groups));
+    // optional, the mount profile of the filesystem is used as is
+    std::string mount_options;
+    if (obj.contains("mount_options")) {
+      mount_options = obj.at("mount_options").as_string().c_str();
+      MountProfiles::Validate(mount_options);
+    }
+    std::string queue_tuning;
+    if (obj.contains("queue_tuning")) {
+      queue_tuning = obj.at("queue_tuning").as_string().c_str();
+      QueueTuning::Validate(queue_tuning);
+    }
+    std::vector<dal::User> new_users{system_user.value()};
+    std::vector<dal::Group> new_groups{system_group.value()};
+    const dal::PermissionEntry new_entry(
+        dal::Device({vid, pid, serial}), std::move(new_users),
+        std::move(new_groups), std::move(mount_options),
+        std::move(queue_tuning));
     if (!dbase_->permissions.Find(dal::Device({vid, pid, serial}))) {
       dbase_->permissions.Create(new_entry);
     } else {
@@ -382,14 +985,7 @@ void DbusMethods::CreateRules(const boost::json::array &arr_created) {
 }
 
 void DbusMethods::UpdateRules(const boost::json::array &arr_updated) {
-  auto id_limits = utils::GetSystemUidMinMax(logger_);
-  std::vector<dal::User> system_users;
-  std::vector<dal::Group> system_groups;
-  if (id_limits) {
-    system_users = utils::GetHumanUsers(id_limits.value(), logger_);
-    system_users.emplace_back(0, "root");
-    system_groups = utils::GetHumanGroups(id_limits.value(), logger_);
-  }
+  const auto accounts = SystemAccounts::Instance().Snapshot(logger_);
   for (const auto &element : arr_updated) {
     const json::object &obj = element.as_object();
     const uint64_t id_to_update =
@@ -415,26 +1011,43 @@ void DbusMethods::UpdateRules(const boost::json::array &arr_updated) {
     if (!serial.empty()) {
       original.at("device").as_object().at("serial") = serial;
     }
-    if (!user.empty() && !system_users.empty()) {
-      auto it_system_user = std::find_if(
-          system_users.cbegin(), system_users.cend(),
-          [&user](const dal::User &usr) { return usr.name() == user; });
-      if (it_system_user != system_users.cend()) {
+    if (!user.empty()) {
+      const auto system_user = FindRuleUser(*accounts, user, logger_);
+      if (system_user) {
         original.at("users").as_array()[0].as_object().at("uid") =
-            it_system_user->uid();
+            system_user->uid();
         original.at("users").as_array()[0].as_object().at("name") =
-            it_system_user->name();
+            system_user->name();
       }
     }
-    if (!group.empty() && !system_groups.empty()) {
-      auto it_system_group = std::find_if(
-          system_groups.cbegin(), system_groups.cend(),
-          [&group](const dal::Group &grp) { return grp.name() == group; });
-      if (it_system_group != system_groups.cend()) {
+    if (!group.empty()) {
+      const auto system_group = FindRuleGroup(*accounts, group, logger_);
+      if (system_group) {
         original.at("groups").as_array()[0].as_object().at("gid") =
-            it_system_group->gid();
+            system_group->gid();
         original.at("groups").as_array()[0].as_object().at("name") =
-            it_system_group->name();
+            system_group->name();
+      }
+    }
+    // an empty string drops the override
+    if (obj.contains("mount_options")) {
+      const std::string mount_options =
+          obj.at("mount_options").as_string().c_str();
+      MountProfiles::Validate(mount_options);
+      if (mount_options.empty()) {
+        original.erase("mount_options");
+      } else {
+        original["mount_options"] = mount_options;
+      }
+    }
+    if (obj.contains("queue_tuning")) {
+      const std::string queue_tuning =
+          obj.at("queue_tuning").as_string().c_str();
+      QueueTuning::Validate(queue_tuning);
+      if (queue_tuning.empty()) {
+        original.erase("queue_tuning");
+      } else {
+        original["queue_tuning"] = queue_tuning;
       }
     }
     // update data
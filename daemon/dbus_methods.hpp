@@ -20,16 +20,33 @@
 
 #pragma once
 #include "dal/local_storage.hpp"
+#include "events.hpp"
+#include "method_dispatcher.hpp"
+#include "metrics.hpp"
+#include "polkit_snapshot_writer.hpp"
+#include "principal_directory.hpp"
+#include "system_accounts.hpp"
 #include "udev_monitor.hpp"
+#include "usbd_types.hpp"
+#include "watchdog.hpp"
+#include <atomic>
 #include <boost/json/array.hpp>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
 #include <memory>
+#include <mutex>
+#include <optional>
 #include <sdbus-c++/IConnection.h>
 #include <sdbus-c++/IObject.h>
+#include <sdbus-c++/IProxy.h>
 #include <sdbus-c++/Message.h>
 #include <sdbus-c++/Types.h>
 #include <sdbus-c++/sdbus-c++.h>
 #include <spdlog/logger.h>
 #include <string>
+#include <vector>
 
 namespace usbmount {
 
@@ -40,13 +57,86 @@ public:
   DbusMethods &operator=(const DbusMethods &) = delete;
   DbusMethods &&operator=(DbusMethods &&) = delete;
   DbusMethods() = delete;
-  ~DbusMethods() = default;
+  /**
+   * @brief Leave the event loop, unregister the object, stop the dispatcher
+   * @details A method call arriving during shutdown must not reach the
+   * dispatcher or the handlers while their members are destroyed.
+   */
+  ~DbusMethods() noexcept;
   explicit DbusMethods(std::shared_ptr<UdevMonitor> udev_monitor,
                        std::shared_ptr<spdlog::logger> logger);
 
   void Run();
 
+  /**
+   * @brief Emit a DBus signal for the event
+   * @details DeviceAdded(sssss) DeviceRemoved(s) Mounted(ss) Unmounted(ss)
+   * MountFailed(ss) UnmountFailed(ss) RulesChanged(t)
+   */
+  void EmitEvent(const Event &event) noexcept;
+
+  /**
+   * @brief Publish CanUserMount and CanAnotherUserUnmount answers for the
+   * connected and mounted devices to the polkit snapshot file
+   * @details Called on every event and periodically, the file is rewritten
+   * only if the answers change.
+   */
+  void PublishPolkitSnapshot() noexcept;
+
+  /**
+   * @brief Post watchdog probes to the DBus event loop and dispatcher lanes
+   * @details The event loop is probed with a "health" call to itself through
+   * the bus, each lane with a job. A loop beats when its probe runs.
+   * @param period time between probes
+   */
+  void ProbeLoops(std::chrono::milliseconds period) noexcept;
+
 private:
+  using Lane = MethodDispatcher::Lane;
+
+  /// polkit queries (CanUserMount, CanAnotherUserUnmount)
+  static constexpr size_t kFastLaneWorkers = 2;
+  static constexpr size_t kWorkers = 4;
+  /// ListDevices and ListDevicesV2 share the udev context
+  static constexpr const char *kUdevEnumeration = "UdevEnumeration";
+  static constexpr uint32_t kMaxPageSize = 1000;
+  static constexpr const char *kWatchdogProbe = "WatchdogProbe";
+
+  struct MethodMetrics {
+    metrics::Counter *calls;
+    metrics::Counter *errors;
+    metrics::Histogram *latency;
+  };
+
+  /// @brief Concurrency limit key of the method
+  static std::string LimitKey(const std::string &method);
+
+  /**
+   * @brief Wrap a method handler to run in the dispatcher lane
+   * @details The reply is sent by the handler from a worker thread. If the
+   * handler throws, an error reply is sent. Calls, errors and latency are
+   * counted per method.
+   */
+  sdbus::method_callback
+  Deferred(Lane lane, std::string method,
+           std::function<void(sdbus::MethodCall)> handler);
+
+  /// @brief Queue depths and DB writes, read on export
+  void RegisterMetrics();
+
+  /**
+   * @brief Users or groups whose name starts with the prefix, for
+   * autocompletion
+   * @throws std::invalid_argument for an unknown kind
+   */
+  void SearchPrincipals(sdbus::MethodCall call);
+
+  /** @brief Prometheus text of the metrics registry */
+  void GetMetrics(const sdbus::MethodCall &);
+
+  /** @brief Block queue and BDI values written to the connected disks */
+  static void GetQueueTuning(const sdbus::MethodCall &);
+
   /** @brief Health method for DBus returns "OK" to caller */
   static void Health(const sdbus::MethodCall &);
 
@@ -54,8 +144,44 @@ private:
   void CanUserMount(sdbus::MethodCall);
   void ListActiveDevices(const sdbus::MethodCall &);
   void ListActiveRules(const sdbus::MethodCall &);
+  /** @brief ListDevices with a native signature a(sssssss) */
+  void ListActiveDevicesV2(const sdbus::MethodCall &);
+  /** @brief ListRules with a native signature a(tsssa(us)a(us)) */
+  void ListActiveRulesV2(const sdbus::MethodCall &);
+  /**
+   * @brief A page of rules (tua{ss}) -> (a(tsssa(us)a(us))bt)
+   * @details cursor, limit (0 - kMaxPageSize), filter {"device","user",
+   * "group"}. Returns rules, has_next and the cursor of the next page.
+   */
+  void ListRulesPage(sdbus::MethodCall);
   void GetSystemUsersAndGroups(const sdbus::MethodCall &);
+  /**
+   * @brief Everything the UI shows in one reply
+   * @details generation, health, users and groups JSON, ListRules JSON,
+   * devices a(sssssss). Rules and device statuses come from one snapshot.
+   */
+  void GetSnapshot(const sdbus::MethodCall &);
   void SaveRules(sdbus::MethodCall);
+  /**
+   * @brief Rules from a file descriptor (hs) -> (tt)
+   * @details JSON lines, "merge" or "replace" mode. Returns created and
+   * skipped (duplicate device) counts. Nothing is applied on invalid data.
+   */
+  void ImportRules(sdbus::MethodCall call);
+  /** @brief All rules as JSON lines to a file descriptor (h) -> (t) */
+  void ExportRules(sdbus::MethodCall call);
+
+  /// @brief RulesChanged if the table was written since the generation
+  void NotifyRulesChanged(uint64_t generation) noexcept;
+
+  /** @brief Connected devices with mount points and rule status */
+  std::vector<dbus_bindings::usbd::DeviceStruct> CollectActiveDevices() const;
+
+  static dbus_bindings::usbd::RuleStruct
+  ToRuleStruct(uint64_t index, const dal::PermissionEntry &rule);
+
+  /// @brief GetUsersAndGroups response {"users":[...],"groups":[...]}
+  std::string UsersAndGroupsJson() const;
 
   void UpdateRules(const boost::json::array &arr_updated);
   void CreateRules(const boost::json::array &arr_created);
@@ -68,9 +194,18 @@ private:
   sdbus::InterfaceName interface_name_obj_;
   std::unique_ptr<sdbus::IConnection> connection_;
   std::unique_ptr<sdbus::IObject> dbus_object_ptr;
+  // watchdog probes of the event loop, a call to this service
+  std::unique_ptr<sdbus::IProxy> health_proxy_;
+  std::atomic<bool> health_probe_pending_{false};
   std::shared_ptr<spdlog::logger> logger_;
   std::shared_ptr<dal::LocalStorage> dbase_;
   std::shared_ptr<UdevMonitor> udev_monitor_;
+  // the state is collected and published under one lock, an older state
+  // can't overwrite a newer one
+  std::mutex polkit_mutex_;
+  PolkitSnapshotWriter polkit_snapshot_;
+  // the last member - workers are joined before the connection is destroyed
+  MethodDispatcher dispatcher_;
 };
 
 } // namespace usbmount
\ No newline at end of file
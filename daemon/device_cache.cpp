@@ -0,0 +1,86 @@
+/* File: device_cache.cpp
+
+  Copyright (C)   2024
+  Author: Oleg Proskurin, <proskurinov@basealt.ru>
+
+  This program is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with this program; if not, see <https://www.gnu.org/licenses/>.
+
+*/
+
+#include "device_cache.hpp"
+#include "dal/dto.hpp"
+#include "usb_udev_device.hpp"
+#include <cstddef>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include <string>
+#include <unordered_map>
+#include <utility>
+
+namespace usbmount {
+
+void DeviceCache::Put(const UsbUdevDevice &device) noexcept {
+  if (!device.vendor_id()) {
+    return;
+  }
+  const std::string block_name(device.block_name());
+  try {
+    Put(block_name, dal::DeviceParams{device.vid(), device.pid(),
+                                      std::string(device.serial())});
+  } catch (const std::exception &) {
+    Erase(block_name);
+  }
+}
+
+void DeviceCache::Put(const std::string &block_name,
+                      const dal::DeviceParams &params) noexcept {
+  if (block_name.empty()) {
+    return;
+  }
+  try {
+    auto dev = std::make_shared<const dal::Device>(params);
+    const std::unique_lock<std::shared_mutex> lock(mutex_);
+    devices_[block_name] = std::move(dev);
+  } catch (const std::exception &) {
+    // the device is looked up in udev then
+    Erase(block_name);
+  }
+}
+
+void DeviceCache::Erase(const std::string &block_name) noexcept {
+  const std::unique_lock<std::shared_mutex> lock(mutex_);
+  devices_.erase(block_name);
+}
+
+std::shared_ptr<const dal::Device>
+DeviceCache::Find(const std::string &block_name) const noexcept {
+  const std::shared_lock<std::shared_mutex> lock(mutex_);
+  auto it_found = devices_.find(block_name);
+  return it_found != devices_.cend() ? it_found->second : nullptr;
+}
+
+size_t DeviceCache::size() const noexcept {
+  const std::shared_lock<std::shared_mutex> lock(mutex_);
+  return devices_.size();
+}
+
+std::unordered_map<std::string, std::shared_ptr<const dal::Device>>
+DeviceCache::GetAll() const {
+  const std::shared_lock<std::shared_mutex> lock(mutex_);
+  return devices_;
+}
+
+} // namespace usbmount
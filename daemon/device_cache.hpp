@@ -0,0 +1,69 @@
+/* File: device_cache.hpp
+
+  Copyright (C)   2024
+  Author: Oleg Proskurin, <proskurinov@basealt.ru>
+
+  This program is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with this program; if not, see <https://www.gnu.org/licenses/>.
+
+*/
+
+#pragma once
+#include "dal/dto.hpp"
+#include "usb_udev_device.hpp"
+#include <cstddef>
+#include <memory>
+#include <shared_mutex>
+#include <string>
+#include <unordered_map>
+
+namespace usbmount {
+
+/**
+ * @class DeviceCache
+ * @brief vid, pid and serial of connected devices by the block name
+ * @details Filled by UdevMonitor from udev events, so DBus methods can answer
+ * without a udev enumeration. A lookup doesn't allocate.
+ */
+class DeviceCache {
+public:
+  /// @brief Add or replace the device, a device without vid is ignored
+  void Put(const UsbUdevDevice &device) noexcept;
+
+  /// @brief Add or replace the device by the block name (/dev/sdX)
+  void Put(const std::string &block_name,
+           const dal::DeviceParams &params) noexcept;
+
+  /// @brief Forget the device
+  void Erase(const std::string &block_name) noexcept;
+
+  /**
+   * @brief Find a device by the block name
+   * @param block_name /dev/sdX
+   * @return nullptr if the device is unknown
+   */
+  std::shared_ptr<const dal::Device>
+  Find(const std::string &block_name) const noexcept;
+
+  size_t size() const noexcept;
+
+  /// @brief A copy of the block name -> device map
+  std::unordered_map<std::string, std::shared_ptr<const dal::Device>>
+  GetAll() const;
+
+private:
+  mutable std::shared_mutex mutex_;
+  std::unordered_map<std::string, std::shared_ptr<const dal::Device>> devices_;
+};
+
+} // namespace usbmount
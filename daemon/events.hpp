@@ -0,0 +1,58 @@
+/* File: events.hpp
+
+  Copyright (C)   2024
+  Author: Oleg Proskurin, <proskurinov@basealt.ru>
+
+  This program is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with this program; if not, see <https://www.gnu.org/licenses/>.
+
+*/
+
+#pragma once
+#include <cstdint>
+#include <functional>
+#include <string>
+
+namespace usbmount {
+
+/// @brief Changes of the daemon state, emitted as DBus signals
+enum class EventType : uint8_t {
+  kDeviceAdded,
+  kDeviceRemoved,
+  kMounted,
+  kUnmounted,
+  kMountFailed,
+  kUnmountFailed,
+  kRulesChanged
+};
+
+/**
+ * @brief A state change
+ * @details Only the fields relevant for the type are filled.
+ */
+struct Event {
+  EventType type = EventType::kDeviceAdded;
+  std::string block;       /// /dev/sdX
+  std::string vid;         /// kDeviceAdded
+  std::string pid;         /// kDeviceAdded
+  std::string serial;      /// kDeviceAdded
+  std::string fs;          /// kDeviceAdded
+  std::string mount_point; /// kMounted,kUnmounted
+  std::string reason;      /// kMountFailed,kUnmountFailed
+  uint64_t generation = 0; /// kRulesChanged
+};
+
+/// @brief Event consumer, an empty function means nobody listens.
+using EventHandler = std::function<void(const Event &)>;
+
+} // namespace usbmount
@@ -0,0 +1,143 @@
+/* File: method_dispatcher.cpp
+
+  Copyright (C)   2024
+  Author: Oleg Proskurin, <proskurinov@basealt.ru>
+
+  This program is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with this program; if not, see <https://www.gnu.org/licenses/>.
+
+*/
+
+#include "method_dispatcher.hpp"
+#include <array>
+#include <cstddef>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <utility>
+
+namespace usbmount {
+
+MethodDispatcher::MethodDispatcher(size_t fast_workers, size_t normal_workers,
+                                   std::shared_ptr<spdlog::logger> logger)
+    : logger_(std::move(logger)) {
+  const std::array<size_t, 2> workers{fast_workers, normal_workers};
+  try {
+    for (size_t lane = 0; lane < queues_.size(); ++lane) {
+      for (size_t i = 0; i < workers[lane]; ++i) {
+        queues_[lane].workers.emplace_back(&MethodDispatcher::WorkerLoop, this,
+                                           static_cast<Lane>(lane));
+      }
+    }
+  } catch (const std::exception &) {
+    Stop();
+    throw;
+  }
+}
+
+MethodDispatcher::~MethodDispatcher() noexcept { Stop(); }
+
+void MethodDispatcher::SetLimit(const std::string &key, size_t limit) noexcept {
+  try {
+    const std::lock_guard<std::mutex> lock(mutex_);
+    limits_[key] = limit;
+  } catch (const std::exception &ex) {
+    logger_->error("[MethodDispatcher] Can't set limit for {} {}", key,
+                   ex.what());
+  }
+}
+
+bool MethodDispatcher::Submit(Lane lane, const std::string &key,
+                              Task &&task) noexcept {
+  try {
+    {
+      const std::lock_guard<std::mutex> lock(mutex_);
+      Queue &queue = queues_.at(static_cast<size_t>(lane));
+      if (stopped_ || queue.workers.empty()) {
+        return false;
+      }
+      queue.jobs.push_back({key, std::move(task)});
+    }
+    cv_.notify_all();
+    return true;
+  } catch (const std::exception &ex) {
+    logger_->error("[MethodDispatcher] Can't queue {} {}", key, ex.what());
+  }
+  return false;
+}
+
+void MethodDispatcher::Stop() noexcept {
+  {
+    const std::lock_guard<std::mutex> lock(mutex_);
+    stopped_ = true;
+  }
+  cv_.notify_all();
+  for (auto &queue : queues_) {
+    for (auto &worker : queue.workers) {
+      if (worker.joinable() && worker.get_id() != std::this_thread::get_id()) {
+        worker.join();
+      }
+    }
+  }
+}
+
+size_t MethodDispatcher::QueueSize(Lane lane) const noexcept {
+  const std::lock_guard<std::mutex> lock(mutex_);
+  return queues_[static_cast<size_t>(lane)].jobs.size();
+}
+
+bool MethodDispatcher::TakeJob(Queue &queue, Job &job) noexcept {
+  for (auto it = queue.jobs.begin(); it != queue.jobs.end(); ++it) {
+    auto limit = limits_.find(it->key);
+    if (limit != limits_.end() && limit->second != 0 &&
+        running_[it->key] >= limit->second) {
+      continue;
+    }
+    job = std::move(*it);
+    queue.jobs.erase(it);
+    ++running_[job.key];
+    return true;
+  }
+  return false;
+}
+
+void MethodDispatcher::WorkerLoop(Lane lane) noexcept {
+  Queue &queue = queues_[static_cast<size_t>(lane)];
+  while (true) {
+    Job job;
+    {
+      std::unique_lock<std::mutex> lock(mutex_);
+      cv_.wait(lock, [this, &queue, &job] {
+        return TakeJob(queue, job) || (stopped_ && queue.jobs.empty());
+      });
+      if (!job.task) {
+        return;
+      }
+    }
+    try {
+      job.task();
+    } catch (const std::exception &ex) {
+      logger_->error("[MethodDispatcher] {} {}", job.key, ex.what());
+    }
+    {
+      const std::lock_guard<std::mutex> lock(mutex_);
+      --running_[job.key];
+    }
+    // a job waiting for this key may be in any lane
+    cv_.notify_all();
+  }
+}
+
+} // namespace usbmount
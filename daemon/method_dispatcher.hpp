@@ -0,0 +1,112 @@
+/* File: method_dispatcher.hpp
+
+  Copyright (C)   2024
+  Author: Oleg Proskurin, <proskurinov@basealt.ru>
+
+  This program is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with this program; if not, see <https://www.gnu.org/licenses/>.
+
+*/
+
+#pragma once
+#include <array>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <spdlog/logger.h>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+namespace usbmount {
+
+/**
+ * @class MethodDispatcher
+ * @brief Worker pool for DBus method calls
+ * @details Each lane has its own queue and its own workers, so a slow
+ * method in the normal lane never delays the fast lane. Jobs with the same
+ * key share a concurrency limit, a job whose key is at the limit waits in the
+ * queue while the following jobs are served.
+ */
+class MethodDispatcher {
+public:
+  enum class Lane : uint8_t { kFast, kNormal };
+  using Task = std::function<void()>;
+
+  MethodDispatcher(const MethodDispatcher &) = delete;
+  MethodDispatcher(MethodDispatcher &&) = delete;
+  MethodDispatcher &operator=(const MethodDispatcher &) = delete;
+  MethodDispatcher &operator=(MethodDispatcher &&) = delete;
+  MethodDispatcher() = delete;
+
+  /**
+   * @brief Construct a new Method Dispatcher object and start the workers
+   * @param fast_workers threads for Lane::kFast
+   * @param normal_workers threads for Lane::kNormal
+   * @throws std::system_error if a thread can't be started
+   */
+  MethodDispatcher(size_t fast_workers, size_t normal_workers,
+                   std::shared_ptr<spdlog::logger> logger);
+
+  ~MethodDispatcher() noexcept;
+
+  /**
+   * @brief Limit the number of jobs with this key running at the same time
+   * @param limit 0 - no limit
+   */
+  void SetLimit(const std::string &key, size_t limit) noexcept;
+
+  /**
+   * @brief Put a job to the lane queue
+   * @return false if the dispatcher is stopped or the job can't be queued,
+   * the task is not moved from in this case
+   */
+  bool Submit(Lane lane, const std::string &key, Task &&task) noexcept;
+
+  /// @brief Finish queued jobs and join the workers
+  void Stop() noexcept;
+
+  /// @brief Number of jobs waiting in the lane queue
+  size_t QueueSize(Lane lane) const noexcept;
+
+private:
+  struct Job {
+    std::string key;
+    Task task;
+  };
+
+  struct Queue {
+    std::deque<Job> jobs;
+    std::vector<std::thread> workers;
+  };
+
+  void WorkerLoop(Lane lane) noexcept;
+
+  /// @brief Find the first job which is not over the limit, under mutex_
+  bool TakeJob(Queue &queue, Job &job) noexcept;
+
+  std::shared_ptr<spdlog::logger> logger_;
+  mutable std::mutex mutex_;
+  std::condition_variable cv_;
+  bool stopped_ = false;
+  std::array<Queue, 2> queues_;
+  std::unordered_map<std::string, size_t> limits_;
+  std::unordered_map<std::string, size_t> running_;
+};
+
+} // namespace usbmount
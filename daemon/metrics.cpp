@@ -0,0 +1,275 @@
+/* File: metrics.cpp
+
+  Copyright (C)   2024
+  Author: Oleg Proskurin, <proskurinov@basealt.ru>
+
+  This program is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with this program; if not, see <https://www.gnu.org/licenses/>.
+
+*/
+
+#include "metrics.hpp"
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <exception>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <ios>
+#include <map>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace usbmount::metrics {
+
+namespace {
+
+const char *TypeName(Type type) noexcept {
+  switch (type) {
+  case Type::kCounter:
+    return "counter";
+  case Type::kGauge:
+    return "gauge";
+  case Type::kHistogram:
+    return "histogram";
+  }
+  return "untyped";
+}
+
+// name{labels} or name
+std::string Series(const std::string &name, const std::string &labels,
+                   const std::string &extra_label = {}) {
+  std::string res = name;
+  if (labels.empty() && extra_label.empty()) {
+    return res;
+  }
+  res += '{';
+  res += labels;
+  if (!labels.empty() && !extra_label.empty()) {
+    res += ',';
+  }
+  res += extra_label;
+  res += '}';
+  return res;
+}
+
+} // namespace
+
+// Histogram
+void Histogram::Observe(std::chrono::nanoseconds duration) noexcept {
+  const double seconds = std::chrono::duration<double>(duration).count();
+  const auto it_bound =
+      std::lower_bound(kBounds.cbegin(), kBounds.cend(), seconds);
+  buckets_[static_cast<size_t>(std::distance(kBounds.cbegin(), it_bound))]
+      .fetch_add(1, std::memory_order_relaxed);
+  count_.fetch_add(1, std::memory_order_relaxed);
+  sum_ns_.fetch_add(static_cast<uint64_t>(std::max<int64_t>(
+                        duration.count(), 0)),
+                    std::memory_order_relaxed);
+}
+
+// Registry
+Registry::Entry *Registry::FindEntry(const std::string &name,
+                                     const std::string &labels) {
+  auto it_entry =
+      std::find_if(entries_.begin(), entries_.end(),
+                   [&name, &labels](const Entry &entry) {
+                     return entry.name == name && entry.labels == labels;
+                   });
+  return it_entry != entries_.end() ? &(*it_entry) : nullptr;
+}
+
+Counter &Registry::AddCounter(const std::string &name, const std::string &help,
+                              const std::string &labels) {
+  const std::lock_guard<std::mutex> lock(mutex_);
+  const Entry *entry = FindEntry(name, labels);
+  if (entry != nullptr && entry->counter != nullptr) {
+    return *entry->counter;
+  }
+  Counter &res = counters_.emplace_back();
+  entries_.push_back({name, help, labels, Type::kCounter, &res, nullptr,
+                      nullptr, nullptr});
+  return res;
+}
+
+Gauge &Registry::AddGauge(const std::string &name, const std::string &help,
+                          const std::string &labels) {
+  const std::lock_guard<std::mutex> lock(mutex_);
+  const Entry *entry = FindEntry(name, labels);
+  if (entry != nullptr && entry->gauge != nullptr) {
+    return *entry->gauge;
+  }
+  Gauge &res = gauges_.emplace_back();
+  entries_.push_back(
+      {name, help, labels, Type::kGauge, nullptr, &res, nullptr, nullptr});
+  return res;
+}
+
+Histogram &Registry::AddHistogram(const std::string &name,
+                                  const std::string &help,
+                                  const std::string &labels) {
+  const std::lock_guard<std::mutex> lock(mutex_);
+  const Entry *entry = FindEntry(name, labels);
+  if (entry != nullptr && entry->histogram != nullptr) {
+    return *entry->histogram;
+  }
+  Histogram &res = histograms_.emplace_back();
+  entries_.push_back({name, help, labels, Type::kHistogram, nullptr, nullptr,
+                      &res, nullptr});
+  return res;
+}
+
+void Registry::AddCallback(const std::string &name, const std::string &help,
+                           Type type, const std::string &labels,
+                           std::function<double()> callback) {
+  const std::lock_guard<std::mutex> lock(mutex_);
+  Entry *entry = FindEntry(name, labels);
+  if (entry != nullptr) {
+    entry->callback = std::move(callback);
+    return;
+  }
+  entries_.push_back(
+      {name, help, labels, type, nullptr, nullptr, nullptr, std::move(callback)});
+}
+
+std::string Registry::Serialize() const {
+  std::ostringstream res;
+  // the callbacks run without the lock, they may take locks of their own
+  std::vector<Entry> entries;
+  {
+    const std::lock_guard<std::mutex> lock(mutex_);
+    entries = entries_;
+  }
+  // series of one metric must be together
+  std::map<std::string, std::vector<const Entry *>> families;
+  for (const auto &entry : entries) {
+    families[entry.name].push_back(&entry);
+  }
+  for (const auto &family : families) {
+    const Entry &first = *family.second.front();
+    res << "# HELP " << first.name << ' ' << first.help << '\n';
+    res << "# TYPE " << first.name << ' ' << TypeName(first.type) << '\n';
+    for (const Entry *entry : family.second) {
+      if (entry->counter != nullptr) {
+        res << Series(entry->name, entry->labels) << ' '
+            << entry->counter->value() << '\n';
+      } else if (entry->gauge != nullptr) {
+        res << Series(entry->name, entry->labels) << ' '
+            << entry->gauge->value() << '\n';
+      } else if (entry->callback) {
+        res << Series(entry->name, entry->labels) << ' ' << entry->callback()
+            << '\n';
+      } else if (entry->histogram != nullptr) {
+        const Histogram &hist = *entry->histogram;
+        uint64_t cumulative = 0;
+        for (size_t i = 0; i < Histogram::kBounds.size(); ++i) {
+          cumulative += hist.bucket(i);
+          std::ostringstream bound;
+          bound << "le=\"" << Histogram::kBounds[i] << '"';
+          res << Series(entry->name + "_bucket", entry->labels, bound.str())
+              << ' ' << cumulative << '\n';
+        }
+        cumulative += hist.bucket(Histogram::kBounds.size());
+        res << Series(entry->name + "_bucket", entry->labels, "le=\"+Inf\"")
+            << ' ' << cumulative << '\n';
+        res << Series(entry->name + "_sum", entry->labels) << ' ' << hist.sum()
+            << '\n';
+        res << Series(entry->name + "_count", entry->labels) << ' '
+            << cumulative << '\n';
+      }
+    }
+  }
+  return res.str();
+}
+
+bool Registry::WriteTextfile(const std::string &path) const noexcept {
+  namespace fs = std::filesystem;
+  try {
+    const fs::path file_path(path);
+    fs::create_directories(file_path.parent_path());
+    // node_exporter must never see a partly written file
+    const std::string tmp_path = path + ".tmp";
+    {
+      std::ofstream file(tmp_path, std::ios_base::out | std::ios_base::trunc);
+      if (!file.is_open()) {
+        return false;
+      }
+      file << Serialize();
+      file.close();
+      if (file.fail()) {
+        return false;
+      }
+    }
+    fs::rename(tmp_path, file_path);
+  } catch (const std::exception &) {
+    return false;
+  }
+  return true;
+}
+
+const DaemonMetrics &Get() {
+  static const DaemonMetrics instance{
+      Registry::Instance().AddCounter("altusbd_udev_events_total",
+                                      "Udev events received",
+                                      "action=\"add\""),
+      Registry::Instance().AddCounter("altusbd_udev_events_total",
+                                      "Udev events received",
+                                      "action=\"remove\""),
+      Registry::Instance().AddCounter("altusbd_udev_events_total",
+                                      "Udev events received",
+                                      "action=\"change\""),
+      Registry::Instance().AddCounter("altusbd_udev_events_total",
+                                      "Udev events received",
+                                      "action=\"other\""),
+      Registry::Instance().AddCounter("altusbd_mounts_total", "Mount attempts",
+                                      "result=\"ok\""),
+      Registry::Instance().AddCounter("altusbd_mounts_total", "Mount attempts",
+                                      "result=\"failed\""),
+      Registry::Instance().AddCounter(
+          "altusbd_mounts_read_only_fallback_total",
+          "Devices mounted read-only after a failed read-write mount"),
+      Registry::Instance().AddCounter(
+          "altusbd_mounts_read_only_cached_total",
+          "Devices mounted read-only first with the cached mount flags"),
+      Registry::Instance().AddCounter("altusbd_unmounts_total",
+                                      "Unmount attempts", "result=\"ok\""),
+      Registry::Instance().AddCounter("altusbd_unmounts_total",
+                                      "Unmount attempts",
+                                      "result=\"failed\""),
+      Registry::Instance().AddCounter(
+          "altusbd_unmounts_detached_total",
+          "Busy mounts detached after the unmount grace period")};
+  static const bool fallback_ratio = [] {
+    Registry::Instance().AddCallback(
+        "altusbd_mounts_read_only_fallback_ratio",
+        "Share of successful mounts that needed a read-only retry",
+        Type::kGauge, {}, [] {
+          const uint64_t mounts = instance.mounts_ok.value();
+          return mounts == 0
+                     ? 0.0
+                     : static_cast<double>(instance.mounts_read_only.value()) /
+                           static_cast<double>(mounts);
+        });
+    return true;
+  }();
+  static_cast<void>(fallback_ratio);
+  return instance;
+}
+
+} // namespace usbmount::metrics
@@ -0,0 +1,187 @@
+/* File: metrics.hpp
+
+  Copyright (C)   2024
+  Author: Oleg Proskurin, <proskurinov@basealt.ru>
+
+  This program is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with this program; if not, see <https://www.gnu.org/licenses/>.
+
+*/
+
+#pragma once
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace usbmount::metrics {
+
+enum class Type : uint8_t { kCounter, kGauge, kHistogram };
+
+/// @brief Monotonic counter, lock-free
+class Counter {
+public:
+  inline void Inc(uint64_t value = 1) noexcept {
+    value_.fetch_add(value, std::memory_order_relaxed);
+  }
+  inline uint64_t value() const noexcept {
+    return value_.load(std::memory_order_relaxed);
+  }
+
+private:
+  std::atomic<uint64_t> value_{0};
+};
+
+/// @brief A value that goes up and down, lock-free
+class Gauge {
+public:
+  inline void Set(int64_t value) noexcept {
+    value_.store(value, std::memory_order_relaxed);
+  }
+  inline void Add(int64_t value) noexcept {
+    value_.fetch_add(value, std::memory_order_relaxed);
+  }
+  inline int64_t value() const noexcept {
+    return value_.load(std::memory_order_relaxed);
+  }
+
+private:
+  std::atomic<int64_t> value_{0};
+};
+
+/**
+ * @brief Latency histogram with fixed buckets, lock-free
+ * @details Bucket bounds are in seconds, from 100us to 10s.
+ */
+class Histogram {
+public:
+  static constexpr std::array<double, 15> kBounds{
+      0.0001, 0.00025, 0.0005, 0.001, 0.0025, 0.005, 0.01, 0.025,
+      0.05,   0.1,     0.25,   0.5,   1,      2.5,   10};
+
+  void Observe(std::chrono::nanoseconds duration) noexcept;
+
+  /// @brief Observations in the bucket, not cumulative; the last is +Inf
+  inline uint64_t bucket(size_t index) const noexcept {
+    return buckets_[index].load(std::memory_order_relaxed);
+  }
+  inline uint64_t count() const noexcept {
+    return count_.load(std::memory_order_relaxed);
+  }
+  /// @brief Sum of observations in seconds
+  inline double sum() const noexcept {
+    return static_cast<double>(sum_ns_.load(std::memory_order_relaxed)) /
+           1e9;
+  }
+
+private:
+  std::array<std::atomic<uint64_t>, kBounds.size() + 1> buckets_{};
+  std::atomic<uint64_t> count_{0};
+  std::atomic<uint64_t> sum_ns_{0};
+};
+
+/**
+ * @class Registry
+ * @brief Owns all metrics of the daemon
+ * @details Metrics are registered once (under a mutex) and then updated
+ * through the returned references without locks. A metric with the same name
+ * and labels is registered only once. Labels are a ready Prometheus label
+ * list without braces, e.g. method="CanUserMount".
+ */
+class Registry {
+public:
+  Registry(const Registry &) = delete;
+  Registry(Registry &&) = delete;
+  Registry &operator=(const Registry &) = delete;
+  Registry &operator=(Registry &&) = delete;
+  ~Registry() = default;
+
+  static Registry &Instance() {
+    static Registry instance;
+    return instance;
+  }
+
+  Counter &AddCounter(const std::string &name, const std::string &help,
+                      const std::string &labels = {});
+  Gauge &AddGauge(const std::string &name, const std::string &help,
+                  const std::string &labels = {});
+  Histogram &AddHistogram(const std::string &name, const std::string &help,
+                          const std::string &labels = {});
+
+  /**
+   * @brief A counter or a gauge which value is read on export
+   * @details The callback must stay valid while the registry is exported.
+   */
+  void AddCallback(const std::string &name, const std::string &help,
+                   Type type, const std::string &labels,
+                   std::function<double()> callback);
+
+  /// @brief Prometheus text exposition format
+  std::string Serialize() const;
+
+  /**
+   * @brief Write Serialize() to the file atomically (temp file + rename)
+   * @return false on error
+   */
+  bool WriteTextfile(const std::string &path) const noexcept;
+
+private:
+  Registry() = default;
+
+  struct Entry {
+    std::string name;
+    std::string help;
+    std::string labels;
+    Type type = Type::kCounter;
+    Counter *counter = nullptr;
+    Gauge *gauge = nullptr;
+    Histogram *histogram = nullptr;
+    std::function<double()> callback;
+  };
+
+  /// @brief Find the entry, under mutex_
+  Entry *FindEntry(const std::string &name, const std::string &labels);
+
+  mutable std::mutex mutex_;
+  // deque - stable addresses
+  std::deque<Counter> counters_;
+  std::deque<Gauge> gauges_;
+  std::deque<Histogram> histograms_;
+  std::vector<Entry> entries_;
+};
+
+/// @brief Metrics updated from several modules
+struct DaemonMetrics {
+  Counter &events_add;
+  Counter &events_remove;
+  Counter &events_change;
+  Counter &events_other;
+  Counter &mounts_ok;
+  Counter &mounts_failed;
+  Counter &mounts_read_only;        /// read-write failed, read-only worked
+  Counter &mounts_read_only_cached; /// read-only first, see MountModeCache
+  Counter &unmounts_ok;
+  Counter &unmounts_failed;
+  Counter &unmounts_detached; /// busy past the grace period, see UnmountQueue
+};
+
+/// @brief Registered on the first call
+const DaemonMetrics &Get();
+
+} // namespace usbmount::metrics
@@ -0,0 +1,206 @@
+/* File: mount_mode_cache.cpp
+
+  Copyright (C)   2024
+  Author: Oleg Proskurin, <proskurinov@basealt.ru>
+
+  This program is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with this program; if not, see <https://www.gnu.org/licenses/>.
+
+*/
+
+#include "mount_mode_cache.hpp"
+#include "config.hpp"
+#include "utils.hpp"
+#include <algorithm>
+#include <boost/json/object.hpp>
+#include <boost/json/parse.hpp>
+#include <boost/json/serialize.hpp>
+#include <boost/json/value.hpp>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <exception>
+#include <filesystem>
+#include <fstream>
+#include <mutex>
+#include <optional>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <utility>
+
+namespace usbmount {
+
+namespace json = boost::json;
+
+namespace {
+
+int64_t Now() noexcept {
+  return std::chrono::duration_cast<std::chrono::seconds>(
+             std::chrono::system_clock::now().time_since_epoch())
+      .count();
+}
+
+} // namespace
+
+MountModeCache::MountModeCache(Options options)
+    : options_(std::move(options)) {}
+
+MountModeCache &MountModeCache::Instance() {
+  static MountModeCache instance{Options{MOUNT_MODES_FILE}};
+  return instance;
+}
+
+std::string MountModeCache::Key(std::string_view fs_uuid,
+                                std::string_view fs_type) {
+  if (fs_uuid.empty()) {
+    return {};
+  }
+  std::string res;
+  res.reserve(fs_uuid.size() + fs_type.size() + 1);
+  res.append(fs_uuid);
+  res += ':';
+  res.append(fs_type);
+  return res;
+}
+
+// NOLINTNEXTLINE(google-runtime-int)
+std::optional<unsigned long> MountModeCache::Find(const std::string &key) {
+  if (key.empty()) {
+    return std::nullopt;
+  }
+  const std::lock_guard<std::mutex> lock(mutex_);
+  Load();
+  auto it_found = entries_.find(key);
+  if (it_found == entries_.end()) {
+    return std::nullopt;
+  }
+  if (Now() - it_found->second.last_success >= options_.ttl.count()) {
+    // the file is rewritten on the next change
+    entries_.erase(it_found);
+    return std::nullopt;
+  }
+  return it_found->second.flags;
+}
+
+// NOLINTNEXTLINE(google-runtime-int)
+void MountModeCache::Success(const std::string &key, unsigned long flags,
+                             const utils::logger_t &logger) noexcept {
+  if (key.empty()) {
+    return;
+  }
+  const std::lock_guard<std::mutex> lock(mutex_);
+  Load();
+  if (flags == 0) {
+    if (entries_.erase(key) > 0) {
+      Save(logger);
+    }
+    return;
+  }
+  auto it_found = entries_.find(key);
+  if (it_found != entries_.end() && it_found->second.flags == flags) {
+    // the cached flags were reused, the entry still expires ttl after they
+    // were found - a repaired filesystem gets read-write again
+    if (it_found->second.failures != 0) {
+      it_found->second.failures = 0;
+      Save(logger);
+    }
+    return;
+  }
+  if (entries_.size() >= options_.max_entries && it_found == entries_.end()) {
+    entries_.erase(std::min_element(entries_.begin(), entries_.end(),
+                                    [](const auto &lhs, const auto &rhs) {
+                                      return lhs.second.last_success <
+                                             rhs.second.last_success;
+                                    }));
+  }
+  entries_[key] = Entry{flags, Now(), 0};
+  Save(logger);
+}
+
+void MountModeCache::Failure(const std::string &key,
+                             const utils::logger_t &logger) noexcept {
+  const std::lock_guard<std::mutex> lock(mutex_);
+  auto it_found = entries_.find(key);
+  if (it_found == entries_.end()) {
+    return;
+  }
+  if (++it_found->second.failures >= options_.max_failures) {
+    entries_.erase(it_found);
+  }
+  Save(logger);
+}
+
+size_t MountModeCache::size() const noexcept {
+  const std::lock_guard<std::mutex> lock(mutex_);
+  return entries_.size();
+}
+
+void MountModeCache::Load() noexcept {
+  if (loaded_) {
+    return;
+  }
+  loaded_ = true;
+  try {
+    std::ifstream file(options_.path);
+    if (!file.is_open()) {
+      return;
+    }
+    std::stringstream buf;
+    buf << file.rdbuf();
+    const json::value val = json::parse(buf.str());
+    for (const auto &item : val.as_object()) {
+      const json::object &obj = item.value().as_object();
+      Entry entry;
+      entry.flags = obj.at("flags").to_number<unsigned long>(); // NOLINT
+      entry.last_success = obj.at("last_success").to_number<int64_t>();
+      entry.failures = obj.at("failures").to_number<uint32_t>();
+      entries_.emplace(item.key(), entry);
+    }
+  } catch (const std::exception &) {
+    // a broken cache only costs a failed mount attempt
+    entries_.clear();
+  }
+}
+
+void MountModeCache::Save(const utils::logger_t &logger) noexcept {
+  namespace fs = std::filesystem;
+  try {
+    json::object obj;
+    for (const auto &[key, entry] : entries_) {
+      json::object item;
+      item["flags"] = entry.flags;
+      item["last_success"] = entry.last_success;
+      item["failures"] = entry.failures;
+      obj[key] = std::move(item);
+    }
+    const fs::path file_path(options_.path);
+    fs::create_directories(file_path.parent_path());
+    const std::string tmp_path = options_.path + ".tmp";
+    {
+      std::ofstream file(tmp_path, std::ios_base::out | std::ios_base::trunc);
+      file << json::serialize(obj);
+      file.close();
+      if (file.fail()) {
+        throw std::runtime_error("Can't write " + tmp_path);
+      }
+    }
+    fs::rename(tmp_path, file_path);
+  } catch (const std::exception &ex) {
+    logger->warn("[MountModeCache] Can't save {} {}", options_.path,
+                 ex.what());
+  }
+}
+
+} // namespace usbmount
@@ -0,0 +1,99 @@
+/* File: mount_mode_cache.hpp
+
+  Copyright (C)   2024
+  Author: Oleg Proskurin, <proskurinov@basealt.ru>
+
+  This program is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with this program; if not, see <https://www.gnu.org/licenses/>.
+
+*/
+
+#pragma once
+#include "utils.hpp"
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+
+namespace usbmount {
+
+/**
+ * @class MountModeCache
+ * @brief Mount flags that worked last time, by filesystem UUID and type
+ * @details A dirty NTFS or a write-protected stick fails the read-write
+ * mount on every plug. The flags of the last successful mount are tried first
+ * next time. Only flags that differ from the default (read-write) are kept,
+ * a successful default mount drops the entry. An entry expires ttl after
+ * the flags were found (a mount with the cached flags doesn't extend it) so
+ * a repaired filesystem gets read-write again, and is dropped after
+ * max_failures failed attempts in a row. The mount data is not cached: it
+ * contains the uid and gid of the user who plugged the device.
+ * The cache is a small JSON file rewritten (temp file + rename) on change.
+ */
+class MountModeCache {
+public:
+  struct Options {
+    std::string path;
+    std::chrono::seconds ttl = std::chrono::hours(24 * 30);
+    uint32_t max_failures = 2;
+    /// the oldest entry is dropped when exceeded
+    size_t max_entries = 1024;
+  };
+
+  explicit MountModeCache(Options options);
+
+  static MountModeCache &Instance();
+
+  /// @return empty key if the filesystem has no UUID
+  static std::string Key(std::string_view fs_uuid, std::string_view fs_type);
+
+  /**
+   * @brief Mount flags to try first
+   * @return nullopt if unknown or expired
+   */
+  std::optional<unsigned long> Find(const std::string &key); // NOLINT
+
+  /// @brief Remember the flags of a successful mount, the same flags keep
+  /// the time they were found
+  void Success(const std::string &key, unsigned long flags, // NOLINT
+               const utils::logger_t &logger) noexcept;
+
+  /// @brief The cached flags didn't work
+  void Failure(const std::string &key, const utils::logger_t &logger) noexcept;
+
+  size_t size() const noexcept;
+
+private:
+  struct Entry {
+    unsigned long flags = 0; // NOLINT
+    int64_t last_success = 0; /// unix time the flags were found
+    uint32_t failures = 0;    /// failed attempts with the flags in a row
+  };
+
+  /// @brief Read the file once, under mutex_
+  void Load() noexcept;
+
+  /// @brief Rewrite the file, under mutex_
+  void Save(const utils::logger_t &logger) noexcept;
+
+  const Options options_;
+  mutable std::mutex mutex_;
+  bool loaded_ = false;
+  std::unordered_map<std::string, Entry> entries_;
+};
+
+} // namespace usbmount
@@ -0,0 +1,311 @@
+/* File: mount_profiles.cpp
+
+  Copyright (C)   2024
+  Author: Oleg Proskurin, <proskurinov@basealt.ru>
+
+  This program is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with this program; if not, see <https://www.gnu.org/licenses/>.
+
+*/
+
+#include "mount_profiles.hpp"
+#include "utils.hpp"
+#include <algorithm>
+#include <array>
+#include <boost/json/object.hpp>
+#include <boost/json/parse.hpp>
+#include <boost/json/value.hpp>
+#include <cstddef>
+#include <cstdint>
+#include <exception>
+#include <filesystem>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <sys/mount.h>
+#include <utility>
+#include <vector>
+
+namespace usbmount {
+
+namespace json = boost::json;
+
+namespace {
+
+struct FlagWord {
+  std::string_view word;
+  unsigned long set;   // NOLINT(google-runtime-int)
+  unsigned long clear; // NOLINT(google-runtime-int)
+};
+
+// the atime modes exclude each other
+constexpr std::array<FlagWord, 9> kFlagWords{{
+    {"ro", MS_RDONLY, 0},
+    {"noatime", MS_NOATIME, MS_RELATIME | MS_STRICTATIME},
+    {"nodiratime", MS_NODIRATIME, 0},
+    {"lazytime", MS_LAZYTIME, 0},
+    {"relatime", MS_RELATIME, MS_NOATIME | MS_STRICTATIME},
+    {"strictatime", MS_STRICTATIME, MS_NOATIME | MS_RELATIME},
+    {"sync", MS_SYNCHRONOUS, 0},
+    {"dirsync", MS_DIRSYNC, 0},
+    {"noexec", MS_NOEXEC, 0},
+}};
+
+// the seeds tried for a slot array size before it is doubled
+constexpr uint32_t kMaxSeeds = 256;
+
+const FlagWord *FindFlag(std::string_view word) noexcept {
+  const auto *it_flag =
+      std::find_if(kFlagWords.cbegin(), kFlagWords.cend(),
+                   [word](const FlagWord &flag) { return flag.word == word; });
+  return it_flag != kFlagWords.cend() ? &*it_flag : nullptr;
+}
+
+/// @brief FNV-1a, the seed changes the offset basis
+uint32_t Hash(std::string_view str, uint32_t seed) noexcept {
+  uint32_t res = 2166136261U ^ (seed * 16777619U);
+  for (const char chr : str) {
+    res ^= static_cast<unsigned char>(chr);
+    res *= 16777619U;
+  }
+  return res;
+}
+
+std::vector<std::string_view> Split(std::string_view str) {
+  std::vector<std::string_view> res;
+  while (!str.empty()) {
+    const size_t pos = str.find(',');
+    res.push_back(str.substr(0, pos));
+    if (pos == std::string_view::npos) {
+      break;
+    }
+    str.remove_prefix(pos + 1);
+  }
+  return res;
+}
+
+std::string_view OptionName(std::string_view option) noexcept {
+  return option.substr(0, option.find('='));
+}
+
+std::string ReadFile(const std::string &path) {
+  std::ifstream file(path);
+  if (!file.is_open()) {
+    throw std::runtime_error("Can't open " + path);
+  }
+  std::stringstream buf;
+  buf << file.rdbuf();
+  return buf.str();
+}
+
+} // namespace
+
+MountProfiles::MountProfiles(std::vector<MountProfile> profiles)
+    : profiles_(std::move(profiles)) {
+  Compile();
+}
+
+MountProfiles &MountProfiles::Instance() {
+  static MountProfiles instance{Defaults()};
+  return instance;
+}
+
+void MountProfiles::Load(const std::string &path,
+                         const utils::logger_t &logger) noexcept {
+  try {
+    auto profiles = Defaults();
+    std::error_code err;
+    if (std::filesystem::exists(path, err)) {
+      Parse(ReadFile(path), profiles);
+      logger->info("[MountProfiles] Loaded {}", path);
+    }
+    MountProfiles compiled(std::move(profiles));
+    profiles_ = std::move(compiled.profiles_);
+    slots_ = std::move(compiled.slots_);
+    seed_ = compiled.seed_;
+    logger->debug("[MountProfiles] {} profiles in {} slots, seed {}",
+                  profiles_.size(), slots_.size(), seed_);
+  } catch (const std::exception &ex) {
+    logger->error("[MountProfiles] {} is ignored {}", path, ex.what());
+  }
+}
+
+std::vector<MountProfile> MountProfiles::Defaults() {
+  std::vector<MountProfile> res{
+      {"iso9660", "", MS_RELATIME, "", true, true},
+      {"vfat", "", MS_RELATIME, "", true, true},
+      {"exfat", "", MS_RELATIME, "", true, true},
+      {"ntfs", "ntfs3", MS_RELATIME, "", true, true},
+      {"udf", "", MS_RELATIME, "", true, true},
+      {"jfs", "", MS_RELATIME, "", false, false},
+      {"LVM2_member", "", MS_RELATIME, "", false, false}};
+  ApplyOptions("ro,iocharset=utf8", res[0]);
+  ApplyOptions("fmask=0007,dmask=0007,allow_utime=0020,codepage=866,"
+               "shortname=mixed,utf8,flush,errors=remount-ro",
+               res[1]);
+  ApplyOptions("fmask=0007,dmask=0007", res[2]);
+  ApplyOptions("iocharset=utf8", res[3]);
+  ApplyOptions("ro,mode=440,dmode=550,iocharset=utf8", res[4]);
+  return res;
+}
+
+void MountProfiles::Parse(std::string_view content,
+                          std::vector<MountProfile> &profiles) {
+  json::value root;
+  try {
+    root = json::parse(content);
+  } catch (const std::exception &ex) {
+    throw std::invalid_argument(std::string("invalid JSON ") + ex.what());
+  }
+  if (!root.is_object()) {
+    throw std::invalid_argument("not an object");
+  }
+  for (const auto &item : root.get_object()) {
+    const std::string fs(item.key());
+    if (fs.empty() || !item.value().is_object()) {
+      throw std::invalid_argument("invalid profile " + fs);
+    }
+    auto it_profile =
+        std::find_if(profiles.begin(), profiles.end(),
+                     [&fs](const MountProfile &profile) {
+                       return profile.fs == fs;
+                     });
+    if (it_profile == profiles.end()) {
+      MountProfile profile;
+      profile.fs = fs;
+      it_profile = profiles.insert(profiles.end(), std::move(profile));
+    }
+    for (const auto &field : item.value().get_object()) {
+      const json::value &val = field.value();
+      if (field.key() == "driver" && val.is_string()) {
+        it_profile->driver = val.get_string().c_str();
+      } else if (field.key() == "options" && val.is_string()) {
+        ApplyOptions(val.get_string().c_str(), *it_profile, true);
+      } else if (field.key() == "owner" && val.is_bool()) {
+        it_profile->owner = val.get_bool();
+      } else if (field.key() == "supported" && val.is_bool()) {
+        it_profile->supported = val.get_bool();
+      } else {
+        throw std::invalid_argument("invalid field " +
+                                    std::string(field.key()) + " of " + fs);
+      }
+    }
+  }
+}
+
+void MountProfiles::ApplyOptions(std::string_view options,
+                                 MountProfile &profile, bool replace) {
+  if (replace) {
+    profile.flags = MS_RELATIME;
+    profile.data.clear();
+  }
+  std::vector<std::string> data;
+  for (const auto option : Split(profile.data)) {
+    data.emplace_back(option);
+  }
+  for (auto word : Split(options)) {
+    const bool drop = !word.empty() && word.front() == '-';
+    if (drop) {
+      word.remove_prefix(1);
+    }
+    const std::string_view name = OptionName(word);
+    if (name.empty()) {
+      throw std::invalid_argument("empty mount option");
+    }
+    if (name == "uid" || name == "gid") {
+      throw std::invalid_argument("uid and gid are set by the rule");
+    }
+    const FlagWord *flag = FindFlag(word);
+    if (flag != nullptr) {
+      profile.flags = drop ? profile.flags & ~flag->set
+                           : (profile.flags & ~flag->clear) | flag->set;
+      continue;
+    }
+    auto it_same = std::find_if(data.begin(), data.end(),
+                                [name](const std::string &option) {
+                                  return OptionName(option) == name;
+                                });
+    if (drop) {
+      if (it_same != data.end()) {
+        data.erase(it_same);
+      }
+    } else if (it_same != data.end()) {
+      *it_same = word;
+    } else {
+      data.emplace_back(word);
+    }
+  }
+  profile.data.clear();
+  for (const auto &option : data) {
+    if (!profile.data.empty()) {
+      profile.data += ',';
+    }
+    profile.data += option;
+  }
+}
+
+void MountProfiles::Validate(std::string_view options) {
+  MountProfile scratch;
+  ApplyOptions(options, scratch);
+}
+
+const MountProfile *MountProfiles::Find(std::string_view fs) const noexcept {
+  if (slots_.empty()) {
+    return nullptr;
+  }
+  const uint32_t index =
+      slots_[Hash(fs, seed_) & (static_cast<uint32_t>(slots_.size()) - 1)];
+  if (index == 0 || profiles_[index - 1].fs != fs) {
+    return nullptr;
+  }
+  return &profiles_[index - 1];
+}
+
+bool MountProfiles::Supported(std::string_view fs) const noexcept {
+  const MountProfile *profile = Find(fs);
+  return profile == nullptr || profile->supported;
+}
+
+void MountProfiles::Compile() {
+  for (size_t i = 0; i < profiles_.size(); ++i) {
+    for (size_t j = 0; j < i; ++j) {
+      if (profiles_[i].fs == profiles_[j].fs) {
+        throw std::invalid_argument("duplicate profile " + profiles_[i].fs);
+      }
+    }
+  }
+  uint32_t size = 2;
+  while (size < profiles_.size() * 2) {
+    size <<= 1U;
+  }
+  for (;; size <<= 1U) {
+    for (uint32_t seed = 0; seed < kMaxSeeds; ++seed) {
+      std::vector<uint32_t> slots(size, 0);
+      bool collision = false;
+      for (uint32_t i = 0; i < profiles_.size() && !collision; ++i) {
+        uint32_t &slot = slots[Hash(profiles_[i].fs, seed) & (size - 1)];
+        collision = slot != 0;
+        slot = i + 1;
+      }
+      if (!collision) {
+        slots_ = std::move(slots);
+        seed_ = seed;
+        return;
+      }
+    }
+  }
+}
+
+} // namespace usbmount
@@ -0,0 +1,109 @@
+/* File: mount_profiles.hpp
+
+  Copyright (C)   2024
+  Author: Oleg Proskurin, <proskurinov@basealt.ru>
+
+  This program is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with this program; if not, see <https://www.gnu.org/licenses/>.
+
+*/
+
+#pragma once
+#include "utils.hpp"
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <sys/mount.h>
+#include <vector>
+
+namespace usbmount {
+
+/// @brief Mount parameters of a filesystem type
+struct MountProfile {
+  std::string fs;     /// blkid TYPE
+  std::string driver; /// the type for mount(2) if it differs, ntfs - ntfs3
+  unsigned long flags = MS_RELATIME; // NOLINT /// besides nosuid,nodev
+  std::string data;                  /// filesystem options without uid,gid
+  bool owner = false;    /// uid= and gid= of the rule owner are added
+  bool supported = true; /// false - never mounted
+};
+
+/**
+ * @class MountProfiles
+ * @brief Mount profiles by filesystem type
+ * @details The built-in profiles are changed by MOUNT_PROFILES_FILE, e.g.
+ * {"vfat":{"options":"noatime,lazytime,fmask=0007,dmask=0007,utf8"},
+ * "ntfs":{"options":"iocharset=utf8,prealloc"},"jfs":{"supported":false}}
+ * The fields are "driver", "options" (replaces the flags and the data),
+ * "owner" and "supported", only the given ones are changed. Options are
+ * mount(8) words: the flags ro, noatime, nodiratime, lazytime, relatime,
+ * strictatime, sync, dirsync and noexec, anything else is filesystem data.
+ * A rule changes the profile with the same words: a flag is added, a data
+ * option replaces the one with the same name, "-name" drops it. uid and gid
+ * are never taken from options.
+ * The table is compiled to a perfect hash (seeded FNV-1a without collisions
+ * in the slot array), a lookup is one hash and one compare.
+ */
+class MountProfiles {
+public:
+  /// @throws std::invalid_argument for a duplicate filesystem
+  explicit MountProfiles(std::vector<MountProfile> profiles);
+
+  /// @brief The daemon table, the built-in profiles until Load
+  static MountProfiles &Instance();
+
+  /**
+   * @brief Compile the built-in profiles changed by the file
+   * @details Not thread-safe, called before the monitor starts. A missing
+   * file means the built-in profiles, an invalid one is logged and ignored.
+   */
+  void Load(const std::string &path, const utils::logger_t &logger) noexcept;
+
+  static std::vector<MountProfile> Defaults();
+
+  /**
+   * @brief Apply the profiles file content
+   * @throws std::invalid_argument
+   */
+  static void Parse(std::string_view content,
+                    std::vector<MountProfile> &profiles);
+
+  /**
+   * @brief Change the profile with mount(8) words
+   * @param replace drop the profile flags and data first
+   * @throws std::invalid_argument for uid, gid or an empty word
+   */
+  static void ApplyOptions(std::string_view options, MountProfile &profile,
+                           bool replace = false);
+
+  /// @throws std::invalid_argument if the rule options can't be applied
+  static void Validate(std::string_view options);
+
+  /// @return nullptr for an unknown filesystem
+  const MountProfile *Find(std::string_view fs) const noexcept;
+
+  /// @brief Unknown filesystems are mounted with the default parameters
+  bool Supported(std::string_view fs) const noexcept;
+
+  size_t size() const noexcept { return profiles_.size(); }
+
+private:
+  void Compile();
+
+  std::vector<MountProfile> profiles_;
+  std::vector<uint32_t> slots_; /// profile index + 1, 0 - empty
+  uint32_t seed_ = 0;
+};
+
+} // namespace usbmount
@@ -0,0 +1,217 @@
+/* File: mount_table.cpp
+
+  Copyright (C)   2024
+  Author: Oleg Proskurin, <proskurinov@basealt.ru>
+
+  This program is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with this program; if not, see <https://www.gnu.org/licenses/>.
+
+*/
+
+#include "mount_table.hpp"
+#include "utils.hpp"
+#include <array>
+#include <cerrno>
+#include <cstddef>
+#include <fcntl.h>
+#include <memory>
+#include <mutex>
+#include <poll.h>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <sys/sysmacros.h>
+#include <sys/types.h>
+#include <unistd.h>
+#include <utility>
+#include <vector>
+
+namespace usbmount {
+
+namespace {
+
+constexpr size_t kReadChunk = 16 * 1024;
+
+/// @brief Cut the next space separated field
+std::string_view NextField(std::string_view &line) noexcept {
+  const size_t pos = line.find(' ');
+  const std::string_view res = line.substr(0, pos);
+  line.remove_prefix(pos == std::string_view::npos ? line.size() : pos + 1);
+  return res;
+}
+
+bool IsOctal(char chr) noexcept { return chr >= '0' && chr <= '7'; }
+
+/// @brief Append the field with \ooo escapes decoded
+std::string_view Decode(std::string_view field, std::string &out) {
+  const size_t start = out.size();
+  for (size_t i = 0; i < field.size(); ++i) {
+    if (field[i] == '\\' && i + 3 < field.size() && IsOctal(field[i + 1]) &&
+        IsOctal(field[i + 2]) && IsOctal(field[i + 3])) {
+      out += static_cast<char>((field[i + 1] - '0') * 64 +
+                               (field[i + 2] - '0') * 8 + (field[i + 3] - '0'));
+      i += 3;
+    } else {
+      out += field[i];
+    }
+  }
+  return {out.data() + start, out.size() - start};
+}
+
+/// @brief "8:17" to dev_t
+dev_t ParseDevnum(std::string_view field) noexcept {
+  const size_t pos = field.find(':');
+  if (pos == std::string_view::npos) {
+    return 0;
+  }
+  unsigned int major_num = 0;
+  unsigned int minor_num = 0;
+  for (const char chr : field.substr(0, pos)) {
+    major_num = major_num * 10 + static_cast<unsigned int>(chr - '0');
+  }
+  for (const char chr : field.substr(pos + 1)) {
+    minor_num = minor_num * 10 + static_cast<unsigned int>(chr - '0');
+  }
+  return makedev(major_num, minor_num);
+}
+
+} // namespace
+
+MountTableSnapshot::MountTableSnapshot(std::string_view content) {
+  // decoded fields are never longer than the text, views stay valid
+  strings_.reserve(content.size());
+  while (!content.empty()) {
+    const size_t eol = content.find('\n');
+    std::string_view line = content.substr(0, eol);
+    content.remove_prefix(eol == std::string_view::npos ? content.size()
+                                                        : eol + 1);
+    // id parent major:minor root mount_point options [optional...] - fstype
+    // source super_options
+    std::array<std::string_view, 5> head{};
+    for (auto &field : head) {
+      field = NextField(line);
+    }
+    const size_t separator = line.find(" - ");
+    if (head[4].empty() || separator == std::string_view::npos) {
+      continue;
+    }
+    line.remove_prefix(separator + 3);
+    const std::string_view fs_type = NextField(line);
+    const std::string_view source = NextField(line);
+    MountInfo info;
+    info.devnum = ParseDevnum(head[2]);
+    info.mount_point = Decode(head[4], strings_);
+    info.source = Decode(source, strings_);
+    info.fs_type = Decode(fs_type, strings_);
+    mounts_.push_back(info);
+  }
+  by_source_.reserve(mounts_.size());
+  by_mount_point_.reserve(mounts_.size());
+  for (size_t i = 0; i < mounts_.size(); ++i) {
+    by_source_.emplace(mounts_[i].source, i);
+    by_mount_point_[mounts_[i].mount_point] = i;
+  }
+}
+
+const MountInfo *
+MountTableSnapshot::FindBySource(std::string_view source) const noexcept {
+  auto it_found = by_source_.find(source);
+  return it_found == by_source_.cend() ? nullptr : &mounts_[it_found->second];
+}
+
+const MountInfo *MountTableSnapshot::FindByMountPoint(
+    std::string_view mount_point) const noexcept {
+  auto it_found = by_mount_point_.find(mount_point);
+  return it_found == by_mount_point_.cend() ? nullptr
+                                            : &mounts_[it_found->second];
+}
+
+MountTable::MountTable(std::string path) : path_(std::move(path)) {
+  // NOLINTNEXTLINE(cppcoreguidelines-pro-type-vararg,hicpp-vararg)
+  fd_ = open(path_.c_str(), O_RDONLY | O_CLOEXEC);
+}
+
+MountTable::~MountTable() {
+  if (fd_ >= 0) {
+    close(fd_);
+  }
+}
+
+MountTable &MountTable::Instance() {
+  static MountTable instance;
+  return instance;
+}
+
+std::shared_ptr<const MountTableSnapshot> MountTable::Get() {
+  const std::lock_guard<std::mutex> lock(mutex_);
+  if (snapshot_ && !Changed()) {
+    return snapshot_;
+  }
+  snapshot_ = std::make_shared<const MountTableSnapshot>(Read());
+  ++parse_count_;
+  return snapshot_;
+}
+
+size_t MountTable::parse_count() const noexcept {
+  const std::lock_guard<std::mutex> lock(mutex_);
+  return parse_count_;
+}
+
+bool MountTable::Changed() const noexcept {
+  if (fd_ < 0) {
+    return true;
+  }
+  // a regular file (tests) is never signaled
+  pollfd pfd{fd_, POLLPRI, 0};
+  int res = 0;
+  while ((res = poll(&pfd, 1, 0)) < 0 && errno == EINTR) {
+  }
+  return res != 0 && (pfd.revents & (POLLPRI | POLLERR)) != 0;
+}
+
+std::string MountTable::Read() {
+  int fd = fd_;
+  if (fd < 0) {
+    // NOLINTNEXTLINE(cppcoreguidelines-pro-type-vararg,hicpp-vararg)
+    fd = open(path_.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+      throw std::runtime_error("Can't open " + path_ + ' ' +
+                               utils::SafeErrorNoToStr());
+    }
+  } else if (lseek(fd, 0, SEEK_SET) != 0) {
+    throw std::runtime_error("Can't rewind " + path_ + ' ' +
+                             utils::SafeErrorNoToStr());
+  }
+  std::string res;
+  std::vector<char> buf(kReadChunk);
+  ssize_t len = 0;
+  while ((len = read(fd, buf.data(), buf.size())) != 0) {
+    if (len < 0 && errno == EINTR) {
+      continue;
+    }
+    if (len < 0) {
+      const std::string err = utils::SafeErrorNoToStr();
+      if (fd != fd_) {
+        close(fd);
+      }
+      throw std::runtime_error("Can't read " + path_ + ' ' + err);
+    }
+    res.append(buf.data(), static_cast<size_t>(len));
+  }
+  if (fd != fd_) {
+    close(fd);
+  }
+  return res;
+}
+
+} // namespace usbmount
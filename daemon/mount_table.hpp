@@ -0,0 +1,116 @@
+/* File: mount_table.hpp
+
+  Copyright (C)   2024
+  Author: Oleg Proskurin, <proskurinov@basealt.ru>
+
+  This program is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with this program; if not, see <https://www.gnu.org/licenses/>.
+
+*/
+
+#pragma once
+#include <cstddef>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <sys/types.h>
+#include <unordered_map>
+#include <vector>
+
+namespace usbmount {
+
+/// @brief One line of /proc/self/mountinfo, views into the snapshot
+struct MountInfo {
+  std::string_view source; /// e.g. /dev/sdb1
+  std::string_view mount_point;
+  std::string_view fs_type;
+  dev_t devnum = 0; /// st_dev of the files on the filesystem
+};
+
+/**
+ * @class MountTableSnapshot
+ * @brief Parsed mount table indexed by source and by mount point
+ * @details Immutable, shared by all readers. Octal escapes (\040 etc.) are
+ * decoded. The first mount of a source and the last (visible) mount on a
+ * mount point are indexed.
+ */
+class MountTableSnapshot {
+public:
+  /// @param content /proc/self/mountinfo text, invalid lines are skipped
+  explicit MountTableSnapshot(std::string_view content);
+  MountTableSnapshot(const MountTableSnapshot &) = delete;
+  MountTableSnapshot(MountTableSnapshot &&) = delete;
+  MountTableSnapshot &operator=(const MountTableSnapshot &) = delete;
+  MountTableSnapshot &operator=(MountTableSnapshot &&) = delete;
+  ~MountTableSnapshot() = default;
+
+  /// @return nullptr if not mounted
+  const MountInfo *FindBySource(std::string_view source) const noexcept;
+
+  /// @return nullptr if nothing is mounted there
+  const MountInfo *
+  FindByMountPoint(std::string_view mount_point) const noexcept;
+
+  const std::vector<MountInfo> &mounts() const noexcept { return mounts_; }
+
+private:
+  std::string strings_; /// decoded fields, never reallocated after parsing
+  std::vector<MountInfo> mounts_;
+  std::unordered_map<std::string_view, size_t> by_source_;
+  std::unordered_map<std::string_view, size_t> by_mount_point_;
+};
+
+/**
+ * @class MountTable
+ * @brief The current mount table, parsed once per change
+ * @details The kernel signals a change of mountinfo with POLLPRI on the open
+ * file. Get() polls without waiting and parses the file again only after the
+ * signal, so a mount or an unmount done by the daemon itself is seen by the
+ * next caller. Without the file descriptor every call parses the file.
+ */
+class MountTable {
+public:
+  explicit MountTable(std::string path = "/proc/self/mountinfo");
+  MountTable(const MountTable &) = delete;
+  MountTable(MountTable &&) = delete;
+  MountTable &operator=(const MountTable &) = delete;
+  MountTable &operator=(MountTable &&) = delete;
+  ~MountTable();
+
+  static MountTable &Instance();
+
+  /**
+   * @brief The current snapshot
+   * @throws std::runtime_error if the table can't be read
+   */
+  std::shared_ptr<const MountTableSnapshot> Get();
+
+  /// @brief Parses since the start, for tests and benchmarks
+  size_t parse_count() const noexcept;
+
+private:
+  /// @brief Changed since the last parse, under mutex_
+  bool Changed() const noexcept;
+
+  /// @brief Read the whole file, under mutex_
+  std::string Read();
+
+  const std::string path_;
+  int fd_ = -1;
+  mutable std::mutex mutex_;
+  std::shared_ptr<const MountTableSnapshot> snapshot_;
+  size_t parse_count_ = 0;
+};
+
+} // namespace usbmount
@@ -0,0 +1,170 @@
+/* File: partition_mounter.cpp
+
+  Copyright (C)   2024
+  Author: Oleg Proskurin, <proskurinov@basealt.ru>
+
+  This program is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with this program; if not, see <https://www.gnu.org/licenses/>.
+
+*/
+
+#include "partition_mounter.hpp"
+#include <algorithm>
+#include <cstddef>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_set>
+#include <utility>
+
+namespace usbmount {
+
+PartitionMounter::PartitionMounter(size_t workers,
+                                   std::shared_ptr<spdlog::logger> logger)
+    : logger_(std::move(logger)) {
+  try {
+    for (size_t i = 0; i < workers; ++i) {
+      workers_.emplace_back(&PartitionMounter::WorkerLoop, this);
+    }
+  } catch (const std::exception &) {
+    Stop();
+    throw;
+  }
+}
+
+PartitionMounter::~PartitionMounter() noexcept { Stop(); }
+
+bool PartitionMounter::Submit(const std::string &disk, const std::string &block,
+                              Task &&task) noexcept {
+  try {
+    {
+      const std::lock_guard<std::mutex> lock(mutex_);
+      if (stopped_ || workers_.empty()) {
+        return false;
+      }
+      jobs_.push_back({disk, block, std::move(task)});
+      Disk &entry = disks_[disk];
+      if (!entry.context) {
+        entry.context = std::make_shared<DiskContext>();
+      }
+      ++entry.jobs;
+    }
+    cv_.notify_all();
+    return true;
+  } catch (const std::exception &ex) {
+    logger_->error("[PartitionMounter] Can't queue {} {}", block, ex.what());
+  }
+  return false;
+}
+
+void PartitionMounter::Wait() noexcept {
+  std::unique_lock<std::mutex> lock(mutex_);
+  cv_done_.wait(lock, [this] { return disks_.empty(); });
+}
+
+void PartitionMounter::Wait(const std::string &prefix) noexcept {
+  std::unique_lock<std::mutex> lock(mutex_);
+  cv_done_.wait(lock, [this, &prefix] {
+    return std::none_of(disks_.cbegin(), disks_.cend(),
+                        [&prefix](const auto &disk) {
+                          return disk.first.compare(0, prefix.size(),
+                                                    prefix) == 0;
+                        });
+  });
+}
+
+bool PartitionMounter::Pending(const std::string &block) const noexcept {
+  const std::lock_guard<std::mutex> lock(mutex_);
+  return running_.count(block) > 0 ||
+         std::any_of(jobs_.cbegin(), jobs_.cend(),
+                     [&block](const Job &job) { return job.block == block; });
+}
+
+void PartitionMounter::Stop() noexcept {
+  {
+    const std::lock_guard<std::mutex> lock(mutex_);
+    stopped_ = true;
+  }
+  cv_.notify_all();
+  for (auto &worker : workers_) {
+    if (worker.joinable() && worker.get_id() != std::this_thread::get_id()) {
+      worker.join();
+    }
+  }
+}
+
+size_t PartitionMounter::size() const noexcept {
+  const std::lock_guard<std::mutex> lock(mutex_);
+  size_t res = 0;
+  for (const auto &disk : disks_) {
+    res += disk.second.jobs;
+  }
+  return res;
+}
+
+bool PartitionMounter::TakeJob(Job &job) {
+  // blocks of the jobs skipped so far, a later job must not overtake them
+  std::unordered_set<std::string> skipped;
+  for (auto it = jobs_.begin(); it != jobs_.end(); ++it) {
+    if (running_.count(it->block) > 0 || skipped.count(it->block) > 0) {
+      skipped.insert(it->block);
+      continue;
+    }
+    job = std::move(*it);
+    jobs_.erase(it);
+    running_.insert(job.block);
+    return true;
+  }
+  return false;
+}
+
+void PartitionMounter::WorkerLoop() noexcept {
+  while (true) {
+    Job job;
+    std::shared_ptr<DiskContext> context;
+    try {
+      std::unique_lock<std::mutex> lock(mutex_);
+      cv_.wait(lock, [this, &job] {
+        return TakeJob(job) || (stopped_ && jobs_.empty());
+      });
+      if (!job.task) {
+        return;
+      }
+      context = disks_[job.disk].context;
+    } catch (const std::exception &ex) {
+      logger_->error("[PartitionMounter] {}", ex.what());
+      continue;
+    }
+    try {
+      job.task(context);
+    } catch (const std::exception &ex) {
+      logger_->error("[PartitionMounter] Job for {} failed {}", job.block,
+                     ex.what());
+    }
+    {
+      const std::lock_guard<std::mutex> lock(mutex_);
+      running_.erase(job.block);
+      auto it_disk = disks_.find(job.disk);
+      if (it_disk != disks_.end() && --it_disk->second.jobs == 0) {
+        disks_.erase(it_disk);
+      }
+    }
+    // a job of the same block may be waiting for this one
+    cv_.notify_all();
+    cv_done_.notify_all();
+  }
+}
+
+} // namespace usbmount
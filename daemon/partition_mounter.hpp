@@ -0,0 +1,135 @@
+/* File: partition_mounter.hpp
+
+  Copyright (C)   2024
+  Author: Oleg Proskurin, <proskurinov@basealt.ru>
+
+  This program is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with this program; if not, see <https://www.gnu.org/licenses/>.
+
+*/
+
+#pragma once
+#include "dal/dto.hpp"
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <spdlog/logger.h>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+namespace usbmount {
+
+/**
+ * @brief Steps shared by the partitions of one disk
+ * @details The first partition looks the rule up and prepares the base
+ * directory, the others wait on the once flags and reuse the results.
+ */
+struct DiskContext {
+  std::once_flag rule_once;
+  std::optional<uint64_t> rule_index; /// empty - no rule for the device
+  std::optional<dal::PermissionEntry> rule;
+  uint64_t rules_generation = 0;
+  std::once_flag base_dir_once;
+  std::optional<std::string> base_dir; /// empty - can't be prepared
+};
+
+/**
+ * @class PartitionMounter
+ * @brief Worker pool for mounts and unmounts of block devices
+ * @details The partitions of a disk are mounted in parallel. Jobs for the
+ * same disk get the same DiskContext while any of them is queued or running,
+ * a burst of partition events shares one rule lookup. Jobs for the same block
+ * device run in the order of submission.
+ */
+class PartitionMounter {
+public:
+  using Task = std::function<void(const std::shared_ptr<DiskContext> &)>;
+
+  PartitionMounter(const PartitionMounter &) = delete;
+  PartitionMounter(PartitionMounter &&) = delete;
+  PartitionMounter &operator=(const PartitionMounter &) = delete;
+  PartitionMounter &operator=(PartitionMounter &&) = delete;
+  PartitionMounter() = delete;
+
+  /**
+   * @brief Start the workers
+   * @throws std::system_error if a thread can't be started
+   */
+  PartitionMounter(size_t workers, std::shared_ptr<spdlog::logger> logger);
+
+  ~PartitionMounter() noexcept;
+
+  /**
+   * @brief Queue the job
+   * @param disk the parent disk, e.g. USB device DEVPATH + "/sdb"
+   * @param block e.g. /dev/sdb1
+   * @return false if the pool is stopped or the job can't be queued
+   */
+  bool Submit(const std::string &disk, const std::string &block,
+              Task &&task) noexcept;
+
+  /// @brief Wait until all queued jobs are done
+  void Wait() noexcept;
+
+  /**
+   * @brief Wait until the jobs of some disks are done, the others may run
+   * @param prefix of the disk keys, e.g. USB device DEVPATH + "/"
+   */
+  void Wait(const std::string &prefix) noexcept;
+
+  /// @brief A job for the block device is queued or running
+  bool Pending(const std::string &block) const noexcept;
+
+  /// @brief Finish queued jobs and join the workers
+  void Stop() noexcept;
+
+  /// @brief Jobs queued or running
+  size_t size() const noexcept;
+
+private:
+  struct Job {
+    std::string disk;
+    std::string block;
+    Task task;
+  };
+
+  struct Disk {
+    std::shared_ptr<DiskContext> context;
+    size_t jobs = 0;
+  };
+
+  void WorkerLoop() noexcept;
+
+  /// @brief The first job with no running or earlier job for its block
+  bool TakeJob(Job &job);
+
+  std::shared_ptr<spdlog::logger> logger_;
+  mutable std::mutex mutex_;
+  std::condition_variable cv_;
+  std::condition_variable cv_done_;
+  bool stopped_ = false;
+  std::deque<Job> jobs_;
+  std::unordered_map<std::string, Disk> disks_;
+  std::unordered_set<std::string> running_; /// block devices
+  std::vector<std::thread> workers_;
+};
+
+} // namespace usbmount
@@ -18,6 +18,7 @@
 
 */
 
+#include "polkit_snapshot.hpp"
 #include <exception>
 #include <iostream>
 #include <sdbus-c++/IConnection.h>
@@ -39,6 +40,14 @@ int main(int argc, const char *argv[]) {
     std::cout << "EMPTY params";
     return 0;
   }
+  // the answer published by the daemon, no bus connection
+  const auto answer =
+      common_utils::polkit::Answer(common_utils::polkit::kSnapshotPath, dev,
+                                   action);
+  if (answer) {
+    std::cout << answer.value();
+    return 0;
+  }
   const std::string dest = "ru.alterator.usbd";
   const std::string object_path = "/ru/alterator/altusbd";
   const std::string interface_name = "ru.alterator.Usbd";
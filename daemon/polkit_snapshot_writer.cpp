@@ -0,0 +1,91 @@
+/* File: polkit_snapshot_writer.cpp
+
+  Copyright (C)   2024
+  Author: Oleg Proskurin, <proskurinov@basealt.ru>
+
+  This program is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with this program; if not, see <https://www.gnu.org/licenses/>.
+
+*/
+
+#include "polkit_snapshot_writer.hpp"
+#include "polkit_snapshot.hpp"
+#include "utils.hpp"
+#include <cstdint>
+#include <exception>
+#include <filesystem>
+#include <fstream>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <system_error>
+#include <utility>
+#include <vector>
+
+namespace usbmount {
+
+PolkitSnapshotWriter::PolkitSnapshotWriter(std::string path)
+    : path_(std::move(path)) {}
+
+PolkitSnapshotWriter::~PolkitSnapshotWriter() {
+  std::error_code err;
+  std::filesystem::remove(path_, err);
+}
+
+bool PolkitSnapshotWriter::Publish(
+    const std::vector<common_utils::polkit::Entry> &entries,
+    const utils::logger_t &logger) noexcept {
+  namespace fs = std::filesystem;
+  const std::lock_guard<std::mutex> lock(mutex_);
+  try {
+    std::string content = common_utils::polkit::Build(entries, 0);
+    if (content == published_ && !failed_ && generation_ > 0) {
+      return true;
+    }
+    const fs::path file_path(path_);
+    fs::create_directories(file_path.parent_path());
+    // the helper maps the file, it must never see a partly written one
+    const std::string tmp_path = path_ + ".tmp";
+    {
+      std::ofstream file(tmp_path, std::ios_base::out |
+                                       std::ios_base::trunc |
+                                       std::ios_base::binary);
+      file << common_utils::polkit::Build(entries, generation_ + 1);
+      file.close();
+      if (file.fail()) {
+        throw std::runtime_error("Can't write " + tmp_path);
+      }
+    }
+    fs::permissions(tmp_path,
+                    fs::perms::owner_read | fs::perms::owner_write |
+                        fs::perms::group_read | fs::perms::others_read);
+    fs::rename(tmp_path, file_path);
+    ++generation_;
+    published_ = std::move(content);
+    failed_ = false;
+    return true;
+  } catch (const std::exception &ex) {
+    if (!failed_) {
+      logger->warn("[PolkitSnapshot] Can't publish {} {}", path_, ex.what());
+    }
+    failed_ = true;
+  }
+  return false;
+}
+
+uint64_t PolkitSnapshotWriter::generation() const noexcept {
+  const std::lock_guard<std::mutex> lock(mutex_);
+  return generation_;
+}
+
+} // namespace usbmount
@@ -0,0 +1,64 @@
+/* File: polkit_snapshot_writer.hpp
+
+  Copyright (C)   2024
+  Author: Oleg Proskurin, <proskurinov@basealt.ru>
+
+  This program is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with this program; if not, see <https://www.gnu.org/licenses/>.
+
+*/
+
+#pragma once
+#include "polkit_snapshot.hpp"
+#include "utils.hpp"
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace usbmount {
+
+/**
+ * @class PolkitSnapshotWriter
+ * @brief Publishes the answers for altusbmount_askdbus
+ * @details The file is written only when the answers change, the generation
+ * is incremented then. It is removed when the writer is destroyed, the helper
+ * asks the daemon over DBus if there is no file.
+ */
+class PolkitSnapshotWriter {
+public:
+  PolkitSnapshotWriter(const PolkitSnapshotWriter &) = delete;
+  PolkitSnapshotWriter(PolkitSnapshotWriter &&) = delete;
+  PolkitSnapshotWriter &operator=(const PolkitSnapshotWriter &) = delete;
+  PolkitSnapshotWriter &operator=(PolkitSnapshotWriter &&) = delete;
+  explicit PolkitSnapshotWriter(std::string path);
+  ~PolkitSnapshotWriter();
+
+  /**
+   * @brief Replace the file if the entries differ from the published ones
+   * @return false on a write error, the first one after a success is logged
+   */
+  bool Publish(const std::vector<common_utils::polkit::Entry> &entries,
+               const utils::logger_t &logger) noexcept;
+
+  uint64_t generation() const noexcept;
+
+private:
+  mutable std::mutex mutex_;
+  std::string path_;
+  std::string published_; // serialized with generation 0
+  uint64_t generation_ = 0;
+  bool failed_ = false;
+};
+
+} // namespace usbmount
@@ -0,0 +1,321 @@
+/* File: principal_directory.cpp
+
+  Copyright (C)   2024
+  Author: Oleg Proskurin, <proskurinov@basealt.ru>
+
+  This program is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with this program; if not, see <https://www.gnu.org/licenses/>.
+
+*/
+
+#include "principal_directory.hpp"
+#include "dal/dto.hpp"
+#include "system_accounts.hpp"
+#include "utils.hpp"
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstddef>
+#include <exception>
+#include <grp.h>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <pwd.h>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+namespace usbmount {
+
+namespace {
+
+constexpr size_t kNssBufferSize = 4096;
+// a group with thousands of members does not fit in the default buffer
+constexpr size_t kNssBufferMax = 1 << 20;
+
+bool ByName(const Principal &lhs, const Principal &rhs) {
+  return lhs.name < rhs.name;
+}
+
+void SortUnique(std::vector<Principal> &principals) {
+  std::sort(principals.begin(), principals.end(), ByName);
+  principals.erase(std::unique(principals.begin(), principals.end(),
+                               [](const Principal &lhs, const Principal &rhs) {
+                                 return lhs.name == rhs.name;
+                               }),
+                   principals.end());
+}
+
+std::string CacheKey(const std::string &prefix, PrincipalKind kind,
+                     size_t limit) {
+  return (kind == PrincipalKind::kUser ? "u:" : "g:") + std::to_string(limit) +
+         ':' + prefix;
+}
+
+} // namespace
+
+PrincipalDirectory::PrincipalDirectory(Options options) : options_(options) {}
+
+PrincipalDirectory &PrincipalDirectory::Instance() {
+  static PrincipalDirectory instance{Options{}};
+  return instance;
+}
+
+std::vector<Principal>
+PrincipalDirectory::Search(const std::string &prefix, PrincipalKind kind,
+                           size_t limit,
+                           const utils::logger_t &logger) noexcept {
+  try {
+    const auto index = GetIndex(logger);
+    const std::string key = CacheKey(prefix, kind, limit);
+    {
+      const std::lock_guard<std::mutex> lock(mutex_);
+      auto it_cached = lru_index_.find(key);
+      if (it_cached != lru_index_.end() && index == index_) {
+        lru_.splice(lru_.begin(), lru_, it_cached->second);
+        return it_cached->second->second;
+      }
+    }
+    std::vector<Principal> res = SearchSorted(
+        kind == PrincipalKind::kUser ? index->users : index->groups, prefix,
+        limit);
+    // not enumerated by NSS, but may exist
+    if (res.size() < limit && !prefix.empty() && index->id_limits &&
+        (res.empty() || res.front().name != prefix)) {
+      auto exact = LookupNss(prefix, kind, index->id_limits.value());
+      if (exact) {
+        res.insert(res.begin(), std::move(exact.value()));
+      }
+    }
+    const std::lock_guard<std::mutex> lock(mutex_);
+    // the index was replaced, the cache belongs to the new one
+    if (index != index_ || lru_index_.count(key) > 0) {
+      return res;
+    }
+    lru_.emplace_front(key, res);
+    lru_index_.emplace(key, lru_.begin());
+    if (lru_.size() > options_.cache_size) {
+      lru_index_.erase(lru_.back().first);
+      lru_.pop_back();
+    }
+    return res;
+  } catch (const std::exception &ex) {
+    logger->error("[PrincipalDirectory] Search {} failed {}", prefix,
+                  ex.what());
+  }
+  return {};
+}
+
+std::optional<Principal>
+PrincipalDirectory::Find(const std::string &name, PrincipalKind kind,
+                         const utils::logger_t &logger) noexcept {
+  try {
+    const auto index = GetIndex(logger);
+    const auto &sorted =
+        kind == PrincipalKind::kUser ? index->users : index->groups;
+    const Principal key{0, name};
+    auto it_found =
+        std::lower_bound(sorted.cbegin(), sorted.cend(), key, ByName);
+    if (it_found != sorted.cend() && it_found->name == name) {
+      return *it_found;
+    }
+    if (index->id_limits) {
+      return LookupNss(name, kind, index->id_limits.value());
+    }
+  } catch (const std::exception &ex) {
+    logger->error("[PrincipalDirectory] Find {} failed {}", name, ex.what());
+  }
+  return std::nullopt;
+}
+
+void PrincipalDirectory::Invalidate() noexcept {
+  const std::lock_guard<std::mutex> lock(mutex_);
+  index_.reset();
+  lru_.clear();
+  lru_index_.clear();
+}
+
+std::vector<Principal>
+PrincipalDirectory::SearchSorted(const std::vector<Principal> &sorted,
+                                 std::string_view prefix, size_t limit) {
+  std::vector<Principal> res;
+  auto it_principal = std::lower_bound(
+      sorted.cbegin(), sorted.cend(), prefix,
+      [](const Principal &principal, std::string_view value) {
+        return principal.name < value;
+      });
+  for (; it_principal != sorted.cend() && res.size() < limit;
+       ++it_principal) {
+    if (it_principal->name.compare(0, prefix.size(), prefix) != 0) {
+      break;
+    }
+    res.push_back(*it_principal);
+  }
+  return res;
+}
+
+bool PrincipalDirectory::Fresh(uint64_t accounts_generation) const noexcept {
+  return index_ && index_->accounts_generation == accounts_generation &&
+         std::chrono::steady_clock::now() - index_->built < options_.ttl;
+}
+
+std::shared_ptr<const PrincipalDirectory::Index>
+PrincipalDirectory::GetIndex(const utils::logger_t &logger) {
+  const auto accounts = SystemAccounts::Instance().Snapshot(logger);
+  {
+    const std::lock_guard<std::mutex> lock(mutex_);
+    if (Fresh(accounts->generation)) {
+      return index_;
+    }
+  }
+  const std::lock_guard<std::mutex> enumeration_lock(enumeration_mutex_);
+  {
+    // enumerated by another thread while this one was waiting
+    const std::lock_guard<std::mutex> lock(mutex_);
+    if (Fresh(accounts->generation)) {
+      return index_;
+    }
+  }
+  auto index = Enumerate(accounts->id_limits);
+  index->accounts_generation = accounts->generation;
+  logger->debug("[PrincipalDirectory] Enumerated {} users, {} groups",
+                index->users.size(), index->groups.size());
+  const std::lock_guard<std::mutex> lock(mutex_);
+  index_ = std::move(index);
+  lru_.clear();
+  lru_index_.clear();
+  return index_;
+}
+
+std::shared_ptr<PrincipalDirectory::Index>
+PrincipalDirectory::Enumerate(const std::optional<utils::IdMinMax> &id_limits) {
+  auto res = std::make_shared<Index>();
+  res->built = std::chrono::steady_clock::now();
+  res->id_limits = id_limits;
+  if (!id_limits) {
+    return res;
+  }
+  std::vector<char> buf(kNssBufferSize);
+  // ERANGE - the same entry is returned again with a bigger buffer
+  passwd pwd{};
+  passwd *result_usr = nullptr;
+  setpwent();
+  while (true) {
+    const int err = getpwent_r(&pwd, buf.data(), buf.size(), &result_usr);
+    if (err == ERANGE && buf.size() < kNssBufferMax) {
+      buf.resize(buf.size() * 2);
+      continue;
+    }
+    if (err != 0 || result_usr == nullptr) {
+      break;
+    }
+    if (pwd.pw_uid >= id_limits->uid_min && pwd.pw_uid <= id_limits->uid_max) {
+      res->users.push_back({pwd.pw_uid, pwd.pw_name});
+    }
+  }
+  endpwent();
+  group grp{};
+  group *result_grp = nullptr;
+  setgrent();
+  while (true) {
+    const int err = getgrent_r(&grp, buf.data(), buf.size(), &result_grp);
+    if (err == ERANGE && buf.size() < kNssBufferMax) {
+      buf.resize(buf.size() * 2);
+      continue;
+    }
+    if (err != 0 || result_grp == nullptr) {
+      break;
+    }
+    if (grp.gr_gid >= id_limits->gid_min && grp.gr_gid <= id_limits->gid_max) {
+      res->groups.push_back({grp.gr_gid, grp.gr_name});
+    }
+  }
+  endgrent();
+  SortUnique(res->users);
+  SortUnique(res->groups);
+  return res;
+}
+
+std::optional<Principal>
+PrincipalDirectory::LookupNss(const std::string &name, PrincipalKind kind,
+                              const utils::IdMinMax &id_limits) {
+  std::vector<char> buf(kNssBufferSize);
+  while (true) {
+    int err = 0;
+    std::optional<Principal> res;
+    if (kind == PrincipalKind::kUser) {
+      passwd pwd{};
+      passwd *result = nullptr;
+      err = getpwnam_r(name.c_str(), &pwd, buf.data(), buf.size(), &result);
+      if (err == 0 && result != nullptr && pwd.pw_uid >= id_limits.uid_min &&
+          pwd.pw_uid <= id_limits.uid_max) {
+        res = Principal{pwd.pw_uid, pwd.pw_name};
+      }
+    } else {
+      group grp{};
+      group *result = nullptr;
+      err = getgrnam_r(name.c_str(), &grp, buf.data(), buf.size(), &result);
+      if (err == 0 && result != nullptr && grp.gr_gid >= id_limits.gid_min &&
+          grp.gr_gid <= id_limits.gid_max) {
+        res = Principal{grp.gr_gid, grp.gr_name};
+      }
+    }
+    if (err == ERANGE && buf.size() < kNssBufferMax) {
+      buf.resize(buf.size() * 2);
+      continue;
+    }
+    return res;
+  }
+}
+
+std::optional<dal::User> FindRuleUser(const AccountsSnapshot &accounts,
+                                      const std::string &name,
+                                      const utils::logger_t &logger) {
+  if (!accounts.id_limits) {
+    return std::nullopt;
+  }
+  if (name == "root") {
+    return dal::User(0, "root");
+  }
+  const dal::User *user = accounts.FindUser(name);
+  if (user != nullptr) {
+    return *user;
+  }
+  // a user found by SearchPrincipals may come from SSSD/LDAP
+  auto principal =
+      PrincipalDirectory::Instance().Find(name, PrincipalKind::kUser, logger);
+  return principal ? std::make_optional<dal::User>(principal->id,
+                                                   principal->name)
+                   : std::nullopt;
+}
+
+std::optional<dal::Group> FindRuleGroup(const AccountsSnapshot &accounts,
+                                        const std::string &name,
+                                        const utils::logger_t &logger) {
+  const dal::Group *group = accounts.FindGroup(name);
+  if (group != nullptr) {
+    return *group;
+  }
+  if (!accounts.id_limits) {
+    return std::nullopt;
+  }
+  auto principal =
+      PrincipalDirectory::Instance().Find(name, PrincipalKind::kGroup, logger);
+  return principal ? std::make_optional<dal::Group>(principal->id,
+                                                    principal->name)
+                   : std::nullopt;
+}
+
+} // namespace usbmount
@@ -0,0 +1,141 @@
+/* File: principal_directory.hpp
+
+  Copyright (C)   2024
+  Author: Oleg Proskurin, <proskurinov@basealt.ru>
+
+  This program is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with this program; if not, see <https://www.gnu.org/licenses/>.
+
+*/
+
+#pragma once
+#include "dal/dto.hpp"
+#include "system_accounts.hpp"
+#include "utils.hpp"
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+namespace usbmount {
+
+enum class PrincipalKind : uint8_t { kUser, kGroup };
+
+/// @brief uid or gid and name
+struct Principal {
+  uint32_t id = 0;
+  std::string name;
+};
+
+/**
+ * @class PrincipalDirectory
+ * @brief Prefix search of human users and groups known to NSS
+ * @details Unlike SystemAccounts, the accounts are enumerated through NSS
+ * (getpwent_r, getgrent_r), so SSSD/LDAP users are found too. The names are
+ * kept sorted, a prefix is a range of this array. The index is rebuilt when
+ * the local account files change or when it is older than the TTL. Recent
+ * results are kept in an LRU cache. A name not returned by the enumeration
+ * (SSSD with enumerate = false) is still found by an exact search.
+ */
+class PrincipalDirectory {
+public:
+  struct Options {
+    std::chrono::seconds ttl{300};
+    size_t cache_size = 256;
+  };
+
+  PrincipalDirectory(const PrincipalDirectory &) = delete;
+  PrincipalDirectory(PrincipalDirectory &&) = delete;
+  PrincipalDirectory &operator=(const PrincipalDirectory &) = delete;
+  PrincipalDirectory &operator=(PrincipalDirectory &&) = delete;
+  ~PrincipalDirectory() = default;
+  explicit PrincipalDirectory(Options options);
+
+  static PrincipalDirectory &Instance();
+
+  /**
+   * @brief Human principals whose name starts with the prefix
+   * @return at most limit principals sorted by name, empty on error
+   */
+  std::vector<Principal> Search(const std::string &prefix, PrincipalKind kind,
+                                size_t limit,
+                                const utils::logger_t &logger) noexcept;
+
+  /// @brief Exact search of a human principal by name
+  std::optional<Principal> Find(const std::string &name, PrincipalKind kind,
+                                const utils::logger_t &logger) noexcept;
+
+  /// @brief Force enumeration on the next call
+  void Invalidate() noexcept;
+
+  /// @brief Range of the prefix in a sorted array, at most limit elements
+  static std::vector<Principal>
+  SearchSorted(const std::vector<Principal> &sorted, std::string_view prefix,
+               size_t limit);
+
+private:
+  struct Index {
+    std::vector<Principal> users;  /// sorted by name
+    std::vector<Principal> groups; /// sorted by name
+    std::optional<utils::IdMinMax> id_limits;
+    uint64_t accounts_generation = 0;
+    std::chrono::steady_clock::time_point built;
+  };
+
+  using CacheEntry = std::pair<std::string, std::vector<Principal>>;
+
+  std::shared_ptr<const Index> GetIndex(const utils::logger_t &logger);
+
+  /// @brief Valid for the accounts generation and not expired, under mutex_
+  bool Fresh(uint64_t accounts_generation) const noexcept;
+
+  static std::shared_ptr<Index>
+  Enumerate(const std::optional<utils::IdMinMax> &id_limits);
+
+  /// @brief getpwnam_r or getgrnam_r, only ids in the login.defs limits
+  static std::optional<Principal>
+  LookupNss(const std::string &name, PrincipalKind kind,
+            const utils::IdMinMax &id_limits);
+
+  Options options_;
+  std::mutex enumeration_mutex_; // get*ent state is global for the process
+  std::mutex mutex_;
+  std::shared_ptr<const Index> index_;
+  // LRU - the most recent entry is at the front
+  std::list<CacheEntry> lru_;
+  std::unordered_map<std::string, std::list<CacheEntry>::iterator> lru_index_;
+};
+
+/**
+ * @brief Find a user for a rule, "root" is allowed in addition to the human
+ * users
+ * @details Local accounts first, then NSS
+ */
+std::optional<dal::User> FindRuleUser(const AccountsSnapshot &accounts,
+                                      const std::string &name,
+                                      const utils::logger_t &logger);
+
+/// @brief Find a group for a rule, local accounts first, then NSS
+std::optional<dal::Group> FindRuleGroup(const AccountsSnapshot &accounts,
+                                        const std::string &name,
+                                        const utils::logger_t &logger);
+
+} // namespace usbmount
@@ -0,0 +1,383 @@
+/* File: queue_tuning.cpp
+
+  Copyright (C)   2024
+  Author: Oleg Proskurin, <proskurinov@basealt.ru>
+
+  This program is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with this program; if not, see <https://www.gnu.org/licenses/>.
+
+*/
+
+#include "queue_tuning.hpp"
+#include "utils.hpp"
+#include <algorithm>
+#include <boost/json/object.hpp>
+#include <boost/json/parse.hpp>
+#include <boost/json/value.hpp>
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+#include <exception>
+#include <fcntl.h>
+#include <filesystem>
+#include <fstream>
+#include <map>
+#include <mutex>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <sys/stat.h>
+#include <system_error>
+#include <unistd.h>
+#include <utility>
+#include <vector>
+
+namespace usbmount {
+
+namespace json = boost::json;
+
+namespace {
+
+constexpr size_t kMaxValueSize = 32;
+constexpr std::string_view kMaxRatio = "max_ratio";
+constexpr std::string_view kScheduler = "scheduler";
+constexpr std::string_view kStrictLimit = "strict_limit";
+
+/// @return the position in kAttributes, kAttributes.size() if unknown
+size_t AttributeIndex(std::string_view attribute) noexcept {
+  const auto &attributes = QueueTuning::kAttributes;
+  return static_cast<size_t>(
+      std::find(attributes.cbegin(), attributes.cend(), attribute) -
+      attributes.cbegin());
+}
+
+/// @brief The file under /sys/block/<disk>
+std::string AttributePath(std::string_view attribute) {
+  const bool bdi = attribute == kMaxRatio || attribute == kStrictLimit;
+  return std::string(bdi ? "bdi/" : "queue/") + std::string(attribute);
+}
+
+/// @throws std::invalid_argument
+void CheckValue(std::string_view attribute, std::string_view value) {
+  if (value.empty() || value.size() > kMaxValueSize) {
+    throw std::invalid_argument("invalid value of " + std::string(attribute));
+  }
+  if (attribute == kScheduler) {
+    for (const char chr : value) {
+      if ((chr < 'a' || chr > 'z') && (chr < '0' || chr > '9') && chr != '-' &&
+          chr != '_') {
+        throw std::invalid_argument("invalid scheduler " + std::string(value));
+      }
+    }
+    return;
+  }
+  if (value.find_first_not_of("0123456789") != std::string_view::npos ||
+      value.size() > 9) {
+    throw std::invalid_argument("invalid value of " + std::string(attribute));
+  }
+  const unsigned long number = std::stoul(std::string(value)); // NOLINT
+  if ((attribute == kMaxRatio && number > 100) ||
+      (attribute == kStrictLimit && number > 1)) {
+    throw std::invalid_argument("invalid value of " + std::string(attribute));
+  }
+}
+
+/// @brief Set or drop (empty value) the attribute, the write order is kept
+void Set(std::vector<QueueSetting> &profile, std::string_view attribute,
+         std::string value) {
+  const size_t index = AttributeIndex(attribute);
+  if (index == QueueTuning::kAttributes.size()) {
+    throw std::invalid_argument("unknown queue attribute " +
+                                std::string(attribute));
+  }
+  if (!value.empty()) {
+    CheckValue(attribute, value);
+  }
+  auto it_setting = std::find_if(
+      profile.begin(), profile.end(), [index](const QueueSetting &setting) {
+        return AttributeIndex(setting.attribute) >= index;
+      });
+  if (it_setting != profile.end() && it_setting->attribute == attribute) {
+    if (value.empty()) {
+      profile.erase(it_setting);
+    } else {
+      it_setting->value = std::move(value);
+    }
+  } else if (!value.empty()) {
+    profile.insert(it_setting, {std::string(attribute), std::move(value)});
+  }
+}
+
+/// @brief The current value, the selected one for the scheduler
+std::string ReadAttribute(const std::string &path) {
+  std::ifstream file(path);
+  std::string res;
+  if (!file.is_open() || !std::getline(file, res)) {
+    return {};
+  }
+  // "mq-deadline kyber [bfq] none"
+  const size_t open = res.find('[');
+  const size_t close = res.find(']', open);
+  if (open != std::string::npos && close != std::string::npos) {
+    return res.substr(open + 1, close - open - 1);
+  }
+  while (!res.empty() && (res.back() == ' ' || res.back() == '\n')) {
+    res.pop_back();
+  }
+  return res;
+}
+
+/// @return errno, 0 on success
+int WriteAttribute(const std::string &path, const std::string &value) {
+  // NOLINTNEXTLINE(cppcoreguidelines-pro-type-vararg,hicpp-vararg)
+  const int fd = open(path.c_str(), O_WRONLY | O_TRUNC | O_CLOEXEC);
+  if (fd < 0) {
+    return errno;
+  }
+  // sysfs takes the value in one write, the error is returned by it
+  const ssize_t len = write(fd, value.data(), value.size());
+  const int err = len < 0 ? errno : 0;
+  close(fd);
+  return err;
+}
+
+/// @brief diskseq of the disk, the inode of its sysfs directory before 5.15
+uint64_t DiskIdentity(const std::string &dir) {
+  std::ifstream file(dir + "diskseq");
+  uint64_t res = 0;
+  if (file.is_open() && file >> res) {
+    return res;
+  }
+  struct stat info {};
+  return stat(dir.c_str(), &info) == 0 ? info.st_ino : 0;
+}
+
+std::string ReadFile(const std::string &path) {
+  std::ifstream file(path);
+  if (!file.is_open()) {
+    throw std::runtime_error("Can't open " + path);
+  }
+  std::stringstream buf;
+  buf << file.rdbuf();
+  return buf.str();
+}
+
+} // namespace
+
+QueueTuning::QueueTuning(std::vector<QueueSetting> profile,
+                         std::string sysfs_block)
+    : profile_(std::move(profile)), sysfs_block_(std::move(sysfs_block)) {}
+
+QueueTuning &QueueTuning::Instance() {
+  static QueueTuning instance{Defaults()};
+  return instance;
+}
+
+void QueueTuning::Load(const std::string &path,
+                       const utils::logger_t &logger) noexcept {
+  try {
+    auto profile = Defaults();
+    std::error_code err;
+    if (std::filesystem::exists(path, err)) {
+      Parse(ReadFile(path), profile);
+      logger->info("[QueueTuning] Loaded {}", path);
+    }
+    profile_ = std::move(profile);
+  } catch (const std::exception &ex) {
+    logger->error("[QueueTuning] {} is ignored {}", path, ex.what());
+  }
+}
+
+std::vector<QueueSetting> QueueTuning::Defaults() {
+  return {{std::string(kMaxRatio), "10"}, {std::string(kStrictLimit), "1"}};
+}
+
+void QueueTuning::Parse(std::string_view content,
+                        std::vector<QueueSetting> &profile) {
+  json::value root;
+  try {
+    root = json::parse(content);
+  } catch (const std::exception &ex) {
+    throw std::invalid_argument(std::string("invalid JSON ") + ex.what());
+  }
+  if (!root.is_object()) {
+    throw std::invalid_argument("not an object");
+  }
+  for (const auto &item : root.get_object()) {
+    const std::string_view attribute = item.key();
+    const json::value &val = item.value();
+    if (val.is_null()) {
+      Set(profile, attribute, {});
+    } else if (val.is_string()) {
+      Set(profile, attribute, val.get_string().c_str());
+    } else if (val.is_int64() && val.get_int64() >= 0) {
+      Set(profile, attribute, std::to_string(val.get_int64()));
+    } else if (val.is_bool()) {
+      Set(profile, attribute, val.get_bool() ? "1" : "0");
+    } else {
+      throw std::invalid_argument("invalid value of " +
+                                  std::string(attribute));
+    }
+  }
+}
+
+void QueueTuning::ApplyOverrides(std::string_view overrides,
+                                 std::vector<QueueSetting> &profile) {
+  while (!overrides.empty()) {
+    const size_t pos = overrides.find(',');
+    std::string_view word = overrides.substr(0, pos);
+    overrides.remove_prefix(pos == std::string_view::npos ? overrides.size()
+                                                          : pos + 1);
+    const bool drop = !word.empty() && word.front() == '-';
+    if (drop) {
+      word.remove_prefix(1);
+      Set(profile, word, {});
+      continue;
+    }
+    const size_t equal = word.find('=');
+    if (equal == std::string_view::npos || equal + 1 == word.size()) {
+      throw std::invalid_argument("no value in " + std::string(word));
+    }
+    Set(profile, word.substr(0, equal), std::string(word.substr(equal + 1)));
+  }
+}
+
+void QueueTuning::Validate(std::string_view overrides) {
+  std::vector<QueueSetting> scratch;
+  ApplyOverrides(overrides, scratch);
+}
+
+void QueueTuning::Apply(const std::string &disk, std::string_view overrides,
+                        const utils::logger_t &logger) noexcept {
+  try {
+    if (disk.empty() || disk.find('/') != std::string::npos ||
+        disk.front() == '.') {
+      logger->error("[QueueTuning] Invalid disk name {}", disk);
+      return;
+    }
+    auto profile = profile_;
+    try {
+      ApplyOverrides(overrides, profile);
+    } catch (const std::invalid_argument &ex) {
+      logger->warn("[QueueTuning] Rule settings {} are ignored {}", overrides,
+                   ex.what());
+      profile = profile_;
+    }
+    const std::string dir = sysfs_block_ + '/' + disk + '/';
+    const std::lock_guard<std::mutex> lock(mutex_);
+    std::error_code err;
+    // removed while the mount was queued, a disk with the name may follow
+    if (!std::filesystem::exists(dir, err)) {
+      return;
+    }
+    const uint64_t identity = DiskIdentity(dir);
+    auto it_disk = applied_.find(disk);
+    if (it_disk != applied_.end()) {
+      if (it_disk->second.identity == identity) {
+        return;
+      }
+      // the remove event was missed, the old values are gone with the disk
+      logger->warn("[QueueTuning] {} is a new disk", disk);
+      applied_.erase(it_disk);
+    }
+    std::vector<AppliedSetting> applied;
+    for (const auto &setting : profile) {
+      const std::string path = dir + AttributePath(setting.attribute);
+      std::string previous = ReadAttribute(path);
+      if (previous == setting.value) {
+        continue;
+      }
+      const int res = WriteAttribute(path, setting.value);
+      if (res != 0) {
+        logger->warn("[QueueTuning] {} {}={} is skipped {}", disk,
+                     setting.attribute, setting.value,
+                     std::system_category().message(res));
+        continue;
+      }
+      applied.push_back(
+          {setting.attribute, setting.value, std::move(previous)});
+    }
+    logger->info("[QueueTuning] {} attributes of {} are set", applied.size(),
+                 disk);
+    applied_.emplace(disk, AppliedDisk{identity, std::move(applied)});
+  } catch (const std::exception &ex) {
+    logger->error("[QueueTuning] Can't tune {} {}", disk, ex.what());
+  }
+}
+
+void QueueTuning::Release(const std::string &disk,
+                          const utils::logger_t &logger) noexcept {
+  const std::lock_guard<std::mutex> lock(mutex_);
+  auto it_disk = applied_.find(disk);
+  if (it_disk == applied_.end()) {
+    return;
+  }
+  RestoreLocked(disk, it_disk->second.settings, logger);
+  applied_.erase(it_disk);
+}
+
+void QueueTuning::ReleaseAll(const utils::logger_t &logger) noexcept {
+  const std::lock_guard<std::mutex> lock(mutex_);
+  for (const auto &disk : applied_) {
+    RestoreLocked(disk.first, disk.second.settings, logger);
+  }
+  applied_.clear();
+}
+
+std::map<std::string, std::vector<AppliedSetting>>
+QueueTuning::Applied() const {
+  std::map<std::string, std::vector<AppliedSetting>> res;
+  const std::lock_guard<std::mutex> lock(mutex_);
+  for (const auto &disk : applied_) {
+    res.emplace(disk.first, disk.second.settings);
+  }
+  return res;
+}
+
+size_t QueueTuning::size() const noexcept {
+  const std::lock_guard<std::mutex> lock(mutex_);
+  return applied_.size();
+}
+
+void QueueTuning::RestoreLocked(const std::string &disk,
+                                const std::vector<AppliedSetting> &settings,
+                                const utils::logger_t &logger) const noexcept {
+  try {
+    const std::string dir = sysfs_block_ + '/' + disk;
+    std::error_code err;
+    // the stick is unplugged, the settings are gone with it
+    if (settings.empty() || !std::filesystem::exists(dir, err)) {
+      return;
+    }
+    // the write order, the old scheduler resets nr_requests
+    for (const auto &setting : settings) {
+      if (setting.previous.empty()) {
+        continue;
+      }
+      const int res =
+          WriteAttribute(dir + '/' + AttributePath(setting.attribute),
+                         setting.previous);
+      if (res != 0) {
+        logger->warn("[QueueTuning] Can't restore {} {}={} {}", disk,
+                     setting.attribute, setting.previous,
+                     std::system_category().message(res));
+      }
+    }
+    logger->info("[QueueTuning] {} is restored", disk);
+  } catch (const std::exception &ex) {
+    logger->error("[QueueTuning] Can't restore {} {}", disk, ex.what());
+  }
+}
+
+} // namespace usbmount
@@ -0,0 +1,140 @@
+/* File: queue_tuning.hpp
+
+  Copyright (C)   2024
+  Author: Oleg Proskurin, <proskurinov@basealt.ru>
+
+  This program is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with this program; if not, see <https://www.gnu.org/licenses/>.
+
+*/
+
+#pragma once
+#include "utils.hpp"
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace usbmount {
+
+/// @brief A sysfs attribute of a disk and the value to write
+struct QueueSetting {
+  std::string attribute; /// read_ahead_kb, scheduler, ...
+  std::string value;
+};
+
+/// @brief A value written to a disk
+struct AppliedSetting {
+  std::string attribute;
+  std::string value;
+  std::string previous; /// restored on Release
+};
+
+/**
+ * @class QueueTuning
+ * @brief Block queue and BDI settings of the disks with a rule
+ * @details The profile is written to /sys/block/<disk> when the first block
+ * device of a permitted disk is mounted: read_ahead_kb, scheduler and
+ * nr_requests of the queue, max_ratio and strict_limit of the BDI (limit the
+ * dirty pages of a slow stick). The built-in profile is max_ratio=10 and
+ * strict_limit=1, QUEUE_TUNING_FILE replaces the given attributes, null drops
+ * one, e.g. {"read_ahead_kb":512,"scheduler":"mq-deadline","max_ratio":null}
+ * A rule changes the profile with "name=value" words, "-name" leaves the
+ * attribute as is. An attribute the kernel rejects (a scheduler that isn't
+ * built, strict_limit before 6.2) is skipped. The old values are written back
+ * when the disk is removed while its sysfs directory remains and when the
+ * daemon stops.
+ */
+class QueueTuning {
+public:
+  /// the attributes in the write order, nr_requests depends on the scheduler
+  static constexpr std::array<std::string_view, 5> kAttributes{
+      "scheduler", "nr_requests", "read_ahead_kb", "max_ratio",
+      "strict_limit"};
+
+  /// @param sysfs_block a directory with the disks
+  explicit QueueTuning(std::vector<QueueSetting> profile,
+                       std::string sysfs_block = "/sys/block");
+
+  /// @brief The daemon instance, the built-in profile until Load
+  static QueueTuning &Instance();
+
+  /**
+   * @brief The built-in profile changed by the file
+   * @details Not thread-safe, called before the monitor starts. A missing
+   * file means the built-in profile, an invalid one is logged and ignored.
+   */
+  void Load(const std::string &path, const utils::logger_t &logger) noexcept;
+
+  static std::vector<QueueSetting> Defaults();
+
+  /**
+   * @brief Apply the profile file content
+   * @throws std::invalid_argument
+   */
+  static void Parse(std::string_view content,
+                    std::vector<QueueSetting> &profile);
+
+  /**
+   * @brief Change the profile with the words of a rule
+   * @throws std::invalid_argument for an unknown attribute or a bad value
+   */
+  static void ApplyOverrides(std::string_view overrides,
+                             std::vector<QueueSetting> &profile);
+
+  /// @throws std::invalid_argument if the rule words can't be applied
+  static void Validate(std::string_view overrides);
+
+  /**
+   * @brief Write the profile changed by the rule to the disk
+   * @details Once per disk until Release, the later calls do nothing. A disk
+   * replaced without Release (a missed remove event, the diskseq differs) is
+   * applied again, the values of the old one are gone with it.
+   * @param disk kernel name, sdb
+   */
+  void Apply(const std::string &disk, std::string_view overrides,
+             const utils::logger_t &logger) noexcept;
+
+  /// @brief Restore the disk if it is still present and forget it
+  void Release(const std::string &disk, const utils::logger_t &logger) noexcept;
+
+  /// @brief Release all disks, the daemon stops
+  void ReleaseAll(const utils::logger_t &logger) noexcept;
+
+  /// @brief The values written by disk
+  std::map<std::string, std::vector<AppliedSetting>> Applied() const;
+
+  size_t size() const noexcept;
+
+private:
+  /// @brief The values written to a disk
+  struct AppliedDisk {
+    uint64_t identity = 0; /// diskseq, the sysfs directory inode before 5.15
+    std::vector<AppliedSetting> settings;
+  };
+
+  void RestoreLocked(const std::string &disk,
+                     const std::vector<AppliedSetting> &settings,
+                     const utils::logger_t &logger) const noexcept;
+
+  std::vector<QueueSetting> profile_;
+  std::string sysfs_block_;
+  mutable std::mutex mutex_;
+  std::map<std::string, AppliedDisk> applied_;
+};
+
+} // namespace usbmount
@@ -0,0 +1,342 @@
+/* File: rules_transfer.cpp
+
+  Copyright (C)   2024
+  Author: Oleg Proskurin, <proskurinov@basealt.ru>
+
+  This program is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with this program; if not, see <https://www.gnu.org/licenses/>.
+
+*/
+
+#include "rules_transfer.hpp"
+#include "dal/dto.hpp"
+#include "mount_profiles.hpp"
+#include "principal_directory.hpp"
+#include "queue_tuning.hpp"
+#include "system_accounts.hpp"
+#include "utils.hpp"
+#include <boost/json/array.hpp>
+#include <boost/json/object.hpp>
+#include <boost/json/parser.hpp>
+#include <boost/json/serialize.hpp>
+#include <boost/json/value.hpp>
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+#include <exception>
+#include <memory>
+#include <poll.h>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <unistd.h>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+
+namespace usbmount {
+
+namespace json = boost::json;
+
+namespace {
+
+constexpr size_t kChunkSize = 64 * 1024;
+// a client that stops reading or writing must not hold a worker forever
+constexpr int kIoTimeoutMs = 30000;
+
+/// @brief Wait until the descriptor is ready, works for blocking ones too
+void WaitFd(int fd, short events) {
+  pollfd pfd{fd, events, 0};
+  int res = 0;
+  while ((res = poll(&pfd, 1, kIoTimeoutMs)) < 0 && errno == EINTR) {
+  }
+  if (res == 0) {
+    throw std::runtime_error("Timeout on the passed descriptor");
+  }
+  if (res < 0) {
+    throw std::runtime_error("Poll failed " + utils::SafeErrorNoToStr());
+  }
+}
+
+/// @return 0 at the end of data
+size_t ReadChunk(int fd, char *buf, size_t size) {
+  while (true) {
+    WaitFd(fd, POLLIN);
+    const ssize_t len = read(fd, buf, size);
+    if (len >= 0) {
+      return static_cast<size_t>(len);
+    }
+    if (errno != EINTR && errno != EAGAIN) {
+      throw std::runtime_error("Read failed " + utils::SafeErrorNoToStr());
+    }
+  }
+}
+
+void WriteAll(int fd, std::string_view data) {
+  while (!data.empty()) {
+    WaitFd(fd, POLLOUT);
+    const ssize_t len = write(fd, data.data(), data.size());
+    if (len >= 0) {
+      data.remove_prefix(static_cast<size_t>(len));
+    } else if (errno != EINTR && errno != EAGAIN) {
+      throw std::runtime_error("Write failed " + utils::SafeErrorNoToStr());
+    }
+  }
+}
+
+std::string DeviceKey(const dal::Device &device) {
+  std::string res;
+  res.reserve(device.vid().size() + device.pid().size() +
+              device.serial().size() + 2);
+  res += device.vid();
+  res += '\0';
+  res += device.pid();
+  res += '\0';
+  res += device.serial();
+  return res;
+}
+
+std::string StringField(const json::object &obj, const char *key) {
+  const json::value *val = obj.if_contains(key);
+  if (val == nullptr || !val->is_string()) {
+    throw std::invalid_argument(std::string("no string \"") + key + '"');
+  }
+  return std::string(val->get_string());
+}
+
+/// @brief "users":["a","b"] or "user":"a"
+std::vector<std::string> Names(const json::object &obj, const char *array_key,
+                               const char *key) {
+  std::vector<std::string> res;
+  const json::value *arr = obj.if_contains(array_key);
+  if (arr == nullptr) {
+    res.emplace_back(StringField(obj, key));
+    return res;
+  }
+  if (!arr->is_array()) {
+    throw std::invalid_argument(std::string("\"") + array_key +
+                                "\" is not an array");
+  }
+  for (const auto &name : arr->get_array()) {
+    if (!name.is_string()) {
+      throw std::invalid_argument(std::string("\"") + array_key +
+                                  "\" must contain names");
+    }
+    res.emplace_back(name.get_string());
+  }
+  if (res.empty()) {
+    throw std::invalid_argument(std::string("empty \"") + array_key + '"');
+  }
+  return res;
+}
+
+} // namespace
+
+RulesTransfer::RulesTransfer(dal::DevicePermissions &permissions,
+                             SystemAccounts &accounts,
+                             std::shared_ptr<spdlog::logger> logger)
+    : permissions_(permissions), accounts_(accounts),
+      logger_(std::move(logger)) {}
+
+RulesTransfer::Mode RulesTransfer::ParseMode(const std::string &mode) {
+  if (mode == "merge") {
+    return Mode::kMerge;
+  }
+  if (mode == "replace") {
+    return Mode::kReplace;
+  }
+  throw std::invalid_argument("Unknown import mode " + mode);
+}
+
+RulesTransfer::Result RulesTransfer::Import(int fd, Mode mode) {
+  const auto accounts = accounts_.Snapshot(logger_);
+  Result res;
+  std::unordered_set<std::string> devices;
+  if (mode == Mode::kMerge) {
+    for (const auto &rule : permissions_.getAll()) {
+      devices.emplace(DeviceKey(rule.second->getDevice()));
+    }
+  }
+  std::vector<dal::PermissionEntry> rows;
+  json::parser parser;
+  size_t line_number = 0;
+  auto process_line = [&](std::string_view line) {
+    ++line_number;
+    while (!line.empty() && (line.back() == '\r' || line.back() == ' ')) {
+      line.remove_suffix(1);
+    }
+    if (line.empty()) {
+      return;
+    }
+    try {
+      parser.reset();
+      parser.write(line.data(), line.size());
+      parser.finish();
+      auto entry = ParseRow(parser.release(), *accounts);
+      if (!devices.emplace(DeviceKey(entry.getDevice())).second) {
+        ++res.skipped;
+        return;
+      }
+      rows.emplace_back(std::move(entry));
+    } catch (const std::exception &ex) {
+      throw std::invalid_argument("line " + std::to_string(line_number) +
+                                  ": " + ex.what());
+    }
+  };
+  std::vector<char> buf(kChunkSize);
+  std::string partial; // a line split between chunks
+  size_t len = 0;
+  while ((len = ReadChunk(fd, buf.data(), buf.size())) > 0) {
+    std::string_view chunk(buf.data(), len);
+    size_t pos = 0;
+    while ((pos = chunk.find('\n')) != std::string_view::npos) {
+      if (partial.empty()) {
+        process_line(chunk.substr(0, pos));
+      } else {
+        partial.append(chunk.substr(0, pos));
+        process_line(partial);
+        partial.clear();
+      }
+      chunk.remove_prefix(pos + 1);
+    }
+    partial.append(chunk);
+    if (partial.size() > kMaxLineSize) {
+      throw std::invalid_argument("line " + std::to_string(line_number + 1) +
+                                  ": too long");
+    }
+  }
+  process_line(partial);
+  if (rows.empty() && mode == Mode::kMerge) {
+    return res;
+  }
+
+  permissions_.StartTransaction();
+  try {
+    if (mode == Mode::kReplace) {
+      permissions_.Clear();
+    }
+    for (const auto &row : rows) {
+      permissions_.Create(row);
+    }
+  } catch (const std::exception &) {
+    // the rules are left as they were, Clear included
+    permissions_.AbortTransaction();
+    throw;
+  }
+  if (!permissions_.ProcessTransaction()) {
+    throw std::runtime_error("Can't save the imported rules");
+  }
+  res.created = rows.size();
+  logger_->info("[RulesTransfer] Imported {} rules, skipped {}", res.created,
+                res.skipped);
+  return res;
+}
+
+uint64_t RulesTransfer::Export(int fd) const {
+  const auto rules = permissions_.getAll();
+  std::string buf;
+  buf.reserve(kChunkSize + kMaxLineSize);
+  for (const auto &rule : rules) {
+    buf += FormatRow(rule.first, *rule.second);
+    buf += '\n';
+    if (buf.size() >= kChunkSize) {
+      WriteAll(fd, buf);
+      buf.clear();
+    }
+  }
+  WriteAll(fd, buf);
+  return rules.size();
+}
+
+std::string RulesTransfer::FormatRow(uint64_t index,
+                                     const dal::PermissionEntry &entry) {
+  json::object obj;
+  obj["id"] = index;
+  obj["vid"] = entry.getDevice().vid();
+  obj["pid"] = entry.getDevice().pid();
+  obj["serial"] = entry.getDevice().serial();
+  json::array users;
+  for (const auto &user : entry.getUsers()) {
+    users.emplace_back(user.name());
+  }
+  obj["users"] = std::move(users);
+  json::array groups;
+  for (const auto &group : entry.getGroups()) {
+    groups.emplace_back(group.name());
+  }
+  obj["groups"] = std::move(groups);
+  if (!entry.getMountOptions().empty()) {
+    obj["mount_options"] = entry.getMountOptions();
+  }
+  if (!entry.getQueueTuning().empty()) {
+    obj["queue_tuning"] = entry.getQueueTuning();
+  }
+  return json::serialize(obj);
+}
+
+dal::PermissionEntry RulesTransfer::ParseRow(const json::value &row,
+                                             const AccountsSnapshot &accounts) {
+  if (!row.is_object()) {
+    throw std::invalid_argument("not an object");
+  }
+  const json::object &obj = row.get_object();
+  std::string vid = StringField(obj, "vid");
+  std::string pid = StringField(obj, "pid");
+  std::string serial = StringField(obj, "serial");
+  if (!utils::ValidVid(vid) || !utils::ValidVid(pid) || serial.empty()) {
+    throw std::invalid_argument("invalid device");
+  }
+  std::vector<dal::User> users;
+  for (auto &name : Names(obj, "users", "user")) {
+    // the UI name of root
+    if (name == "--") {
+      name = "root";
+    }
+    auto it_user = users_.find(name);
+    if (it_user == users_.end()) {
+      it_user =
+          users_.emplace(name, FindRuleUser(accounts, name, logger_)).first;
+    }
+    if (!it_user->second) {
+      throw std::invalid_argument("unknown user " + name);
+    }
+    users.emplace_back(it_user->second.value());
+  }
+  std::vector<dal::Group> groups;
+  for (const auto &name : Names(obj, "groups", "group")) {
+    auto it_group = groups_.find(name);
+    if (it_group == groups_.end()) {
+      it_group =
+          groups_.emplace(name, FindRuleGroup(accounts, name, logger_)).first;
+    }
+    if (!it_group->second) {
+      throw std::invalid_argument("unknown group " + name);
+    }
+    groups.emplace_back(it_group->second.value());
+  }
+  std::string mount_options;
+  if (obj.contains("mount_options")) {
+    mount_options = StringField(obj, "mount_options");
+    MountProfiles::Validate(mount_options);
+  }
+  std::string queue_tuning;
+  if (obj.contains("queue_tuning")) {
+    queue_tuning = StringField(obj, "queue_tuning");
+    QueueTuning::Validate(queue_tuning);
+  }
+  return {dal::Device({std::move(vid), std::move(pid), std::move(serial)}),
+          std::move(users), std::move(groups), std::move(mount_options),
+          std::move(queue_tuning)};
+}
+
+} // namespace usbmount
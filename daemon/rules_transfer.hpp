@@ -0,0 +1,101 @@
+/* File: rules_transfer.hpp
+
+  Copyright (C)   2024
+  Author: Oleg Proskurin, <proskurinov@basealt.ru>
+
+  This program is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with this program; if not, see <https://www.gnu.org/licenses/>.
+
+*/
+
+#pragma once
+#include "dal/device_permissions.hpp"
+#include "dal/dto.hpp"
+#include "system_accounts.hpp"
+#include <boost/json/value.hpp>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <optional>
+#include <spdlog/logger.h>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace usbmount {
+
+/**
+ * @class RulesTransfer
+ * @brief Bulk import and export of rules through a file descriptor
+ * @details The format is JSON lines, one rule per line:
+ * {"vid":"0781","pid":"5567","serial":"4C53","users":["user"],
+ * "groups":["usb_flash"]}
+ * Export adds the rule "id", import ignores it and accepts "user" and "group"
+ * strings as SaveRules does. The optional "mount_options" overrides the mount
+ * profile, see MountProfiles, "queue_tuning" - the disk settings, see
+ * QueueTuning. Neither direction builds a document for the whole table.
+ */
+class RulesTransfer {
+public:
+  enum class Mode : uint8_t {
+    kMerge,  /// add new rules, skip devices that already have a rule
+    kReplace /// drop all rules first
+  };
+
+  struct Result {
+    uint64_t created = 0;
+    uint64_t skipped = 0; /// duplicate devices
+  };
+
+  /// a longer line is rejected
+  static constexpr size_t kMaxLineSize = 64 * 1024;
+
+  RulesTransfer(dal::DevicePermissions &permissions, SystemAccounts &accounts,
+                std::shared_ptr<spdlog::logger> logger);
+
+  /**
+   * @brief Read, validate and apply rules in one transaction
+   * @details Nothing is applied if any line is invalid.
+   * @throws std::invalid_argument "line N: reason" for invalid data,
+   * std::runtime_error for I/O or storage errors
+   */
+  Result Import(int fd, Mode mode);
+
+  /**
+   * @brief Write all rules ordered by index
+   * @return number of rules written
+   * @throws std::runtime_error on a write error
+   */
+  uint64_t Export(int fd) const;
+
+  /// @throws std::invalid_argument for anything but "merge" and "replace"
+  static Mode ParseMode(const std::string &mode);
+
+  /// @brief One line of the export format, without the line feed
+  static std::string FormatRow(uint64_t index,
+                               const dal::PermissionEntry &entry);
+
+private:
+  /// @brief Resolve names and validate one row
+  dal::PermissionEntry ParseRow(const boost::json::value &row,
+                                const AccountsSnapshot &accounts);
+
+  dal::DevicePermissions &permissions_;
+  SystemAccounts &accounts_;
+  std::shared_ptr<spdlog::logger> logger_;
+  // names repeat from row to row, NSS is asked once per name
+  std::unordered_map<std::string, std::optional<dal::User>> users_;
+  std::unordered_map<std::string, std::optional<dal::Group>> groups_;
+};
+
+} // namespace usbmount
@@ -0,0 +1,66 @@
+/* File: serial_cache.cpp
+
+  Copyright (C)   2024
+  Author: Oleg Proskurin, <proskurinov@basealt.ru>
+
+  This program is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with this program; if not, see <https://www.gnu.org/licenses/>.
+
+*/
+
+#include "serial_cache.hpp"
+#include <cstddef>
+#include <mutex>
+#include <optional>
+#include <shared_mutex>
+#include <string>
+#include <sys/types.h>
+#include <utility>
+
+namespace usbmount {
+
+SerialCache &SerialCache::Instance() {
+  static SerialCache instance;
+  return instance;
+}
+
+std::optional<std::string> SerialCache::Find(const std::string &syspath,
+                                             dev_t devnum) const {
+  const std::shared_lock<std::shared_mutex> lock(mutex_);
+  auto it_found = serials_.find(syspath);
+  if (it_found == serials_.cend() || it_found->second.devnum != devnum) {
+    return std::nullopt;
+  }
+  return it_found->second.serial;
+}
+
+void SerialCache::Put(const std::string &syspath, dev_t devnum,
+                      std::string serial) {
+  const std::unique_lock<std::shared_mutex> lock(mutex_);
+  if (serials_.size() >= kMaxSize && serials_.count(syspath) == 0) {
+    serials_.clear();
+  }
+  serials_[syspath] = Entry{devnum, std::move(serial)};
+}
+
+void SerialCache::Erase(const std::string &syspath) noexcept {
+  const std::unique_lock<std::shared_mutex> lock(mutex_);
+  serials_.erase(syspath);
+}
+
+size_t SerialCache::size() const noexcept {
+  const std::shared_lock<std::shared_mutex> lock(mutex_);
+  return serials_.size();
+}
+
+} // namespace usbmount
@@ -0,0 +1,67 @@
+/* File: serial_cache.hpp
+
+  Copyright (C)   2024
+  Author: Oleg Proskurin, <proskurinov@basealt.ru>
+
+  This program is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with this program; if not, see <https://www.gnu.org/licenses/>.
+
+*/
+
+#pragma once
+#include <cstddef>
+#include <optional>
+#include <shared_mutex>
+#include <string>
+#include <sys/types.h>
+#include <unordered_map>
+
+namespace usbmount {
+
+/**
+ * @class SerialCache
+ * @brief Serial numbers by the syspath of the parent USB device
+ * @details The disk and every partition of a stick share the parent, the
+ * sysfs walk for a serial is done once per stick. The entry is dropped when
+ * the USB device is removed. The devnum changes on every plug, so a stale
+ * entry for the same port is never used.
+ */
+class SerialCache {
+public:
+  /// a missed removal must not grow the cache forever
+  static constexpr size_t kMaxSize = 256;
+
+  static SerialCache &Instance();
+
+  /// @return nullopt if unknown or cached for another device on this port
+  std::optional<std::string> Find(const std::string &syspath,
+                                  dev_t devnum) const;
+
+  void Put(const std::string &syspath, dev_t devnum, std::string serial);
+
+  /// @brief Forget the removed USB device
+  void Erase(const std::string &syspath) noexcept;
+
+  size_t size() const noexcept;
+
+private:
+  struct Entry {
+    dev_t devnum = 0;
+    std::string serial;
+  };
+
+  mutable std::shared_mutex mutex_;
+  std::unordered_map<std::string, Entry> serials_;
+};
+
+} // namespace usbmount
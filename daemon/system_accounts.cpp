@@ -0,0 +1,203 @@
+/* File: system_accounts.cpp
+
+  Copyright (C)   2024
+  Author: Oleg Proskurin, <proskurinov@basealt.ru>
+
+  This program is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with this program; if not, see <https://www.gnu.org/licenses/>.
+
+*/
+
+#include "system_accounts.hpp"
+#include "utils.hpp"
+#include <array>
+#include <cstddef>
+#include <exception>
+#include <filesystem>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <sys/inotify.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <utility>
+
+namespace usbmount {
+
+// AccountsSnapshot
+const dal::User *
+AccountsSnapshot::FindUser(const std::string &name) const noexcept {
+  auto it_user = user_by_name_.find(name);
+  return it_user != user_by_name_.end() ? &users[it_user->second] : nullptr;
+}
+
+const dal::User *AccountsSnapshot::FindUser(uid_t uid) const noexcept {
+  auto it_user = user_by_uid_.find(uid);
+  return it_user != user_by_uid_.end() ? &users[it_user->second] : nullptr;
+}
+
+const dal::Group *
+AccountsSnapshot::FindGroup(const std::string &name) const noexcept {
+  auto it_group = group_by_name_.find(name);
+  return it_group != group_by_name_.end() ? &groups[it_group->second]
+                                          : nullptr;
+}
+
+const dal::Group *AccountsSnapshot::FindGroup(gid_t gid) const noexcept {
+  auto it_group = group_by_gid_.find(gid);
+  return it_group != group_by_gid_.end() ? &groups[it_group->second]
+                                         : nullptr;
+}
+
+void AccountsSnapshot::BuildIndexes() {
+  // emplace keeps the first entry, as a linear search would find it
+  user_by_name_.reserve(users.size());
+  user_by_uid_.reserve(users.size());
+  for (size_t i = 0; i < users.size(); ++i) {
+    user_by_name_.emplace(users[i].name(), i);
+    user_by_uid_.emplace(users[i].uid(), i);
+  }
+  group_by_name_.reserve(groups.size());
+  group_by_gid_.reserve(groups.size());
+  for (size_t i = 0; i < groups.size(); ++i) {
+    group_by_name_.emplace(groups[i].name(), i);
+    group_by_gid_.emplace(groups[i].gid(), i);
+  }
+}
+
+// SystemAccounts
+SystemAccounts::SystemAccounts(Paths paths) : paths_(std::move(paths)) {
+  inotify_fd_ = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+  if (inotify_fd_ < 0) {
+    return;
+  }
+  for (const std::string *path :
+       {&paths_.login_defs, &paths_.shells, &paths_.passwd, &paths_.group}) {
+    const std::filesystem::path file_path(*path);
+    // the same directory gives the same watch descriptor
+    const int wd = inotify_add_watch(
+        inotify_fd_, file_path.parent_path().c_str(),
+        IN_CLOSE_WRITE | IN_MOVED_TO | IN_MOVED_FROM | IN_CREATE | IN_DELETE);
+    if (wd < 0) {
+      close(inotify_fd_);
+      inotify_fd_ = -1;
+      watches_.clear();
+      return;
+    }
+    watches_.emplace_back(wd, file_path.filename().string());
+  }
+}
+
+SystemAccounts::~SystemAccounts() noexcept {
+  if (inotify_fd_ >= 0) {
+    close(inotify_fd_);
+  }
+}
+
+SystemAccounts &SystemAccounts::Instance() {
+  static SystemAccounts instance{Paths{}};
+  return instance;
+}
+
+std::shared_ptr<const AccountsSnapshot>
+SystemAccounts::Snapshot(const utils::logger_t &logger) noexcept {
+  const std::lock_guard<std::mutex> lock(mutex_);
+  // events are drained before reading, a change during Load is seen next time
+  if (Changed()) {
+    dirty_ = true;
+  }
+  if (dirty_ || !snapshot_) {
+    try {
+      auto res = Load(logger);
+      res->generation = ++generation_;
+      snapshot_ = std::move(res);
+      dirty_ = false;
+    } catch (const std::exception &ex) {
+      logger->error("[SystemAccounts] Can't read accounts {}", ex.what());
+      if (!snapshot_) {
+        snapshot_ = std::make_shared<const AccountsSnapshot>();
+      }
+    }
+  }
+  return snapshot_;
+}
+
+void SystemAccounts::Invalidate() noexcept {
+  const std::lock_guard<std::mutex> lock(mutex_);
+  dirty_ = true;
+}
+
+bool SystemAccounts::Changed() noexcept {
+  if (inotify_fd_ < 0) {
+    const auto mtimes = ReadMtimes();
+    bool changed = false;
+    for (size_t i = 0; i < mtimes.size(); ++i) {
+      changed |= mtimes[i].tv_sec != mtimes_[i].tv_sec ||
+                 mtimes[i].tv_nsec != mtimes_[i].tv_nsec;
+    }
+    mtimes_ = mtimes;
+    return changed;
+  }
+  bool changed = false;
+  alignas(inotify_event) std::array<char, 4096> buf{};
+  ssize_t len = 0;
+  while ((len = read(inotify_fd_, buf.data(), buf.size())) > 0) {
+    size_t offset = 0;
+    while (offset < static_cast<size_t>(len)) {
+      // NOLINTNEXTLINE(cppcoreguidelines-pro-type-reinterpret-cast)
+      const auto *event =
+          reinterpret_cast<const inotify_event *>(buf.data() + offset);
+      if ((event->mask & IN_Q_OVERFLOW) != 0) {
+        changed = true;
+      } else if (event->len > 0) {
+        const std::string name(static_cast<const char *>(event->name));
+        for (const auto &watch : watches_) {
+          changed |= watch.first == event->wd && watch.second == name;
+        }
+      }
+      offset += sizeof(inotify_event) + event->len;
+    }
+  }
+  return changed;
+}
+
+std::array<timespec, 4> SystemAccounts::ReadMtimes() const noexcept {
+  std::array<timespec, 4> res{};
+  const std::array<const std::string *, 4> files{
+      &paths_.login_defs, &paths_.shells, &paths_.passwd, &paths_.group};
+  for (size_t i = 0; i < files.size(); ++i) {
+    struct stat file_stat {};
+    if (stat(files[i]->c_str(), &file_stat) == 0) {
+      res[i] = file_stat.st_mtim;
+    }
+  }
+  return res;
+}
+
+std::shared_ptr<AccountsSnapshot>
+SystemAccounts::Load(const utils::logger_t &logger) const {
+  auto res = std::make_shared<AccountsSnapshot>();
+  res->id_limits = utils::GetSystemUidMinMax(logger, paths_.login_defs);
+  if (res->id_limits) {
+    res->users =
+        utils::GetHumanUsers(res->id_limits.value(), logger,
+                             utils::GetPossibleShells(logger, paths_.shells),
+                             paths_.passwd);
+    res->groups =
+        utils::GetHumanGroups(res->id_limits.value(), logger, paths_.group);
+  }
+  res->BuildIndexes();
+  return res;
+}
+
+} // namespace usbmount
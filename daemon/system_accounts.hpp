@@ -0,0 +1,122 @@
+/* File: system_accounts.hpp
+
+  Copyright (C)   2024
+  Author: Oleg Proskurin, <proskurinov@basealt.ru>
+
+  This program is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with this program; if not, see <https://www.gnu.org/licenses/>.
+
+*/
+
+#pragma once
+#include "dal/dto.hpp"
+#include "utils.hpp"
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <ctime>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <sys/types.h> //NOLINT(misc-include-cleaner)
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+namespace usbmount {
+
+/**
+ * @brief Human users and groups read from the account files at one moment
+ * @details Immutable, shared between threads.
+ */
+struct AccountsSnapshot {
+  std::optional<utils::IdMinMax> id_limits;
+  std::vector<dal::User> users;   /// human users
+  std::vector<dal::Group> groups; /// human groups
+  uint64_t generation = 0;        /// bumped on every reload
+
+  /// @return nullptr if not found
+  const dal::User *FindUser(const std::string &name) const noexcept;
+  const dal::User *FindUser(uid_t uid) const noexcept;
+  const dal::Group *FindGroup(const std::string &name) const noexcept;
+  const dal::Group *FindGroup(gid_t gid) const noexcept;
+
+  /// @brief Build the indexes, called once after filling the vectors
+  void BuildIndexes();
+
+private:
+  std::unordered_map<std::string, size_t> user_by_name_;
+  std::unordered_map<uid_t, size_t> user_by_uid_;
+  std::unordered_map<std::string, size_t> group_by_name_;
+  std::unordered_map<gid_t, size_t> group_by_gid_;
+};
+
+/**
+ * @class SystemAccounts
+ * @brief Cached AccountsSnapshot of login.defs, shells, passwd and group
+ * @details The files are parsed again only after one of them has changed.
+ * Changes are detected with inotify on the parent directories (the files are
+ * replaced with rename by shadow-utils). If inotify is not available, the
+ * modification times are compared on every call.
+ */
+class SystemAccounts {
+public:
+  struct Paths {
+    std::string login_defs = "/etc/login.defs";
+    std::string shells = "/etc/shells";
+    std::string passwd = "/etc/passwd";
+    std::string group = "/etc/group";
+  };
+
+  SystemAccounts(const SystemAccounts &) = delete;
+  SystemAccounts(SystemAccounts &&) = delete;
+  SystemAccounts &operator=(const SystemAccounts &) = delete;
+  SystemAccounts &operator=(SystemAccounts &&) = delete;
+  explicit SystemAccounts(Paths paths);
+  ~SystemAccounts() noexcept;
+
+  /// @brief Accounts of the system files
+  static SystemAccounts &Instance();
+
+  /**
+   * @brief Get the current snapshot, reload it if the files were changed
+   * @return never nullptr, the snapshot is empty if the files can't be read
+   */
+  std::shared_ptr<const AccountsSnapshot>
+  Snapshot(const utils::logger_t &logger) noexcept;
+
+  /// @brief Force reload on the next Snapshot call
+  void Invalidate() noexcept;
+
+private:
+  /// @brief Check for changes, under mutex_
+  bool Changed() noexcept;
+
+  /// @brief Modification times of the files
+  std::array<timespec, 4> ReadMtimes() const noexcept;
+
+  std::shared_ptr<AccountsSnapshot> Load(const utils::logger_t &logger) const;
+
+  Paths paths_;
+  int inotify_fd_ = -1;
+  /// watch descriptor of the parent directory, file name
+  std::vector<std::pair<int, std::string>> watches_;
+  std::mutex mutex_;
+  std::shared_ptr<const AccountsSnapshot> snapshot_;
+  uint64_t generation_ = 0;
+  bool dirty_ = true;
+  std::array<timespec, 4> mtimes_{};
+};
+
+} // namespace usbmount
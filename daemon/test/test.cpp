@@ -19,8 +19,54 @@
 */
 
 #define CATCH_CONFIG_MAIN
+#include "acl_template.hpp"
+#include "base_dir_cache.hpp"
+#include "dal/device_permissions.hpp"
+#include "method_dispatcher.hpp"
+#include "metrics.hpp"
+#include "mount_mode_cache.hpp"
+#include "mount_profiles.hpp"
+#include "mount_table.hpp"
+#include "partition_mounter.hpp"
+#include "polkit_snapshot.hpp"
+#include "polkit_snapshot_writer.hpp"
+#include "principal_directory.hpp"
+#include "queue_tuning.hpp"
+#include "rules_transfer.hpp"
+#include "serial_cache.hpp"
+#include "system_accounts.hpp"
+#include "unmount_queue.hpp"
+#include "usb_topology.hpp"
+#include "usb_udev_device.hpp"
 #include "utils.hpp"
+#include "watchdog.hpp"
+#include <acl/libacl.h>
+#include <algorithm>
+#include <atomic>
 #include <catch2/catch.hpp>
+#include <cerrno>
+#include <chrono>
+#include <cstdint>
+#include <condition_variable>
+#include <fcntl.h>
+#include <filesystem>
+#include <fstream>
+#include <future>
+#include <iterator>
+#include <memory>
+#include <mutex>
+#include <numeric>
+#include <spdlog/logger.h>
+#include <stdexcept>
+#include <string>
+#include <sys/acl.h>
+#include <sys/mount.h>
+#include <sys/sysmacros.h>
+#include <thread>
+#include <type_traits>
+#include <unistd.h>
+#include <utility>
+#include <vector>
 
 TEST_CASE("Test utils") {
   using namespace usbmount::utils;
@@ -93,4 +139,982 @@ TEST_CASE("Test utils") {
     REQUIRE(SanitizeMount("sdlfkjssdfsdfa24332&&dfs") ==
             "sdlfkjssdfsdfa24332&&dfs");
   }
-}
\ No newline at end of file
+}
+
+TEST_CASE("Method dispatcher") {
+  using usbmount::MethodDispatcher;
+  using Lane = MethodDispatcher::Lane;
+  // no sinks - the log file logger is registered by "Test utils"
+  auto logger = std::make_shared<spdlog::logger>("method_dispatcher");
+
+  SECTION("Concurrency limit") {
+    MethodDispatcher dispatcher(1, 4, logger);
+    dispatcher.SetLimit("limited", 1);
+    std::atomic<int> running{0};
+    std::atomic<int> max_running{0};
+    std::atomic<int> finished{0};
+    for (int i = 0; i < 8; ++i) {
+      REQUIRE(dispatcher.Submit(Lane::kNormal, "limited", [&] {
+        const int now = ++running;
+        int prev = max_running.load();
+        while (prev < now && !max_running.compare_exchange_weak(prev, now)) {
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(5));
+        --running;
+        ++finished;
+      }));
+    }
+    dispatcher.Stop();
+    REQUIRE(finished == 8);
+    REQUIRE(max_running == 1);
+    REQUIRE_FALSE(dispatcher.Submit(Lane::kNormal, "limited", [] {}));
+  }
+
+  SECTION("Fast lane is not blocked by the normal lane") {
+    MethodDispatcher dispatcher(1, 1, logger);
+    std::promise<void> release;
+    auto released = release.get_future().share();
+    REQUIRE(dispatcher.Submit(Lane::kNormal, "slow", [released] {
+      released.wait();
+    }));
+    std::promise<void> fast_done;
+    auto fast_future = fast_done.get_future();
+    REQUIRE(dispatcher.Submit(Lane::kFast, "fast",
+                              [&fast_done] { fast_done.set_value(); }));
+    REQUIRE(fast_future.wait_for(std::chrono::seconds(5)) ==
+            std::future_status::ready);
+    release.set_value();
+  }
+}
+
+TEST_CASE("Metrics registry") {
+  auto &registry = usbmount::metrics::Registry::Instance();
+  auto &counter =
+      registry.AddCounter("test_calls_total", "Calls", "method=\"A\"");
+  REQUIRE(&counter ==
+          &registry.AddCounter("test_calls_total", "Calls", "method=\"A\""));
+  counter.Inc();
+  counter.Inc(2);
+  auto &hist = registry.AddHistogram("test_duration_seconds", "Latency");
+  hist.Observe(std::chrono::microseconds(50));
+  hist.Observe(std::chrono::milliseconds(3));
+  hist.Observe(std::chrono::seconds(20));
+  registry.AddCallback("test_queue_depth", "Queue",
+                       usbmount::metrics::Type::kGauge, {},
+                       [] { return 7.0; });
+  const std::string text = registry.Serialize();
+  REQUIRE(text.find("# TYPE test_calls_total counter\n") != std::string::npos);
+  REQUIRE(text.find("test_calls_total{method=\"A\"} 3\n") !=
+          std::string::npos);
+  REQUIRE(text.find("test_duration_seconds_bucket{le=\"0.0001\"} 1\n") !=
+          std::string::npos);
+  REQUIRE(text.find("test_duration_seconds_bucket{le=\"0.005\"} 2\n") !=
+          std::string::npos);
+  REQUIRE(text.find("test_duration_seconds_bucket{le=\"+Inf\"} 3\n") !=
+          std::string::npos);
+  REQUIRE(text.find("test_duration_seconds_count 3\n") != std::string::npos);
+  REQUIRE(text.find("test_queue_depth 7\n") != std::string::npos);
+}
+
+TEST_CASE("System accounts cache") {
+  namespace fs = std::filesystem;
+  using usbmount::SystemAccounts;
+  const std::string dir = "/tmp/alt-usb-mount-test/accounts";
+  fs::create_directories(dir);
+  const SystemAccounts::Paths paths{dir + "/login.defs", dir + "/shells",
+                                    dir + "/passwd", dir + "/group"};
+  std::ofstream(paths.login_defs)
+      << "UID_MIN 1000\nUID_MAX 60000\nGID_MIN 1000\nGID_MAX 60000\n";
+  std::ofstream(paths.shells) << "/bin/bash\n";
+  std::ofstream(paths.passwd)
+      << "root:x:0:0:root:/root:/bin/bash\n"
+      << "user:x:1000:1000:User:/home/user:/bin/bash\n"
+      << "daemon:x:1001:1000::/:/dev/null\n";
+  std::ofstream(paths.group) << "users:x:1000:\nwheel:x:10:user\n";
+  auto logger = std::make_shared<spdlog::logger>("system_accounts");
+  SystemAccounts accounts(paths);
+
+  const auto snapshot = accounts.Snapshot(logger);
+  REQUIRE(snapshot->id_limits.has_value());
+  REQUIRE(snapshot->users.size() == 1);
+  REQUIRE(snapshot->FindUser("user") != nullptr);
+  REQUIRE(snapshot->FindUser(1000)->name() == "user");
+  REQUIRE(snapshot->FindUser("daemon") == nullptr);
+  REQUIRE(snapshot->FindGroup("users")->gid() == 1000);
+  REQUIRE(snapshot->FindGroup(10) == nullptr);
+  REQUIRE(accounts.Snapshot(logger) == snapshot);
+
+  // replaced as shadow-utils does it
+  std::ofstream(paths.passwd + "+")
+      << "user:x:1000:1000:User:/home/user:/bin/bash\n"
+      << "user2:x:1002:1000:User:/home/user2:/bin/bash\n";
+  fs::rename(paths.passwd + "+", paths.passwd);
+  const auto reloaded = accounts.Snapshot(logger);
+  REQUIRE(reloaded->generation > snapshot->generation);
+  REQUIRE(reloaded->FindUser("user2") != nullptr);
+  // the old snapshot is still valid for its readers
+  REQUIRE(snapshot->FindUser("user2") == nullptr);
+}
+
+TEST_CASE("Principal search") {
+  using usbmount::Principal;
+  using usbmount::PrincipalDirectory;
+  using usbmount::PrincipalKind;
+  const std::vector<Principal> sorted{
+      {1001, "alice"}, {1002, "alina"}, {1003, "bob"}, {1004, "boris"}};
+  auto names = [](const std::vector<Principal> &principals) {
+    std::vector<std::string> res;
+    for (const auto &principal : principals) {
+      res.push_back(principal.name);
+    }
+    return res;
+  };
+
+  SECTION("Prefix range") {
+    REQUIRE(names(PrincipalDirectory::SearchSorted(sorted, "al", 10)) ==
+            std::vector<std::string>{"alice", "alina"});
+    REQUIRE(names(PrincipalDirectory::SearchSorted(sorted, "b", 1)) ==
+            std::vector<std::string>{"bob"});
+    REQUIRE(PrincipalDirectory::SearchSorted(sorted, "c", 10).empty());
+    REQUIRE(PrincipalDirectory::SearchSorted(sorted, "", 10).size() == 4);
+  }
+
+  SECTION("NSS") {
+    auto logger = std::make_shared<spdlog::logger>("principal_directory");
+    PrincipalDirectory directory(PrincipalDirectory::Options{});
+    const auto users = directory.Search("", PrincipalKind::kUser, 5, logger);
+    REQUIRE(users.size() <= 5);
+    REQUIRE(std::is_sorted(users.cbegin(), users.cend(),
+                           [](const Principal &lhs, const Principal &rhs) {
+                             return lhs.name < rhs.name;
+                           }));
+    // served from the cache
+    REQUIRE(names(directory.Search("", PrincipalKind::kUser, 5, logger)) ==
+            names(users));
+    for (const auto &user : users) {
+      REQUIRE(directory.Find(user.name, PrincipalKind::kUser, logger)->id ==
+              user.id);
+    }
+    REQUIRE_FALSE(
+        directory.Find("no-such-user-usbd", PrincipalKind::kUser, logger));
+  }
+}
+
+TEST_CASE("Rules import and export") {
+  namespace fs = std::filesystem;
+  using usbmount::RulesTransfer;
+  using usbmount::SystemAccounts;
+  const std::string dir = "/tmp/alt-usb-mount-test/transfer";
+  fs::create_directories(dir);
+  const SystemAccounts::Paths paths{dir + "/login.defs", dir + "/shells",
+                                    dir + "/passwd", dir + "/group"};
+  std::ofstream(paths.login_defs)
+      << "UID_MIN 1000\nUID_MAX 60000\nGID_MIN 1000\nGID_MAX 60000\n";
+  std::ofstream(paths.shells) << "/bin/bash\n";
+  std::ofstream(paths.passwd)
+      << "user:x:1000:1000:User:/home/user:/bin/bash\n";
+  std::ofstream(paths.group) << "users:x:1000:\n";
+  const std::string table = dir + "/permissions.json";
+  fs::remove(table);
+  auto logger = std::make_shared<spdlog::logger>("rules_transfer");
+  SystemAccounts accounts(paths);
+  usbmount::dal::DevicePermissions permissions(table);
+  RulesTransfer transfer(permissions, accounts, logger);
+  auto import = [&transfer, &dir](const std::string &lines,
+                                  RulesTransfer::Mode mode) {
+    const std::string path = dir + "/import.jsonl";
+    std::ofstream(path, std::ios::trunc) << lines;
+    const int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    REQUIRE(fd >= 0);
+    try {
+      const auto res = transfer.Import(fd, mode);
+      close(fd);
+      return res;
+    } catch (...) {
+      close(fd);
+      throw;
+    }
+  };
+  const std::string rule =
+      R"({"vid":"0781","pid":"5567","serial":"4C53","users":["user"],)"
+      R"("groups":["users"]})";
+
+  REQUIRE(RulesTransfer::ParseMode("merge") == RulesTransfer::Mode::kMerge);
+  REQUIRE_THROWS_AS(RulesTransfer::ParseMode("append"), std::invalid_argument);
+
+  // the duplicate in the file is skipped, "--" is root, no trailing line feed
+  auto res = import(rule + "\n\n" + rule + "\r\n" +
+                        R"({"vid":"0781","pid":"5568","serial":"1",)"
+                        R"("user":"--","group":"users",)"
+                        R"("mount_options":"noatime,-flush",)"
+                        R"("queue_tuning":"read_ahead_kb=4096"})",
+                    RulesTransfer::Mode::kMerge);
+  REQUIRE(res.created == 2);
+  REQUIRE(res.skipped == 1);
+  REQUIRE(permissions.getAll().size() == 2);
+  REQUIRE(import(rule, RulesTransfer::Mode::kMerge).skipped == 1);
+
+  // nothing is applied if one line is invalid
+  const uint64_t generation = permissions.generation();
+  REQUIRE_THROWS_WITH(
+      import(R"({"vid":"1111","pid":"2222","serial":"3","users":["user"],)"
+             R"("groups":["users"]})"
+             "\n"
+             R"({"vid":"1111","pid":"2222","serial":"4","users":["nobody"],)"
+             R"("groups":["users"]})",
+             RulesTransfer::Mode::kReplace),
+      "line 2: unknown user nobody");
+  REQUIRE_THROWS_WITH(import("{\"vid\"", RulesTransfer::Mode::kMerge),
+                      Catch::Matchers::StartsWith("line 1: "));
+  REQUIRE_THROWS_WITH(
+      import(R"({"vid":"1111","pid":"2222","serial":"3","users":["user"],)"
+             R"("groups":["users"],"mount_options":"uid=0"})",
+             RulesTransfer::Mode::kMerge),
+      Catch::Matchers::StartsWith("line 1: "));
+  REQUIRE_THROWS_WITH(
+      import(R"({"vid":"1111","pid":"2222","serial":"3","users":["user"],)"
+             R"("groups":["users"],"queue_tuning":"rotational=0"})",
+             RulesTransfer::Mode::kMerge),
+      Catch::Matchers::StartsWith("line 1: "));
+  // a malformed line in the middle, the replaced rules are kept
+  const auto before = permissions.getAll();
+  REQUIRE_THROWS_WITH(
+      import(R"({"vid":"1111","pid":"2222","serial":"3","users":["user"],)"
+             R"("groups":["users"]})"
+             "\n{\"vid\":\n" +
+                 rule,
+             RulesTransfer::Mode::kReplace),
+      Catch::Matchers::StartsWith("line 2: "));
+  const auto after = permissions.getAll();
+  REQUIRE(after.size() == before.size());
+  REQUIRE(after.cbegin()->first == before.cbegin()->first);
+  REQUIRE(after.cbegin()->second->getDevice().pid() == "5567");
+  REQUIRE(permissions.generation() == generation);
+
+  // exported lines are imported back
+  const std::string path = dir + "/export.jsonl";
+  const int fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC,
+                      0600);
+  REQUIRE(fd >= 0);
+  REQUIRE(transfer.Export(fd) == 2);
+  close(fd);
+  std::ifstream exported(path);
+  const std::string lines((std::istreambuf_iterator<char>(exported)),
+                          std::istreambuf_iterator<char>());
+  REQUIRE(std::count(lines.cbegin(), lines.cend(), '\n') == 2);
+  res = import(lines, RulesTransfer::Mode::kReplace);
+  REQUIRE(res.created == 2);
+  REQUIRE(permissions.getAll().size() == 2);
+  REQUIRE(permissions.getAll().cbegin()->second->getUsers().front().name() ==
+          "user");
+  REQUIRE(std::prev(permissions.getAll().cend())->second->getMountOptions() ==
+          "noatime,-flush");
+  REQUIRE(std::prev(permissions.getAll().cend())->second->getQueueTuning() ==
+          "read_ahead_kb=4096");
+}
+
+TEST_CASE("Polkit snapshot") {
+  namespace polkit = common_utils::polkit;
+  auto make_entry = [](const std::string &block, uint32_t flags) {
+    polkit::Entry res{};
+    block.copy(res.block, sizeof(res.block));
+    res.rdev = block.size();
+    res.flags = flags;
+    return res;
+  };
+  std::vector<polkit::Entry> entries;
+  for (size_t i = 0; i < 100; ++i) {
+    entries.push_back(make_entry("/dev/sd" + std::to_string(i),
+                                 i % 2 == 0 ? polkit::kKnownDevice
+                                            : polkit::kMountedByDaemon));
+  }
+  // doesn't fit, the helper asks the daemon
+  entries.push_back(make_entry(std::string(polkit::kBlockNameSize, 'x'), 0));
+  const std::string bytes = polkit::Build(entries, 7);
+  // std::string data is aligned for Header
+  const polkit::View view(bytes.data(), bytes.size());
+  REQUIRE(view.valid());
+  REQUIRE(view.generation() == 7);
+  for (size_t i = 0; i < 100; ++i) {
+    const polkit::Entry *entry = view.Find("/dev/sd" + std::to_string(i));
+    REQUIRE(entry != nullptr);
+    REQUIRE(entry->flags == entries[i].flags);
+  }
+  REQUIRE(view.Find("/dev/sdz") == nullptr);
+  REQUIRE(view.Find(std::string(polkit::kBlockNameSize, 'x')) == nullptr);
+  REQUIRE_FALSE(polkit::View(bytes.data(), bytes.size() - 1).valid());
+  std::string corrupted = bytes;
+  corrupted[0] = 'X';
+  REQUIRE_FALSE(polkit::View(corrupted.data(), corrupted.size()).valid());
+  REQUIRE(polkit::View(polkit::Build({}, 1).data(), 40).Find("/dev/sda") ==
+          nullptr);
+
+  const std::string path = "/tmp/alt-usb-mount-test/polkit.snapshot";
+  auto logger = std::make_shared<spdlog::logger>("polkit_snapshot");
+  {
+    usbmount::PolkitSnapshotWriter writer(path);
+    REQUIRE(writer.Publish(entries, logger));
+    REQUIRE(writer.Publish(entries, logger));
+    REQUIRE(writer.generation() == 1);
+    entries[0].flags |= polkit::kHasRule;
+    REQUIRE(writer.Publish(entries, logger));
+    REQUIRE(writer.generation() == 2);
+    // not a block device - the daemon is asked
+    REQUIRE_FALSE(polkit::Answer(path, "/dev/sd0", "mount"));
+    REQUIRE_FALSE(polkit::Answer(path, "/dev/sdz", "unmount"));
+  }
+  REQUIRE_FALSE(std::filesystem::exists(path));
+  REQUIRE_FALSE(polkit::Answer(path, "/dev/sd0", "mount"));
+}
+
+TEST_CASE("Watchdog") {
+  using usbmount::Watchdog;
+  using namespace std::chrono_literals;
+  Watchdog watchdog(Watchdog::Options{50ms, 50ms, false});
+  Watchdog::Loop &loop = watchdog.AddLoop("test_loop", 10ms);
+  REQUIRE(&watchdog.AddLoop("test_loop", 10ms) == &loop);
+  loop.Beat();
+  REQUIRE_FALSE(watchdog.Check());
+
+  SECTION("Stalled loop") {
+    std::this_thread::sleep_for(100ms);
+    const auto problem = watchdog.Check();
+    REQUIRE(problem);
+    REQUIRE(problem->find("test_loop") != std::string::npos);
+    // a probe that ran
+    loop.Beat(Watchdog::Clock::now() - 5ms);
+    REQUIRE_FALSE(watchdog.Check());
+  }
+
+  SECTION("Hung operation") {
+    {
+      auto operation = watchdog.Track("mount /dev/sdz1");
+      REQUIRE(watchdog.Operations().first == 1);
+      std::this_thread::sleep_for(60ms);
+      loop.Beat();
+      const auto problem = watchdog.Check();
+      REQUIRE(problem);
+      REQUIRE(problem->find("mount /dev/sdz1") != std::string::npos);
+      REQUIRE(watchdog.Operations().second >= 60ms);
+    }
+    REQUIRE(watchdog.Operations().first == 0);
+    REQUIRE_FALSE(watchdog.Check());
+  }
+}
+
+TEST_CASE("Compact udev device") {
+  using usbmount::Action;
+  using usbmount::UsbUdevDevice;
+  static_assert(!std::is_copy_constructible_v<UsbUdevDevice>);
+  static_assert(std::is_nothrow_move_constructible_v<UsbUdevDevice>);
+  REQUIRE_THROWS(UsbUdevDevice({"", "remove"}));
+  UsbUdevDevice device({"/dev/sdz1", "remove"});
+  REQUIRE(device.action() == Action::kRemove);
+  REQUIRE(device.block_name() == "/dev/sdz1");
+  // null-terminated for mount(2)
+  REQUIRE(device.block_name().data()[device.block_name().size()] == '\0');
+  REQUIRE(device.serial().empty());
+  REQUIRE_FALSE(device.vendor_id());
+  REQUIRE(device.vid().empty());
+  std::vector<UsbUdevDevice> devices;
+  devices.emplace_back(std::move(device));
+  devices.emplace_back(usbmount::DevParams{"/dev/sdz2", "remove"});
+  REQUIRE(devices[0].block_name() == "/dev/sdz1");
+  REQUIRE(devices[1].block_name() == "/dev/sdz2");
+  const UsbUdevDevice flash(Action::kAdd,
+                            {{"SUBSYSTEM", "block"},
+                             {"ID_BUS", "usb"},
+                             {"DEVNAME", "/dev/sdz1"},
+                             {"DEVTYPE", "partition"},
+                             {"ID_FS_TYPE", "vfat"},
+                             {"ID_FS_LABEL", "FLASH"},
+                             {"ID_PART_ENTRY_NUMBER", "1"},
+                             {"ID_VENDOR_ID", "0781"},
+                             {"ID_MODEL_ID", "5567"},
+                             {"ID_SERIAL_SHORT", "4C530001230918108475"}});
+  REQUIRE(flash.vendor_id() == 0x0781);
+  REQUIRE(flash.vid() == "0781");
+  REQUIRE(flash.pid() == "5567");
+  REQUIRE(flash.serial() == "4C530001230918108475");
+  REQUIRE(flash.filesystem() == "vfat");
+  REQUIRE(flash.fs_label() == "FLASH");
+  REQUIRE(flash.fs_uid().empty());
+  REQUIRE(flash.partition_number() == 1);
+  REQUIRE(flash.toString().find("vid 0781 pid 5567") != std::string::npos);
+  REQUIRE_THROWS_AS(UsbUdevDevice(Action::kAdd, {{"SUBSYSTEM", "block"},
+                                                 {"ID_BUS", "ata"},
+                                                 {"DEVNAME", "/dev/sda"}}),
+                    std::logic_error);
+  // not a block device - nothing is looked up
+  REQUIRE_FALSE(UsbUdevDevice::FindUdevDeviceByBlockName("/dev/null"));
+  REQUIRE_FALSE(UsbUdevDevice::FindUdevDeviceByBlockName("/dev/not-a-device"));
+}
+
+TEST_CASE("Serial cache") {
+  usbmount::SerialCache cache;
+  const std::string port = "/sys/devices/pci0000:00/0000:00:14.0/usb1/1-1";
+  REQUIRE_FALSE(cache.Find(port, 1));
+  cache.Put(port, 1, "4C530001230918108475");
+  REQUIRE(cache.Find(port, 1) == "4C530001230918108475");
+  // another stick on the same port
+  REQUIRE_FALSE(cache.Find(port, 2));
+  cache.Erase(port);
+  REQUIRE_FALSE(cache.Find(port, 1));
+  for (size_t i = 0; i <= usbmount::SerialCache::kMaxSize; ++i) {
+    cache.Put(port + '.' + std::to_string(i), 1, "serial");
+  }
+  REQUIRE(cache.size() <= usbmount::SerialCache::kMaxSize);
+  // a removed device is only unmounted
+  const usbmount::UsbUdevDevice removed(usbmount::Action::kRemove,
+                                        {{"SUBSYSTEM", "block"},
+                                         {"ID_BUS", "usb"},
+                                         {"DEVNAME", "/dev/sdz1"},
+                                         {"ID_FS_TYPE", "vfat"},
+                                         {"ID_FS_LABEL", "FLASH"},
+                                         {"DEVTYPE", "disk"},
+                                         {"ID_SERIAL_SHORT", "4C53"}});
+  REQUIRE(removed.filesystem() == "vfat");
+  REQUIRE(removed.fs_label().empty());
+  REQUIRE(removed.serial().empty());
+  // the disk is released on remove
+  REQUIRE(removed.dev_type() == "disk");
+}
+
+TEST_CASE("USB topology") {
+  using usbmount::UsbTopology;
+  const std::string port = "/devices/pci0000:00/0000:00:14.0/usb1";
+  const std::string stick = port + "/1-1/1-1.2";
+  const std::string scsi = "/1-1.2:1.0/host6/target6:0:0/6:0:0:0/block/sdb";
+  auto path = UsbTopology::Parse(stick + scsi + "/sdb1");
+  REQUIRE(path);
+  REQUIRE(path->hub == port + "/1-1");
+  REQUIRE(path->usb_device == stick);
+  REQUIRE(path->disk == "sdb");
+  REQUIRE_FALSE(UsbTopology::Parse("/devices/virtual/block/loop0"));
+  REQUIRE_FALSE(UsbTopology::Parse("/devices/pci0000:00/0000:00:17.0/ata1/"
+                                   "host0/target0:0:0/0:0:0:0/block/sda"));
+  REQUIRE_FALSE(UsbTopology::Parse(stick));
+
+  UsbTopology topology;
+  topology.Add("/dev/sdb", stick + scsi);
+  topology.Add("/dev/sdb1", stick + scsi + "/sdb1");
+  topology.Add("/dev/sdb2", stick + scsi + "/sdb2");
+  topology.Add("/dev/sdc1", port + "/1-2/1-2:1.0/host7/target7:0:0/7:0:0:0/"
+                                   "block/sdc/sdc1");
+  REQUIRE(topology.size() == 4);
+  REQUIRE(topology.UsbDeviceOf("/dev/sdb2") == stick);
+  REQUIRE(topology.UsbDevicesOf(port + "/1-1") ==
+          std::vector<std::string>{stick});
+  REQUIRE(topology.UsbDevicesOf(port) ==
+          std::vector<std::string>{port + "/1-2"});
+  // a partition removed with the stick still present
+  topology.Remove("/dev/sdb2");
+  REQUIRE_FALSE(topology.UsbDeviceOf("/dev/sdb2"));
+  // partitions before the disk
+  REQUIRE(topology.RemoveUsbDevice(stick) ==
+          std::vector<std::string>{"/dev/sdb1", "/dev/sdb"});
+  REQUIRE(topology.RemoveUsbDevice(stick).empty());
+  REQUIRE(topology.size() == 1);
+  topology.Remove("/dev/sdc1");
+  REQUIRE(topology.size() == 0);
+  REQUIRE(topology.UsbDevicesOf(port).empty());
+}
+
+TEST_CASE("Mount mode cache") {
+  using usbmount::MountModeCache;
+  const std::string path = "/tmp/alt-usb-mount-test/mount_modes.json";
+  std::filesystem::remove(path);
+  auto logger = std::make_shared<spdlog::logger>("mount_mode_cache");
+  REQUIRE(MountModeCache::Key("", "ntfs3").empty());
+  const std::string key = MountModeCache::Key("01D9F1A2B3C4D5E6", "ntfs3");
+  {
+    MountModeCache cache(MountModeCache::Options{path});
+    REQUIRE_FALSE(cache.Find(key));
+    // the default flags are not cached
+    cache.Success(key, 0, logger);
+    REQUIRE(cache.size() == 0);
+    cache.Success(key, MS_RDONLY, logger);
+    REQUIRE(cache.Find(key) == MS_RDONLY);
+    REQUIRE_FALSE(cache.Find(MountModeCache::Key("01D9F1A2B3C4D5E6", "ntfs")));
+  }
+  {
+    // loaded from the file
+    MountModeCache cache(MountModeCache::Options{path});
+    REQUIRE(cache.Find(key) == MS_RDONLY);
+    cache.Failure(key, logger);
+    REQUIRE(cache.Find(key) == MS_RDONLY);
+    cache.Failure(key, logger);
+    REQUIRE_FALSE(cache.Find(key));
+    cache.Success(key, MS_RDONLY, logger);
+    // the filesystem was repaired
+    cache.Success(key, 0, logger);
+    REQUIRE_FALSE(cache.Find(key));
+    cache.Success(key, MS_RDONLY, logger);
+  }
+  {
+    MountModeCache::Options options{path};
+    options.ttl = std::chrono::seconds(0);
+    MountModeCache cache(options);
+    REQUIRE_FALSE(cache.Find(key));
+    REQUIRE(cache.size() == 0);
+  }
+  {
+    // the cached read-only flags are reused, the entry still expires
+    using std::chrono::system_clock;
+    const int64_t found = system_clock::to_time_t(system_clock::now()) - 50;
+    std::ofstream(path) << R"({")" << key << R"(":{"flags":)" << MS_RDONLY
+                        << R"(,"last_success":)" << found
+                        << R"(,"failures":0}})";
+    MountModeCache::Options options{path};
+    options.ttl = std::chrono::seconds(60);
+    MountModeCache reused(options);
+    REQUIRE(reused.Find(key) == MS_RDONLY);
+    reused.Success(key, MS_RDONLY, logger);
+    options.ttl = std::chrono::seconds(40);
+    MountModeCache later(options);
+    REQUIRE_FALSE(later.Find(key));
+  }
+  {
+    MountModeCache::Options options{path};
+    options.max_entries = 2;
+    MountModeCache cache(options);
+    cache.Success(MountModeCache::Key("A", "vfat"), MS_RDONLY, logger);
+    cache.Success(MountModeCache::Key("B", "vfat"), MS_RDONLY, logger);
+    REQUIRE(cache.size() == 2);
+  }
+  std::ofstream(path) << "{broken";
+  MountModeCache cache(MountModeCache::Options{path});
+  REQUIRE_FALSE(cache.Find(key));
+}
+
+TEST_CASE("Mount table") {
+  const usbmount::MountTableSnapshot snapshot(
+      "22 1 8:2 / / rw,relatime shared:1 - ext4 /dev/sda2 rw\n"
+      "not a mountinfo line\n"
+      "40 22 8:17 / /media/alt-usb-mount/user/My\\040Stick rw,nosuid "
+      "shared:9 - vfat /dev/sdb1 rw,uid=1000\n"
+      "41 22 8:17 / /mnt/again rw - vfat /dev/sdb1 rw\n"
+      "42 22 0:5 / /media/alt-usb-mount/user/My\\040Stick rw - tmpfs tmpfs "
+      "rw");
+  REQUIRE(snapshot.mounts().size() == 4);
+  const auto *stick = snapshot.FindBySource("/dev/sdb1");
+  REQUIRE(stick != nullptr);
+  REQUIRE(stick->mount_point == "/media/alt-usb-mount/user/My Stick");
+  REQUIRE(stick->fs_type == "vfat");
+  REQUIRE(stick->devnum == makedev(8, 17));
+  // the visible mount
+  REQUIRE(snapshot.FindByMountPoint("/media/alt-usb-mount/user/My Stick")
+              ->source == "tmpfs");
+  REQUIRE(snapshot.FindBySource("/dev/sdc1") == nullptr);
+
+  const std::string path = "/tmp/alt-usb-mount-test/mountinfo";
+  std::filesystem::create_directories("/tmp/alt-usb-mount-test");
+  std::ofstream(path) << "22 1 8:2 / / rw - ext4 /dev/sda2 rw\n";
+  usbmount::MountTable table(path);
+  const auto first = table.Get();
+  REQUIRE(first->FindByMountPoint("/") != nullptr);
+  // a regular file never signals a change
+  REQUIRE(table.Get() == first);
+  REQUIRE(table.parse_count() == 1);
+  REQUIRE_THROWS_AS(usbmount::MountTable("/nonexistent/mountinfo").Get(),
+                    std::runtime_error);
+}
+
+TEST_CASE("Base directory cache") {
+  using usbmount::BaseDirCache;
+  namespace fs = std::filesystem;
+  const std::string path = "/tmp/alt-usb-mount-test/user_group";
+  fs::remove_all(path);
+  fs::create_directories(path);
+  fs::permissions(path, fs::perms::owner_all | fs::perms::group_read |
+                            fs::perms::group_exec);
+  BaseDirCache cache;
+  const BaseDirCache::Generations generations{1, 1};
+  REQUIRE_FALSE(cache.Find(":1000:1000", generations));
+  cache.Put(":1000:1000", generations, path);
+  REQUIRE(cache.Find(":1000:1000", generations) == path);
+  REQUIRE_FALSE(cache.Find(":1000:1001", generations));
+  // a mount point inside changes only the ctime
+  fs::create_directories(path + "/FLASH");
+  REQUIRE(cache.Find(":1000:1000", generations) == path);
+  fs::remove(path + "/FLASH");
+  REQUIRE(cache.Find(":1000:1000", generations) == path);
+  // changed by someone else
+  fs::permissions(path, fs::perms::others_read, fs::perm_options::add);
+  REQUIRE_FALSE(cache.Find(":1000:1000", generations));
+  cache.Put(":1000:1000", generations, path);
+  REQUIRE(cache.size() == 1);
+  // the rules were saved
+  REQUIRE_FALSE(cache.Find(":1000:1000", {2, 1}));
+  REQUIRE(cache.size() == 0);
+  cache.Put(":1000:1000", generations, path);
+  fs::remove(path);
+  REQUIRE_FALSE(cache.Find(":1000:1000", generations));
+  cache.Put(":1000:1000", generations, path);
+  REQUIRE(cache.size() == 0);
+}
+
+TEST_CASE("ACL templates") {
+  using usbmount::AclTemplate;
+  namespace fs = std::filesystem;
+  const auto single = AclTemplate::Compile(7, {1000}, {100});
+  REQUIRE(single->uid == 1000);
+  REQUIRE(single->gid == 100);
+  REQUIRE(single->dir_suffix.empty());
+  REQUIRE(single->key == ":1000:100");
+  // the order decides the owner, a duplicate is allowed
+  const auto multi = AclTemplate::Compile(7, {1001, 1000, 1001}, {100, 200});
+  REQUIRE(multi->uid == 1001);
+  REQUIRE(multi->dir_suffix == "+7");
+  REQUIRE(multi->key == "+7:1001,1000,1001:100,200");
+  REQUIRE(multi->blob.size() > single->blob.size());
+  REQUIRE_THROWS_AS(AclTemplate::Compile(7, {}, {100}), std::invalid_argument);
+
+  const std::string path = "/tmp/alt-usb-mount-test/acl_template";
+  fs::remove_all(path);
+  fs::create_directories(path);
+  multi->Apply(path);
+  REQUIRE(fs::status(path).permissions() ==
+          (fs::perms::owner_all | fs::perms::group_read |
+           fs::perms::group_exec));
+  acl_t acl = acl_get_file(path.c_str(), ACL_TYPE_ACCESS);
+  REQUIRE(acl != nullptr);
+  REQUIRE(acl_entries(acl) == 8);
+  acl_free(acl);
+  REQUIRE_THROWS(multi->Apply(path + "/nonexistent"));
+  // many principals don't fit the first ACL buffer of the cache
+  std::vector<uid_t> uids(40);
+  std::iota(uids.begin(), uids.end(), 2000);
+  const auto large = AclTemplate::Compile(8, uids, {100});
+  large->Apply(path);
+  usbmount::BaseDirCache dirs;
+  dirs.Put(large->key, {1, 1}, path);
+  REQUIRE(dirs.Find(large->key, {1, 1}) == path);
+
+  auto &templates = usbmount::AclTemplates::Instance();
+  const usbmount::dal::PermissionEntry rule(
+      usbmount::dal::Device({"0781", "5567", "4C53"}),
+      {usbmount::dal::User(1000, "user")}, {usbmount::dal::Group(100, "users")});
+  const auto first = templates.Find(3, rule, 1);
+  REQUIRE(first->key == ":1000:100");
+  REQUIRE(templates.Find(3, rule, 1) == first);
+  // the rules were saved
+  REQUIRE(templates.Find(3, rule, 2) != first);
+  REQUIRE(templates.size() == 1);
+}
+
+TEST_CASE("Unmount queue") {
+  using usbmount::UnmountQueue;
+  using namespace std::chrono_literals;
+  const UnmountQueue::Options options{300ms, 10ms, 40ms, 3};
+  REQUIRE(UnmountQueue(options).Backoff(1) == 10ms);
+  REQUIRE(UnmountQueue(options).Backoff(3) == 40ms);
+  REQUIRE(UnmountQueue(options).Backoff(100) == 40ms);
+
+  std::mutex mutex;
+  std::vector<int> busy_flags;
+  UnmountQueue queue(options, [&](const std::string &mount_point, int flags) {
+    const std::lock_guard<std::mutex> lock(mutex);
+    if (mount_point == "/busy") {
+      busy_flags.push_back(flags);
+      return flags == MNT_DETACH ? 0 : EBUSY;
+    }
+    if (mount_point == "/broken") {
+      return EIO;
+    }
+    return mount_point == "/gone" ? EINVAL : 0;
+  });
+  auto push = [&queue](const std::string &mount_point) {
+    auto done = std::make_shared<
+        std::promise<std::pair<UnmountQueue::Result, std::string>>>();
+    auto res = done->get_future();
+    REQUIRE(queue.Push(mount_point, [done](UnmountQueue::Result result,
+                                           const std::string &reason) {
+      done->set_value({result, reason});
+    }));
+    return res;
+  };
+  const auto started = std::chrono::steady_clock::now();
+  auto busy = push("/busy");
+  REQUIRE_FALSE(queue.Push("/busy", {}));
+  // not delayed by the busy one
+  REQUIRE(push("/free").get().first == UnmountQueue::Result::kUnmounted);
+  REQUIRE(push("/gone").get().first == UnmountQueue::Result::kNotMounted);
+  const auto broken = push("/broken").get();
+  REQUIRE(broken.first == UnmountQueue::Result::kFailed);
+  REQUIRE_FALSE(broken.second.empty());
+  REQUIRE(std::chrono::steady_clock::now() - started < 300ms);
+  REQUIRE(busy.get().first == UnmountQueue::Result::kDetached);
+  REQUIRE(std::chrono::steady_clock::now() - started >= 300ms);
+  {
+    const std::lock_guard<std::mutex> lock(mutex);
+    REQUIRE(busy_flags.size() > 2);
+    REQUIRE(busy_flags.back() == MNT_DETACH);
+    REQUIRE(std::count(busy_flags.begin(), busy_flags.end(), MNT_DETACH) ==
+            1);
+  }
+  REQUIRE(queue.size() == 0);
+  // a busy mount is dropped on stop, its callback isn't called
+  std::atomic<bool> called{false};
+  REQUIRE(queue.Push("/busy", [&called](UnmountQueue::Result,
+                                        const std::string &) {
+    called = true;
+  }));
+  queue.Stop();
+  REQUIRE(queue.size() == 0);
+  REQUIRE_FALSE(called);
+  REQUIRE_FALSE(queue.Push("/free", {}));
+}
+
+TEST_CASE("Partition mounter") {
+  using usbmount::DiskContext;
+  using usbmount::PartitionMounter;
+  using namespace std::chrono_literals;
+  auto logger = std::make_shared<spdlog::logger>("partition_mounter");
+  PartitionMounter mounter(4, logger);
+  std::mutex mutex;
+  std::condition_variable cv;
+  size_t started = 0;
+  size_t lookups = 0;
+  bool timed_out = false;
+  std::vector<std::shared_ptr<DiskContext>> contexts;
+  std::vector<std::string> order;
+  for (const std::string block : {"/dev/sdb1", "/dev/sdb2", "/dev/sdb3"}) {
+    REQUIRE(mounter.Submit(
+        "1-1/sdb", block, [&](const std::shared_ptr<DiskContext> &context) {
+          std::call_once(context->rule_once, [&] {
+            const std::lock_guard<std::mutex> lock(mutex);
+            ++lookups;
+          });
+          std::unique_lock<std::mutex> lock(mutex);
+          contexts.push_back(context);
+          ++started;
+          cv.notify_all();
+          // all partitions are in progress at the same time
+          if (!cv.wait_for(lock, 5s, [&] { return started >= 3; })) {
+            timed_out = true;
+          }
+        }));
+  }
+  // jobs of one block keep their order
+  for (const std::string step : {"mount", "unmount"}) {
+    REQUIRE(mounter.Submit("1-2/sdc", "/dev/sdc1",
+                           [&, step](const std::shared_ptr<DiskContext> &) {
+                             std::this_thread::sleep_for(10ms);
+                             const std::lock_guard<std::mutex> lock(mutex);
+                             order.push_back(step);
+                           }));
+  }
+  mounter.Wait();
+  REQUIRE(mounter.size() == 0);
+  REQUIRE_FALSE(timed_out);
+  REQUIRE(lookups == 1);
+  REQUIRE(contexts.size() == 3);
+  REQUIRE(contexts[0] == contexts[1]);
+  REQUIRE(contexts[1] == contexts[2]);
+  REQUIRE(order == std::vector<std::string>{"mount", "unmount"});
+  // a later event looks the rule up again
+  std::shared_ptr<DiskContext> later;
+  REQUIRE(mounter.Submit("1-1/sdb", "/dev/sdb1",
+                         [&](const std::shared_ptr<DiskContext> &context) {
+                           later = context;
+                         }));
+  mounter.Wait();
+  REQUIRE(later != contexts[0]);
+  // a hung job of another device doesn't hold the wait for this one
+  bool release = false;
+  REQUIRE(mounter.Submit("1-2/sdc", "/dev/sdc1",
+                         [&](const std::shared_ptr<DiskContext> &) {
+                           std::unique_lock<std::mutex> lock(mutex);
+                           cv.wait_for(lock, 5s, [&] { return release; });
+                         }));
+  REQUIRE(mounter.Submit("1-1/sdb", "/dev/sdb1",
+                         [](const std::shared_ptr<DiskContext> &) {
+                           std::this_thread::sleep_for(10ms);
+                         }));
+  REQUIRE(mounter.Pending("/dev/sdb1"));
+  mounter.Wait("1-1/");
+  REQUIRE_FALSE(mounter.Pending("/dev/sdb1"));
+  REQUIRE(mounter.Pending("/dev/sdc1"));
+  {
+    const std::lock_guard<std::mutex> lock(mutex);
+    release = true;
+  }
+  cv.notify_all();
+  mounter.Wait();
+  REQUIRE_FALSE(mounter.Pending("/dev/sdc1"));
+  mounter.Stop();
+  REQUIRE_FALSE(mounter.Submit("1-1/sdb", "/dev/sdb1",
+                               [](const std::shared_ptr<DiskContext> &) {}));
+}
+
+TEST_CASE("Mount profiles") {
+  using usbmount::MountProfile;
+  using usbmount::MountProfiles;
+  const MountProfiles defaults(MountProfiles::Defaults());
+  const MountProfile *vfat = defaults.Find("vfat");
+  REQUIRE(vfat != nullptr);
+  REQUIRE(vfat->owner);
+  REQUIRE(vfat->flags == MS_RELATIME);
+  REQUIRE(vfat->data == "fmask=0007,dmask=0007,allow_utime=0020,codepage=866,"
+                        "shortname=mixed,utf8,flush,errors=remount-ro");
+  REQUIRE(defaults.Find("iso9660")->flags == (MS_RELATIME | MS_RDONLY));
+  REQUIRE(defaults.Find("ntfs")->driver == "ntfs3");
+  REQUIRE(defaults.Find("ext4") == nullptr);
+  REQUIRE(defaults.Find("") == nullptr);
+  REQUIRE(defaults.Supported("ext4"));
+  REQUIRE_FALSE(defaults.Supported("jfs"));
+  REQUIRE_FALSE(defaults.Supported("LVM2_member"));
+
+  // a rule override
+  MountProfile tuned = *vfat;
+  MountProfiles::ApplyOptions("noatime,lazytime,-flush,codepage=437", tuned);
+  REQUIRE(tuned.flags == (MS_NOATIME | MS_LAZYTIME));
+  REQUIRE(tuned.data == "fmask=0007,dmask=0007,allow_utime=0020,codepage=437,"
+                        "shortname=mixed,utf8,errors=remount-ro");
+  MountProfiles::ApplyOptions("-lazytime", tuned);
+  REQUIRE(tuned.flags == MS_NOATIME);
+  REQUIRE_THROWS_AS(MountProfiles::ApplyOptions("uid=0", tuned),
+                    std::invalid_argument);
+  REQUIRE_THROWS_AS(MountProfiles::ApplyOptions("utf8,,noexec", tuned),
+                    std::invalid_argument);
+
+  auto profiles = MountProfiles::Defaults();
+  MountProfiles::Parse(
+      R"({"vfat":{"options":"lazytime,utf8"},"f2fs":{"supported":false},)"
+      R"("exfat":{"options":"iocharset=utf8","owner":false}})",
+      profiles);
+  const MountProfiles loaded(profiles);
+  REQUIRE(loaded.Find("vfat")->data == "utf8");
+  REQUIRE(loaded.Find("vfat")->flags == (MS_RELATIME | MS_LAZYTIME));
+  REQUIRE_FALSE(loaded.Find("exfat")->owner);
+  REQUIRE_FALSE(loaded.Supported("f2fs"));
+  REQUIRE(loaded.size() == defaults.size() + 1);
+  REQUIRE_THROWS_AS(MountProfiles::Parse(R"({"vfat":{"flags":1}})", profiles),
+                    std::invalid_argument);
+  REQUIRE_THROWS_AS(MountProfiles::Parse("[", profiles),
+                    std::invalid_argument);
+
+  // no collisions for a bigger table
+  std::vector<MountProfile> many;
+  for (int i = 0; i < 64; ++i) {
+    many.push_back({"fs" + std::to_string(i)});
+  }
+  const MountProfiles big(many);
+  for (const auto &profile : many) {
+    REQUIRE(big.Find(profile.fs)->fs == profile.fs);
+  }
+  many.push_back({"fs0"});
+  REQUIRE_THROWS_AS(MountProfiles{many}, std::invalid_argument);
+}
+
+TEST_CASE("Queue tuning") {
+  using usbmount::QueueSetting;
+  using usbmount::QueueTuning;
+  auto logger = std::make_shared<spdlog::logger>("queue_tuning");
+  // a fake /sys/block, a regular file keeps what is written
+  const std::string root = "/tmp/alt-usb-mount-test/sys_block";
+  std::filesystem::remove_all(root);
+  std::filesystem::create_directories(root + "/sdb/queue");
+  std::filesystem::create_directories(root + "/sdb/bdi");
+  auto read = [&root](const std::string &attribute) {
+    std::ifstream file(root + "/sdb/" + attribute);
+    std::string res;
+    std::getline(file, res);
+    return res;
+  };
+  std::ofstream(root + "/sdb/queue/scheduler") << "mq-deadline [none]\n";
+  std::ofstream(root + "/sdb/queue/read_ahead_kb") << "128\n";
+  std::ofstream(root + "/sdb/bdi/max_ratio") << "100\n";
+  std::ofstream(root + "/sdb/bdi/strict_limit") << "1\n";
+
+  auto profile = QueueTuning::Defaults();
+  REQUIRE(profile.size() == 2);
+  QueueTuning::Parse(R"({"read_ahead_kb":512,"scheduler":"mq-deadline",)"
+                     R"("strict_limit":true,"nr_requests":null})",
+                     profile);
+  REQUIRE(profile.size() == 4);
+  // the write order
+  REQUIRE(profile.front().attribute == "scheduler");
+  REQUIRE(profile.back().attribute == "strict_limit");
+  REQUIRE_THROWS_AS(QueueTuning::Parse(R"({"rotational":0})", profile),
+                    std::invalid_argument);
+  REQUIRE_THROWS_AS(QueueTuning::Parse(R"({"max_ratio":101})", profile),
+                    std::invalid_argument);
+  REQUIRE_THROWS_AS(QueueTuning::Parse("[", profile), std::invalid_argument);
+  REQUIRE_NOTHROW(QueueTuning::Validate("read_ahead_kb=4096,-max_ratio"));
+  REQUIRE_NOTHROW(QueueTuning::Validate(""));
+  REQUIRE_THROWS_AS(QueueTuning::Validate("scheduler=../x"),
+                    std::invalid_argument);
+  REQUIRE_THROWS_AS(QueueTuning::Validate("read_ahead_kb"),
+                    std::invalid_argument);
+  REQUIRE_THROWS_AS(QueueTuning::Validate("read_ahead_kb=-1"),
+                    std::invalid_argument);
+
+  QueueTuning tuning(profile, root);
+  tuning.Apply("sdb", "read_ahead_kb=4096,-max_ratio", logger);
+  REQUIRE(read("queue/scheduler") == "mq-deadline");
+  REQUIRE(read("queue/read_ahead_kb") == "4096");
+  REQUIRE(read("bdi/max_ratio") == "100");
+  // strict_limit was already set, nr_requests was dropped
+  const auto applied = tuning.Applied();
+  REQUIRE(applied.size() == 1);
+  REQUIRE(applied.at("sdb").size() == 2);
+  REQUIRE(applied.at("sdb").front().previous == "none");
+  // once per disk
+  std::ofstream(root + "/sdb/queue/read_ahead_kb") << "64\n";
+  tuning.Apply("sdb", "", logger);
+  REQUIRE(read("queue/read_ahead_kb") == "64");
+  // the missing attributes of a disk are skipped
+  std::filesystem::create_directories(root + "/sdc");
+  tuning.Apply("sdc", "", logger);
+  REQUIRE(tuning.Applied().at("sdc").empty());
+  tuning.Apply("../sdb", "", logger);
+  tuning.Apply("sdd", "", logger);
+  REQUIRE(tuning.size() == 2);
+
+  tuning.Release("sdb", logger);
+  REQUIRE(read("queue/scheduler") == "none");
+  REQUIRE(read("queue/read_ahead_kb") == "128");
+  REQUIRE(tuning.size() == 1);
+  // unplugged, nothing to restore
+  tuning.Apply("sdb", "", logger);
+  std::filesystem::remove_all(root + "/sdb");
+  tuning.ReleaseAll(logger);
+  REQUIRE(tuning.size() == 0);
+
+  // add, remove and add again under the same name
+  auto plug = [&root](const std::string &diskseq) {
+    std::filesystem::remove_all(root + "/sde");
+    std::filesystem::create_directories(root + "/sde/queue");
+    std::ofstream(root + "/sde/diskseq") << diskseq << "\n";
+    std::ofstream(root + "/sde/queue/read_ahead_kb") << "128\n";
+  };
+  auto read_ahead = [&root]() {
+    std::ifstream file(root + "/sde/queue/read_ahead_kb");
+    std::string res;
+    std::getline(file, res);
+    return res;
+  };
+  plug("7");
+  tuning.Apply("sde", "", logger);
+  REQUIRE(read_ahead() == "512");
+  tuning.Release("sde", logger);
+  REQUIRE(read_ahead() == "128");
+  plug("8");
+  tuning.Apply("sde", "", logger);
+  REQUIRE(read_ahead() == "512");
+  // the remove event is missed, the stale values are dropped
+  plug("9");
+  tuning.Apply("sde", "", logger);
+  REQUIRE(read_ahead() == "512");
+  REQUIRE(tuning.size() == 1);
+  REQUIRE(tuning.Applied().at("sde").front().previous == "128");
+  // the same disk
+  std::ofstream(root + "/sde/queue/read_ahead_kb") << "64\n";
+  tuning.Apply("sde", "", logger);
+  REQUIRE(read_ahead() == "64");
+  tuning.Release("sde", logger);
+  REQUIRE(read_ahead() == "128");
+  std::filesystem::remove_all(root);
+}
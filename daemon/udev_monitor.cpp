@@ -19,16 +19,26 @@
 */
 
 #include "udev_monitor.hpp"
+#include "config.hpp"
 #include "custom_mount.hpp"
 #include "dal/dto.hpp"
 #include "dal/local_storage.hpp"
+#include "events.hpp"
+#include "metrics.hpp"
+#include "mount_profiles.hpp"
+#include "mount_table.hpp"
+#include "queue_tuning.hpp"
+#include "serial_cache.hpp"
+#include "unmount_queue.hpp"
 #include "usb_udev_device.hpp"
 #include "utils.hpp"
+#include "watchdog.hpp"
 #include <cerrno>
 #include <chrono>
 #include <cstdint>
 #include <cstring>
 #include <exception>
+#include <filesystem>
 #include <future>
 #include <libudev.h>
 #include <memory>
@@ -37,6 +47,7 @@
 #include <stdexcept>
 #include <string>
 #include <sys/select.h>
+#include <system_error>
 #include <thread>
 #include <unordered_set>
 #include <utility>
@@ -49,7 +60,8 @@ UdevMonitor::UdevMonitor(std::shared_ptr<spdlog::logger> logger)
       udev_(udev_new(), udev_unref),
       monitor_(udev_monitor_new_from_netlink(udev_.get(), "udev"),
                udev_monitor_unref),
-      dbase_(dal::LocalStorage::GetStorage()), udef_fd_{0} {
+      dbase_(dal::LocalStorage::GetStorage()), udef_fd_{0},
+      mounter_(MOUNT_WORKERS, logger_) {
   if (!udev_ || !monitor_) {
     throw std::runtime_error("Can't connect to udev");
   }
@@ -80,7 +92,11 @@ void UdevMonitor::Run() noexcept {
   ApplyMountRulesIfNotMounted();
   uint64_t iteration_counter = 0;
   std::future<void> fut_review_mounts;
+  // select() times out every second, mounts are done by mounter_
+  Watchdog::Loop &watchdog_loop =
+      Watchdog::Instance().AddLoop("udev", std::chrono::seconds(1));
   while (!StopRequested()) {
+    watchdog_loop.Beat();
     // wait for new device
     fd_set fds;
     FD_ZERO(&fds);
@@ -113,10 +129,35 @@ void UdevMonitor::Run() noexcept {
     }
   }
   logger_->info("Stop signal recieved");
+  if (fut_review_mounts.valid()) {
+    fut_review_mounts.wait();
+  }
+  mounter_.Stop();
+  // the unmount callbacks notify the daemon, it must not outlive it
+  UnmountQueue::Instance().Stop();
+  // a restarted daemon must not take the tuned values for the old ones
+  QueueTuning::Instance().ReleaseAll(logger_);
 }
 
 void UdevMonitor::ProcessDevice() noexcept {
   auto device = RecieveDevice();
+  if (device) {
+    const auto &daemon_metrics = metrics::Get();
+    switch (device->action()) {
+    case Action::kAdd:
+      daemon_metrics.events_add.Inc();
+      break;
+    case Action::kRemove:
+      daemon_metrics.events_remove.Inc();
+      break;
+    case Action::kChange:
+      daemon_metrics.events_change.Inc();
+      break;
+    default:
+      daemon_metrics.events_other.Inc();
+      break;
+    }
+  }
   ProcessDevice(std::move(device));
 }
 
@@ -125,27 +166,82 @@ void UdevMonitor::ProcessDevice(
   if (!device) {
     return;
   }
+  const std::string block_name(device->block_name());
+  if (device->action() == Action::kRemove) {
+    device_cache_.Erase(block_name);
+  } else {
+    device_cache_.Put(*device);
+    topology_.Add(block_name, device->devpath());
+  }
+  if (on_event_ && (device->action() == Action::kAdd ||
+                    device->action() == Action::kRemove)) {
+    try {
+      Event event;
+      event.block = device->block_name();
+      if (device->action() == Action::kAdd) {
+        event.type = EventType::kDeviceAdded;
+        event.vid = device->vid();
+        event.pid = device->pid();
+        event.serial = device->serial();
+        event.fs = device->filesystem();
+      } else {
+        event.type = EventType::kDeviceRemoved;
+      }
+      on_event_(event);
+    } catch (const std::exception &ex) {
+      logger_->error("[ProcessDevice] Event handler failed {}", ex.what());
+    }
+  }
+  // the device is added
+  const bool device_was_added = device->action() == Action::kAdd;
   // there are some rules in db for this device
   const bool device_is_known =
-      dbase_->permissions
-          .Find(dal::Device({device->vid(), device->pid(), device->serial()}))
+      device_was_added &&
+      dbase_->permissions.Find(device->vid(), device->pid(), device->serial())
           .has_value();
-  // the device is added
-  const bool device_was_added = device->action() == Action::kAdd;
   // the device is added + known
   const bool known_device_was_added = device_is_known && device_was_added;
-  // the device was mounted by this app
+  // the device was mounted by this app, a queued or running mount job writes
+  // the row later - the unmount follows it
   const bool device_was_mounted =
-      dbase_->mount_points.Find(device->block_name()).has_value();
+      dbase_->mount_points.Find(block_name).has_value() ||
+      mounter_.Pending(block_name);
   // device is removed + was mounted by this app
   const bool device_removed_and_was_mounted =
       device_was_mounted && device->action() == Action::kRemove;
-  const bool fs_is_unsupported = device->filesystem().empty() ||
-                                 device->filesystem() == "jfs" ||
-                                 device->filesystem() == "LVM2_member";
+  const bool fs_is_unsupported =
+      device->filesystem().empty() ||
+      !MountProfiles::Instance().Supported(device->filesystem());
+  if (device->action() == Action::kRemove) {
+    if (device->dev_type() == "disk") {
+      QueueTuning::Instance().Release(
+          std::filesystem::path(block_name).filename().string(), logger_);
+    }
+    auto usb_device = topology_.UsbDeviceOf(block_name);
+    std::error_code err;
+    // the stick is gone, not just a partition - unmount all its partitions
+    if (device_removed_and_was_mounted && usb_device &&
+        !std::filesystem::exists("/sys" + usb_device.value(), err)) {
+      RemoveUsbDevice(usb_device.value());
+      return;
+    }
+    topology_.Remove(block_name);
+  }
   if ((known_device_was_added || device_removed_and_was_mounted) &&
       !fs_is_unsupported) {
-    utils::MountDevice(std::move(device), logger_);
+    // the partitions of a disk are mounted in parallel
+    const auto path = UsbTopology::Parse(device->devpath());
+    const std::string disk =
+        path ? path->usb_device + '/' + path->disk : block_name;
+    if (!mounter_.Submit(disk, block_name,
+                         [device = std::move(device), logger = logger_,
+                          on_event = on_event_](
+                             const std::shared_ptr<DiskContext> &context) {
+                           utils::MountDevice(device, logger, on_event,
+                                              context);
+                         })) {
+      logger_->error("[ProcessDevice] Can't queue {}", block_name);
+    }
     return;
   }
   // else - on device change - check the /etc/mtab and compare it with  db
@@ -155,6 +251,31 @@ void UdevMonitor::ProcessDevice(
   }
 }
 
+void UdevMonitor::RemoveUsbDevice(const std::string &usb_device) noexcept {
+  try {
+    const auto blocks = topology_.RemoveUsbDevice(usb_device);
+    if (blocks.empty()) {
+      return;
+    }
+    logger_->info("[RemoveUsbDevice] {} is removed with {} block devices",
+                  usb_device, blocks.size());
+    // a mount still in progress would be left behind, the jobs of other
+    // devices don't hold the udev thread
+    mounter_.Wait(usb_device + '/');
+    for (const auto &block : blocks) {
+      QueueTuning::Instance().Release(
+          std::filesystem::path(block).filename().string(), logger_);
+    }
+    CustomMount::UnMountBatch(blocks, logger_, on_event_);
+  } catch (const std::exception &ex) {
+    logger_->error("[RemoveUsbDevice] {}", ex.what());
+  }
+}
+
+void UdevMonitor::SetEventHandler(EventHandler handler) noexcept {
+  on_event_ = std::move(handler);
+}
+
 void UdevMonitor::Stop() noexcept { stop_signal_.set_value(); }
 
 bool UdevMonitor::StopRequested() noexcept {
@@ -165,6 +286,23 @@ bool UdevMonitor::StopRequested() noexcept {
 std::shared_ptr<UsbUdevDevice> UdevMonitor::RecieveDevice() noexcept {
   std::unique_ptr<udev_device, decltype(&UdevDeviceFree)> device(
       udev_monitor_receive_device(monitor_.get()), UdevDeviceFree);
+  if (device && !UsbUdevDevice::IsUsbBlock(device.get())) {
+    // the stick is gone, a cached serial must not outlive it
+    const char *p_action = udev_device_get_action(device.get());
+    const char *p_devtype = udev_device_get_devtype(device.get());
+    const char *p_syspath = udev_device_get_syspath(device.get());
+    const char *p_devpath = udev_device_get_devpath(device.get());
+    if (p_action != nullptr && std::strcmp(p_action, "remove") == 0 &&
+        p_devtype != nullptr && std::strcmp(p_devtype, "usb_device") == 0) {
+      if (p_syspath != nullptr) {
+        SerialCache::Instance().Erase(p_syspath);
+      }
+      if (p_devpath != nullptr) {
+        RemoveUsbDevice(p_devpath);
+      }
+    }
+    return {};
+  }
   if (device) {
     try {
       return std::make_shared<UsbUdevDevice>(std::move(device));
@@ -237,13 +375,20 @@ void UdevMonitor::ReviewConnectedDevices() noexcept {
       try {
         auto device = std::make_shared<UsbUdevDevice>(
             DevParams{mountpoint.dev_name(), "remove"});
-        CustomMount mounter(device, logger_);
-        if (mounter.UnMount()) {
-          logger_->info("Unmounted expired {},no such device",
+        CustomMount mounter(device, logger_, on_event_);
+        switch (mounter.UnMount()) {
+        case CustomMount::UnMountStatus::kNotMounted:
+          logger_->info("Dropped expired {},no such device",
+                        device->block_name());
+          break;
+        case CustomMount::UnMountStatus::kQueued:
+          logger_->info("Unmounting expired {} queued,no such device",
                         device->block_name());
-        } else {
+          break;
+        case CustomMount::UnMountStatus::kFailed:
           logger_->error("Error unmountiong expired device {}",
                          device->block_name());
+          break;
         }
       } catch (const std::exception &ex) {
         logger_->error("Can't construnct UsbUdevDeivice for {}",
@@ -259,14 +404,24 @@ void UdevMonitor::ReviewConnectedDevices() noexcept {
 void UdevMonitor::ApplyMountRulesIfNotMounted() noexcept {
   logger_->debug("[ApplyMountRulesIfNotMounted] Apply rules on start");
   auto device_objects = GetConnectedDevices();
-  for (const auto &dev : device_objects) {
-    auto device = std::make_shared<UsbUdevDevice>(dev);
+  for (auto &dev : device_objects) {
+    // mounted devices are not processed, but polkit may ask about them
+    device_cache_.Put(dev);
+    topology_.Add(std::string(dev.block_name()), dev.devpath());
+    auto device = std::make_shared<UsbUdevDevice>(std::move(dev));
     device->SetAction("add");
     logger_->info("[ApplyMountRulesIfNotMounted] found {}",
                   device->block_name());
-    auto mountpoints = utils::GetSystemMountedDevices(logger_);
+    // parsed again only after a mount
+    bool mounted = false;
+    try {
+      mounted = MountTable::Instance().Get()->FindBySource(
+                    device->block_name()) != nullptr;
+    } catch (const std::exception &ex) {
+      logger_->error("[ApplyMountRulesIfNotMounted] {}", ex.what());
+    }
     // if not mounted yet
-    if (mountpoints.count(device->block_name()) == 0) {
+    if (!mounted) {
       logger_->info("process {}", device->block_name());
       ProcessDevice(std::move(device));
     }
@@ -20,11 +20,16 @@
 
 #pragma once
 #include "dal/local_storage.hpp"
+#include "device_cache.hpp"
+#include "events.hpp"
+#include "partition_mounter.hpp"
+#include "usb_topology.hpp"
 #include "usb_udev_device.hpp"
 #include <future>
 #include <libudev.h>
 #include <memory>
 #include <spdlog/logger.h>
+#include <string>
 #include <vector>
 
 namespace usbmount {
@@ -39,6 +44,20 @@ public:
   void Stop() noexcept;
   std::vector<UsbUdevDevice> GetConnectedDevices() const noexcept;
 
+  /**
+   * @brief Set the Event Handler for device and mount events
+   * @details Must be called before Run
+   */
+  void SetEventHandler(EventHandler handler) noexcept;
+
+  /// @brief Connected devices known from udev events
+  inline const DeviceCache &device_cache() const noexcept {
+    return device_cache_;
+  }
+
+  /// @brief USB devices with their block devices
+  inline const UsbTopology &topology() const noexcept { return topology_; }
+
 private:
   bool StopRequested() noexcept;
   void ProcessDevice() noexcept;
@@ -56,6 +75,12 @@ private:
    */
   void ApplyMountRulesIfNotMounted() noexcept;
 
+  /**
+   * @brief Unmount all block devices of the removed USB device in one batch
+   * @param usb_device DEVPATH of the USB device
+   */
+  void RemoveUsbDevice(const std::string &usb_device) noexcept;
+
   /**
    * @brief Recieve a device from udev
    * @return std::shared_ptr<UsbUdevDevice>
@@ -68,7 +93,12 @@ private:
   std::unique_ptr<udev, decltype(&udev_unref)> udev_;
   std::unique_ptr<udev_monitor, decltype(&udev_monitor_unref)> monitor_;
   std::shared_ptr<dal::LocalStorage> dbase_;
+  EventHandler on_event_;
+  DeviceCache device_cache_;
+  UsbTopology topology_;
   int udef_fd_;
+  // the last member, queued jobs are done before the rest is destroyed
+  PartitionMounter mounter_;
 };
 
 } // namespace usbmount
\ No newline at end of file
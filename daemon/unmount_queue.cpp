@@ -0,0 +1,168 @@
+/* File: unmount_queue.cpp
+
+  Copyright (C)   2024
+  Author: Oleg Proskurin, <proskurinov@basealt.ru>
+
+  This program is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with this program; if not, see <https://www.gnu.org/licenses/>.
+
+*/
+
+#include "unmount_queue.hpp"
+#include "config.hpp"
+#include "watchdog.hpp"
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstddef>
+#include <exception>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <sys/mount.h>
+#include <system_error>
+#include <thread>
+#include <utility>
+
+namespace usbmount {
+
+UnmountQueue::UnmountQueue(Options options, Unmounter unmounter)
+    : options_(options), unmounter_(std::move(unmounter)) {
+  if (!unmounter_) {
+    unmounter_ = [](const std::string &mount_point, int flags) {
+      return umount2(mount_point.c_str(), flags) == 0 ? 0 : errno;
+    };
+  }
+}
+
+UnmountQueue::~UnmountQueue() { Stop(); }
+
+UnmountQueue &UnmountQueue::Instance() {
+  static UnmountQueue instance{
+      Options{std::chrono::seconds(UNMOUNT_GRACE_SEC)}};
+  return instance;
+}
+
+bool UnmountQueue::Push(const std::string &mount_point, Done done) {
+  {
+    const std::lock_guard<std::mutex> lock(mutex_);
+    if (stop_ || !queued_.insert(mount_point).second) {
+      return false;
+    }
+    const auto now = Clock::now();
+    scheduled_.emplace(now, Request{mount_point, std::move(done), now});
+    if (!worker_.joinable()) {
+      worker_ = std::thread(&UnmountQueue::Run, this);
+    }
+  }
+  cond_.notify_all();
+  return true;
+}
+
+void UnmountQueue::Stop() noexcept {
+  {
+    const std::lock_guard<std::mutex> lock(mutex_);
+    stop_ = true;
+  }
+  cond_.notify_all();
+  if (worker_.joinable()) {
+    worker_.join();
+  }
+  // the callbacks may hold the handlers of the stopped daemon
+  const std::lock_guard<std::mutex> lock(mutex_);
+  scheduled_.clear();
+  queued_.clear();
+}
+
+size_t UnmountQueue::size() const {
+  const std::lock_guard<std::mutex> lock(mutex_);
+  return queued_.size();
+}
+
+std::chrono::milliseconds
+UnmountQueue::Backoff(size_t attempt) const noexcept {
+  std::chrono::milliseconds res = options_.initial_backoff;
+  for (size_t i = 1; i < attempt && res < options_.max_backoff; ++i) {
+    res *= 2;
+  }
+  return std::min(res, options_.max_backoff);
+}
+
+void UnmountQueue::Run() {
+  std::unique_lock<std::mutex> lock(mutex_);
+  while (!stop_) {
+    if (scheduled_.empty()) {
+      cond_.wait(lock);
+      continue;
+    }
+    auto it_next = scheduled_.begin();
+    if (it_next->first > Clock::now()) {
+      cond_.wait_until(lock, it_next->first);
+      continue;
+    }
+    Request request = std::move(it_next->second);
+    scheduled_.erase(it_next);
+    lock.unlock();
+    Attempt(std::move(request));
+    lock.lock();
+  }
+}
+
+void UnmountQueue::Attempt(Request request) {
+  const auto now = Clock::now();
+  const bool detach = now - request.queued >= options_.grace;
+  int err = 0;
+  {
+    auto operation =
+        Watchdog::Instance().Track("umount " + request.mount_point);
+    err = unmounter_(request.mount_point, detach ? MNT_DETACH : 0);
+  }
+  std::optional<Result> result;
+  std::string reason;
+  if (err == 0) {
+    result = detach ? Result::kDetached : Result::kUnmounted;
+  } else if (err == EINVAL || err == ENOENT) {
+    result = Result::kNotMounted;
+  } else if (err == EBUSY && !detach) {
+    ++request.busy;
+  } else if (++request.attempts >= options_.max_attempts) {
+    result = Result::kFailed;
+    reason = std::system_category().message(err);
+  }
+  if (!result) {
+    auto next = now + Backoff(request.busy + request.attempts);
+    // don't wait past the grace period to detach
+    if (err == EBUSY) {
+      next = std::min<Clock::time_point>(next,
+                                         request.queued + options_.grace);
+    }
+    const std::lock_guard<std::mutex> lock(mutex_);
+    if (!stop_) {
+      scheduled_.emplace(next, std::move(request));
+    }
+    return;
+  }
+  {
+    const std::lock_guard<std::mutex> lock(mutex_);
+    queued_.erase(request.mount_point);
+  }
+  if (!request.done) {
+    return;
+  }
+  try {
+    request.done(result.value(), reason);
+  } catch (const std::exception &) {
+  }
+}
+
+} // namespace usbmount
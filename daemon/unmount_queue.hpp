@@ -0,0 +1,124 @@
+/* File: unmount_queue.hpp
+
+  Copyright (C)   2024
+  Author: Oleg Proskurin, <proskurinov@basealt.ru>
+
+  This program is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with this program; if not, see <https://www.gnu.org/licenses/>.
+
+*/
+
+#pragma once
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_set>
+
+namespace usbmount {
+
+/**
+ * @class UnmountQueue
+ * @brief Unmounts on a worker thread, a busy mount doesn't block the caller
+ * @details A normal unmount is retried with a doubling delay while the mount
+ * is busy. After the grace period the mount is detached (MNT_DETACH), the
+ * files still open keep working and the directory is free. Other errors are
+ * retried up to max_attempts. The completion callback runs on the worker
+ * thread, requests still queued on destruction are dropped.
+ */
+class UnmountQueue {
+public:
+  using Clock = std::chrono::steady_clock;
+
+  struct Options {
+    std::chrono::milliseconds grace{10000};
+    std::chrono::milliseconds initial_backoff{250};
+    std::chrono::milliseconds max_backoff{4000};
+    size_t max_attempts = 8; /// for errors other than EBUSY
+  };
+
+  enum class Result : uint8_t {
+    kUnmounted,
+    kDetached,   /// after the grace period
+    kNotMounted, /// EINVAL or ENOENT, unmounted by someone else
+    kFailed
+  };
+
+  /// @param reason strerror for kFailed
+  using Done = std::function<void(Result result, const std::string &reason)>;
+  /// @return 0 or errno
+  using Unmounter =
+      std::function<int(const std::string &mount_point, int flags)>;
+
+  UnmountQueue(const UnmountQueue &) = delete;
+  UnmountQueue(UnmountQueue &&) = delete;
+  UnmountQueue &operator=(const UnmountQueue &) = delete;
+  UnmountQueue &operator=(UnmountQueue &&) = delete;
+  ~UnmountQueue();
+
+  /// @param unmounter umount2 if empty
+  explicit UnmountQueue(Options options, Unmounter unmounter = {});
+
+  /// @brief The daemon queue, the grace period is UNMOUNT_GRACE_SEC
+  static UnmountQueue &Instance();
+
+  /**
+   * @brief Schedule the unmount, the first attempt is made at once
+   * @details The worker thread is started by the first request.
+   * @return false if the mount point is already queued, done is not called
+   */
+  bool Push(const std::string &mount_point, Done done);
+
+  /**
+   * @brief Join the worker, the requests still queued are dropped
+   * @details The callbacks are not called after Stop returns, later Push
+   * calls are refused.
+   */
+  void Stop() noexcept;
+
+  /// @brief Requests not finished yet
+  size_t size() const;
+
+  /// @brief Delay after the failed attempt number (1 - the first attempt)
+  std::chrono::milliseconds Backoff(size_t attempt) const noexcept;
+
+private:
+  struct Request {
+    std::string mount_point;
+    Done done;
+    Clock::time_point queued;
+    size_t attempts = 0; /// failed with an error other than EBUSY
+    size_t busy = 0;
+  };
+
+  void Run();
+
+  /// @brief One attempt, reschedules the request or completes it
+  void Attempt(Request request);
+
+  Options options_;
+  Unmounter unmounter_;
+  mutable std::mutex mutex_;
+  std::condition_variable cond_;
+  std::multimap<Clock::time_point, Request> scheduled_;
+  std::unordered_set<std::string> queued_; /// mount points
+  bool stop_ = false;
+  std::thread worker_;
+};
+
+} // namespace usbmount
@@ -0,0 +1,182 @@
+/* File: usb_topology.cpp
+
+  Copyright (C)   2024
+  Author: Oleg Proskurin, <proskurinov@basealt.ru>
+
+  This program is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with this program; if not, see <https://www.gnu.org/licenses/>.
+
+*/
+
+#include "usb_topology.hpp"
+#include <algorithm>
+#include <cctype>
+#include <cstddef>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+namespace usbmount {
+
+namespace {
+
+/// @brief "1-1", "1-1.4.2" - a USB device, not "1-1:1.0" - an interface
+bool IsUsbDeviceName(std::string_view name) noexcept {
+  const size_t dash = name.find('-');
+  if (dash == 0 || dash == std::string_view::npos || dash + 1 == name.size()) {
+    return false;
+  }
+  return std::all_of(name.cbegin(), name.cend(), [](char chr) {
+    return std::isdigit(static_cast<unsigned char>(chr)) != 0 || chr == '-' ||
+           chr == '.';
+  });
+}
+
+/// @brief "usb1" - a root hub
+bool IsRootHubName(std::string_view name) noexcept {
+  return name.size() > 3 && name.substr(0, 3) == "usb" &&
+         std::all_of(name.cbegin() + 3, name.cend(), [](char chr) {
+           return std::isdigit(static_cast<unsigned char>(chr)) != 0;
+         });
+}
+
+} // namespace
+
+std::optional<UsbTopology::Path> UsbTopology::Parse(std::string_view devpath) {
+  Path res;
+  size_t hub_end = 0;
+  size_t device_end = 0;
+  size_t pos = 0;
+  while (pos < devpath.size()) {
+    size_t end = devpath.find('/', pos + 1);
+    if (end == std::string_view::npos) {
+      end = devpath.size();
+    }
+    const std::string_view name = devpath.substr(pos + 1, end - pos - 1);
+    if (IsRootHubName(name) || IsUsbDeviceName(name)) {
+      // the USB device of the disk is the last one, the one before is its hub
+      hub_end = device_end;
+      device_end = end;
+    } else if (name == "block" && end < devpath.size()) {
+      const size_t disk_end = devpath.find('/', end + 1);
+      res.disk = devpath.substr(end + 1, disk_end == std::string_view::npos
+                                              ? std::string_view::npos
+                                              : disk_end - end - 1);
+      break;
+    }
+    pos = end;
+  }
+  // a root hub itself is not a USB device with a disk
+  if (res.disk.empty() || hub_end == 0) {
+    return std::nullopt;
+  }
+  res.hub = devpath.substr(0, hub_end);
+  res.usb_device = devpath.substr(0, device_end);
+  return res;
+}
+
+void UsbTopology::Add(const std::string &block_name, std::string_view devpath) {
+  auto path = Parse(devpath);
+  if (!path) {
+    return;
+  }
+  const std::lock_guard<std::mutex> lock(mutex_);
+  // the block name may belong to a device that was removed unnoticed
+  RemoveLocked(block_name);
+  UsbNode &node = usb_devices_[path->usb_device];
+  node.hub = std::move(path->hub);
+  node.disks[path->disk].insert(block_name);
+  blocks_[block_name] = std::move(path->usb_device);
+}
+
+void UsbTopology::Remove(const std::string &block_name) noexcept {
+  const std::lock_guard<std::mutex> lock(mutex_);
+  RemoveLocked(block_name);
+}
+
+void UsbTopology::RemoveLocked(const std::string &block_name) noexcept {
+  auto it_block = blocks_.find(block_name);
+  if (it_block == blocks_.end()) {
+    return;
+  }
+  auto it_device = usb_devices_.find(it_block->second);
+  blocks_.erase(it_block);
+  if (it_device == usb_devices_.end()) {
+    return;
+  }
+  auto &disks = it_device->second.disks;
+  for (auto it_disk = disks.begin(); it_disk != disks.end(); ++it_disk) {
+    if (it_disk->second.erase(block_name) > 0) {
+      if (it_disk->second.empty()) {
+        disks.erase(it_disk);
+      }
+      break;
+    }
+  }
+  if (disks.empty()) {
+    usb_devices_.erase(it_device);
+  }
+}
+
+std::vector<std::string>
+UsbTopology::RemoveUsbDevice(const std::string &usb_device) {
+  std::vector<std::string> res;
+  const std::lock_guard<std::mutex> lock(mutex_);
+  auto it_device = usb_devices_.find(usb_device);
+  if (it_device == usb_devices_.end()) {
+    return res;
+  }
+  for (const auto &disk : it_device->second.disks) {
+    // "/dev/sdb" sorts before "/dev/sdb1"
+    for (auto it_block = disk.second.crbegin();
+         it_block != disk.second.crend(); ++it_block) {
+      res.push_back(*it_block);
+      blocks_.erase(*it_block);
+    }
+  }
+  usb_devices_.erase(it_device);
+  return res;
+}
+
+std::optional<std::string>
+UsbTopology::UsbDeviceOf(const std::string &block_name) const {
+  const std::lock_guard<std::mutex> lock(mutex_);
+  auto it_block = blocks_.find(block_name);
+  if (it_block == blocks_.cend()) {
+    return std::nullopt;
+  }
+  return it_block->second;
+}
+
+std::vector<std::string>
+UsbTopology::UsbDevicesOf(const std::string &hub) const {
+  std::vector<std::string> res;
+  const std::lock_guard<std::mutex> lock(mutex_);
+  for (const auto &device : usb_devices_) {
+    if (device.second.hub == hub) {
+      res.push_back(device.first);
+    }
+  }
+  std::sort(res.begin(), res.end());
+  return res;
+}
+
+size_t UsbTopology::size() const noexcept {
+  const std::lock_guard<std::mutex> lock(mutex_);
+  return blocks_.size();
+}
+
+} // namespace usbmount
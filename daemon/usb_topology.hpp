@@ -0,0 +1,93 @@
+/* File: usb_topology.hpp
+
+  Copyright (C)   2024
+  Author: Oleg Proskurin, <proskurinov@basealt.ru>
+
+  This program is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with this program; if not, see <https://www.gnu.org/licenses/>.
+
+*/
+
+#pragma once
+#include <cstddef>
+#include <map>
+#include <mutex>
+#include <optional>
+#include <set>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+namespace usbmount {
+
+/**
+ * @class UsbTopology
+ * @brief hub -> USB device -> disk -> partitions of connected block devices
+ * @details Built from the udev DEVPATH of added devices, the parent links are
+ * the path components. A remove event carries DEVPATH too, but the parents
+ * are gone from sysfs by then, so the tree is kept from the add events.
+ */
+class UsbTopology {
+public:
+  /// @brief The DEVPATH components of a block device
+  struct Path {
+    std::string hub;        /// /devices/.../usb1 or an external hub
+    std::string usb_device; /// /devices/.../usb1/1-1
+    std::string disk;       /// sdb
+  };
+
+  /**
+   * @brief Parse a block device DEVPATH
+   * @param devpath e.g. /devices/pci0000:00/0000:00:14.0/usb1/1-1/1-1:1.0/
+   * host6/target6:0:0/6:0:0:0/block/sdb/sdb1
+   * @return nullopt if it is not a block device on USB
+   */
+  static std::optional<Path> Parse(std::string_view devpath);
+
+  /// @brief Add or move the block device (/dev/sdX) to the tree
+  void Add(const std::string &block_name, std::string_view devpath);
+
+  /// @brief Forget one block device, an empty USB device is dropped
+  void Remove(const std::string &block_name) noexcept;
+
+  /**
+   * @brief Drop the USB device with all its disks and partitions
+   * @return block names, partitions before their disks
+   */
+  std::vector<std::string> RemoveUsbDevice(const std::string &usb_device);
+
+  /// @return DEVPATH of the USB device of the block device
+  std::optional<std::string> UsbDeviceOf(const std::string &block_name) const;
+
+  /// @return DEVPATHs of the USB devices connected to the hub
+  std::vector<std::string> UsbDevicesOf(const std::string &hub) const;
+
+  size_t size() const noexcept;
+
+private:
+  struct UsbNode {
+    std::string hub;
+    /// disk kernel name -> block names of the disk and its partitions
+    std::map<std::string, std::set<std::string>> disks;
+  };
+
+  void RemoveLocked(const std::string &block_name) noexcept;
+
+  mutable std::mutex mutex_;
+  std::unordered_map<std::string, UsbNode> usb_devices_;
+  /// block name -> USB device DEVPATH
+  std::unordered_map<std::string, std::string> blocks_;
+};
+
+} // namespace usbmount
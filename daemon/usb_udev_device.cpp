@@ -19,17 +19,92 @@
 */
 
 #include "usb_udev_device.hpp"
+#include "serial_cache.hpp"
 #include "utils.hpp"
+#include <charconv>
 #include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <exception>
+#include <fmt/format.h>
 #include <libudev.h>
+#include <limits>
 #include <memory>
-#include <sstream>
+#include <optional>
 #include <stdexcept>
 #include <string>
+#include <string_view>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <system_error>
+#include <unordered_map>
 #include <utility>
 
 namespace usbmount {
 
+namespace {
+
+/// @brief libudev is not thread safe, a context per thread lives until exit
+udev *ThreadUdev() {
+  thread_local const std::unique_ptr<udev, decltype(&udev_unref)> context{
+      udev_new(), udev_unref};
+  if (!context) {
+    throw std::runtime_error("Failed to create udev object");
+  }
+  return context.get();
+}
+
+std::string_view Property(udev_device *device, const char *key) noexcept {
+  const char *value = udev_device_get_property_value(device, key);
+  return value != nullptr ? std::string_view(value) : std::string_view();
+}
+
+/// @brief "0781" -> 0x0781, nullopt for anything but 4 hex digits
+std::optional<uint16_t> ParseId(std::string_view str) noexcept {
+  uint16_t res = 0;
+  if (str.size() != 4) {
+    return std::nullopt;
+  }
+  const auto [ptr, err] =
+      std::from_chars(str.data(), str.data() + str.size(), res, 16);
+  if (err != std::errc() || ptr != str.data() + str.size()) {
+    return std::nullopt;
+  }
+  return res;
+}
+
+/// @brief The sysattr of the device or of up to 3 USB parents
+const char *WalkSerial(udev_device *device) noexcept {
+  // Then read a system attribute.
+  const char *p_serial = udev_device_get_sysattr_value(device, "serial");
+  if (p_serial != nullptr) {
+    return p_serial;
+  }
+  // Finally, traverse a Udev tree (maximum = 3 steps).
+  // The parents are owned by the device.
+  constexpr size_t max_iterations = 3;
+  udev_device *parent_device = device;
+  for (size_t it_counter = 0; it_counter < max_iterations; ++it_counter) {
+    parent_device = udev_device_get_parent_with_subsystem_devtype(
+        parent_device, "usb", nullptr);
+    if (parent_device == nullptr) {
+      break;
+    }
+    const char *p_parent_serial =
+        udev_device_get_sysattr_value(parent_device, "serial");
+    if (p_parent_serial != nullptr) {
+      return p_parent_serial;
+    }
+  }
+  return nullptr;
+}
+
+std::string FormatId(const std::optional<uint16_t> &id) {
+  return id ? fmt::format("{:04x}", id.value()) : std::string();
+}
+
+} // namespace
+
 void UdevDeviceFree(udev_device *dev) noexcept {
   if (dev != nullptr) {
     udev_device_unref(dev);
@@ -43,8 +118,7 @@ UsbUdevDevice::UsbUdevDevice(UniquePtrUdevDeviceStruct &&device) {
   getUdevDeviceInfo(std::move(device));
 }
 
-UsbUdevDevice::UsbUdevDevice(const DevParams &params)
-    : block_name_(params.dev_path) {
+UsbUdevDevice::UsbUdevDevice(const DevParams &params) {
   if (params.dev_path.empty()) {
     throw std::runtime_error("Empty device name");
   }
@@ -57,83 +131,104 @@ UsbUdevDevice::UsbUdevDevice(const DevParams &params)
     action_ = Action::kRemove;
   }
   // Information about the device is not needed for actions other than "add"
-  if (action_ != Action::kAdd) {
-    return;
+  if (action_ == Action::kAdd) {
+    auto ptr_device = FindUdevDeviceByBlockName(params.dev_path);
+    // device found
+    if (ptr_device) {
+      getUdevDeviceInfo(std::move(ptr_device), params.dev_path);
+      return;
+    }
   }
-  auto ptr_device = FindUdevDeviceByBlockName();
-  // device found
-  if (ptr_device) {
-    getUdevDeviceInfo(std::move(ptr_device));
+  Fields fields;
+  fields[kBlockName] = params.dev_path;
+  Pack(fields);
+}
+
+UsbUdevDevice::UsbUdevDevice(
+    Action action,
+    const std::unordered_map<std::string, std::string> &properties)
+    : action_(action) {
+  auto get = [&properties](const char *key) {
+    auto it_value = properties.find(key);
+    return it_value != properties.end() ? std::string_view(it_value->second)
+                                        : std::string_view();
+  };
+  Fields fields = ReadFields(get, {});
+  if (action_ != Action::kRemove) {
+    fields[kSerial] = get("ID_SERIAL_SHORT");
   }
+  Pack(fields);
 }
 
-void UsbUdevDevice::getUdevDeviceInfo(
-    std::unique_ptr<udev_device, decltype(&UdevDeviceFree)> device) {
-  // subsystem
-  const char *p_subsystem =
-      udev_device_get_property_value(device.get(), "SUBSYSTEM");
-  if (p_subsystem != nullptr) {
-    subsystem_ = p_subsystem;
+void UsbUdevDevice::getUdevDeviceInfo(UniquePtrUdevDeviceStruct device,
+                                      std::string_view block_name) {
+  // the views point to the udev device, copied once by Pack
+  Fields fields = ReadFields(
+      [&device](const char *key) { return Property(device.get(), key); },
+      block_name);
+  std::string serial_buffer;
+  if (action_ != Action::kRemove) {
+    fields[kSerial] = FindSerial(device.get(), serial_buffer);
   }
-  if (subsystem_ != "block") {
+  Pack(fields);
+}
+
+template <typename Getter>
+UsbUdevDevice::Fields UsbUdevDevice::ReadFields(const Getter &get,
+                                                std::string_view block_name) {
+  Fields fields;
+  fields[kSubsystem] = get("SUBSYSTEM");
+  if (fields[kSubsystem] != "block") {
     throw std::logic_error("wrong subsystem");
   }
-  // bus
-  const char *p_idbus = udev_device_get_property_value(device.get(), "ID_BUS");
-  if (p_idbus != nullptr) {
-    id_bus_ = p_idbus;
-  }
-  if (id_bus_ != "usb" && id_bus_ != "USB") {
+  const std::string_view id_bus = get("ID_BUS");
+  if (id_bus != "usb" && id_bus != "USB") {
     throw std::logic_error("Wrong ID_BUS");
   }
-  // block name
-  const char *p_block = udev_device_get_property_value(device.get(), "DEVNAME");
-  if (p_block != nullptr) {
-    block_name_ = p_block;
+  fields[kBlockName] = get("DEVNAME");
+  if (fields[kBlockName].empty()) {
+    fields[kBlockName] = block_name;
   }
-  if (block_name_.empty()) {
+  if (fields[kBlockName].empty()) {
     throw std::logic_error("Empty block name");
   }
-  // fs label
-  const char *p_label =
-      udev_device_get_property_value(device.get(), "ID_FS_LABEL");
-  if (p_label != nullptr) {
-    fs_label_ = p_label;
+  fields[kFilesystem] = get("ID_FS_TYPE");
+  // the disk of a removed device is released
+  fields[kDevType] = get("DEVTYPE");
+  fields[kDevPath] = get("DEVPATH");
+  // a removed device is only unmounted
+  if (action_ == Action::kRemove) {
+    return fields;
   }
-  // fs uuid
-  const char *p_uid =
-      udev_device_get_property_value(device.get(), "ID_FS_UUID");
-  if (p_uid != nullptr) {
-    uid_ = p_uid;
+  fields[kFsLabel] = get("ID_FS_LABEL");
+  fields[kFsUid] = get("ID_FS_UUID");
+  const std::string_view partition_number = get("ID_PART_ENTRY_NUMBER");
+  if (!partition_number.empty()) {
+    partitions_number_ = std::stoi(std::string(partition_number));
   }
-  // fs type
-  const char *p_fs = udev_device_get_property_value(device.get(), "ID_FS_TYPE");
-  if (p_fs != nullptr) {
-    filesystem_ = p_fs;
-  }
-  const char *p_devtipe =
-      udev_device_get_property_value(device.get(), "DEVTYPE");
-  if (p_devtipe != nullptr) {
-    dev_type_ = p_devtipe;
-  }
-  const char *p_partition_number =
-      udev_device_get_property_value(device.get(), "ID_PART_ENTRY_NUMBER");
-  if (p_partition_number != nullptr) {
-    partitions_number_ = std::stoi(p_partition_number);
-  }
-  const char *p_vid =
-      udev_device_get_property_value(device.get(), "ID_VENDOR_ID");
-  if (p_vid != nullptr) {
-    vid_ = p_vid;
+  vid_ = ParseId(get("ID_VENDOR_ID"));
+  pid_ = ParseId(get("ID_MODEL_ID"));
+  return fields;
+}
+
+void UsbUdevDevice::Pack(const Fields &fields) {
+  size_t size = 0;
+  for (const auto &value : fields) {
+    size += value.size() + 1;
   }
-  const char *p_pid =
-      udev_device_get_property_value(device.get(), "ID_MODEL_ID");
-  if (p_pid != nullptr) {
-    pid_ = p_pid;
+  if (size > std::numeric_limits<uint16_t>::max()) {
+    throw std::length_error("Udev properties are too long");
   }
-  if (action_ != Action::kRemove) {
-    FindSerial(device);
+  // NOLINTNEXTLINE(modernize-avoid-c-arrays)
+  arena_ = std::make_unique<char[]>(size);
+  size_t pos = 0;
+  for (size_t i = 0; i < fields.size(); ++i) {
+    offsets_[i] = static_cast<uint16_t>(pos);
+    fields[i].copy(&arena_[pos], fields[i].size());
+    pos += fields[i].size();
+    arena_[pos++] = '\0';
   }
+  offsets_[kFieldCount] = static_cast<uint16_t>(pos);
 }
 
 /*
@@ -141,41 +236,48 @@ void UsbUdevDevice::getUdevDeviceInfo(
  * ID_SERIAL_SHORT value. It traverses the Udev devices tree to find a serial
  * number for a parent device.
  */
-void UsbUdevDevice::FindSerial(
-    std::unique_ptr<udev_device, decltype(&UdevDeviceFree)> &device) noexcept {
-  // First, try to find it the usual way.
+std::string_view UsbUdevDevice::FindSerial(udev_device *device,
+                                           std::string &buffer) {
+  // First, try to find it the usual way, the property comes with the event.
   const char *p_serial_udev =
-      udev_device_get_property_value(device.get(), "ID_SERIAL_SHORT");
+      udev_device_get_property_value(device, "ID_SERIAL_SHORT");
   if (p_serial_udev != nullptr) {
-    serial_ = p_serial_udev;
-    return;
-  }
-  // Then read a system attribute.
-  const char *p_serial = udev_device_get_sysattr_value(device.get(), "serial");
-  if (p_serial != nullptr) {
-    serial_ = p_serial;
-    return;
+    return p_serial_udev;
   }
-  // Finally, traverse a Udev tree (maximum = 3 steps).
-  size_t it_counter = 0;
-  constexpr size_t max_iterations = 3;
-  udev_device *parent_device = device.get();
-  while (serial_.empty() && it_counter < max_iterations) {
-    ++it_counter;
-    parent_device = udev_device_get_parent_with_subsystem_devtype(
-        parent_device, "usb", nullptr);
-    if (parent_device != nullptr) {
-      const char *p_parent_serial =
-          udev_device_get_sysattr_value(parent_device, "serial");
-      if (p_parent_serial != nullptr) {
-        serial_ = p_parent_serial;
-      }
-    } else {
-      break;
+  // The disk and its partitions have the same USB device.
+  udev_device *usb_device = udev_device_get_parent_with_subsystem_devtype(
+      device, "usb", "usb_device");
+  const char *p_syspath =
+      usb_device != nullptr ? udev_device_get_syspath(usb_device) : nullptr;
+  const dev_t devnum =
+      usb_device != nullptr ? udev_device_get_devnum(usb_device) : 0;
+  if (p_syspath != nullptr) {
+    auto cached = SerialCache::Instance().Find(p_syspath, devnum);
+    if (cached) {
+      buffer = std::move(cached.value());
+      return buffer;
     }
   }
+  const char *p_serial = WalkSerial(device);
+  if (p_serial == nullptr) {
+    return {};
+  }
+  if (p_syspath != nullptr) {
+    SerialCache::Instance().Put(p_syspath, devnum, p_serial);
+  }
+  return p_serial;
+}
+
+bool UsbUdevDevice::IsUsbBlock(udev_device *device) noexcept {
+  const std::string_view id_bus = Property(device, "ID_BUS");
+  return Property(device, "SUBSYSTEM") == "block" &&
+         (id_bus == "usb" || id_bus == "USB");
 }
 
+std::string UsbUdevDevice::vid() const { return FormatId(vid_); }
+
+std::string UsbUdevDevice::pid() const { return FormatId(pid_); }
+
 void UsbUdevDevice::SetAction(const char *p_action) {
   if (p_action != nullptr) {
     const std::string tmp = p_action;
@@ -192,73 +294,53 @@ void UsbUdevDevice::SetAction(const char *p_action) {
 }
 
 std::string UsbUdevDevice::toString() const noexcept {
-  std::stringstream res;
-  res << "Action: ";
+  std::string_view action = "undefined";
   switch (action_) {
   case Action::kAdd:
-    res << "add";
+    action = "add";
     break;
   case Action::kRemove:
-    res << "remove";
+    action = "remove";
     break;
   case Action::kChange:
-    res << "change";
+    action = "change";
     break;
   case Action::kNoAction:
-    res << "no_action";
+    action = "no_action";
     break;
   case Action::kUndefined:
-    res << "undefined";
     break;
   }
-  res << " block_name: " << block_name_ << " fs_label: " << fs_label_
-      << " fs_uid: " << uid_ << " file_system: " << filesystem_
-      << " device_type:" << dev_type_ << " partition number "
-      << std::to_string(partitions_number_) << " vid " << vid_ << " pid "
-      << pid_ << " subsystem " << subsystem_ << " serial " << serial_;
-  return res.str();
+  try {
+    return fmt::format(
+        "Action: {} block_name: {} fs_label: {} fs_uid: {} file_system: {} "
+        "device_type:{} partition number {} vid {} pid {} subsystem {} "
+        "serial {}",
+        action, block_name(), fs_label(), fs_uid(), filesystem(), dev_type(),
+        partitions_number_, vid(), pid(), subsystem(), serial());
+  } catch (const std::exception &) {
+    return {};
+  }
 }
 
-UniquePtrUdevDeviceStruct UsbUdevDevice::FindUdevDeviceByBlockName() const {
-  using utils::udev::UdevEnumerateFree;
-  // udev object
-  const std::unique_ptr<udev, decltype(&udev_unref)> udev{udev_new(),
-                                                          udev_unref};
-  if (!udev) {
-    throw std::runtime_error("Failed to create udev object");
+UniquePtrUdevDeviceStruct
+UsbUdevDevice::FindUdevDeviceByBlockName(const std::string &block_name) {
+  struct stat info {};
+  if (stat(block_name.c_str(), &info) != 0 || !S_ISBLK(info.st_mode)) {
+    return {nullptr, UdevDeviceFree};
   }
-  // udev enumerate
-  const std::unique_ptr<udev_enumerate, decltype(&UdevEnumerateFree)> enumerate{
-      udev_enumerate_new(udev.get()), UdevEnumerateFree};
-  if (!enumerate) {
-    throw std::runtime_error("Failed to create udev enumerate");
+  UniquePtrUdevDeviceStruct device(
+      udev_device_new_from_devnum(ThreadUdev(), 'b', info.st_rdev),
+      UdevDeviceFree);
+  if (!device) {
+    return {nullptr, UdevDeviceFree};
   }
-  udev_enumerate_add_match_subsystem(enumerate.get(), "block");
-  udev_enumerate_add_match_property(enumerate.get(), "ID_BUS", "usb");
-  udev_enumerate_scan_devices(enumerate.get());
-  udev_list_entry *entry = udev_enumerate_get_list_entry(enumerate.get());
-  while (entry != nullptr) {
-    const char *p_path = udev_list_entry_get_name(entry);
-    if (p_path == nullptr) {
-      continue;
-    }
-    std::unique_ptr<udev_device, decltype(&UdevDeviceFree)> device(
-        udev_device_new_from_syspath(udev.get(), p_path), UdevDeviceFree);
-    if (!device) {
-      continue;
-    }
-    const char *devnode = udev_device_get_devnode(device.get());
-    if (devnode == nullptr) {
-      continue;
-    }
-    // a device found
-    if (block_name_ == std::string(devnode)) {
-      // ptr_device = std::move(device);
-      return device;
-    }
-    entry = udev_list_entry_get_next(entry);
+  // only USB devices were enumerated before
+  const char *p_bus = udev_device_get_property_value(device.get(), "ID_BUS");
+  if (p_bus == nullptr || std::strcmp(p_bus, "usb") != 0) {
+    return {nullptr, UdevDeviceFree};
   }
-  return {nullptr, UdevDeviceFree};
+  return device;
 }
 
 } // namespace usbmount
\ No newline at end of file
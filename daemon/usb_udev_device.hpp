@@ -19,10 +19,14 @@
 */
 
 #pragma once
+#include <array>
 #include <cstdint>
 #include <libudev.h>
 #include <memory>
+#include <optional>
 #include <string>
+#include <string_view>
+#include <unordered_map>
 
 namespace usbmount {
 
@@ -39,6 +43,13 @@ struct DevParams {
 using UniquePtrUdevDeviceStruct =
     std::unique_ptr<udev_device, decltype(&UdevDeviceFree)>;
 
+/**
+ * @class UsbUdevDevice
+ * @brief A USB block device from a udev event
+ * @details The strings are packed into one buffer allocated once per device,
+ * the getters return views into it. vid and pid are kept as numbers. The
+ * object is move-only, pass it on instead of copying.
+ */
 class UsbUdevDevice {
 public:
   /// construct with Udev device object
@@ -51,51 +62,130 @@ public:
    */
   explicit UsbUdevDevice(const DevParams &params);
 
+  /**
+   * @brief Construct from recorded udev properties, e.g. to replay events
+   * @details ID_SERIAL_SHORT is the serial, there is no device tree to walk.
+   * @throws std::logic_error as for a udev device
+   */
+  UsbUdevDevice(Action action,
+                const std::unordered_map<std::string, std::string> &properties);
+
+  UsbUdevDevice(UsbUdevDevice &&) noexcept = default;
+  UsbUdevDevice &operator=(UsbUdevDevice &&) noexcept = default;
+  UsbUdevDevice(const UsbUdevDevice &) = delete;
+  UsbUdevDevice &operator=(const UsbUdevDevice &) = delete;
+  ~UsbUdevDevice() = default;
+
   std::string toString() const noexcept;
 
-  // getters
+  // getters, the views live as long as the object
   inline Action action() const noexcept { return action_; }
-  inline const std::string &subsystem() const noexcept { return subsystem_; }
-  inline const std::string &fs_label() const noexcept { return fs_label_; }
-  inline const std::string &fs_uid() const noexcept { return uid_; }
-  inline const std::string &filesystem() const noexcept { return filesystem_; }
-  inline const std::string &dev_type() const noexcept { return dev_type_; }
-  inline const std::string &block_name() const noexcept { return block_name_; }
+  inline std::string_view subsystem() const noexcept {
+    return field(kSubsystem);
+  }
+  inline std::string_view fs_label() const noexcept { return field(kFsLabel); }
+  inline std::string_view fs_uid() const noexcept { return field(kFsUid); }
+  inline std::string_view filesystem() const noexcept {
+    return field(kFilesystem);
+  }
+  inline std::string_view dev_type() const noexcept { return field(kDevType); }
+  /// @brief /dev/sdX, the view is null-terminated
+  inline std::string_view block_name() const noexcept {
+    return field(kBlockName);
+  }
   inline int partition_number() const noexcept { return partitions_number_; }
-  inline const std::string &vid() const noexcept { return vid_; }
-  inline const std::string &pid() const noexcept { return pid_; }
-  inline const std::string &serial() const noexcept { return serial_; }
+  inline std::string_view serial() const noexcept { return field(kSerial); }
+  /// @brief DEVPATH, the sysfs path without /sys
+  inline std::string_view devpath() const noexcept { return field(kDevPath); }
+  /// @brief ID_VENDOR_ID, nullopt if unknown
+  inline std::optional<uint16_t> vendor_id() const noexcept { return vid_; }
+  /// @brief ID_MODEL_ID, nullopt if unknown
+  inline std::optional<uint16_t> product_id() const noexcept { return pid_; }
+  /// @brief four lowercase hex digits as udev has it, empty if unknown
+  std::string vid() const;
+  std::string pid() const;
 
   void SetAction(const char *p_action);
 
+  /**
+   * @brief Find the udev device of a USB block device by its devnode
+   * @details The devnode is resolved to the device number, no enumeration.
+   * A libudev context is kept per thread.
+   * @param block_name /dev/sdX
+   * @return nullptr if there is no such block device or it is not on USB
+   * @throws std::runtime_error if a udev context can't be created
+   */
+  static UniquePtrUdevDeviceStruct
+  FindUdevDeviceByBlockName(const std::string &block_name);
+
+  /**
+   * @brief A block device on USB, the check before any property is copied
+   * @details Loop devices, disks and USB devices themselves are filtered out
+   * without constructing an object.
+   */
+  static bool IsUsbBlock(udev_device *device) noexcept;
+
 private:
+  enum Field : uint8_t {
+    kSubsystem,
+    kBlockName,  /// /dev/sdX
+    kFsLabel,    /// ID_FS_LABEL
+    kFsUid,      /// ID_FS_UUID
+    kFilesystem, /// ID_FS_TYPE
+    kDevType,    /// DEVTYPE e.g "partition"
+    kSerial,
+    kDevPath, /// DEVPATH
+    kFieldCount
+  };
+  using Fields = std::array<std::string_view, kFieldCount>;
+
   /**
    * @brief This function is a workaround for some cases when the Udev has no
    * ID_SERIAL_SHORT value. It traverses the Udev devices tree to find a serial
-   * number for a parent device.
+   * number for a parent device. The result is cached for the parent USB
+   * device.
    *
    * @param device
+   * @param buffer holds a serial found in the cache
+   * @return a view of the device property, sysattr or buffer, empty if not
+   * found
    */
-  void FindSerial(UniquePtrUdevDeviceStruct &device) noexcept;
-
-  /// @brief find an info about device and fill the member fields
-  void getUdevDeviceInfo(UniquePtrUdevDeviceStruct device);
+  static std::string_view FindSerial(udev_device *device, std::string &buffer);
 
-  /// @brief find an udev device struct by it's block-name.
-  UniquePtrUdevDeviceStruct FindUdevDeviceByBlockName() const;
+  /**
+   * @brief find an info about device and fill the member fields
+   * @param block_name used if the device has no DEVNAME
+   */
+  void getUdevDeviceInfo(UniquePtrUdevDeviceStruct device,
+                         std::string_view block_name = {});
 
-  Action action_ = Action::kUndefined;
-  std::string subsystem_;
-  std::string block_name_; /// /dev/sdX
-  std::string id_bus_;     //  ID_BUS
-  std::string fs_label_;   /// ID_FS_LABEL
-  std::string uid_;        /// ID_FS_UUID
-  std::string filesystem_; /// ID_FS_TYPE
-  std::string dev_type_;   /// DEVTYPE e.g "partition"
+  /**
+   * @brief Validate and read all but the serial
+   * @details For a removed device only the properties needed for unmount and
+   * for the release of its disk are read.
+   * @param get property name -> std::string_view, empty if missing
+   */
+  template <typename Getter>
+  Fields ReadFields(const Getter &get, std::string_view block_name);
+
+  /// @brief Copy the fields to the buffer, one allocation
+  void Pack(const Fields &fields);
+
+  inline std::string_view field(Field index) const noexcept {
+    if (!arena_) {
+      return {};
+    }
+    return {&arena_[offsets_[index]],
+            static_cast<size_t>(offsets_[index + 1] - offsets_[index] - 1)};
+  }
+
+  // NOLINTNEXTLINE(modernize-avoid-c-arrays)
+  std::unique_ptr<char[]> arena_; /// null-terminated fields in Field order
+  std::array<uint16_t, kFieldCount + 1> offsets_{};
   int partitions_number_ = 0;
-  std::string vid_;
-  std::string pid_;
-  std::string serial_;
+  std::optional<uint16_t> vid_;
+  std::optional<uint16_t> pid_;
+  Action action_ = Action::kUndefined;
 };
 
 } // namespace usbmount
\ No newline at end of file
@@ -19,18 +19,19 @@
 */
 
 #include "utils.hpp"
+#include "base_dir_cache.hpp"
 #include "config.hpp"
 #include "custom_mount.hpp"
 #include "dal/dto.hpp"
 #include "dal/local_storage.hpp"
+#include "mount_table.hpp"
+#include "partition_mounter.hpp"
 #include "spdlog/async.h"
 #include "usb_udev_device.hpp"
 #include <acl/libacl.h>
 #include <boost/algorithm/string/predicate.hpp>
-#include <boost/algorithm/string/regex.hpp>
 #include <boost/algorithm/string/split.hpp>
 #include <boost/algorithm/string/trim.hpp>
-#include <boost/regex.hpp> //NOLINT(misc-include-cleaner)
 #include <cerrno>
 #include <cstdint>
 #include <cstdio>
@@ -42,7 +43,6 @@
 #include <iostream>
 #include <libudev.h>
 #include <memory>
-#include <mntent.h>
 #include <optional>
 #include <spdlog/common.h>
 #include <spdlog/sinks/basic_file_sink.h>
@@ -50,6 +50,7 @@
 #include <sstream>
 #include <stdexcept>
 #include <string>
+#include <string_view>
 #include <sys/acl.h>
 #include <sys/syslog.h>
 #include <sys/types.h>
@@ -80,12 +81,14 @@ std::shared_ptr<spdlog::logger> InitLogFile(const std::string &path) noexcept {
 }
 
 void MountDevice(std::shared_ptr<UsbUdevDevice> ptr_device,
-                 const std::shared_ptr<spdlog::logger> &logger) noexcept {
+                 const std::shared_ptr<spdlog::logger> &logger,
+                 const EventHandler &on_event,
+                 std::shared_ptr<DiskContext> context) noexcept {
   try {
     if (ptr_device->subsystem() != "block") {
       return;
     }
-    CustomMount mounter(ptr_device, logger);
+    CustomMount mounter(ptr_device, logger, on_event, std::move(context));
     if (ptr_device->action() == Action::kAdd) {
       logger->info("Mount {} ", ptr_device->block_name());
       if (!mounter.Mount()) {
@@ -104,54 +107,33 @@ void MountDevice(std::shared_ptr<UsbUdevDevice> ptr_device,
 std::unordered_set<std::string>
 GetSystemMountPoints(const std::shared_ptr<spdlog::logger> &logger) noexcept {
   std::unordered_set<std::string> mtab_mountpoints;
-  // get all system mountpoints
-  FILE *p_file = setmntent("/etc/mtab", "r");
-  if (p_file == nullptr) {
-    logger->error("[UnMount] Error opening /etc/mtab");
-    logger->flush();
-    return mtab_mountpoints;
-  }
-  mntent entry{};
-  std::vector<char> buff;
-  buff.reserve(BUFSIZ);
-  std::memset(buff.data(), 0, BUFSIZ);
-  while (getmntent_r(p_file, &entry, buff.data(), BUFSIZ) != nullptr) {
-    if (boost::contains(entry.mnt_dir, CustomMount::mount_root)) {
-      mtab_mountpoints.emplace(entry.mnt_dir);
+  try {
+    const auto table = MountTable::Instance().Get();
+    for (const auto &mount : table->mounts()) {
+      if (mount.mount_point.find(CustomMount::mount_root) !=
+          std::string_view::npos) {
+        mtab_mountpoints.emplace(mount.mount_point);
+      }
     }
+  } catch (const std::exception &ex) {
+    logger->error("[GetSystemMountPoints] {}", ex.what());
+    logger->flush();
   }
-  // mntent *entry=nullptr;
-  // while ((entry = getmntent(p_file)) != NULL) {
-  //   if (boost::contains(entry->mnt_dir, CustomMount::mount_root)) {
-  //     mtab_mountpoints.emplace(entry->mnt_dir);
-  //   }
-  // }
-  endmntent(p_file);
   return mtab_mountpoints;
 }
 
 std::unordered_set<std::string> GetSystemMountedDevices(
     const std::shared_ptr<spdlog::logger> &logger) noexcept {
   std::unordered_set<std::string> mtab_devs;
-  // get all system mountpoints
-  FILE *p_file = setmntent("/etc/mtab", "r");
-  if (p_file == nullptr) {
-    logger->error("[UnMount] Error opening /etc/mtab");
+  try {
+    const auto table = MountTable::Instance().Get();
+    for (const auto &mount : table->mounts()) {
+      mtab_devs.emplace(mount.source);
+    }
+  } catch (const std::exception &ex) {
+    logger->error("[GetSystemMountedDevices] {}", ex.what());
     logger->flush();
-    return mtab_devs;
-  }
-  mntent entry{};
-  std::vector<char> buff;
-  buff.reserve(BUFSIZ);
-  std::memset(buff.data(), 0, BUFSIZ);
-  while (getmntent_r(p_file, &entry, buff.data(), BUFSIZ) != nullptr) {
-    mtab_devs.emplace(entry.mnt_fsname);
-  }
-  // mntent *entry;
-  // while ((entry = getmntent(p_file)) != NULL) {
-  //   mtab_devs.emplace(entry->mnt_fsname);
-  // }
-  endmntent(p_file);
+  }
   return mtab_devs;
 }
 
@@ -159,6 +141,8 @@ bool ReviewMountPoints(const std::shared_ptr<spdlog::logger> &logger) noexcept {
   auto dbase = dal::LocalStorage::GetStorage();
   auto mtab_mountpoints = GetSystemMountPoints(logger);
   dbase->mount_points.RemoveExpired(mtab_mountpoints);
+  // the directories below may be removed
+  BaseDirCache::Instance().Clear();
   // remove empty folders
   const std::string mount_folder = BASE_MOUNT_POINT;
   namespace fs = std::filesystem;
@@ -187,8 +171,8 @@ bool ReviewMountPoints(const std::shared_ptr<spdlog::logger> &logger) noexcept {
   return true;
 }
 // NOLINTBEGIN(misc-include-cleaner)
-std::optional<IdMinMax> GetSystemUidMinMax(const logger_t &logger) noexcept {
-  const std::string fname = "/etc/login.defs";
+std::optional<IdMinMax> GetSystemUidMinMax(const logger_t &logger,
+                                           const std::string &fname) noexcept {
   try {
     if (!std::filesystem::exists(fname)) {
       logger->error("[GetSystemUidMinMax] file {} was not found", fname);
@@ -206,24 +190,24 @@ std::optional<IdMinMax> GetSystemUidMinMax(const logger_t &logger) noexcept {
   IdMinMax res{0, 0, 0, 0};
   bool res_ok = false;
   try {
-    const boost::regex whitespace("\\s+");
     std::string line;
     while (std::getline(defs_file, line)) {
       boost::trim(line);
       if (line.empty() || boost::starts_with(line, "#")) {
         continue;
       }
-      std::vector<std::string> tokens;
-      boost::split_regex(tokens, line, whitespace);
-      if (tokens.size() > 1) {
-        if (tokens[0] == "UID_MIN") {
-          res.uid_min = static_cast<uid_t>(StrToUint(tokens[1]));
-        } else if (tokens[0] == "UID_MAX") {
-          res.uid_max = static_cast<uid_t>(StrToUint(tokens[1]));
-        } else if (tokens[0] == "GID_MIN") {
-          res.gid_min = static_cast<gid_t>(StrToUint(tokens[1]));
-        } else if (tokens[0] == "GID_MAX") {
-          res.gid_max = static_cast<gid_t>(StrToUint(tokens[1]));
+      std::istringstream tokens(line);
+      std::string key;
+      std::string value;
+      if (tokens >> key >> value) {
+        if (key == "UID_MIN") {
+          res.uid_min = static_cast<uid_t>(StrToUint(value));
+        } else if (key == "UID_MAX") {
+          res.uid_max = static_cast<uid_t>(StrToUint(value));
+        } else if (key == "GID_MIN") {
+          res.gid_min = static_cast<gid_t>(StrToUint(value));
+        } else if (key == "GID_MAX") {
+          res.gid_max = static_cast<gid_t>(StrToUint(value));
         }
       }
       if (res.uid_min > 0 && res.uid_max > 0 && res.gid_min > 0 &&
@@ -244,9 +228,8 @@ std::optional<IdMinMax> GetSystemUidMinMax(const logger_t &logger) noexcept {
 // NOLINTEND(misc-include-cleaner)
 
 std::unordered_set<std::string>
-GetPossibleShells(const logger_t &logger) noexcept {
+GetPossibleShells(const logger_t &logger, const std::string &fname) noexcept {
   std::unordered_set<std::string> res;
-  const std::string fname = "/etc/shells";
   try {
     if (!std::filesystem::exists(fname)) {
       throw std::runtime_error("File not found " + fname);
@@ -275,9 +258,14 @@ GetPossibleShells(const logger_t &logger) noexcept {
 
 std::vector<dal::User> GetHumanUsers(const IdMinMax &id_limits,
                                      const logger_t &logger) noexcept {
+  return GetHumanUsers(id_limits, logger, GetPossibleShells(logger));
+}
+
+std::vector<dal::User>
+GetHumanUsers(const IdMinMax &id_limits, const logger_t &logger,
+              const std::unordered_set<std::string> &shells,
+              const std::string &fpath) noexcept {
   std::vector<dal::User> res;
-  const std::unordered_set<std::string> shells = GetPossibleShells(logger);
-  const std::string fpath = "/etc/passwd";
   namespace fs = std::filesystem;
   try {
     if (!fs::exists(fpath)) {
@@ -322,9 +310,9 @@ std::vector<dal::User> GetHumanUsers(const IdMinMax &id_limits,
 }
 
 std::vector<dal::Group> GetHumanGroups(const IdMinMax &id_limits,
-                                       const logger_t &logger) noexcept {
+                                       const logger_t &logger,
+                                       const std::string &fpath) noexcept {
   std::vector<dal::Group> res;
-  const std::string fpath = "/etc/group";
   namespace fs = std::filesystem;
   try {
     if (!fs::exists(fpath)) {
@@ -411,11 +399,10 @@ std::string SanitizeMount(const std::string &str) noexcept {
 }
 
 std::string SafeErrorNoToStr() noexcept {
-  std::vector<char> buf;
-  buf.reserve(300);
-  std::memset(buf.data(), 0, 300);
+  const int err = errno;
+  std::vector<char> buf(256, 0);
   // NOLINTNEXTLINE
-  const char *str_err = strerror_r(errno, buf.data(), 256);
+  const char *str_err = strerror_r(err, buf.data(), buf.size());
   if (str_err != nullptr) {
     return str_err;
   }
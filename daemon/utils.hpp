@@ -20,6 +20,8 @@
 
 #pragma once
 #include "dal/dto.hpp"
+#include "events.hpp"
+#include "partition_mounter.hpp"
 #include "usb_udev_device.hpp"
 #include <acl/libacl.h> //NOLINT(misc-include-cleaner)
 #include <cstdint>
@@ -50,9 +52,13 @@ std::shared_ptr<spdlog::logger> InitLogFile(const std::string &path) noexcept;
  * @brief Mount or unmount device (depends on UsbUdevDevice action value )
  * @param ptr_device Device to process
  * @param logger
+ * @param on_event Receives mount events
+ * @param context Shared by the partitions of the disk, see PartitionMounter
  */
 void MountDevice(std::shared_ptr<UsbUdevDevice> ptr_device,
-                 const std::shared_ptr<spdlog::logger> &logger) noexcept;
+                 const std::shared_ptr<spdlog::logger> &logger,
+                 const EventHandler &on_event,
+                 std::shared_ptr<DiskContext> context = {}) noexcept;
 
 std::unordered_set<std::string>
 GetSystemMountPoints(const std::shared_ptr<spdlog::logger> &logger) noexcept;
@@ -82,13 +88,17 @@ struct IdMinMax {
  * @brief Get the System User ID Min Max
  * @return std::unordered_map<std::string,std::pair<uid_t,uid_t>>
  */
-std::optional<IdMinMax> GetSystemUidMinMax(const logger_t &) noexcept;
+std::optional<IdMinMax>
+GetSystemUidMinMax(const logger_t &,
+                   const std::string &path = "/etc/login.defs") noexcept;
 
 /**
  * @brief Get the Possible Shells for user
  * @return std::unordered_set<std::string>
  */
-std::unordered_set<std::string> GetPossibleShells(const logger_t &) noexcept;
+std::unordered_set<std::string>
+GetPossibleShells(const logger_t &,
+                  const std::string &path = "/etc/shells") noexcept;
 
 /**
  * @brief Get the Human Users array
@@ -97,12 +107,23 @@ std::unordered_set<std::string> GetPossibleShells(const logger_t &) noexcept;
 std::vector<dal::User> GetHumanUsers(const IdMinMax &,
                                      const logger_t &) noexcept;
 
+/**
+ * @brief Get the Human Users array
+ * @param shells login shells, a user with another shell is skipped
+ * @param path passwd file
+ */
+std::vector<dal::User>
+GetHumanUsers(const IdMinMax &, const logger_t &,
+              const std::unordered_set<std::string> &shells,
+              const std::string &path = "/etc/passwd") noexcept;
+
 /**
  * @brief Get the Guman Groups array
  * @return std::vector<dal::Group>
  */
-std::vector<dal::Group> GetHumanGroups(const IdMinMax &,
-                                       const logger_t &) noexcept;
+std::vector<dal::Group>
+GetHumanGroups(const IdMinMax &, const logger_t &,
+               const std::string &path = "/etc/group") noexcept;
 
 /**
  * @brief string to uint_64
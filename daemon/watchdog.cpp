@@ -0,0 +1,204 @@
+/* File: watchdog.cpp
+
+  Copyright (C)   2024
+  Author: Oleg Proskurin, <proskurinov@basealt.ru>
+
+  This program is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with this program; if not, see <https://www.gnu.org/licenses/>.
+
+*/
+
+#include "watchdog.hpp"
+#include "metrics.hpp"
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <utility>
+
+namespace usbmount {
+
+namespace {
+
+double Seconds(Watchdog::Clock::duration duration) {
+  return std::chrono::duration<double>(duration).count();
+}
+
+} // namespace
+
+Watchdog::Loop::Loop(std::string name, Clock::duration interval,
+                     metrics::Histogram &lag)
+    : name_(std::move(name)), interval_(interval), lag_(lag),
+      last_beat_(Clock::now().time_since_epoch().count()) {}
+
+void Watchdog::Loop::Beat() noexcept {
+  const auto now = Clock::now();
+  const Clock::time_point last(
+      Clock::duration(last_beat_.exchange(now.time_since_epoch().count())));
+  lag_.Observe(std::max(now - last - interval_, Clock::duration::zero()));
+}
+
+void Watchdog::Loop::Beat(Clock::time_point posted) noexcept {
+  const auto now = Clock::now();
+  last_beat_.store(now.time_since_epoch().count());
+  lag_.Observe(now - posted);
+}
+
+Watchdog::Clock::duration
+Watchdog::Loop::Age(Clock::time_point now) const noexcept {
+  return now - Clock::time_point(Clock::duration(last_beat_.load()));
+}
+
+bool Watchdog::Loop::Stalled(Clock::time_point now,
+                             std::chrono::milliseconds max_lag) const noexcept {
+  return Age(now) > interval_ + max_lag;
+}
+
+Watchdog::Operation::Operation(Watchdog *watchdog, uint64_t id) noexcept
+    : watchdog_(watchdog), id_(id) {}
+
+Watchdog::Operation::Operation(Operation &&other) noexcept
+    : watchdog_(other.watchdog_), id_(other.id_) {
+  other.watchdog_ = nullptr;
+}
+
+Watchdog::Operation::~Operation() {
+  if (watchdog_ != nullptr) {
+    watchdog_->Finish(id_);
+  }
+}
+
+Watchdog::Watchdog(Options options) : options_(options) {
+  if (!options_.export_metrics) {
+    return;
+  }
+  auto &registry = metrics::Registry::Instance();
+  registry.AddCallback("altusbd_operations_in_flight",
+                       "Mount and umount calls in progress",
+                       metrics::Type::kGauge, {}, [this]() {
+                         return static_cast<double>(Operations().first);
+                       });
+  registry.AddCallback("altusbd_oldest_operation_seconds",
+                       "Age of the oldest mount or umount call in progress",
+                       metrics::Type::kGauge, {},
+                       [this]() { return Seconds(Operations().second); });
+  registry.AddCallback("altusbd_healthy",
+                       "1 while systemd watchdog is notified",
+                       metrics::Type::kGauge, {},
+                       [this]() { return Check() ? 0.0 : 1.0; });
+}
+
+Watchdog &Watchdog::Instance() {
+  static Watchdog instance{Options{std::chrono::milliseconds(60000),
+                                   std::chrono::milliseconds(60000), true}};
+  return instance;
+}
+
+Watchdog::Loop &Watchdog::AddLoop(const std::string &name,
+                                  std::chrono::milliseconds interval) {
+  auto find = [this, &name]() -> Loop * {
+    for (const auto &loop : loops_) {
+      if (loop->name() == name) {
+        return loop.get();
+      }
+    }
+    return nullptr;
+  };
+  {
+    const std::lock_guard<std::mutex> lock(mutex_);
+    Loop *found = find();
+    if (found != nullptr) {
+      return *found;
+    }
+  }
+  // not under mutex_, the registry callbacks lock it
+  const std::string labels = "loop=\"" + name + "\"";
+  auto &registry = metrics::Registry::Instance();
+  auto &lag = registry.AddHistogram(
+      "altusbd_loop_lag_seconds",
+      "Iteration delay past the interval or probe queueing time", labels);
+  Loop *res = nullptr;
+  {
+    const std::lock_guard<std::mutex> lock(mutex_);
+    // added by another thread meanwhile
+    res = find();
+    if (res != nullptr) {
+      return *res;
+    }
+    // NOLINTNEXTLINE(cppcoreguidelines-owning-memory)
+    loops_.emplace_back(new Loop(name, interval, lag));
+    res = loops_.back().get();
+  }
+  if (options_.export_metrics) {
+    registry.AddCallback(
+        "altusbd_loop_last_beat_seconds", "Time since the loop last ran",
+        metrics::Type::kGauge, labels,
+        [res]() { return Seconds(res->Age(Clock::now())); });
+  }
+  return *res;
+}
+
+Watchdog::Operation Watchdog::Track(std::string description) {
+  const std::lock_guard<std::mutex> lock(mutex_);
+  const uint64_t id = next_id_++;
+  operations_.emplace(id, InFlight{std::move(description), Clock::now()});
+  return {this, id};
+}
+
+void Watchdog::Finish(uint64_t id) noexcept {
+  const std::lock_guard<std::mutex> lock(mutex_);
+  operations_.erase(id);
+}
+
+std::optional<std::string> Watchdog::Check() const noexcept {
+  try {
+    const auto now = Clock::now();
+    const std::lock_guard<std::mutex> lock(mutex_);
+    for (const auto &loop : loops_) {
+      if (loop->Stalled(now, options_.max_lag)) {
+        return "loop " + loop->name() + " stalled for " +
+               std::to_string(static_cast<int64_t>(Seconds(loop->Age(now)))) +
+               "s";
+      }
+    }
+    for (const auto &operation : operations_) {
+      if (now - operation.second.started > options_.max_operation) {
+        return operation.second.description + " running for " +
+               std::to_string(static_cast<int64_t>(
+                   Seconds(now - operation.second.started))) +
+               "s";
+      }
+    }
+  } catch (const std::exception &ex) {
+    return ex.what();
+  }
+  return std::nullopt;
+}
+
+std::pair<size_t, Watchdog::Clock::duration>
+Watchdog::Operations() const noexcept {
+  const std::lock_guard<std::mutex> lock(mutex_);
+  Clock::duration oldest = Clock::duration::zero();
+  const auto now = Clock::now();
+  for (const auto &operation : operations_) {
+    oldest = std::max(oldest, now - operation.second.started);
+  }
+  return {operations_.size(), oldest};
+}
+
+} // namespace usbmount
@@ -0,0 +1,149 @@
+/* File: watchdog.hpp
+
+  Copyright (C)   2024
+  Author: Oleg Proskurin, <proskurinov@basealt.ru>
+
+  This program is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with this program; if not, see <https://www.gnu.org/licenses/>.
+
+*/
+
+#pragma once
+#include "metrics.hpp"
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace usbmount {
+
+/**
+ * @class Watchdog
+ * @brief Liveness of the daemon loops and of mount operations
+ * @details A loop beats on every iteration, or a probe posted to it beats when
+ * it runs. The lag (delay past the expected interval, or the probe queueing
+ * time) is exported as a histogram per loop. A loop that didn't beat for
+ * interval + max_lag is stalled. A mount or umount in flight longer than
+ * max_operation is hung. systemd is notified (WATCHDOG=1) only while nothing
+ * is stalled or hung.
+ */
+class Watchdog {
+public:
+  using Clock = std::chrono::steady_clock;
+
+  struct Options {
+    std::chrono::milliseconds max_lag{60000};
+    std::chrono::milliseconds max_operation{60000};
+    /// loop ages and operations are exported, the loop lag is always
+    bool export_metrics = false;
+  };
+
+  /// @brief Heartbeat of one loop, updated without locks
+  class Loop {
+  public:
+    Loop(const Loop &) = delete;
+    Loop(Loop &&) = delete;
+    Loop &operator=(const Loop &) = delete;
+    Loop &operator=(Loop &&) = delete;
+    ~Loop() = default;
+
+    /// @brief An iteration of the loop, the lag is the delay past interval
+    void Beat() noexcept;
+
+    /// @brief A probe posted at the time ran, the lag is the queueing time
+    void Beat(Clock::time_point posted) noexcept;
+
+    const std::string &name() const noexcept { return name_; }
+
+    /// @brief Time since the last beat
+    Clock::duration Age(Clock::time_point now) const noexcept;
+
+    bool Stalled(Clock::time_point now,
+                 std::chrono::milliseconds max_lag) const noexcept;
+
+  private:
+    friend class Watchdog;
+    Loop(std::string name, Clock::duration interval, metrics::Histogram &lag);
+
+    std::string name_;
+    Clock::duration interval_;
+    metrics::Histogram &lag_;
+    std::atomic<Clock::rep> last_beat_;
+  };
+
+  /// @brief An operation in flight until destroyed
+  class Operation {
+  public:
+    Operation(const Operation &) = delete;
+    Operation &operator=(const Operation &) = delete;
+    Operation &operator=(Operation &&) = delete;
+    Operation(Operation &&other) noexcept;
+    ~Operation();
+
+  private:
+    friend class Watchdog;
+    Operation(Watchdog *watchdog, uint64_t id) noexcept;
+
+    Watchdog *watchdog_;
+    uint64_t id_;
+  };
+
+  Watchdog(const Watchdog &) = delete;
+  Watchdog(Watchdog &&) = delete;
+  Watchdog &operator=(const Watchdog &) = delete;
+  Watchdog &operator=(Watchdog &&) = delete;
+  ~Watchdog() = default;
+  explicit Watchdog(Options options);
+
+  /// @brief The daemon watchdog, metrics are exported by the registry
+  static Watchdog &Instance();
+
+  /**
+   * @brief Register a loop, the same name returns the same loop
+   * @param interval expected time between beats
+   * @details The loop lives as long as the watchdog.
+   */
+  Loop &AddLoop(const std::string &name, std::chrono::milliseconds interval);
+
+  /// @brief Track the operation, e.g. "mount /dev/sdb1", until destroyed
+  [[nodiscard]] Operation Track(std::string description);
+
+  /// @return empty if healthy, the reason otherwise
+  std::optional<std::string> Check() const noexcept;
+
+  /// @brief Number of operations in flight and the age of the oldest one
+  std::pair<size_t, Clock::duration> Operations() const noexcept;
+
+private:
+  struct InFlight {
+    std::string description;
+    Clock::time_point started;
+  };
+
+  void Finish(uint64_t id) noexcept;
+
+  Options options_;
+  mutable std::mutex mutex_;
+  std::vector<std::unique_ptr<Loop>> loops_;
+  std::map<uint64_t, InFlight> operations_;
+  uint64_t next_id_ = 1;
+};
+
+} // namespace usbmount